@@ -0,0 +1,64 @@
+/*
+Copyright (c) 2022 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#ifndef __Q_METAL_INDIRECT_DISPATCH_SHADER_H__
+#define __Q_METAL_INDIRECT_DISPATCH_SHADER_H__
+
+#include <metal_stdlib>
+using namespace metal;
+
+//matches qMetal::IndirectDispatchArguments; the first three words are the MTLDispatchThreadgroupsIndirectArguments
+//the next dispatch is made with
+struct qMetalIndirectDispatchArguments
+{
+	uint threadgroupsPerGrid[3];
+	uint threadCount;			//threads the consumer has work for; its last threadgroup may be partial
+	atomic_uint pendingCount;	//appended to by the producer, turned into the dispatch size by IndirectDispatch::Resolve()
+	uint threadsPerThreadgroup;
+	uint reserved[2];
+};
+
+static_assert(sizeof(qMetalIndirectDispatchArguments) == 32, "qMetalIndirectDispatchArguments size mismatch");
+
+//producer: reserve count threads of work for the consumer, returning the first one's index
+static inline uint qMetalIndirectDispatchAppend(device qMetalIndirectDispatchArguments& dispatch, uint count)
+{
+	return atomic_fetch_add_explicit(&dispatch.pendingCount, count, memory_order_relaxed);
+}
+
+//producer that knows the total up front (from a single thread): set the consumer's size directly, no Resolve() needed
+static inline void qMetalIndirectDispatchSet(device qMetalIndirectDispatchArguments& dispatch, uint threadCount)
+{
+	dispatch.threadCount = threadCount;
+	dispatch.threadgroupsPerGrid[0] = (threadCount + dispatch.threadsPerThreadgroup - 1) / dispatch.threadsPerThreadgroup;
+	dispatch.threadgroupsPerGrid[1] = 1;
+	dispatch.threadgroupsPerGrid[2] = 1;
+}
+
+//consumer: threads past the count belong to the partial last threadgroup and should return
+static inline bool qMetalIndirectDispatchInRange(const device qMetalIndirectDispatchArguments& dispatch, uint threadIndex)
+{
+	return threadIndex < dispatch.threadCount;
+}
+
+#endif /* __Q_METAL_INDIRECT_DISPATCH_SHADER_H__ */
@@ -25,12 +25,17 @@ SOFTWARE.
 
 #include "qMetalDevice.h"
 #include "qMetalFunction.h"
+#include "qMetalIndirectDispatch.h"
 #include "qMetalIndirectMesh.h"
 #include "qMetalMaterial.h"
 #include "qMetalMesh.h"
+#include "qMetalRenderQueue.h"
 #include "qMetalRenderTarget.h"
 #include "qMetalTexture.h"
+#include "qMetalTextureTable.h"
 #include "qMetalComputeTexture.h"
+#include "qMetalComputeGraph.h"
+#include "qMetalFrameGraph.h"
 
 
 #endif //__Q_METAL_H__
@@ -0,0 +1,168 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_ARGUMENT_BUFFER_H__
+#define __Q_METAL_ARGUMENT_BUFFER_H__
+
+#include <Metal/Metal.h>
+#include "qCore.h"
+#include "qMetalDevice.h"
+
+namespace qMetal
+{
+	//Metal 3 argument buffers can be written directly, without an MTLArgumentEncoder: every texture and sampler is
+	//its 8 byte MTLResourceID and every buffer its 8 byte GPU address, laid out like the shader's struct. tables
+	//here put slot n at byte n * SlotSize, so the shader struct must declare one member per slot, in slot order,
+	//and without [[id(n)]] attributes
+	namespace ArgumentTable
+	{
+		static constexpr NSUInteger SlotSize = sizeof(uint64_t);
+		
+		//true on Metal 3 GPUs; elsewhere callers fall back to argument encoders, which read the same struct
+		inline bool Supported()
+		{
+			static const bool supported = []() -> bool
+			{
+				if (@available(iOS 16.0, macOS 13.0, *))
+				{
+					return [Device::Get() supportsFamily:MTLGPUFamilyMetal3];
+				}
+				return false;
+			}();
+			return supported;
+		}
+		
+		inline id<MTLBuffer> NewBuffer(uint32_t slotCount, NSString* label)
+		{
+			id<MTLBuffer> buffer = [Device::Get() newBufferWithLength:((slotCount > 0) ? slotCount : 1) * SlotSize options:0];
+			buffer.label = label;
+			return buffer;
+		}
+		
+		inline void SetTexture(void* table, uint32_t slot, id<MTLTexture> texture)
+		{
+			if (@available(iOS 16.0, macOS 13.0, *))
+			{
+				((uint64_t*)table)[slot] = (texture != nil) ? texture.gpuResourceID._impl : 0;
+			}
+		}
+		
+		//the sampler must have been created with supportArgumentBuffers
+		inline void SetSampler(void* table, uint32_t slot, id<MTLSamplerState> sampler)
+		{
+			if (@available(iOS 16.0, macOS 13.0, *))
+			{
+				((uint64_t*)table)[slot] = (sampler != nil) ? sampler.gpuResourceID._impl : 0;
+			}
+		}
+		
+		inline void SetBuffer(void* table, uint32_t slot, id<MTLBuffer> buffer, NSUInteger offset = 0)
+		{
+			if (@available(iOS 16.0, macOS 13.0, *))
+			{
+				((uint64_t*)table)[slot] = (buffer != nil) ? (buffer.gpuAddress + offset) : 0;
+			}
+		}
+	}
+	
+	//an argument buffer filled from a C++ struct that mirrors the shader's, one copy per buffered frame so it can
+	//be rewritten every frame with a memcpy. build _Struct from the slot types below
+	template<class _Struct>
+	class StructArgumentBuffer
+	{
+	public:
+		//shader buffer offsets need this alignment
+		static constexpr NSUInteger Alignment = 256;
+		static constexpr NSUInteger Stride = (sizeof(_Struct) + Alignment - 1) & ~(Alignment - 1);
+		
+		StructArgumentBuffer(NSString* label)
+		{
+			qASSERTM(ArgumentTable::Supported(), "StructArgumentBuffer %s needs a Metal 3 GPU", [label UTF8String]);
+			buffer = [Device::Get() newBufferWithLength:Stride * Q_METAL_FRAMES_TO_BUFFER options:0];
+			buffer.label = label;
+		}
+		
+		~StructArgumentBuffer()
+		{
+			[buffer release];
+		}
+		
+		//the current frame's copy; the GPU may still be reading the other frames'
+		_Struct* Write()
+		{
+			return (_Struct*)((uint8_t*)[buffer contents] + Offset());
+		}
+		
+		id<MTLBuffer> Buffer() const
+		{
+			return buffer;
+		}
+		
+		NSUInteger Offset() const
+		{
+			return Stride * Device::CurrentFrameIndex();
+		}
+		
+	private:
+		StructArgumentBuffer(const StructArgumentBuffer&);
+		StructArgumentBuffer& operator=(const StructArgumentBuffer&);
+		
+		id<MTLBuffer> buffer;
+	};
+	
+	typedef struct ArgumentTexture
+	{
+		uint64_t resourceID;
+		
+		void Set(id<MTLTexture> texture)
+		{
+			ArgumentTable::SetTexture(this, 0, texture);
+		}
+	} ArgumentTexture;
+	
+	typedef struct ArgumentSampler
+	{
+		uint64_t resourceID;
+		
+		void Set(id<MTLSamplerState> sampler)
+		{
+			ArgumentTable::SetSampler(this, 0, sampler);
+		}
+	} ArgumentSampler;
+	
+	template<class _Element>
+	struct ArgumentPointer
+	{
+		uint64_t gpuAddress;
+		
+		void Set(id<MTLBuffer> buffer, NSUInteger offset = 0)
+		{
+			ArgumentTable::SetBuffer(this, 0, buffer, offset);
+		}
+	};
+	
+	static_assert(sizeof(ArgumentTexture) == ArgumentTable::SlotSize, "argument buffer textures are one slot");
+	static_assert(sizeof(ArgumentSampler) == ArgumentTable::SlotSize, "argument buffer samplers are one slot");
+	static_assert(sizeof(ArgumentPointer<float>) == ArgumentTable::SlotSize, "argument buffer pointers are one slot");
+}
+
+#endif //__Q_METAL_ARGUMENT_BUFFER_H__
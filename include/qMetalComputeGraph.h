@@ -0,0 +1,211 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_COMPUTE_GRAPH_H__
+#define __Q_METAL_COMPUTE_GRAPH_H__
+
+#include <Metal/Metal.h>
+#include <vector>
+#include "qCore.h"
+#include "qMetalDevice.h"
+#include "qMetalMaterial.h"
+#include "qMetalIndirectDispatch.h"
+#include "qMetalComputeSchedule.h"
+#include "qMetalTrackedEncoder.h"
+
+namespace qMetal
+{
+	//a frame's compute dispatches, each declaring the resources it reads and writes. Encode() schedules them with
+	//ComputeSchedule into a single concurrent-dispatch encoder: passes with no dependency between them run together,
+	//and the only barriers are the per-resource ones a dependency needs. passes, materials and resources are only
+	//referenced, so they need to live until Encode()
+	class ComputeGraph
+	{
+	public:
+		typedef struct Config
+		{
+			NSString*	name;
+			
+			Config(NSString* _name)
+			: name([_name retain])
+			{ }
+			
+			Config(Config* config, NSString* _name)
+			: name([_name retain])
+			{ }
+		} Config;
+		
+		ComputeGraph(Config* _config)
+		: config(_config)
+		{ }
+		
+		//add a dispatch, then declare what it touches with Read()/Write()/ReadWrite()
+		template<class _VertexParams, class _FragmentParams, class _ComputeParams, class _InstanceParams>
+		uint32_t Add(const Material<_VertexParams, _FragmentParams, _ComputeParams, _InstanceParams>* material, NSUInteger width, NSUInteger height, NSUInteger depth = 1)
+		{
+			Pass pass;
+			pass.encode = &EncodePass<Material<_VertexParams, _FragmentParams, _ComputeParams, _InstanceParams> >;
+			pass.material = material;
+			pass.grid = MTLSizeMake(width, height, depth);
+			pass.dispatch = NULL;
+			pass.dispatchIndex = EmptyIndex;
+			return AddPass(pass);
+		}
+		
+		//a GPU sized dispatch; reading the IndirectDispatch is declared for it
+		template<class _VertexParams, class _FragmentParams, class _ComputeParams, class _InstanceParams>
+		uint32_t AddIndirect(const Material<_VertexParams, _FragmentParams, _ComputeParams, _InstanceParams>* material, const IndirectDispatch* dispatch, ParamIndex dispatchIndex = EmptyIndex)
+		{
+			Pass pass;
+			pass.encode = &EncodePass<Material<_VertexParams, _FragmentParams, _ComputeParams, _InstanceParams> >;
+			pass.material = material;
+			pass.grid = MTLSizeMake(0, 0, 0);
+			pass.dispatch = dispatch;
+			pass.dispatchIndex = dispatchIndex;
+			const uint32_t index = AddPass(pass);
+			Read(dispatch->Buffer());
+			return index;
+		}
+		
+		//IndirectDispatch::Resolve() as a pass of its own
+		uint32_t AddResolve(const IndirectDispatch* dispatch)
+		{
+			Pass pass;
+			pass.encode = &EncodeResolve;
+			pass.material = NULL;
+			pass.grid = MTLSizeMake(0, 0, 0);
+			pass.dispatch = dispatch;
+			pass.dispatchIndex = EmptyIndex;
+			const uint32_t index = AddPass(pass);
+			ReadWrite(dispatch->Buffer());
+			return index;
+		}
+		
+		void Read(id<MTLResource> resource)
+		{
+			schedule.Access((const void*)resource, ComputeSchedule::eAccess_Read);
+		}
+		
+		void Write(id<MTLResource> resource)
+		{
+			schedule.Access((const void*)resource, ComputeSchedule::eAccess_Write);
+		}
+		
+		void ReadWrite(id<MTLResource> resource)
+		{
+			schedule.Access((const void*)resource, ComputeSchedule::eAccess_ReadWrite);
+		}
+		
+		//encodes into an encoder of its own, with concurrent dispatch
+		void Encode()
+		{
+			id<MTLComputeCommandEncoder> encoder = Device::ComputeEncoder(config->name, MTLDispatchTypeConcurrent);
+			TrackedComputeEncoder tracked(encoder);
+			Encode(tracked);
+			[encoder endEncoding];
+		}
+		
+		//the encoder should be a concurrent one; on a serial one the barriers are harmless but nothing overlaps
+		void Encode(TrackedComputeEncoder& encoder)
+		{
+			schedule.Build();
+			
+			uint32_t level = UINT32_MAX;
+			for (auto &index : schedule.Order())
+			{
+				if (schedule.Level(index) != level)
+				{
+					level = schedule.Level(index);
+					
+					const std::vector<const void*>& barrier = schedule.Barrier(level);
+					if (!barrier.empty())
+					{
+						[encoder.Get() memoryBarrierWithResources:(const id<MTLResource> __unsafe_unretained*)barrier.data() count:barrier.size()];
+					}
+				}
+				
+				const Pass& pass = passes[index];
+				pass.encode(encoder, pass);
+			}
+		}
+		
+		//call once the graph is encoded, before adding the next frame's passes
+		void Reset()
+		{
+			passes.clear();
+			schedule.Reset();
+		}
+		
+		uint32_t PassCount() const 					{ return (uint32_t)passes.size(); }
+		const ComputeSchedule& Schedule() const 	{ return schedule; }
+		
+		Config* GetConfig() const
+		{
+			return config;
+		}
+		
+	private:
+		struct Pass;
+		typedef void (*EncodeFunction)(TrackedComputeEncoder& encoder, const Pass& pass);
+		
+		struct Pass
+		{
+			EncodeFunction				encode;
+			const void*					material;
+			MTLSize						grid;
+			const IndirectDispatch*		dispatch;
+			ParamIndex					dispatchIndex;
+		};
+		
+		uint32_t AddPass(const Pass& pass)
+		{
+			passes.push_back(pass);
+			schedule.AddPass();
+			return (uint32_t)passes.size() - 1;
+		}
+		
+		template<class _Material>
+		static void EncodePass(TrackedComputeEncoder& encoder, const Pass& pass)
+		{
+			const _Material* material = (const _Material*)pass.material;
+			if (pass.dispatch != NULL)
+			{
+				material->EncodeComputeIndirect(encoder, pass.dispatch, pass.dispatchIndex);
+			}
+			else
+			{
+				material->EncodeCompute(encoder, pass.grid.width, pass.grid.height, pass.grid.depth);
+			}
+		}
+		
+		static void EncodeResolve(TrackedComputeEncoder& encoder, const Pass& pass)
+		{
+			pass.dispatch->Resolve(encoder);
+		}
+		
+		Config*				config;
+		std::vector<Pass>	passes;
+		ComputeSchedule		schedule;
+	};
+}
+
+#endif //__Q_METAL_COMPUTE_GRAPH_H__
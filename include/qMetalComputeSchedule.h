@@ -0,0 +1,286 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_COMPUTE_SCHEDULE_H__
+#define __Q_METAL_COMPUTE_SCHEDULE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include "qCore.h"
+
+namespace qMetal
+{
+	//dependency analysis for a compute graph. passes declare the resources they read and write, in submission order;
+	//Build() puts each pass in the earliest level after everything it depends on (read after write, write after
+	//write, write after read), so a level's passes can run concurrently and a barrier is only needed between levels.
+	//each barrier lists just the resources a dependency across it needs, placed before the consuming level unless an
+	//earlier barrier since the producer already covers that resource. resources are opaque indices
+	class ComputeSchedule
+	{
+	public:
+		enum eAccess
+		{
+			eAccess_Read		= 1 << 0,
+			eAccess_Write		= 1 << 1,
+			eAccess_ReadWrite	= eAccess_Read | eAccess_Write,
+		};
+		
+		ComputeSchedule()
+		: built(false)
+		{ }
+		
+		uint32_t AddPass()
+		{
+			built = false;
+			passAccessBegin.push_back((uint32_t)accesses.size());
+			return (uint32_t)passAccessBegin.size() - 1;
+		}
+		
+		//declares an access by the most recently added pass; repeated accesses to a resource combine
+		void Access(const void* resource, eAccess access)
+		{
+			qASSERTM(!passAccessBegin.empty(), "ComputeSchedule access declared before any pass");
+			built = false;
+			
+			for (uint32_t i = passAccessBegin.back(); i < (uint32_t)accesses.size(); ++i)
+			{
+				if (accesses[i].resource == resource)
+				{
+					accesses[i].access |= access;
+					return;
+				}
+			}
+			
+			Declaration declaration;
+			declaration.resource = resource;
+			declaration.access = access;
+			accesses.push_back(declaration);
+		}
+		
+		void Build()
+		{
+			const uint32_t passCount = PassCount();
+			
+			passLevel.assign(passCount, 0);
+			dependencies.clear();
+			resourceState.clear();
+			
+			//the levels, then the dependencies that reach each one
+			uint32_t levelCount = (passCount > 0) ? 1 : 0;
+			for (uint32_t pass = 0; pass < passCount; ++pass)
+			{
+				const uint32_t dependencyBegin = (uint32_t)dependencies.size();
+				
+				for (uint32_t i = AccessBegin(pass); i < AccessEnd(pass); ++i)
+				{
+					const Declaration& declaration = accesses[i];
+					ResourceState& state = resourceState[declaration.resource];
+					
+					if (state.lastWriter != NoPass)
+					{
+						AddDependency(state.lastWriter, pass, declaration.resource);
+					}
+					
+					if (declaration.access & eAccess_Write)
+					{
+						for (auto &reader : state.readers)
+						{
+							if (reader != pass)
+							{
+								AddDependency(reader, pass, declaration.resource);
+							}
+						}
+					}
+				}
+				
+				uint32_t level = 0;
+				for (uint32_t i = dependencyBegin; i < (uint32_t)dependencies.size(); ++i)
+				{
+					level = std::max(level, passLevel[dependencies[i].producer] + 1);
+				}
+				passLevel[pass] = level;
+				levelCount = std::max(levelCount, level + 1);
+				
+				//only update the resource state once every dependency of this pass is known
+				for (uint32_t i = AccessBegin(pass); i < AccessEnd(pass); ++i)
+				{
+					const Declaration& declaration = accesses[i];
+					ResourceState& state = resourceState[declaration.resource];
+					
+					if (declaration.access & eAccess_Write)
+					{
+						state.lastWriter = pass;
+						state.readers.clear();
+					}
+					
+					if ((declaration.access & eAccess_Read) && !(declaration.access & eAccess_Write))
+					{
+						state.readers.push_back(pass);
+					}
+				}
+			}
+			
+			//submission order within a level, levels in order
+			order.resize(passCount);
+			for (uint32_t pass = 0; pass < passCount; ++pass)
+			{
+				order[pass] = pass;
+			}
+			std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return passLevel[a] < passLevel[b]; });
+			
+			//barrier b sits before level b, so barrier 0 is always empty. placing dependencies that are due soonest first
+			//means each barrier goes in as late as it can, where it can cover the most dependencies that come after it
+			std::stable_sort(dependencies.begin(), dependencies.end(), [this](const Dependency& a, const Dependency& b)
+			{
+				const uint32_t aConsumer = passLevel[a.consumer];
+				const uint32_t bConsumer = passLevel[b.consumer];
+				return (aConsumer != bConsumer) ? (aConsumer < bConsumer) : (passLevel[a.producer] < passLevel[b.producer]);
+			});
+			barriers.assign(levelCount, std::vector<const void*>());
+			for (auto &dependency : dependencies)
+			{
+				const uint32_t producerLevel = passLevel[dependency.producer];
+				const uint32_t consumerLevel = passLevel[dependency.consumer];
+				
+				bool covered = false;
+				for (uint32_t level = producerLevel + 1; (level <= consumerLevel) && !covered; ++level)
+				{
+					covered = std::find(barriers[level].begin(), barriers[level].end(), dependency.resource) != barriers[level].end();
+				}
+				
+				if (!covered)
+				{
+					barriers[consumerLevel].push_back(dependency.resource);
+				}
+			}
+			
+			built = true;
+		}
+		
+		void Reset()
+		{
+			passAccessBegin.clear();
+			accesses.clear();
+			passLevel.clear();
+			order.clear();
+			dependencies.clear();
+			barriers.clear();
+			built = false;
+		}
+		
+		uint32_t PassCount() const 			{ return (uint32_t)passAccessBegin.size(); }
+		uint32_t LevelCount() const 		{ qASSERT(built); return (uint32_t)barriers.size(); }
+		uint32_t Level(uint32_t pass) const { qASSERT(built); return passLevel[pass]; }
+		uint32_t DependencyCount() const 	{ qASSERT(built); return (uint32_t)dependencies.size(); }
+		bool IsBuilt() const 				{ return built; }
+		
+		//pass indices in encode order
+		const std::vector<uint32_t>& Order() const
+		{
+			qASSERT(built);
+			return order;
+		}
+		
+		//resources to barrier on before the passes of level
+		const std::vector<const void*>& Barrier(uint32_t level) const
+		{
+			qASSERT(built);
+			return barriers[level];
+		}
+		
+		//levels that start with a barrier
+		uint32_t BarrierCount() const
+		{
+			qASSERT(built);
+			uint32_t count = 0;
+			for (auto &barrier : barriers)
+			{
+				count += barrier.empty() ? 0 : 1;
+			}
+			return count;
+		}
+		
+	private:
+		static constexpr uint32_t NoPass = UINT32_MAX;
+		
+		typedef struct Declaration
+		{
+			const void*	resource;
+			uint32_t	access;
+		} Declaration;
+		
+		typedef struct Dependency
+		{
+			uint32_t	producer;
+			uint32_t	consumer;
+			const void*	resource;
+		} Dependency;
+		
+		typedef struct ResourceState
+		{
+			uint32_t				lastWriter;
+			std::vector<uint32_t>	readers;	//since the last write
+			
+			ResourceState()
+			: lastWriter(NoPass)
+			{ }
+		} ResourceState;
+		
+		uint32_t AccessBegin(uint32_t pass) const
+		{
+			return passAccessBegin[pass];
+		}
+		
+		uint32_t AccessEnd(uint32_t pass) const
+		{
+			return (pass + 1 < PassCount()) ? passAccessBegin[pass + 1] : (uint32_t)accesses.size();
+		}
+		
+		void AddDependency(uint32_t producer, uint32_t consumer, const void* resource)
+		{
+			if (producer == consumer)
+			{
+				return;
+			}
+			
+			Dependency dependency;
+			dependency.producer = producer;
+			dependency.consumer = consumer;
+			dependency.resource = resource;
+			dependencies.push_back(dependency);
+		}
+		
+		std::vector<uint32_t>		passAccessBegin;
+		std::vector<Declaration>	accesses;
+		std::vector<uint32_t>		passLevel;
+		std::vector<uint32_t>		order;
+		std::vector<Dependency>		dependencies;
+		std::vector<std::vector<const void*> >	barriers;
+		std::unordered_map<const void*, ResourceState>	resourceState;
+		bool built;
+	};
+}
+
+#endif //__Q_METAL_COMPUTE_SCHEDULE_H__
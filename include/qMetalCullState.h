@@ -24,6 +24,7 @@ SOFTWARE.
 #define __Q_METAL_CULLSTATE_H__
 
 #include <Metal/Metal.h>
+#include "qMetalTrackedEncoder.h"
 
 #define CULL_STATES \
 /*              enum        winding         cull face */ \
@@ -64,6 +65,7 @@ namespace qMetal
 			eCullFace       _face);
       
         void Encode(id<MTLRenderCommandEncoder> encoder);
+        void Encode(TrackedRenderEncoder& encoder);
         
         static CullState* PredefinedState(eCullState state);
     };
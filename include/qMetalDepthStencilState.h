@@ -26,6 +26,7 @@ SOFTWARE.
 #include <Metal/Metal.h>
 #include "qMetalDevice.h"
 #include "qMetalStencilState.h"
+#include "qMetalTrackedEncoder.h"
 
 #define DEPTHSTENCIL_STATES \
 /*                  	enum                        						depth test      depth write,    stencil			*/ \
@@ -87,6 +88,7 @@ namespace qMetal
 			eStencilState _backStencil);
 		
         void Encode(id<MTLRenderCommandEncoder> encoder);
+        void Encode(TrackedRenderEncoder& encoder);
     
         static DepthStencilState* PredefinedState(eDepthStencilState state);
     };
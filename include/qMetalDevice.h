@@ -25,11 +25,19 @@ SOFTWARE.
 
 #include <QuartzCore/CAMetalLayer.h>
 #include <Metal/Metal.h>
+#include "qMetalPipelineCache.h"
+#include "qMetalDispatchShape.h"
+#include "qMetalJobSystem.h"
+#include "qMetalQueueTimeline.h"
 
 #define Q_METAL_FRAMES_TO_BUFFER (3)
+#define Q_METAL_UPLOAD_ALIGNMENT (256) //constant buffer offsets must be 256 byte aligned on macOS
 
 namespace qMetal
 {
+	class TextureTable;
+	class TrackedComputeEncoder;
+	
     namespace Device
     {
 		enum eIndirectCommandBufferPool
@@ -38,6 +46,15 @@ namespace qMetal
 			eIndirectCommandBufferPool_Tessellated,
 			eIndirectCommandBufferPool_Count,
 		};
+		
+		enum eQueue
+		{
+			eQueue_Render,
+			eQueue_Compute,
+			eQueue_Count,
+		};
+		
+		typedef QueueTimeline::Point QueuePoint;
     
 		struct Config
 		{
@@ -56,31 +73,117 @@ namespace qMetal
 			
 			CAMetalLayer* metalLayer;
 			IndirectCommandBufferPoolConfig commandBufferPoolConfig[eIndirectCommandBufferPool_Count];
+			NSUInteger uploadRingSize; //bytes per frame for the upload ring, 0 disables it
+			NSString* pipelineArchivePath; //path, without extension, of the pipeline binary archive and manifest; nil disables it
+			uint64_t pipelineArchiveVersion; //bump to throw away archives from previous builds
+			uint32_t bindlessTextureCount; //texture slots in the device's bindless texture table, 0 disables it
+			uint32_t bindlessSamplerCount; //sampler slots in the bindless texture table
+			NSString* dispatchTuningPath; //path, without extension, of the compute dispatch tuning table; nil uses the heuristic alone
+			bool dispatchTuning; //offline tuning: TuneDispatch() times every candidate threadgroup shape for untuned dispatches and saves the winners
+			uint32_t jobWorkerCount; //worker threads for the device's job system; the default is one per core besides the frame's thread, 0 runs jobs on whichever thread waits for them
+			bool asyncCompute; //a second command queue for async compute, so it overlaps the frame's render work; off, async compute shares the render queue
 			
 			Config()
 			: metalLayer(NULL)
+			, uploadRingSize(0)
+			, pipelineArchivePath(nil)
+			, pipelineArchiveVersion(0)
+			, bindlessTextureCount(0)
+			, bindlessSamplerCount(16)
+			, dispatchTuningPath(nil)
+			, dispatchTuning(false)
+			, jobWorkerCount(JobSystem::AutoWorkerCount)
+			, asyncCompute(false)
 			{
 			}
 		};
+		
+		typedef struct UploadAllocation
+		{
+			id<MTLBuffer> buffer;
+			NSUInteger offset;
+			void* contents;
+			
+			UploadAllocation()
+			: buffer(nil)
+			, offset(0)
+			, contents(NULL)
+			{ }
+		} UploadAllocation;
     
         void Init(Config* config);
         void Destroy();
       
         id<MTLDevice> Get();
+		
+		//pipeline states shared between materials, keyed by a hash of their descriptors
+		PipelineCache<id<MTLRenderPipelineState>>& RenderPipelineCache();
+		PipelineCache<id<MTLComputePipelineState>>& ComputePipelineCache();
+		
+		//call on a descriptor just before building its pipeline: records the pipeline in this session's manifest and
+		//points the descriptor at the binary archive, so pipelines archived by a previous session skip compilation
+		void ArchiveComputePipeline(MTLComputePipelineDescriptor* descriptor, uint64_t key);
+		void ArchiveRenderPipeline(MTLRenderPipelineDescriptor* descriptor, uint64_t key);
+		void SavePipelineArchive();
+		
+		//the threadgroup shape for a dispatchThreads of grid: the tuning table's entry for the pipeline if there is one,
+		//otherwise DispatchShape::Select. never runs anything
+		MTLSize DispatchThreadgroupSize(id<MTLComputePipelineState> pipeline, uint64_t pipelineKey, MTLSize grid);
+		
+		//in a tuning session (Config::dispatchTuning), times every candidate shape for an untuned pipeline and grid
+		//bucket and records the fastest, then returns DispatchThreadgroupSize(). each candidate really runs the kernel,
+		//several times, on its own command buffer with encode making every binding the kernel uses, so only tune
+		//kernels that are idempotent or bound to scratch resources
+		MTLSize TuneDispatch(id<MTLComputePipelineState> pipeline, uint64_t pipelineKey, MTLSize grid, void (^encode)(id<MTLComputeCommandEncoder> encoder));
+		void SaveDispatchTuning();
 
 		id<MTLBlitCommandEncoder> BlitEncoder(NSString* label);
 		id<MTLComputeCommandEncoder> ComputeEncoder(NSString* label);
+		id<MTLComputeCommandEncoder> ComputeEncoder(NSString* label, MTLDispatchType dispatchType);
 		id<MTLRenderCommandEncoder> RenderEncoder(MTLRenderPassDescriptor* descriptor, NSString* label);
+		id<MTLParallelRenderCommandEncoder> ParallelRenderEncoder(MTLRenderPassDescriptor* descriptor, NSString* label);
+		
+		//a compute encoder shared by consecutive compute-only work. don't end it: requesting any other encoder, pushing
+		//or popping a device debug group, or ending the frame, ends it. push a debug group in place of a label. its
+		//serial dispatch only orders tracked resources; kernels writing untracked ones set Material::Config::untrackedWrites
+		TrackedComputeEncoder& CoalescedComputeEncoder();
+		void EndCoalescedComputeEncoder();
 		
 		void PushDebugGroup(NSString* name);
 		void PopDebugGroup();
         
         uint32_t CurrentFrameIndex();
+        uint64_t CurrentFrameNumber();
+		
+		//transient, frame-lifetime suballocation from the device's upload ring; safe to call from encoding threads
+		UploadAllocation AllocateUpload(NSUInteger size, NSUInteger alignment = Q_METAL_UPLOAD_ALIGNMENT);
+		
+		//the device-wide table textures register with for bindless access; NULL unless Config::bindlessTextureCount is set
+		TextureTable* BindlessTextures();
+		
+		//the device's job system, and the frame's job group: EndAndPresentDrawable() waits for the frame's jobs (and
+		//any child group started under them) before ending the frame. work encoding into the off-screen command buffer
+		//should wait on a child group of its own before EndOffScreen()
+		JobSystem& Jobs();
+		JobCounter& FrameJobs();
 		
         void BeginOffScreen();
         void EndOffScreen();
         id<MTLRenderCommandEncoder> BeginDrawable();
         void EndAndPresentDrawable(CFTimeInterval afterMinimumDuration, bool blockUntilFrameComplete = false);
+		
+		//async compute records into a command buffer of the compute queue, which runs alongside the render queue. every
+		//command buffer on either queue signals its queue's shared event as it completes, at the point QueuePendingPoint()
+		//returns while it's open. WaitForQueue() makes a queue's open command buffer (or its next one) wait on a point
+		//the other queue has already submitted, from the next encoder on; it skips waits an earlier one already covers.
+		//end the queue's own encoders before waiting. the frame only retires (and hands its upload ring region and
+		//param slots on) once the async compute submitted before EndAndPresentDrawable() has completed too
+		void BeginAsyncCompute();
+		id<MTLComputeCommandEncoder> AsyncComputeEncoder(NSString* label);
+		QueuePoint EndAsyncCompute();
+		QueuePoint QueuePendingPoint(eQueue queue);
+		void WaitForQueue(eQueue queue, QueuePoint point);
+		bool IsQueuePointComplete(QueuePoint point);
         
         id<MTLIndirectCommandBuffer> IndirectCommandBuffer(eIndirectCommandBufferPool pool);
         id<MTLBuffer> IndirectRangeBuffer(eIndirectCommandBufferPool pool);
@@ -90,6 +193,9 @@ namespace qMetal
 		void ResetIndirectCommandBuffers();
 		void InitIndirectCommandBuffer(eIndirectCommandBufferPool pool, id<MTLComputeCommandEncoder> encoder, id<MTLBuffer> rangeOffsetBuffer);
 		void ExecuteIndirectCommandBuffer(eIndirectCommandBufferPool pool, id<MTLRenderCommandEncoder> encoder, uint32_t indirectRangeOffset);
+		
+		//turns an IndirectDispatch's appended count into the threadgroup counts its consumer is dispatched with
+		void ResolveIndirectDispatch(TrackedComputeEncoder& encoder, id<MTLBuffer> dispatchBuffer, NSUInteger offset);
     }
 }
 
@@ -0,0 +1,342 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_DISPATCH_SHAPE_H__
+#define __Q_METAL_DISPATCH_SHAPE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unordered_map>
+#include <vector>
+#include "qMetalPipelineCache.h"
+#include "qCore.h"
+
+namespace qMetal
+{
+	typedef struct DispatchSize
+	{
+		uint32_t width;
+		uint32_t height;
+		uint32_t depth;
+		
+		DispatchSize()
+		: width(1)
+		, height(1)
+		, depth(1)
+		{ }
+		
+		DispatchSize(uint32_t _width, uint32_t _height, uint32_t _depth = 1)
+		: width(_width)
+		, height(_height)
+		, depth(_depth)
+		{ }
+		
+		uint32_t Threads() const
+		{
+			return width * height * depth;
+		}
+		
+		bool operator==(const DispatchSize& other) const
+		{
+			return (width == other.width) && (height == other.height) && (depth == other.depth);
+		}
+	} DispatchSize;
+	
+	//threadgroup shape selection for dispatchThreads. callers pass the pipeline's threadExecutionWidth
+	//and maxTotalThreadsPerThreadgroup
+	namespace DispatchShape
+	{
+		inline uint32_t Min(uint32_t a, uint32_t b)
+		{
+			return (a < b) ? a : b;
+		}
+		
+		inline uint32_t Max(uint32_t a, uint32_t b)
+		{
+			return (a > b) ? a : b;
+		}
+		
+		//x covers one SIMD group wide where the grid allows, so rows stay coalesced, and y then z take what's left of
+		//the thread budget, clamped to the grid. whatever y and z can't use goes back to x in whole SIMD groups, which
+		//is what turns a wide, short grid (or a 1D one) into a long row rather than a mostly idle square
+		inline DispatchSize Select(const DispatchSize& grid, uint32_t threadExecutionWidth, uint32_t maxTotalThreads)
+		{
+			const uint32_t simdWidth = Max(threadExecutionWidth, 1);
+			const uint32_t maxThreads = Max(maxTotalThreads, 1);
+			
+			if ((grid.width == 0) || (grid.height == 0) || (grid.depth == 0))
+			{
+				return DispatchSize();
+			}
+			
+			DispatchSize shape;
+			shape.width = Min(Min(grid.width, simdWidth), maxThreads);
+			shape.height = Min(grid.height, maxThreads / shape.width);
+			shape.depth = Min(grid.depth, maxThreads / (shape.width * shape.height));
+			
+			const uint32_t widthBudget = maxThreads / (shape.height * shape.depth);
+			if ((grid.width > shape.width) && (widthBudget > shape.width))
+			{
+				const uint32_t gridWidth = ((grid.width + simdWidth - 1) / simdWidth) * simdWidth;
+				const uint32_t budgetWidth = (widthBudget >= simdWidth) ? (widthBudget / simdWidth) * simdWidth : widthBudget;
+				shape.width = Max(shape.width, Min(gridWidth, budgetWidth));
+			}
+			
+			return shape;
+		}
+		
+		//grids whose dimensions share a power of two bucket share a tuning entry
+		inline uint32_t Bucket(uint32_t size)
+		{
+			uint32_t bucket = 0;
+			while ((size > 1) && (bucket < 31))
+			{
+				size = (size >> 1) + (size & 1); //rounds up without overflowing at UINT32_MAX
+				++bucket;
+			}
+			return bucket;
+		}
+		
+		inline uint64_t TuningKey(uint64_t pipelineKey, const DispatchSize& grid)
+		{
+			return PipelineHash().Add(pipelineKey).Add(Bucket(grid.width)).Add(Bucket(grid.height)).Add(Bucket(grid.depth)).Value();
+		}
+		
+		//the shapes an offline tuning run times: power of two sides no bigger than the grid needs, between one SIMD
+		//group and the pipeline's limit, plus the heuristic's pick
+		inline void Candidates(const DispatchSize& grid, uint32_t threadExecutionWidth, uint32_t maxTotalThreads, std::vector<DispatchSize>& candidates)
+		{
+			candidates.clear();
+			
+			const DispatchSize heuristic = Select(grid, threadExecutionWidth, maxTotalThreads);
+			candidates.push_back(heuristic);
+			
+			const uint32_t minThreads = Min(Max(threadExecutionWidth, 1), Max(grid.Threads(), 1));
+			for (uint32_t width = 1; width <= maxTotalThreads; width <<= 1)
+			{
+				for (uint32_t height = 1; width * height <= maxTotalThreads; height <<= 1)
+				{
+					for (uint32_t depth = 1; width * height * depth <= maxTotalThreads; depth <<= 1)
+					{
+						const DispatchSize shape(width, height, depth);
+						const bool fitsGrid = ((width >> 1) < grid.width) && ((height >> 1) < grid.height) && ((depth >> 1) < grid.depth);
+						if (fitsGrid && (shape.Threads() >= minThreads) && !(shape == heuristic))
+						{
+							candidates.push_back(shape);
+						}
+					}
+				}
+			}
+		}
+	}
+	
+	//the fastest threadgroup shape measured per pipeline and grid bucket, saved between runs of an offline tuning
+	//session and loaded by shipping builds. like the pipeline manifest, a table from another environment is discarded
+	//
+	//format, all little endian:
+	//	header	magic u32, format version u32, environment hash u64, record count u32, reserved u32
+	//	records	tuning key u64, width u32, height u32, depth u32, best time in ns u32
+	//	footer	FNV-1a of everything before it u64
+	class DispatchTuningTable
+	{
+	public:
+		static constexpr uint32_t Magic = 0x54444D71; //"qMDT"
+		static constexpr uint32_t FormatVersion = 1;
+		
+		explicit DispatchTuningTable(uint64_t _environmentHash)
+		: environmentHash(_environmentHash)
+		, dirty(false)
+		{ }
+		
+		bool Find(uint64_t pipelineKey, const DispatchSize& grid, DispatchSize& shape) const
+		{
+			EntryMap::const_iterator it = entries.find(DispatchShape::TuningKey(pipelineKey, grid));
+			if (it == entries.end())
+			{
+				return false;
+			}
+			shape = it->second.shape;
+			return true;
+		}
+		
+		//keeps the shape if it beats what's recorded; returns whether it did
+		bool Record(uint64_t pipelineKey, const DispatchSize& grid, const DispatchSize& shape, uint32_t timeNs)
+		{
+			Entry& entry = entries[DispatchShape::TuningKey(pipelineKey, grid)];
+			if (timeNs >= entry.timeNs)
+			{
+				return false;
+			}
+			entry.shape = shape;
+			entry.timeNs = timeNs;
+			dirty = true;
+			return true;
+		}
+		
+		bool Load(const uint8_t* data, size_t size)
+		{
+			entries.clear();
+			dirty = false;
+			
+			const size_t headerSize = 24;
+			const size_t recordSize = 24;
+			const size_t footerSize = 8;
+			
+			if ((data == NULL) || (size < headerSize + footerSize))
+			{
+				return false;
+			}
+			
+			const uint32_t count = Read32(data + 16);
+			if ((Read32(data) != Magic) || (Read32(data + 4) != FormatVersion) || (Read64(data + 8) != environmentHash))
+			{
+				return false;
+			}
+			
+			if (((size - headerSize - footerSize) / recordSize < count) || (size != headerSize + (count * recordSize) + footerSize))
+			{
+				return false;
+			}
+			
+			if (Read64(data + size - footerSize) != PipelineHash().AddBytes(data, size - footerSize).Value())
+			{
+				return false;
+			}
+			
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				const uint8_t* record = data + headerSize + (i * recordSize);
+				Entry& entry = entries[Read64(record)];
+				entry.shape = DispatchSize(Read32(record + 8), Read32(record + 12), Read32(record + 16));
+				entry.timeNs = Read32(record + 20);
+			}
+			
+			return true;
+		}
+		
+		bool LoadFile(const char* path)
+		{
+			std::vector<uint8_t> data;
+			FILE* file = fopen(path, "rb");
+			if (file == NULL)
+			{
+				entries.clear();
+				return false;
+			}
+			
+			uint8_t chunk[4096];
+			size_t read;
+			while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+			{
+				data.insert(data.end(), chunk, chunk + read);
+			}
+			fclose(file);
+			
+			return Load(data.data(), data.size());
+		}
+		
+		std::vector<uint8_t> Serialize() const
+		{
+			std::vector<uint8_t> data;
+			data.reserve(24 + (entries.size() * 24) + 8);
+			
+			Write32(data, Magic);
+			Write32(data, FormatVersion);
+			Write64(data, environmentHash);
+			Write32(data, (uint32_t)entries.size());
+			Write32(data, 0);
+			
+			for (EntryMap::const_iterator it = entries.begin(); it != entries.end(); ++it)
+			{
+				Write64(data, it->first);
+				Write32(data, it->second.shape.width);
+				Write32(data, it->second.shape.height);
+				Write32(data, it->second.shape.depth);
+				Write32(data, it->second.timeNs);
+			}
+			
+			Write64(data, PipelineHash().AddBytes(data.data(), data.size()).Value());
+			return data;
+		}
+		
+		bool SaveFile(const char* path)
+		{
+			const std::vector<uint8_t> data = Serialize();
+			FILE* file = fopen(path, "wb");
+			if (file == NULL)
+			{
+				return false;
+			}
+			const bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+			const bool saved = (fclose(file) == 0) && written;
+			dirty = dirty && !saved;
+			return saved;
+		}
+		
+		bool IsDirty() const 			{ return dirty; }
+		uint32_t Count() const 			{ return (uint32_t)entries.size(); }
+		
+	private:
+		typedef struct Entry
+		{
+			DispatchSize shape;
+			uint32_t timeNs;
+			
+			Entry()
+			: timeNs(UINT32_MAX)
+			{ }
+		} Entry;
+		
+		typedef std::unordered_map<uint64_t, Entry> EntryMap;
+		
+		static uint32_t Read32(const uint8_t* data)
+		{
+			return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+		}
+		
+		static uint64_t Read64(const uint8_t* data)
+		{
+			return (uint64_t)Read32(data) | ((uint64_t)Read32(data + 4) << 32);
+		}
+		
+		static void Write32(std::vector<uint8_t>& data, uint32_t value)
+		{
+			for (int i = 0; i < 4; ++i)
+			{
+				data.push_back((uint8_t)(value >> (i * 8)));
+			}
+		}
+		
+		static void Write64(std::vector<uint8_t>& data, uint64_t value)
+		{
+			Write32(data, (uint32_t)value);
+			Write32(data, (uint32_t)(value >> 32));
+		}
+		
+		uint64_t environmentHash;
+		EntryMap entries;
+		bool dirty;
+	};
+}
+
+#endif //__Q_METAL_DISPATCH_SHAPE_H__
@@ -0,0 +1,441 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_DRAW_QUEUE_H__
+#define __Q_METAL_DRAW_QUEUE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include "qCore.h"
+#include "qMetalJobSystem.h"
+
+namespace qMetal
+{
+	//64 bit draw ordering keys, most significant field first:
+	//opaque:	pass(6) | 0 | pipeline(16) | material(16) | mesh(13) | depth(12), front to back
+	//blended:	pass(6) | 1 | depth(25), back to front | pipeline(16) | material(16)
+	//blended draws within a pass always sort after its opaque draws. pipeline, material and mesh identifiers
+	//are folded down to their field width; a collision only costs a state change, never a wrong draw
+	class DrawKey
+	{
+	public:
+		static constexpr uint32_t PassBits = 6;
+		static constexpr uint32_t PassLimit = 1 << PassBits;
+		static constexpr uint32_t PipelineBits = 16;
+		static constexpr uint32_t MaterialBits = 16;
+		static constexpr uint32_t MeshBits = 13;
+		static constexpr uint32_t OpaqueDepthBits = 12;
+		static constexpr uint32_t BlendedDepthBits = 25;
+		
+		//depth is normalised, 0 at the camera and 1 at the far plane; out of range values are clamped
+		static uint64_t Opaque(uint32_t pass, uint64_t pipeline, uint64_t material, uint64_t mesh, float depth)
+		{
+			uint64_t key = PassField(pass);
+			key |= Fold(pipeline, PipelineBits) << (MaterialBits + MeshBits + OpaqueDepthBits);
+			key |= Fold(material, MaterialBits) << (MeshBits + OpaqueDepthBits);
+			key |= Fold(mesh, MeshBits) << OpaqueDepthBits;
+			key |= Quantise(depth, OpaqueDepthBits);
+			return key;
+		}
+		
+		static uint64_t Blended(uint32_t pass, uint64_t pipeline, uint64_t material, float depth)
+		{
+			const uint64_t depthMax = (1ULL << BlendedDepthBits) - 1;
+			uint64_t key = PassField(pass) | BlendedBit;
+			key |= (depthMax - Quantise(depth, BlendedDepthBits)) << (PipelineBits + MaterialBits);
+			key |= Fold(pipeline, PipelineBits) << MaterialBits;
+			key |= Fold(material, MaterialBits);
+			return key;
+		}
+		
+		static uint64_t Make(uint32_t pass, uint64_t pipeline, uint64_t material, uint64_t mesh, float depth, bool blended)
+		{
+			return blended ? Blended(pass, pipeline, material, depth) : Opaque(pass, pipeline, material, mesh, depth);
+		}
+		
+		static uint32_t Pass(uint64_t key)
+		{
+			return (uint32_t)(key >> (64 - PassBits));
+		}
+		
+		static bool IsBlended(uint64_t key)
+		{
+			return (key & BlendedBit) != 0;
+		}
+		
+	private:
+		static constexpr uint64_t BlendedBit = 1ULL << (63 - PassBits);
+		
+		static uint64_t PassField(uint32_t pass)
+		{
+			qASSERTM(pass < PassLimit, "DrawKey pass %u must be under %u", pass, PassLimit);
+			return (uint64_t)pass << (64 - PassBits);
+		}
+		
+		//fibonacci hashing, so pointers and hashes that differ only in low or high bits still spread
+		static uint64_t Fold(uint64_t value, uint32_t bits)
+		{
+			return (value * 0x9E3779B97F4A7C15ULL) >> (64 - bits);
+		}
+		
+		static uint64_t Quantise(float depth, uint32_t bits)
+		{
+			const uint64_t depthMax = (1ULL << bits) - 1;
+			if (!(depth > 0.0f))
+			{
+				return 0;
+			}
+			if (depth >= 1.0f)
+			{
+				return depthMax;
+			}
+			return (uint64_t)((double)depth * (double)depthMax);
+		}
+	};
+	
+	//a fixed capacity queue of keyed draws. Submit() is lock free and safe to call from any number of threads;
+	//Sort() and everything after it must only run once all submitting threads are done
+	template<class _Draw>
+	class DrawQueue
+	{
+	public:
+		static constexpr uint32_t ParallelSortChunkSize = 8192;	//fewest entries a parallel sort gives each job
+		static constexpr uint32_t ParallelSortChunkLimit = 16;
+		
+		DrawQueue(uint32_t _capacity)
+		: capacity(_capacity)
+		, count(0)
+		, overflowCount(0)
+		, sortedCount(0)
+		, sortPassCount(0)
+		{
+			draws.resize(capacity);
+			entries.resize(capacity);
+			scratch.resize(capacity);
+		}
+		
+		//returns false, and drops the draw, if the queue is full
+		bool Submit(uint64_t key, const _Draw& draw)
+		{
+			const uint32_t slot = count.fetch_add(1, std::memory_order_relaxed);
+			if (slot >= capacity)
+			{
+				overflowCount.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			
+			draws[slot] = draw;
+			entries[slot].key = key;
+			entries[slot].index = slot;
+			return true;
+		}
+		
+		//stable LSD radix sort over the keys, one byte per pass. all eight histograms are built in a single read,
+		//and passes where every key shares the same byte are skipped
+		void Sort()
+		{
+			const uint32_t entryCount = Count();
+			if (entryCount == sortedCount)
+			{
+				return;
+			}
+			
+			uint32_t histograms[8][256];
+			memset(histograms, 0, sizeof(histograms));
+			for (uint32_t i = 0; i < entryCount; ++i)
+			{
+				const uint64_t key = entries[i].key;
+				for (uint32_t byte = 0; byte < 8; ++byte)
+				{
+					++histograms[byte][(key >> (byte * 8)) & 0xFF];
+				}
+			}
+			
+			Entry* source = entries.data();
+			Entry* destination = scratch.data();
+			sortPassCount = 0;
+			for (uint32_t byte = 0; byte < 8; ++byte)
+			{
+				uint32_t* histogram = histograms[byte];
+				if (histogram[(source[0].key >> (byte * 8)) & 0xFF] == entryCount)
+				{
+					continue;
+				}
+				
+				uint32_t offset = 0;
+				for (uint32_t bucket = 0; bucket < 256; ++bucket)
+				{
+					const uint32_t bucketCount = histogram[bucket];
+					histogram[bucket] = offset;
+					offset += bucketCount;
+				}
+				
+				for (uint32_t i = 0; i < entryCount; ++i)
+				{
+					destination[histogram[(source[i].key >> (byte * 8)) & 0xFF]++] = source[i];
+				}
+				
+				Entry* swap = source;
+				source = destination;
+				destination = swap;
+				++sortPassCount;
+			}
+			
+			if (source != entries.data())
+			{
+				entries.swap(scratch);
+			}
+			sortedCount = entryCount;
+		}
+		
+		//the same sort over jobs: every pass histograms, then scatters, fixed chunks of the keys in parallel. each
+		//bucket's offsets are handed out chunk by chunk, so the order is identical to Sort()'s
+		void Sort(JobSystem& jobs)
+		{
+			const uint32_t entryCount = Count();
+			if (entryCount == sortedCount)
+			{
+				return;
+			}
+			
+			const uint32_t chunkCount = std::min(std::min(jobs.WorkerCount() + 1, entryCount / ParallelSortChunkSize), ParallelSortChunkLimit);
+			if (chunkCount < 2)
+			{
+				Sort();
+				return;
+			}
+			
+			chunkHistograms.resize(chunkCount * 8 * 256);
+			
+			ParallelSort sort;
+			sort.queue = this;
+			sort.entryCount = entryCount;
+			sort.chunkCount = chunkCount;
+			sort.source = entries.data();
+			sort.destination = scratch.data();
+			sort.byte = AllBytes;
+			RunChunks(jobs, &CountChunk, sort);
+			
+			sortPassCount = 0;
+			for (uint32_t byte = 0; byte < 8; ++byte)
+			{
+				uint32_t total = 0;
+				const uint32_t firstBucket = (sort.source[0].key >> (byte * 8)) & 0xFF;
+				for (uint32_t chunk = 0; chunk < chunkCount; ++chunk)
+				{
+					total += ChunkHistogram(chunk, byte)[firstBucket];
+				}
+				if (total == entryCount)
+				{
+					continue;
+				}
+				
+				//the first pass can use the counts from above, later ones recount as the chunks now hold other keys
+				if (sortPassCount > 0)
+				{
+					sort.byte = byte;
+					RunChunks(jobs, &CountChunk, sort);
+				}
+				
+				uint32_t offset = 0;
+				for (uint32_t bucket = 0; bucket < 256; ++bucket)
+				{
+					for (uint32_t chunk = 0; chunk < chunkCount; ++chunk)
+					{
+						uint32_t* histogram = ChunkHistogram(chunk, byte);
+						const uint32_t bucketCount = histogram[bucket];
+						histogram[bucket] = offset;
+						offset += bucketCount;
+					}
+				}
+				
+				sort.byte = byte;
+				RunChunks(jobs, &ScatterChunk, sort);
+				
+				Entry* swap = sort.source;
+				sort.source = sort.destination;
+				sort.destination = swap;
+				++sortPassCount;
+			}
+			
+			if (sort.source != entries.data())
+			{
+				entries.swap(scratch);
+			}
+			sortedCount = entryCount;
+		}
+		
+		//sorted order once Sort() has run, submission order before
+		const _Draw& Draw(uint32_t i) const
+		{
+			qASSERTM(i < Count(), "DrawQueue draw %u out of range, %u draws queued", i, Count());
+			return draws[entries[i].index];
+		}
+		
+		uint64_t Key(uint32_t i) const
+		{
+			qASSERTM(i < Count(), "DrawQueue key %u out of range, %u draws queued", i, Count());
+			return entries[i].key;
+		}
+		
+		template<class _Functor>
+		void ForEach(_Functor functor) const
+		{
+			const uint32_t entryCount = Count();
+			for (uint32_t i = 0; i < entryCount; ++i)
+			{
+				functor(entries[i].key, draws[entries[i].index]);
+			}
+		}
+		
+		//first sorted index at or after pass; Count() if there's none
+		uint32_t PassBegin(uint32_t pass) const
+		{
+			qASSERTM(IsSorted(), "DrawQueue must be sorted before looking up passes");
+			uint32_t low = 0;
+			uint32_t high = Count();
+			while (low < high)
+			{
+				const uint32_t mid = low + (high - low) / 2;
+				if (DrawKey::Pass(entries[mid].key) < pass)
+				{
+					low = mid + 1;
+				}
+				else
+				{
+					high = mid;
+				}
+			}
+			return low;
+		}
+		
+		void Reset()
+		{
+			count.store(0, std::memory_order_relaxed);
+			overflowCount.store(0, std::memory_order_relaxed);
+			sortedCount = 0;
+			sortPassCount = 0;
+		}
+		
+		uint32_t Count() const
+		{
+			const uint32_t submitted = count.load(std::memory_order_relaxed);
+			return (submitted < capacity) ? submitted : capacity;
+		}
+		
+		uint32_t Capacity() const			{ return capacity; }
+		uint32_t OverflowCount() const		{ return overflowCount.load(std::memory_order_relaxed); }
+		bool IsSorted() const				{ return sortedCount == Count(); }
+		uint32_t SortPassCount() const		{ return sortPassCount; }
+		
+	private:
+		DrawQueue(const DrawQueue&);
+		DrawQueue& operator=(const DrawQueue&);
+		
+		struct Entry
+		{
+			uint64_t key;
+			uint32_t index;
+		};
+		
+		static constexpr uint32_t AllBytes = 8;
+		
+		struct ParallelSort
+		{
+			DrawQueue*	queue;
+			uint32_t	entryCount;
+			uint32_t	chunkCount;
+			Entry*		source;
+			Entry*		destination;
+			uint32_t	byte;	//AllBytes counts every byte at once
+		};
+		
+		uint32_t* ChunkHistogram(uint32_t chunk, uint32_t byte)
+		{
+			return &chunkHistograms[(chunk * 8 + byte) * 256];
+		}
+		
+		static uint32_t ChunkBegin(const ParallelSort& sort, uint32_t chunk)
+		{
+			return (uint32_t)(((uint64_t)sort.entryCount * chunk) / sort.chunkCount);
+		}
+		
+		static void RunChunks(JobSystem& jobs, JobSystem::JobFunction function, ParallelSort& sort)
+		{
+			JobCounter counter;
+			jobs.ParallelFor(counter, sort.chunkCount, 1, function, &sort);
+			jobs.Wait(counter);
+		}
+		
+		static void CountChunk(void* context, uint32_t begin, uint32_t end)
+		{
+			ParallelSort& sort = *(ParallelSort*)context;
+			for (uint32_t chunk = begin; chunk < end; ++chunk)
+			{
+				const uint32_t byteBegin = (sort.byte == AllBytes) ? 0 : sort.byte;
+				const uint32_t byteEnd = (sort.byte == AllBytes) ? 8 : sort.byte + 1;
+				for (uint32_t byte = byteBegin; byte < byteEnd; ++byte)
+				{
+					memset(sort.queue->ChunkHistogram(chunk, byte), 0, 256 * sizeof(uint32_t));
+				}
+				
+				for (uint32_t i = ChunkBegin(sort, chunk); i < ChunkBegin(sort, chunk + 1); ++i)
+				{
+					const uint64_t key = sort.source[i].key;
+					for (uint32_t byte = byteBegin; byte < byteEnd; ++byte)
+					{
+						++sort.queue->ChunkHistogram(chunk, byte)[(key >> (byte * 8)) & 0xFF];
+					}
+				}
+			}
+		}
+		
+		static void ScatterChunk(void* context, uint32_t begin, uint32_t end)
+		{
+			ParallelSort& sort = *(ParallelSort*)context;
+			for (uint32_t chunk = begin; chunk < end; ++chunk)
+			{
+				uint32_t* offsets = sort.queue->ChunkHistogram(chunk, sort.byte);
+				for (uint32_t i = ChunkBegin(sort, chunk); i < ChunkBegin(sort, chunk + 1); ++i)
+				{
+					sort.destination[offsets[(sort.source[i].key >> (sort.byte * 8)) & 0xFF]++] = sort.source[i];
+				}
+			}
+		}
+		
+		uint32_t				capacity;
+		std::atomic<uint32_t>	count;
+		std::atomic<uint32_t>	overflowCount;
+		uint32_t				sortedCount;
+		uint32_t				sortPassCount;
+		std::vector<_Draw>		draws;
+		std::vector<Entry>		entries;
+		std::vector<Entry>		scratch;
+		std::vector<uint32_t>	chunkHistograms;
+	};
+}
+
+#endif //__Q_METAL_DRAW_QUEUE_H__
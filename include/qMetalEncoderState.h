@@ -0,0 +1,215 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_ENCODER_STATE_H__
+#define __Q_METAL_ENCODER_STATE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "qCore.h"
+
+namespace qMetal
+{
+	//shadow of the state set on one command encoder, so redundant sets can be skipped. every setter says whether
+	//the call still needs issuing and counts it as issued or elided. nothing is known until it's first set, and
+	//an untracked state issues everything (for code paths that take a raw encoder). objects are
+	//compared by pointer
+	class EncoderState
+	{
+	public:
+		static constexpr uint32_t BufferSlotCount = 31;
+		
+		enum eStage
+		{
+			eStage_Vertex,
+			eStage_Fragment,
+			eStage_Compute,
+			eStage_Count,
+		};
+		
+		enum eCall
+		{
+			eCall_Pipeline,
+			eCall_DepthStencil,
+			eCall_CullMode,
+			eCall_Winding,
+			eCall_StencilReference,
+			eCall_Buffer,
+			eCall_Count,
+		};
+		
+		enum eBufferChange
+		{
+			eBufferChange_None,		//already bound
+			eBufferChange_Offset,	//same buffer, only the offset needs updating
+			eBufferChange_Buffer,	//bind it
+		};
+		
+		EncoderState(bool _tracking = true)
+		: tracking(_tracking)
+		{
+			ResetCounters();
+			if (tracking)
+			{
+				Reset();
+			}
+		}
+		
+		//forget everything that's been set, e.g. when the encoder state is changed behind our back
+		void Reset()
+		{
+			pipeline.known = false;
+			depthStencil.known = false;
+			cullMode.known = false;
+			winding.known = false;
+			stencilReference.known = false;
+			for (uint32_t stage = 0; stage < eStage_Count; ++stage)
+			{
+				for (uint32_t i = 0; i < BufferSlotCount; ++i)
+				{
+					buffers[stage][i].known = false;
+				}
+			}
+		}
+		
+		void ResetCounters()
+		{
+			for (uint32_t i = 0; i < eCall_Count; ++i)
+			{
+				issued[i] = 0;
+				elided[i] = 0;
+			}
+		}
+		
+		bool Pipeline(const void* value) 			{ return Track(eCall_Pipeline, pipeline, value); }
+		bool DepthStencil(const void* value) 		{ return Track(eCall_DepthStencil, depthStencil, value); }
+		bool CullMode(uint64_t value) 				{ return Track(eCall_CullMode, cullMode, value); }
+		bool Winding(uint64_t value) 				{ return Track(eCall_Winding, winding, value); }
+		bool StencilReference(uint64_t value) 		{ return Track(eCall_StencilReference, stencilReference, value); }
+		
+		eBufferChange Buffer(eStage stage, uint32_t index, const void* buffer, uint64_t offset)
+		{
+			qASSERTM(index < BufferSlotCount, "EncoderState buffer index %u is out of range", index);
+			
+			if (!tracking)
+			{
+				++issued[eCall_Buffer];
+				return eBufferChange_Buffer;
+			}
+			
+			BufferSlot& slot = buffers[stage][index];
+			if (slot.known && (slot.buffer == buffer))
+			{
+				if (slot.offset == offset)
+				{
+					++elided[eCall_Buffer];
+					return eBufferChange_None;
+				}
+				
+				++issued[eCall_Buffer];
+				slot.offset = offset;
+				return eBufferChange_Offset;
+			}
+			
+			++issued[eCall_Buffer];
+			slot.known = true;
+			slot.buffer = buffer;
+			slot.offset = offset;
+			return eBufferChange_Buffer;
+		}
+		
+		//something other than a buffer (inline bytes, say) now occupies the slot
+		void InvalidateBuffer(eStage stage, uint32_t index)
+		{
+			qASSERTM(index < BufferSlotCount, "EncoderState buffer index %u is out of range", index);
+			buffers[stage][index].known = false;
+		}
+		
+		bool IsTracking() const 				{ return tracking; }
+		uint32_t Issued(eCall call) const 		{ return issued[call]; }
+		uint32_t Elided(eCall call) const 		{ return elided[call]; }
+		
+		uint32_t TotalIssued() const
+		{
+			uint32_t total = 0;
+			for (uint32_t i = 0; i < eCall_Count; ++i)
+			{
+				total += issued[i];
+			}
+			return total;
+		}
+		
+		uint32_t TotalElided() const
+		{
+			uint32_t total = 0;
+			for (uint32_t i = 0; i < eCall_Count; ++i)
+			{
+				total += elided[i];
+			}
+			return total;
+		}
+		
+	private:
+		template<class _Value>
+		struct Tracked
+		{
+			_Value value;
+			bool known;
+		};
+		
+		typedef struct BufferSlot
+		{
+			const void* buffer;
+			uint64_t offset;
+			bool known;
+		} BufferSlot;
+		
+		template<class _Value>
+		bool Track(eCall call, Tracked<_Value>& tracked, _Value value)
+		{
+			if (tracking && tracked.known && (tracked.value == value))
+			{
+				++elided[call];
+				return false;
+			}
+			
+			++issued[call];
+			tracked.value = value;
+			tracked.known = true;
+			return true;
+		}
+		
+		bool tracking;
+		
+		Tracked<const void*> pipeline;
+		Tracked<const void*> depthStencil;
+		Tracked<uint64_t> cullMode;
+		Tracked<uint64_t> winding;
+		Tracked<uint64_t> stencilReference;
+		BufferSlot buffers[eStage_Count][BufferSlotCount];
+		
+		uint32_t issued[eCall_Count];
+		uint32_t elided[eCall_Count];
+	};
+}
+
+#endif //__Q_METAL_ENCODER_STATE_H__
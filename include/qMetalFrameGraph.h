@@ -0,0 +1,581 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_FRAME_GRAPH_H__
+#define __Q_METAL_FRAME_GRAPH_H__
+
+#include <Metal/Metal.h>
+#include <algorithm>
+#include <vector>
+#include "qCore.h"
+#include "qMetalDevice.h"
+#include "qMetalRenderTarget.h"
+#include "qMetalFrameSchedule.h"
+#include "qMetalTransientAllocator.h"
+#include "qMetalTrackedEncoder.h"
+
+namespace qMetal
+{
+	//a frame's render passes, each declaring the attachments it renders into, resolves into and samples. Compile()
+	//runs FrameSchedule over them, then creates the graph's own attachment textures (memoryless where nothing outside
+	//a pass needs them) and a RenderTarget per surviving pass with the load and store actions it picked. the rest of
+	//the graph's attachments are placed in one heap by TransientAllocator, so attachments that are never live at the
+	//same time share memory; heap textures aren't hazard tracked, so passes wait on fences for the ones they depend on.
+	//graph attachments are only live within the graph's passes (import anything needed after them), and are only valid
+	//until the next Compile(). compile once, and again whenever the passes or attachment sizes change
+	class FrameGraph
+	{
+	public:
+		typedef void (*PassFunction)(TrackedRenderEncoder& encoder, void* context);
+		
+		typedef struct Config
+		{
+			NSString*	name;
+			bool		memorylessAttachments;
+			bool		aliasAttachments;
+			
+			Config(NSString* _name)
+			: name([_name retain])
+			, memorylessAttachments(true)
+			, aliasAttachments(true)
+			{ }
+			
+			Config(Config* config, NSString* _name)
+			: name([_name retain])
+			, memorylessAttachments(config->memorylessAttachments)
+			, aliasAttachments(config->aliasAttachments)
+			{ }
+		} Config;
+		
+		FrameGraph(Config* _config)
+		: config(_config)
+		, heap(nil)
+		, lastHeapPass(UINT32_MAX)
+		, encoded(false)
+		{ }
+		
+		~FrameGraph()
+		{
+			ReleaseTargets();
+			for (auto &pass : passes)
+			{
+				[pass.name release];
+			}
+		}
+		
+		//a texture the graph creates from textureConfig (which is only referenced) at Compile()
+		uint32_t CreateAttachment(Texture::Config* textureConfig, SamplerState* samplerState = NULL)
+		{
+			Attachment attachment;
+			attachment.textureConfig = textureConfig;
+			attachment.samplerState = samplerState;
+			attachment.texture = NULL;
+			attachment.sampled = false;
+			attachment.aliased = false;
+			attachments.push_back(attachment);
+			return schedule.AddAttachment(false, false);
+		}
+		
+		//a texture owned elsewhere, whose contents are kept from before the frame; output if it's needed after it
+		uint32_t ImportAttachment(Texture* texture, bool output)
+		{
+			Attachment attachment;
+			attachment.textureConfig = NULL;
+			attachment.samplerState = NULL;
+			attachment.texture = texture;
+			attachment.sampled = false;
+			attachment.aliased = false;
+			attachments.push_back(attachment);
+			return schedule.AddAttachment(true, output);
+		}
+		
+		//add a pass, then declare its attachments; passes whose results nothing consumes are culled unless they have side effects
+		uint32_t AddPass(NSString* name, PassFunction function, void* context, bool sideEffects = false)
+		{
+			Pass pass;
+			pass.name = [name retain];
+			pass.function = function;
+			pass.context = context;
+			for (int i = 0; i < RenderTarget::eColorAttachment_Count; ++i)
+			{
+				pass.colour[i] = FrameSchedule::NoAttachment;
+				pass.colourResolve[i] = FrameSchedule::NoAttachment;
+				pass.clearColour[i] = qRGBA32f_White;
+			}
+			pass.depth = FrameSchedule::NoAttachment;
+			pass.depthClear = 1.0;
+			pass.stencil = FrameSchedule::NoAttachment;
+			pass.stencilClear = 0;
+			pass.targetConfig = NULL;
+			pass.target = NULL;
+			pass.fence = nil;
+			pass.waitsOnFrame = false;
+			passes.push_back(pass);
+			return schedule.AddPass(sideEffects);
+		}
+		
+		//render into attachment, loading what's there
+		void Colour(RenderTarget::eColorAttachment slot, uint32_t attachment)
+		{
+			passes.back().colour[slot] = attachment;
+			schedule.Write(attachment, false);
+		}
+		
+		//render into attachment, clearing it first
+		void Colour(RenderTarget::eColorAttachment slot, uint32_t attachment, qRGBA32f clearColour)
+		{
+			passes.back().colour[slot] = attachment;
+			passes.back().clearColour[slot] = clearColour;
+			schedule.Write(attachment, true);
+		}
+		
+		//resolve the (MSAA) colour attachment in slot into attachment
+		void Resolve(RenderTarget::eColorAttachment slot, uint32_t attachment)
+		{
+			qASSERTM(passes.back().colour[slot] != FrameSchedule::NoAttachment, "FrameGraph resolve from colour slot %i with no attachment", (int)slot);
+			passes.back().colourResolve[slot] = attachment;
+			schedule.Resolve(passes.back().colour[slot], attachment);
+		}
+		
+		void Depth(uint32_t attachment)
+		{
+			passes.back().depth = attachment;
+			schedule.Write(attachment, false);
+		}
+		
+		void Depth(uint32_t attachment, double clearDepth)
+		{
+			passes.back().depth = attachment;
+			passes.back().depthClear = clearDepth;
+			schedule.Write(attachment, true);
+		}
+		
+		void Stencil(uint32_t attachment)
+		{
+			passes.back().stencil = attachment;
+			schedule.Write(attachment, false);
+		}
+		
+		void Stencil(uint32_t attachment, uint32_t clearStencil)
+		{
+			passes.back().stencil = attachment;
+			passes.back().stencilClear = clearStencil;
+			schedule.Write(attachment, true);
+		}
+		
+		//the pass's materials sample attachment
+		void Sample(uint32_t attachment)
+		{
+			attachments[attachment].sampled = true;
+			passes.back().sampled.push_back(attachment);
+			schedule.Read(attachment);
+		}
+		
+		void Compile()
+		{
+			ReleaseTargets();
+			schedule.Compile();
+			
+			//live passes in encode order
+			std::vector<uint32_t> live;
+			for (auto &index : schedule.Order())
+			{
+				if (!schedule.IsCulled(index))
+				{
+					live.push_back(index);
+				}
+			}
+			
+			allocator.Reset();
+			std::vector<uint32_t> allocated;
+			std::vector<Texture::Config*> textureConfigs(attachments.size(), NULL);
+			for (uint32_t i = 0; i < (uint32_t)attachments.size(); ++i)
+			{
+				Attachment& attachment = attachments[i];
+				
+				uint32_t first = UINT32_MAX;
+				uint32_t last = 0;
+				for (uint32_t position = 0; position < (uint32_t)live.size(); ++position)
+				{
+					if (Uses(passes[live[position]], i))
+					{
+						first = std::min(first, position);
+						last = position;
+					}
+				}
+				
+				if ((attachment.textureConfig == NULL) || (first == UINT32_MAX))
+				{
+					continue;
+				}
+				
+				//the texture owns (and deletes) its config, so each compile gets a copy
+				Texture::Config* textureConfig = new Texture::Config(attachment.textureConfig, attachment.textureConfig->name);
+				if (config->memorylessAttachments && schedule.IsMemoryless(i) && MemorylessSupported())
+				{
+					textureConfig->storage = Texture::eStorage_Memoryless;
+					textureConfig->usage = Texture::eUsage_RenderTarget;
+					attachment.texture = new Texture(textureConfig, attachment.samplerState);
+				}
+				else
+				{
+					textureConfig->usage = (Texture::eUsage)(textureConfig->usage | Texture::eUsage_RenderTarget | (attachment.sampled ? Texture::eUsage_ShaderRead : 0));
+					if (config->aliasAttachments)
+					{
+						const MTLSizeAndAlign sizeAndAlign = Texture::HeapSizeAndAlign(textureConfig);
+						allocator.Add(sizeAndAlign.size, sizeAndAlign.align, first, last);
+						allocated.push_back(i);
+						textureConfigs[i] = textureConfig;
+					}
+					else
+					{
+						attachment.texture = new Texture(textureConfig, attachment.samplerState);
+					}
+				}
+			}
+			
+			if (!allocated.empty())
+			{
+				CreateHeap(allocated, textureConfigs);
+				CreateFences(live, allocated);
+			}
+			
+			for (uint32_t i = 0; i < (uint32_t)passes.size(); ++i)
+			{
+				if (!schedule.IsCulled(i))
+				{
+					CreateTarget(i);
+				}
+			}
+			
+			qSPAM("FrameGraph %s culled %u of %u passes", [config->name UTF8String], schedule.CulledCount(), schedule.PassCount());
+			qSPAM("FrameGraph %s aliased %u attachments into %zu bytes, saving %zu bytes", [config->name UTF8String], allocator.ResourceCount(), allocator.IsBuilt() ? allocator.HeapSize() : 0, allocator.IsBuilt() ? allocator.BytesSaved() : 0);
+		}
+		
+		//each surviving pass in its own render encoder, in schedule order
+		void Encode()
+		{
+			qASSERTM(schedule.IsCompiled(), "FrameGraph %s encoded before Compile()", [config->name UTF8String]);
+			
+			for (auto &index : schedule.Order())
+			{
+				if (schedule.IsCulled(index))
+				{
+					continue;
+				}
+				
+				Pass& pass = passes[index];
+				TrackedRenderEncoder encoder(pass.target->Begin());
+				
+				if (pass.waitsOnFrame && encoded)
+				{
+					[encoder.Get() waitForFence:passes[lastHeapPass].fence beforeStages:MTLRenderStageVertex];
+				}
+				for (auto &wait : pass.waits)
+				{
+					[encoder.Get() waitForFence:passes[wait].fence beforeStages:MTLRenderStageVertex];
+				}
+				
+				pass.function(encoder, pass.context);
+				
+				if (pass.fence != nil)
+				{
+					[encoder.Get() updateFence:pass.fence afterStages:MTLRenderStageFragment];
+				}
+				
+				pass.target->End();
+			}
+			
+			encoded = true;
+		}
+		
+		//the attachment's texture, for sampling from materials; NULL for a graph attachment no surviving pass uses
+		Texture* AttachmentTexture(uint32_t attachment) const
+		{
+			return attachments[attachment].texture;
+		}
+		
+		//the surviving pass's render target, NULL if it was culled
+		RenderTarget* PassTarget(uint32_t pass) const
+		{
+			return passes[pass].target;
+		}
+		
+		uint32_t PassCount() const 							{ return (uint32_t)passes.size(); }
+		const FrameSchedule& Schedule() const 				{ return schedule; }
+		const TransientAllocator& Allocator() const 		{ return allocator; }
+		
+		Config* GetConfig() const
+		{
+			return config;
+		}
+		
+		//memoryless textures need an Apple GPU
+		static bool MemorylessSupported()
+		{
+			static const bool supported = []() -> bool
+			{
+				if (@available(iOS 13.0, macOS 10.15, *))
+				{
+					return [Device::Get() supportsFamily:MTLGPUFamilyApple1];
+				}
+				return false;
+			}();
+			return supported;
+		}
+		
+	private:
+		typedef struct Attachment
+		{
+			Texture::Config*	textureConfig;	//NULL when imported
+			SamplerState*		samplerState;
+			Texture*			texture;
+			bool				sampled;
+			bool				aliased;		//placed in the heap
+		} Attachment;
+		
+		typedef struct Pass
+		{
+			NSString*				name;
+			PassFunction			function;
+			void*					context;
+			uint32_t				colour[RenderTarget::eColorAttachment_Count];
+			uint32_t				colourResolve[RenderTarget::eColorAttachment_Count];
+			qRGBA32f				clearColour[RenderTarget::eColorAttachment_Count];
+			uint32_t				depth;
+			double					depthClear;
+			uint32_t				stencil;
+			uint32_t				stencilClear;
+			std::vector<uint32_t>	sampled;
+			RenderTarget::Config*	targetConfig;
+			RenderTarget*			target;
+			id<MTLFence>			fence;			//updated once the pass is done with its heap attachments
+			std::vector<uint32_t>	waits;			//passes whose fences this one waits on
+			bool					waitsOnFrame;	//and the previous frame's last heap pass
+		} Pass;
+		
+		static RenderTarget::eClearAction ClearAction(FrameSchedule::eLoad load)
+		{
+			switch (load)
+			{
+				case FrameSchedule::eLoad_Clear:	return RenderTarget::eClearAction_Clear;
+				case FrameSchedule::eLoad_Load:		return RenderTarget::eClearAction_Load;
+				default:							return RenderTarget::eClearAction_Nothing;
+			}
+		}
+		
+		static RenderTarget::eStoreAction StoreAction(FrameSchedule::eStore store)
+		{
+			switch (store)
+			{
+				case FrameSchedule::eStore_Store:			return RenderTarget::eStoreAction_Store;
+				case FrameSchedule::eStore_Resolve:			return RenderTarget::eStoreAction_Resolve;
+				case FrameSchedule::eStore_StoreAndResolve:	return RenderTarget::eStoreAction_StoreAndResolve;
+				default:									return RenderTarget::eStoreAction_Nothing;
+			}
+		}
+		
+		bool Uses(const Pass& pass, uint32_t attachment) const
+		{
+			for (int i = 0; i < RenderTarget::eColorAttachment_Count; ++i)
+			{
+				if ((pass.colour[i] == attachment) || (pass.colourResolve[i] == attachment))
+				{
+					return true;
+				}
+			}
+			return (pass.depth == attachment) || (pass.stencil == attachment) || (std::find(pass.sampled.begin(), pass.sampled.end(), attachment) != pass.sampled.end());
+		}
+		
+		void CreateHeap(const std::vector<uint32_t>& allocated, const std::vector<Texture::Config*>& textureConfigs)
+		{
+			allocator.Build();
+			
+			MTLHeapDescriptor* heapDescriptor = [MTLHeapDescriptor new];
+			heapDescriptor.type = MTLHeapTypePlacement;
+			heapDescriptor.storageMode = MTLStorageModePrivate;
+			heapDescriptor.hazardTrackingMode = MTLHazardTrackingModeUntracked;
+			heapDescriptor.size = allocator.HeapSize();
+			heap = [Device::Get() newHeapWithDescriptor:heapDescriptor];
+			heap.label = config->name;
+			[heapDescriptor release];
+			
+			for (uint32_t i = 0; i < (uint32_t)allocated.size(); ++i)
+			{
+				Attachment& attachment = attachments[allocated[i]];
+				attachment.texture = new Texture(textureConfigs[allocated[i]], attachment.samplerState, heap, allocator.Offset(i));
+				attachment.aliased = true;
+			}
+		}
+		
+		//each live pass touching the heap waits on the last pass before it to use each of its heap attachments, and on
+		//the last passes of whatever attachments it reuses the bytes of. passes with nothing to wait on in the frame
+		//wait on the previous frame's last heap pass instead, which in turn waits on every heap pass nothing else did
+		void CreateFences(const std::vector<uint32_t>& live, const std::vector<uint32_t>& allocated)
+		{
+			std::vector<uint32_t> lastUse(attachments.size(), UINT32_MAX);
+			std::vector<bool> waitedOn(passes.size(), false);
+			
+			for (auto &index : live)
+			{
+				Pass& pass = passes[index];
+				bool usesHeap = false;
+				for (uint32_t i = 0; i < (uint32_t)allocated.size(); ++i)
+				{
+					const uint32_t attachment = allocated[i];
+					if (!Uses(pass, attachment))
+					{
+						continue;
+					}
+					
+					if (lastUse[attachment] != UINT32_MAX)
+					{
+						AddWait(pass, lastUse[attachment], index);
+					}
+					else
+					{
+						for (auto &alias : allocator.Aliases(i))
+						{
+							AddWait(pass, lastUse[allocated[alias]], index);
+						}
+					}
+					lastUse[attachment] = index;
+					usesHeap = true;
+				}
+				
+				if (usesHeap)
+				{
+					pass.fence = [Device::Get() newFence];
+					pass.fence.label = pass.name;
+					pass.waitsOnFrame = pass.waits.empty();
+					for (auto &wait : pass.waits)
+					{
+						waitedOn[wait] = true;
+					}
+					lastHeapPass = index;
+				}
+			}
+			
+			for (auto &index : live)
+			{
+				if ((passes[index].fence != nil) && !waitedOn[index] && (index != lastHeapPass))
+				{
+					AddWait(passes[lastHeapPass], index, lastHeapPass);
+				}
+			}
+		}
+		
+		static void AddWait(Pass& pass, uint32_t wait, uint32_t index)
+		{
+			if ((wait != index) && (std::find(pass.waits.begin(), pass.waits.end(), wait) == pass.waits.end()))
+			{
+				pass.waits.push_back(wait);
+			}
+		}
+		
+		void CreateTarget(uint32_t index)
+		{
+			Pass& pass = passes[index];
+			RenderTarget::Config* targetConfig = new RenderTarget::Config(pass.name);
+			
+			int colourCount = 0;
+			while ((colourCount < RenderTarget::eColorAttachment_Count) && (pass.colour[colourCount] != FrameSchedule::NoAttachment))
+			{
+				const uint32_t attachment = pass.colour[colourCount];
+				targetConfig->colourTexture[colourCount] = attachments[attachment].texture;
+				targetConfig->clearColour[colourCount] = pass.clearColour[colourCount];
+				targetConfig->clearAction[colourCount] = ClearAction(schedule.LoadAction(index, attachment));
+				targetConfig->storeAction[colourCount] = StoreAction(schedule.StoreAction(index, attachment));
+				if (pass.colourResolve[colourCount] != FrameSchedule::NoAttachment)
+				{
+					targetConfig->colourResolveTexture[colourCount] = attachments[pass.colourResolve[colourCount]].texture;
+				}
+				++colourCount;
+			}
+			for (int i = colourCount; i < RenderTarget::eColorAttachment_Count; ++i)
+			{
+				qASSERTM(pass.colour[i] == FrameSchedule::NoAttachment, "FrameGraph pass %s colour slots must be contiguous", [pass.name UTF8String]);
+			}
+			targetConfig->colorAttachmentCount = (RenderTarget::eColorAttachment)colourCount;
+			
+			if (pass.depth != FrameSchedule::NoAttachment)
+			{
+				targetConfig->depthTexture = attachments[pass.depth].texture;
+				targetConfig->depthClear = pass.depthClear;
+				targetConfig->depthClearAction = ClearAction(schedule.LoadAction(index, pass.depth));
+				targetConfig->depthStoreAction = StoreAction(schedule.StoreAction(index, pass.depth));
+			}
+			
+			if (pass.stencil != FrameSchedule::NoAttachment)
+			{
+				targetConfig->stencilTexture = attachments[pass.stencil].texture;
+				targetConfig->stencilClear = pass.stencilClear;
+				targetConfig->stencilClearAction = ClearAction(schedule.LoadAction(index, pass.stencil));
+				targetConfig->stencilStoreAction = StoreAction(schedule.StoreAction(index, pass.stencil));
+			}
+			
+			pass.targetConfig = targetConfig;
+			pass.target = new RenderTarget(targetConfig);
+		}
+		
+		void ReleaseTargets()
+		{
+			for (auto &pass : passes)
+			{
+				delete pass.target;
+				delete pass.targetConfig;
+				[pass.fence release];
+				pass.target = NULL;
+				pass.targetConfig = NULL;
+				pass.fence = nil;
+				pass.waits.clear();
+				pass.waitsOnFrame = false;
+			}
+			
+			for (auto &attachment : attachments)
+			{
+				if (attachment.textureConfig != NULL)
+				{
+					delete attachment.texture;
+					attachment.texture = NULL;
+					attachment.aliased = false;
+				}
+			}
+			
+			[heap release];
+			heap = nil;
+			lastHeapPass = UINT32_MAX;
+			encoded = false;
+		}
+		
+		Config*					config;
+		std::vector<Attachment>	attachments;
+		std::vector<Pass>		passes;
+		FrameSchedule			schedule;
+		TransientAllocator		allocator;
+		id<MTLHeap>				heap;
+		uint32_t				lastHeapPass;
+		bool					encoded;
+	};
+}
+
+#endif //__Q_METAL_FRAME_GRAPH_H__
@@ -0,0 +1,495 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_FRAME_SCHEDULE_H__
+#define __Q_METAL_FRAME_SCHEDULE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <queue>
+#include <vector>
+#include "qCore.h"
+
+namespace qMetal
+{
+	//compilation for a frame graph of render passes. attachments are indices; each pass declares the ones it renders
+	//into (cleared or loaded), resolves into and samples. Compile() orders the passes (submission order unless a pass
+	//samples a transient attachment whose writer was added later), culls the ones nothing consumes, then picks each
+	//attachment's load and store action from what comes before and after it, and flags the transient attachments that
+	//never leave a pass as memoryless candidates
+	class FrameSchedule
+	{
+	public:
+		static constexpr uint32_t NoAttachment = UINT32_MAX;
+		
+		enum eLoad
+		{
+			eLoad_DontCare,
+			eLoad_Load,
+			eLoad_Clear,
+		};
+		
+		enum eStore
+		{
+			eStore_DontCare,
+			eStore_Store,
+			eStore_Resolve,
+			eStore_StoreAndResolve,
+		};
+		
+		FrameSchedule()
+		: compiled(false)
+		{ }
+		
+		//imported attachments have contents from before the frame, output ones are needed after it
+		uint32_t AddAttachment(bool imported = false, bool output = false)
+		{
+			compiled = false;
+			Attachment attachment;
+			attachment.imported = imported;
+			attachment.output = output;
+			attachment.memoryless = false;
+			attachments.push_back(attachment);
+			return (uint32_t)attachments.size() - 1;
+		}
+		
+		//a pass with side effects (say, it also writes buffers) is never culled
+		uint32_t AddPass(bool sideEffects = false)
+		{
+			compiled = false;
+			Pass pass;
+			pass.declarationBegin = (uint32_t)declarations.size();
+			pass.sideEffects = sideEffects;
+			pass.culled = false;
+			passes.push_back(pass);
+			return (uint32_t)passes.size() - 1;
+		}
+		
+		//the most recently added pass renders into attachment; without a clear it loads what was there. declaring the
+		//same attachment twice (depth and stencil from one texture) only clears if both do
+		void Write(uint32_t attachment, bool clear)
+		{
+			Declaration& declaration = Declare(attachment);
+			declaration.clear = (declaration.flags & eFlag_Write) ? (declaration.clear && clear) : clear;
+			declaration.flags |= eFlag_Write;
+		}
+		
+		//attachment, already written by this pass, resolves into resolveAttachment
+		void Resolve(uint32_t attachment, uint32_t resolveAttachment)
+		{
+			Declaration& declaration = Declare(attachment);
+			qASSERTM(declaration.flags & eFlag_Write, "FrameSchedule resolve from attachment %u that the pass doesn't write", attachment);
+			declaration.resolve = resolveAttachment;
+			Declare(resolveAttachment).flags |= eFlag_ResolveTarget;
+		}
+		
+		//the most recently added pass samples attachment
+		void Read(uint32_t attachment)
+		{
+			Declare(attachment).flags |= eFlag_Read;
+		}
+		
+		void Compile()
+		{
+			const uint32_t passCount = PassCount();
+			
+			for (auto &declaration : declarations)
+			{
+				qASSERTM(!((declaration.flags & eFlag_Read) && (declaration.flags & (eFlag_Write | eFlag_ResolveTarget))), "FrameSchedule attachment %u is both sampled and written by one pass", declaration.attachment);
+				declaration.load = eLoad_DontCare;
+				declaration.store = eStore_DontCare;
+			}
+			
+			BuildOrder();
+			
+			//culling and store actions, back to front: needed means a later pass (or the frame's output) wants the
+			//attachment's current contents
+			std::vector<bool> needed(attachments.size());
+			for (uint32_t i = 0; i < (uint32_t)attachments.size(); ++i)
+			{
+				needed[i] = attachments[i].output;
+			}
+			
+			for (uint32_t i = passCount; i > 0; --i)
+			{
+				Pass& pass = passes[order[i - 1]];
+				
+				bool live = pass.sideEffects;
+				for (uint32_t d = DeclarationBegin(pass); d < DeclarationEnd(pass); ++d)
+				{
+					const Declaration& declaration = declarations[d];
+					live = live || ((declaration.flags & (eFlag_Write | eFlag_ResolveTarget)) && needed[declaration.attachment]);
+				}
+				pass.culled = !live;
+				
+				if (!live)
+				{
+					continue;
+				}
+				
+				for (uint32_t d = DeclarationBegin(pass); d < DeclarationEnd(pass); ++d)
+				{
+					Declaration& declaration = declarations[d];
+					if (declaration.flags & eFlag_Write)
+					{
+						const bool resolved = (declaration.resolve != NoAttachment) && needed[declaration.resolve];
+						declaration.store = needed[declaration.attachment] ? (resolved ? eStore_StoreAndResolve : eStore_Store) : (resolved ? eStore_Resolve : eStore_DontCare);
+					}
+				}
+				
+				//whatever this pass writes is overwritten, then the loads and samples want what came before
+				for (uint32_t d = DeclarationBegin(pass); d < DeclarationEnd(pass); ++d)
+				{
+					const Declaration& declaration = declarations[d];
+					if (declaration.flags & (eFlag_Write | eFlag_ResolveTarget))
+					{
+						needed[declaration.attachment] = false;
+					}
+				}
+				
+				for (uint32_t d = DeclarationBegin(pass); d < DeclarationEnd(pass); ++d)
+				{
+					const Declaration& declaration = declarations[d];
+					if ((declaration.flags & eFlag_Read) || ((declaration.flags & eFlag_Write) && !declaration.clear))
+					{
+						needed[declaration.attachment] = true;
+					}
+				}
+			}
+			
+			//load actions front to back, over the passes that survived
+			std::vector<bool> defined(attachments.size());
+			for (uint32_t i = 0; i < (uint32_t)attachments.size(); ++i)
+			{
+				defined[i] = attachments[i].imported;
+			}
+			
+			for (auto &index : order)
+			{
+				const Pass& pass = passes[index];
+				if (pass.culled)
+				{
+					continue;
+				}
+				
+				for (uint32_t d = DeclarationBegin(pass); d < DeclarationEnd(pass); ++d)
+				{
+					Declaration& declaration = declarations[d];
+					if (declaration.flags & eFlag_Write)
+					{
+						declaration.load = declaration.clear ? eLoad_Clear : (defined[declaration.attachment] ? eLoad_Load : eLoad_DontCare);
+						qWARNING(declaration.clear || defined[declaration.attachment], "FrameSchedule attachment %u is loaded before anything writes it", declaration.attachment);
+					}
+				}
+				
+				for (uint32_t d = DeclarationBegin(pass); d < DeclarationEnd(pass); ++d)
+				{
+					const Declaration& declaration = declarations[d];
+					if (declaration.flags & (eFlag_Write | eFlag_ResolveTarget))
+					{
+						defined[declaration.attachment] = true;
+					}
+				}
+			}
+			
+			//memoryless: transient, and every surviving pass that touches it starts and ends with it on-tile
+			std::vector<uint32_t> useCount(attachments.size(), 0);
+			for (uint32_t i = 0; i < (uint32_t)attachments.size(); ++i)
+			{
+				attachments[i].memoryless = !attachments[i].imported && !attachments[i].output;
+			}
+			
+			for (auto &pass : passes)
+			{
+				if (pass.culled)
+				{
+					continue;
+				}
+				
+				for (uint32_t d = DeclarationBegin(pass); d < DeclarationEnd(pass); ++d)
+				{
+					const Declaration& declaration = declarations[d];
+					const bool onTile = (declaration.flags == eFlag_Write) && (declaration.load != eLoad_Load) && ((declaration.store == eStore_DontCare) || (declaration.store == eStore_Resolve));
+					attachments[declaration.attachment].memoryless = attachments[declaration.attachment].memoryless && onTile;
+					++useCount[declaration.attachment];
+				}
+			}
+			
+			for (uint32_t i = 0; i < (uint32_t)attachments.size(); ++i)
+			{
+				attachments[i].memoryless = attachments[i].memoryless && (useCount[i] > 0);
+			}
+			
+			compiled = true;
+		}
+		
+		void Reset()
+		{
+			attachments.clear();
+			passes.clear();
+			declarations.clear();
+			order.clear();
+			compiled = false;
+		}
+		
+		uint32_t AttachmentCount() const 	{ return (uint32_t)attachments.size(); }
+		uint32_t PassCount() const 			{ return (uint32_t)passes.size(); }
+		bool IsCompiled() const 			{ return compiled; }
+		
+		bool IsCulled(uint32_t pass) const
+		{
+			qASSERT(compiled);
+			return passes[pass].culled;
+		}
+		
+		uint32_t CulledCount() const
+		{
+			qASSERT(compiled);
+			uint32_t count = 0;
+			for (auto &pass : passes)
+			{
+				count += pass.culled ? 1 : 0;
+			}
+			return count;
+		}
+		
+		//every pass index in encode order, culled ones included; skip those with IsCulled()
+		const std::vector<uint32_t>& Order() const
+		{
+			qASSERT(compiled);
+			return order;
+		}
+		
+		//for an attachment the pass renders into
+		eLoad LoadAction(uint32_t pass, uint32_t attachment) const
+		{
+			return Find(pass, attachment).load;
+		}
+		
+		eStore StoreAction(uint32_t pass, uint32_t attachment) const
+		{
+			return Find(pass, attachment).store;
+		}
+		
+		bool IsMemoryless(uint32_t attachment) const
+		{
+			qASSERT(compiled);
+			return attachments[attachment].memoryless;
+		}
+		
+	private:
+		enum eFlag
+		{
+			eFlag_Write				= 1 << 0,
+			eFlag_ResolveTarget		= 1 << 1,
+			eFlag_Read				= 1 << 2,
+		};
+		
+		typedef struct Attachment
+		{
+			bool	imported;
+			bool	output;
+			bool	memoryless;
+		} Attachment;
+		
+		typedef struct Pass
+		{
+			uint32_t	declarationBegin;
+			bool		sideEffects;
+			bool		culled;
+		} Pass;
+		
+		typedef struct Declaration
+		{
+			uint32_t	attachment;
+			uint32_t	flags;
+			bool		clear;
+			uint32_t	resolve;
+			eLoad		load;
+			eStore		store;
+		} Declaration;
+		
+		Declaration& Declare(uint32_t attachment)
+		{
+			qASSERTM(!passes.empty(), "FrameSchedule attachment declared before any pass");
+			qASSERTM(attachment < AttachmentCount(), "FrameSchedule attachment %u out of range", attachment);
+			compiled = false;
+			
+			for (uint32_t i = passes.back().declarationBegin; i < (uint32_t)declarations.size(); ++i)
+			{
+				if (declarations[i].attachment == attachment)
+				{
+					return declarations[i];
+				}
+			}
+			
+			Declaration declaration;
+			declaration.attachment = attachment;
+			declaration.flags = 0;
+			declaration.clear = false;
+			declaration.resolve = NoAttachment;
+			declaration.load = eLoad_DontCare;
+			declaration.store = eStore_DontCare;
+			declarations.push_back(declaration);
+			return declarations.back();
+		}
+		
+		const Declaration& Find(uint32_t pass, uint32_t attachment) const
+		{
+			qASSERT(compiled);
+			for (uint32_t d = DeclarationBegin(passes[pass]); d < DeclarationEnd(passes[pass]); ++d)
+			{
+				if (declarations[d].attachment == attachment)
+				{
+					return declarations[d];
+				}
+			}
+			qBREAK("FrameSchedule pass %u doesn't use attachment %u", pass, attachment);
+			return declarations[0];
+		}
+		
+		uint32_t DeclarationBegin(const Pass& pass) const
+		{
+			return pass.declarationBegin;
+		}
+		
+		uint32_t DeclarationEnd(const Pass& pass) const
+		{
+			return (&pass != &passes.back()) ? (&pass + 1)->declarationBegin : (uint32_t)declarations.size();
+		}
+		
+		//writers of an attachment keep their submission order, and a sample reads the latest writer added before it
+		//(then comes before the next). a transient attachment sampled before anything writes it reads its last writer
+		//instead, so a pass can be added ahead of the ones feeding it. ties go to submission order
+		void BuildOrder()
+		{
+			const uint32_t passCount = PassCount();
+			std::vector<std::vector<uint32_t> > writers(attachments.size());
+			std::vector<std::vector<uint32_t> > edges(passCount);
+			std::vector<uint32_t> incoming(passCount, 0);
+			
+			for (uint32_t pass = 0; pass < passCount; ++pass)
+			{
+				for (uint32_t d = DeclarationBegin(passes[pass]); d < DeclarationEnd(passes[pass]); ++d)
+				{
+					if (declarations[d].flags & (eFlag_Write | eFlag_ResolveTarget))
+					{
+						writers[declarations[d].attachment].push_back(pass);
+					}
+				}
+			}
+			
+			for (uint32_t pass = 0; pass < passCount; ++pass)
+			{
+				for (uint32_t d = DeclarationBegin(passes[pass]); d < DeclarationEnd(passes[pass]); ++d)
+				{
+					const Declaration& declaration = declarations[d];
+					const std::vector<uint32_t>& attachmentWriters = writers[declaration.attachment];
+					
+					//first writer at or after this pass
+					uint32_t next = 0;
+					while ((next < (uint32_t)attachmentWriters.size()) && (attachmentWriters[next] < pass))
+					{
+						++next;
+					}
+					
+					if (declaration.flags & (eFlag_Write | eFlag_ResolveTarget))
+					{
+						if (next > 0)
+						{
+							AddEdge(edges, incoming, attachmentWriters[next - 1], pass);
+						}
+					}
+					else if (next > 0)
+					{
+						AddEdge(edges, incoming, attachmentWriters[next - 1], pass);
+						if (next < (uint32_t)attachmentWriters.size())
+						{
+							AddEdge(edges, incoming, pass, attachmentWriters[next]);
+						}
+					}
+					else if (attachments[declaration.attachment].imported)
+					{
+						if (!attachmentWriters.empty())
+						{
+							AddEdge(edges, incoming, pass, attachmentWriters.front());
+						}
+					}
+					else
+					{
+						qASSERTM(!attachmentWriters.empty(), "FrameSchedule attachment %u is sampled but nothing writes it", declaration.attachment);
+						if (!attachmentWriters.empty())
+						{
+							AddEdge(edges, incoming, attachmentWriters.back(), pass);
+						}
+					}
+				}
+			}
+			
+			std::priority_queue<uint32_t, std::vector<uint32_t>, std::greater<uint32_t> > ready;
+			for (uint32_t pass = 0; pass < passCount; ++pass)
+			{
+				if (incoming[pass] == 0)
+				{
+					ready.push(pass);
+				}
+			}
+			
+			order.clear();
+			while (!ready.empty())
+			{
+				const uint32_t pass = ready.top();
+				ready.pop();
+				order.push_back(pass);
+				
+				for (auto &consumer : edges[pass])
+				{
+					if (--incoming[consumer] == 0)
+					{
+						ready.push(consumer);
+					}
+				}
+			}
+			
+			qASSERTM(order.size() == passCount, "FrameSchedule passes have a dependency cycle");
+		}
+		
+		static void AddEdge(std::vector<std::vector<uint32_t> >& edges, std::vector<uint32_t>& incoming, uint32_t producer, uint32_t consumer)
+		{
+			if (producer == consumer)
+			{
+				return;
+			}
+			edges[producer].push_back(consumer);
+			++incoming[consumer];
+		}
+		
+		std::vector<Attachment>		attachments;
+		std::vector<Pass>			passes;
+		std::vector<Declaration>	declarations;
+		std::vector<uint32_t>		order;
+		bool compiled;
+	};
+}
+
+#endif //__Q_METAL_FRAME_SCHEDULE_H__
@@ -25,6 +25,8 @@ SOFTWARE.
 
 
 #include <Metal/Metal.h>
+#include "qMetalFunctionConstants.h"
+#include "qMetalPipelineCache.h"
 
 namespace qMetal
 {    
@@ -33,17 +35,46 @@ namespace qMetal
     public:
       
         Function(NSString* name, MTLFunctionConstantValues* functionConstantValues = nil);
+        Function(NSString* name, const FunctionConstants& constants);
+		
+		//shared specialisations, keyed by name and the hash of their constant values; built on first use
+		static const Function* Variant(NSString* name, const FunctionConstants& constants);
+		
+		//builds every permutation of name up front across GCD's worker threads, so later Variant() calls are lookups
+		static void BuildVariants(NSString* name, const FunctionPermutationSpace& space);
+		
+		static const PipelineCache<const Function*>& VariantCache();
       
         id <MTLFunction> Get() const
         {
           return function;
         }
+		
+		//stable across runs for plain functions and FunctionConstants specialisations; ones given raw
+		//MTLFunctionConstantValues also mix in the function object itself, as those can't be read back
+		uint64_t Hash() const
+		{
+			return hash;
+		}
+		
+		//only stable hashes are worth recording in a pipeline archive
+		bool HasStableHash() const
+		{
+			return stableHash;
+		}
       
     private:
+		
+		static uint64_t VariantHash(NSString* name, const FunctionConstants& constants);
+		static id <MTLLibrary> DefaultLibrary();
+		void Create(NSString* name, MTLFunctionConstantValues* functionConstantValues);
       
         static id <MTLLibrary> sDefaultLibrary;
+		static PipelineCache<const Function*> sVariantCache;
       
         id <MTLFunction> function;
+		uint64_t hash;
+		bool stableHash;
     };
 }
 
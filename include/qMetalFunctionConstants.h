@@ -0,0 +1,213 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_FUNCTION_CONSTANTS_H__
+#define __Q_METAL_FUNCTION_CONSTANTS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <map>
+#include <vector>
+#include "qMetalPipelineCache.h"
+#include "qCore.h"
+
+namespace qMetal
+{
+	//function constant values that, unlike MTLFunctionConstantValues, can be read back and hashed. values are kept
+	//sorted by index, so the hash doesn't depend on the order they were set in
+	class FunctionConstants
+	{
+	public:
+		enum eType
+		{
+			eType_Bool,
+			eType_Int,
+			eType_UInt,
+			eType_Float,
+		};
+		
+		typedef struct Value
+		{
+			eType type;
+			uint32_t bits; //bools are 0 or 1, floats are their bit pattern
+		} Value;
+		
+		typedef std::map<uint32_t, Value> ValueMap;
+		
+		FunctionConstants& SetBool(uint32_t index, bool value)
+		{
+			return Set(index, eType_Bool, value ? 1 : 0);
+		}
+		
+		FunctionConstants& SetInt(uint32_t index, int32_t value)
+		{
+			return Set(index, eType_Int, (uint32_t)value);
+		}
+		
+		FunctionConstants& SetUInt(uint32_t index, uint32_t value)
+		{
+			return Set(index, eType_UInt, value);
+		}
+		
+		FunctionConstants& SetFloat(uint32_t index, float value)
+		{
+			if (value == 0.0f)
+			{
+				value = 0.0f; //-0 and 0 specialise identically
+			}
+			uint32_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			return Set(index, eType_Float, bits);
+		}
+		
+		FunctionConstants& Set(uint32_t index, eType type, uint32_t bits)
+		{
+			Value& v = values[index];
+			v.type = type;
+			v.bits = bits;
+			return *this;
+		}
+		
+		const ValueMap& Values() const
+		{
+			return values;
+		}
+		
+		bool IsEmpty() const
+		{
+			return values.empty();
+		}
+		
+		uint64_t Hash() const
+		{
+			PipelineHash hash;
+			hash.Add((uint64_t)values.size());
+			for (ValueMap::const_iterator it = values.begin(); it != values.end(); ++it)
+			{
+				hash.Add(it->first).Add((uint32_t)it->second.type).Add(it->second.bits);
+			}
+			return hash.Value();
+		}
+		
+	private:
+		ValueMap values;
+	};
+	
+	//the cartesian product of a set of constant dimensions on top of some fixed base values, e.g. every combination
+	//of an uber-shader's feature flags. permutations are numbered [0, Count()) with the first dimension varying fastest
+	class FunctionPermutationSpace
+	{
+	public:
+		FunctionPermutationSpace(const FunctionConstants& _base = FunctionConstants())
+		: base(_base)
+		{ }
+		
+		FunctionPermutationSpace& AddBool(uint32_t index)
+		{
+			Dimension& dimension = AddDimension(index, FunctionConstants::eType_Bool);
+			dimension.bits.push_back(0);
+			dimension.bits.push_back(1);
+			return *this;
+		}
+		
+		FunctionPermutationSpace& AddInts(uint32_t index, const std::vector<int32_t>& options)
+		{
+			Dimension& dimension = AddDimension(index, FunctionConstants::eType_Int);
+			for (size_t i = 0; i < options.size(); ++i)
+			{
+				dimension.bits.push_back((uint32_t)options[i]);
+			}
+			return *this;
+		}
+		
+		FunctionPermutationSpace& AddUInts(uint32_t index, const std::vector<uint32_t>& options)
+		{
+			Dimension& dimension = AddDimension(index, FunctionConstants::eType_UInt);
+			dimension.bits = options;
+			return *this;
+		}
+		
+		FunctionPermutationSpace& AddFloats(uint32_t index, const std::vector<float>& options)
+		{
+			Dimension& dimension = AddDimension(index, FunctionConstants::eType_Float);
+			for (size_t i = 0; i < options.size(); ++i)
+			{
+				FunctionConstants single;
+				single.SetFloat(index, options[i]);
+				dimension.bits.push_back(single.Values().begin()->second.bits);
+			}
+			return *this;
+		}
+		
+		size_t Count() const
+		{
+			size_t count = 1;
+			for (size_t i = 0; i < dimensions.size(); ++i)
+			{
+				count *= dimensions[i].bits.size();
+			}
+			return count;
+		}
+		
+		FunctionConstants Permutation(size_t permutation) const
+		{
+			qASSERTM(permutation < Count(), "FunctionPermutationSpace permutation %zu is out of range (%zu)", permutation, Count());
+			
+			FunctionConstants constants(base);
+			for (size_t i = 0; i < dimensions.size(); ++i)
+			{
+				const Dimension& dimension = dimensions[i];
+				const size_t optionCount = dimension.bits.size();
+				constants.Set(dimension.index, dimension.type, dimension.bits[permutation % optionCount]);
+				permutation /= optionCount;
+			}
+			return constants;
+		}
+		
+	private:
+		typedef struct Dimension
+		{
+			uint32_t index;
+			FunctionConstants::eType type;
+			std::vector<uint32_t> bits;
+		} Dimension;
+		
+		Dimension& AddDimension(uint32_t index, FunctionConstants::eType type)
+		{
+			for (size_t i = 0; i < dimensions.size(); ++i)
+			{
+				qASSERTM(dimensions[i].index != index, "FunctionPermutationSpace constant %u is declared twice", index);
+			}
+			
+			dimensions.push_back(Dimension());
+			dimensions.back().index = index;
+			dimensions.back().type = type;
+			return dimensions.back();
+		}
+		
+		FunctionConstants base;
+		std::vector<Dimension> dimensions;
+	};
+}
+
+#endif //__Q_METAL_FUNCTION_CONSTANTS_H__
@@ -0,0 +1,137 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_INDIRECT_DISPATCH_H__
+#define __Q_METAL_INDIRECT_DISPATCH_H__
+
+#include <Metal/Metal.h>
+#include <stddef.h>
+#include "qCore.h"
+#include "qMetalDevice.h"
+#include "qMetalTrackedEncoder.h"
+
+namespace qMetal
+{
+	//matches qMetalIndirectDispatchArguments in Shaders/qMetalIndirectDispatchShader.h
+	typedef struct IndirectDispatchArguments
+	{
+		uint32_t threadgroupsPerGrid[3];
+		uint32_t threadCount;
+		uint32_t pendingCount;
+		uint32_t threadsPerThreadgroup;
+		uint32_t reserved[2];
+	} IndirectDispatchArguments;
+	
+	static_assert(sizeof(IndirectDispatchArguments) == 32, "IndirectDispatchArguments size mismatch");
+	static_assert(offsetof(IndirectDispatchArguments, threadgroupsPerGrid) == 0, "the dispatch arguments have to lead");
+	
+	//a GPU-written 1D dispatch size, for chaining compute materials without a CPU round trip: a producer (compaction,
+	//culling) appends to it or sets it, Resolve() turns appends into threadgroup counts, and a consumer material is
+	//dispatched from it with Material::EncodeComputeIndirect. everything stays on the GPU, in encode order
+	class IndirectDispatch
+	{
+	public:
+		typedef struct Config
+		{
+			NSString*	name;
+			uint32_t	threadsPerThreadgroup;	//what the consumer is dispatched with; its kernel should expect it
+			
+			Config(NSString* _name)
+			: name([_name retain])
+			, threadsPerThreadgroup(64)
+			{ }
+			
+			Config(Config* config, NSString* _name)
+			: name([_name retain])
+			, threadsPerThreadgroup(config->threadsPerThreadgroup)
+			{ }
+		} Config;
+		
+		IndirectDispatch(Config* _config)
+		: config(_config)
+		{
+			qASSERTM(config->threadsPerThreadgroup > 0, "IndirectDispatch %s needs a threadgroup size", [config->name UTF8String]);
+			
+			IndirectDispatchArguments arguments;
+			memset(&arguments, 0, sizeof(arguments));
+			arguments.threadsPerThreadgroup = config->threadsPerThreadgroup;
+			
+			buffer = [Device::Get() newBufferWithBytes:&arguments length:sizeof(arguments) options:0];
+			buffer.label = [NSString stringWithFormat:@"%@ indirect dispatch", config->name];
+		}
+		
+		~IndirectDispatch()
+		{
+			[buffer release];
+		}
+		
+		//for the producer (and a consumer that wants the count) to read or append at index
+		void Bind(TrackedComputeEncoder& encoder, NSUInteger index) const
+		{
+			encoder.SetBuffer(buffer, 0, index);
+		}
+		
+		void Bind(id<MTLComputeCommandEncoder> encoder, NSUInteger index) const
+		{
+			TrackedComputeEncoder untracked(encoder, false);
+			Bind(untracked, index);
+		}
+		
+		//after a producer that appended, before the consumer. producers that set the size don't need it
+		void Resolve(TrackedComputeEncoder& encoder) const
+		{
+			Device::ResolveIndirectDispatch(encoder, buffer, 0);
+		}
+		
+		void Resolve(id<MTLComputeCommandEncoder> encoder) const
+		{
+			TrackedComputeEncoder untracked(encoder, false);
+			Resolve(untracked);
+		}
+		
+		id<MTLBuffer> Buffer() const
+		{
+			return buffer;
+		}
+		
+		NSUInteger ArgumentsOffset() const
+		{
+			return offsetof(IndirectDispatchArguments, threadgroupsPerGrid);
+		}
+		
+		MTLSize ThreadsPerThreadgroup() const
+		{
+			return MTLSizeMake(config->threadsPerThreadgroup, 1, 1);
+		}
+		
+		const Config* GetConfig() const
+		{
+			return config;
+		}
+		
+	private:
+		Config*			config;
+		id<MTLBuffer>	buffer;
+	};
+}
+
+#endif //__Q_METAL_INDIRECT_DISPATCH_H__
@@ -28,6 +28,8 @@ SOFTWARE.
 #include "qMetalDevice.h"
 #include "qMetalMesh.h"
 #include "qMetalMaterial.h"
+#include "qMetalPipelineBatch.h"
+#include <atomic>
 #include <vector>
 
 namespace qMetal
@@ -71,6 +73,8 @@ namespace qMetal
 			int32_t indirectTessellationFactorBufferIndex;	//where the tessellation factor buffer lives
 			int32_t indirectTessellationFactorCountIndex;	//where the tessellation factor limit lives
 			
+			PipelineBatch* pipelineBatch;					//if set, the compute pipelines build on worker threads as part of this batch
+			
             Config(NSString* _name)
 			: name([_name retain])
 			, function(NULL)
@@ -95,6 +99,7 @@ namespace qMetal
 			, indirectIndexStreamQuadIndex(EmptyIndex)
 			, indirectTessellationFactorBufferIndex(EmptyIndex)
 			, indirectTessellationFactorCountIndex(EmptyIndex)
+			, pipelineBatch(NULL)
             { }
 			
 			Config(Config* config, NSString* _name)
@@ -123,13 +128,17 @@ namespace qMetal
 			, indirectIndexStreamQuadIndex(config->indirectIndexStreamQuadIndex)
 			, indirectTessellationFactorBufferIndex(config->indirectTessellationFactorBufferIndex)
 			, indirectTessellationFactorCountIndex(config->indirectTessellationFactorCountIndex)
+			, pipelineBatch(config->pipelineBatch)
 			{ }
         } Config;
 		
 		IndirectMesh(Config* _config)
         : config(_config)
+        , computePipelineState(nil)
         , ringClearComputePipelineState(nil)
         , rangeInitComputePipelineState(nil)
+        , pipelineGroup(NULL)
+        , pipelinesReady(false)
 		{
 			qASSERTM(config->meshes.size() > 0, "Mesh config count can can not be zero");
 			qASSERTM(config->meshes.size() < 14, "Mesh config count can can not exceed %i", 29); //32 LIMIT, get based on device
@@ -168,26 +177,37 @@ namespace qMetal
 				vertexInstanceParamsBuffer.label = [NSString stringWithFormat:@"%@ vertex instance params", config->name];
 			}
 			
+			//COMPUTE PIPELINE THREADGROUPS
+			
+			threadsPerGrid = MTLSizeMake(dimension, dimension, 1);
+			
 			// COMPUTE PIPELINE STATE FOR INDIRECT COMMAND BUFFER CONSTRUCTION
 			
-			NSError* error = nil;
-			computePipelineState = [qMetal::Device::Get() newComputePipelineStateWithFunction:config->function->Get()
-									 													error:&error];
-			if (!computePipelineState)
-			{
-				NSLog(@"Failed to created indirect command buffer compute pipeline state, error %@", error);
-			}
+			BuildPipeline(^{
+				NSError* error = nil;
+				computePipelineState = [qMetal::Device::Get() newComputePipelineStateWithFunction:config->function->Get()
+																							error:&error];
+				if (!computePipelineState)
+				{
+					NSLog(@"Failed to created indirect command buffer compute pipeline state, error %@", error);
+				}
+				
+				threadsPerThreadgroup = MTLSizeMake(computePipelineState.threadExecutionWidth, computePipelineState.maxTotalThreadsPerThreadgroup / computePipelineState.threadExecutionWidth, 1);
+			});
 			
 			// COMPUTE PIPELINE STATE FOR CLEARING RING BUFFER
 			
 			if (config->ringClearFunction != nil)
 			{
-				ringClearComputePipelineState = [qMetal::Device::Get() newComputePipelineStateWithFunction:config->ringClearFunction->Get()
-																									 error:&error];
-				if (!ringClearComputePipelineState)
-				{
-					NSLog(@"Failed to created ring alloc compute pipeline state, error %@", error);
-				}
+				BuildPipeline(^{
+					NSError* error = nil;
+					ringClearComputePipelineState = [qMetal::Device::Get() newComputePipelineStateWithFunction:config->ringClearFunction->Get()
+																										 error:&error];
+					if (!ringClearComputePipelineState)
+					{
+						NSLog(@"Failed to created ring alloc compute pipeline state, error %@", error);
+					}
+				});
 			}
 				
 			id <MTLArgumentEncoder> argumentEncoder = [config->function->Get() newArgumentEncoderWithBufferIndex:config->argumentBufferIndex];
@@ -257,15 +277,56 @@ namespace qMetal
 				meshIndex++;
 			}
 			
-			//COMPUTE PIPELINE THREADGROUPS
+			if (pipelineGroup == NULL)
+			{
+				pipelinesReady.store(true, std::memory_order_release);
+			}
+		}
+		
+		~IndirectMesh()
+		{
+			WaitUntilReady();
 			
-			threadsPerGrid = MTLSizeMake(dimension, dimension, 1);
-			threadsPerThreadgroup = MTLSizeMake(computePipelineState.threadExecutionWidth, computePipelineState.maxTotalThreadsPerThreadgroup / computePipelineState.threadExecutionWidth, 1);
+			if (pipelineGroup != NULL)
+			{
+				dispatch_release(pipelineGroup);
+			}
+		}
+		
+		//as with materials, nothing is encoded until the pipelines built through a pipeline batch are ready
+		bool IsReady() const
+		{
+			if (pipelinesReady.load(std::memory_order_acquire))
+			{
+				return true;
+			}
+			
+			if ((pipelineGroup == NULL) || (dispatch_group_wait(pipelineGroup, DISPATCH_TIME_NOW) != 0))
+			{
+				return false;
+			}
+			
+			pipelinesReady.store(true, std::memory_order_release);
+			return true;
+		}
+		
+		void WaitUntilReady() const
+		{
+			if ((pipelineGroup != NULL) && !IsReady())
+			{
+				dispatch_group_wait(pipelineGroup, DISPATCH_TIME_FOREVER);
+				pipelinesReady.store(true, std::memory_order_release);
+			}
 		}
 		
 		template<class _VertexParams, class _FragmentParams, class _ComputeParams, class _InstanceParams>
 		void Encode(id<MTLComputeCommandEncoder> encoder, const Material<_VertexParams, _FragmentParams, _ComputeParams, _InstanceParams> *material)
 		{
+			if (!IsReady())
+			{
+				return;
+			}
+			
 			if (ringClearComputePipelineState != nil)
 			{
 				NSString* debugName = [NSString stringWithFormat:@"%@ Tessellation Ring Clear", config->name];
@@ -292,22 +353,25 @@ namespace qMetal
 			
 			material->EncodeTextures(encoder);
 			
+			//only used to batch residency, every mesh declares the same handful of usages
+			TrackedComputeEncoder residencyEncoder(encoder);
+			
 			[encoder setBuffer:commandBufferArgumentBuffer offset:0 atIndex:config->argumentBufferIndex];
 			
-			[encoder useResource:qMetal::Device::IndirectCommandBuffer(Device::eIndirectCommandBufferPool_Untessellated) usage:MTLResourceUsageWrite];
+			residencyEncoder.UseResource(qMetal::Device::IndirectCommandBuffer(Device::eIndirectCommandBufferPool_Untessellated), MTLResourceUsageWrite);
 			[encoder setBuffer:qMetal::Device::IndirectRangeBuffer(Device::eIndirectCommandBufferPool_Untessellated) offset:0 atIndex:config->executionRangeIndex];
 			[encoder setBuffer:indirectRangeOffsetBuffer offset:0 atIndex:config->executionRangeOffsetIndex];
 			
 			if (config->tessellationFactorsRingBufferIndex != EmptyIndex)
 			{
-				[encoder useResource:qMetal::Device::IndirectCommandBuffer(Device::eIndirectCommandBufferPool_Tessellated) usage:MTLResourceUsageWrite];
+				residencyEncoder.UseResource(qMetal::Device::IndirectCommandBuffer(Device::eIndirectCommandBufferPool_Tessellated), MTLResourceUsageWrite);
 				[encoder setBuffer:qMetal::Device::IndirectRangeBuffer(Device::eIndirectCommandBufferPool_Tessellated) offset:0 atIndex:config->executionTessellationRangeIndex];
 				[encoder setBuffer:indirectTessellationRangeOffsetBuffer offset:0 atIndex:config->executionTessellationRangeOffsetIndex];
 			}
 			
 			if (config->computeParamsIndex != EmptyIndex)
 			{
-				[encoder setBuffer:material->CurrentFrameComputeParamsBuffer() offset:0 atIndex:config->computeParamsIndex];
+				[encoder setBuffer:material->CurrentFrameComputeParamsBuffer() offset:material->CurrentFrameComputeParamsOffset() atIndex:config->computeParamsIndex];
 			}
 			
 			if (config->tessellationFactorsRingBufferIndex != EmptyIndex)
@@ -317,7 +381,7 @@ namespace qMetal
 			
 			if (config->vertexParamsIndex != EmptyIndex)
 			{
-				[encoder setBuffer:material->CurrentFrameVertexParamsBuffer() offset:0 atIndex:config->vertexParamsIndex];
+				[encoder setBuffer:material->CurrentFrameVertexParamsBuffer() offset:material->CurrentFrameVertexParamsOffset() atIndex:config->vertexParamsIndex];
 			}
 			
 			if (config->vertexTextureIndex != EmptyIndex)
@@ -335,7 +399,7 @@ namespace qMetal
 				//we need to check the fragment function as we may be in a shadow pass with a shared material, say
 				if (config->fragmentParamsIndex != EmptyIndex)
 				{
-					[encoder setBuffer:material->CurrentFrameFragmentParamsBuffer() offset:0 atIndex:config->fragmentParamsIndex];
+					[encoder setBuffer:material->CurrentFrameFragmentParamsBuffer() offset:material->CurrentFrameFragmentParamsOffset() atIndex:config->fragmentParamsIndex];
 				}
 				
 				if (config->fragmentTextureIndex != EmptyIndex)
@@ -348,7 +412,7 @@ namespace qMetal
 			int meshIndex = 0;
 			for(auto &it : config->meshes)
 			{
-				it->UseResources(encoder, useVertexArgumentBuffers);
+				it->UseResources(residencyEncoder, useVertexArgumentBuffers);
 				
 				if (config->indirectIndexStreamIndex != EmptyIndex || config->indirectTessellationFactorBufferIndex != EmptyIndex)
 				{
@@ -370,6 +434,7 @@ namespace qMetal
 				meshIndex++;
 			}
 			
+			residencyEncoder.FlushResidency();
 			[encoder dispatchThreads:threadsPerGrid threadsPerThreadgroup:threadsPerThreadgroup];
 			[encoder popDebugGroup];
 		}
@@ -379,32 +444,61 @@ namespace qMetal
 			const Material<_VertexParams, _FragmentParams, _ComputeParams, _InstanceParams> *material,
 			const Material<_VertexParams, _FragmentParams, _ComputeParams, _InstanceParams> *tessellatedMaterial = NULL)
         {
+			if (!IsReady())
+			{
+				return;
+			}
+			
 			NSString* debugName = [NSString stringWithFormat:@"%@ ICB render encode", config->name];
 			[encoder pushDebugGroup:debugName];
+			
+			TrackedRenderEncoder residencyEncoder(encoder);
 			if (config->vertexInstanceParamsIndex != EmptyIndex)
 			{
-				[encoder useResource:vertexInstanceParamsBuffer usage:MTLResourceUsageRead stages:MTLRenderStageVertex];
+				residencyEncoder.UseResource(vertexInstanceParamsBuffer, MTLResourceUsageRead, MTLRenderStageVertex);
 			}
 			
 			for(auto &it : config->meshes)
 			{
-				it->UseResources(encoder);
+				it->UseResources(residencyEncoder);
 			}
+			residencyEncoder.FlushResidency();
 			
-			material->Encode(encoder);
-			qMetal::Device::ExecuteIndirectCommandBuffer(Device::eIndirectCommandBufferPool_Untessellated, encoder, indirectRangeOffset);
+			if (material->Encode(encoder))
+			{
+				qMetal::Device::ExecuteIndirectCommandBuffer(Device::eIndirectCommandBufferPool_Untessellated, encoder, indirectRangeOffset);
+			}
 			
 			if (tessellatedMaterial)
 			{
 				qASSERTM(config->tessellationFactorsRingBufferIndex != EmptyIndex, "Trying to render with a tessellated material without providing tessellation set-up parameters")
-				tessellatedMaterial->Encode(encoder);
-				qMetal::Device::ExecuteIndirectCommandBuffer(Device::eIndirectCommandBufferPool_Tessellated, encoder, indirectTessellationRangeOffset);
+				if (tessellatedMaterial->Encode(encoder))
+				{
+					qMetal::Device::ExecuteIndirectCommandBuffer(Device::eIndirectCommandBufferPool_Tessellated, encoder, indirectTessellationRangeOffset);
+				}
 			}
 			
 			[encoder popDebugGroup];
         }
 		
     private:
+		
+		void BuildPipeline(dispatch_block_t build)
+		{
+			if (config->pipelineBatch == NULL)
+			{
+				build();
+				return;
+			}
+			
+			if (pipelineGroup == NULL)
+			{
+				pipelineGroup = dispatch_group_create();
+			}
+			
+			config->pipelineBatch->Enqueue(pipelineGroup, build);
+		}
+		
         Config              			*config;
 		
 		id <MTLComputePipelineState> 	computePipelineState;
@@ -414,6 +508,9 @@ namespace qMetal
 		MTLSize 						threadsPerGrid;
 		MTLSize 						threadsPerThreadgroup;
 		
+		dispatch_group_t				pipelineGroup;
+		mutable std::atomic<bool>		pipelinesReady;
+		
 		id <MTLBuffer> 					commandBufferArgumentBuffer;
 		id <MTLBuffer> 					tessellationFactorsRingBuffer;
 		id <MTLBuffer> 					vertexInstanceParamsBuffer;
@@ -0,0 +1,337 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_JOB_SYSTEM_H__
+#define __Q_METAL_JOB_SYSTEM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "qCore.h"
+
+namespace qMetal
+{
+	//counts a group of jobs still to finish. a counter with a parent keeps the parent pending while it has jobs of its
+	//own, so waiting on a parent (say, the device's frame jobs) also waits on every child group started under it
+	class JobCounter
+	{
+	public:
+		JobCounter(JobCounter* _parent = NULL)
+		: pending(0)
+		, parent(_parent)
+		{ }
+		
+		~JobCounter()
+		{
+			qASSERTM(IsDone(), "JobCounter destroyed with %u jobs pending", Pending());
+		}
+		
+		bool IsDone() const 		{ return pending.load(std::memory_order_acquire) == 0; }
+		uint32_t Pending() const 	{ return pending.load(std::memory_order_acquire); }
+		
+	private:
+		friend class JobSystem;
+		
+		void Add(uint32_t count)
+		{
+			if ((count > 0) && (pending.fetch_add(count, std::memory_order_acq_rel) == 0) && (parent != NULL))
+			{
+				parent->Add(1);
+			}
+		}
+		
+		//the waiter may destroy this counter as soon as pending hits zero, so the parent is read first
+		void Done()
+		{
+			JobCounter* const owner = parent;
+			if ((pending.fetch_sub(1, std::memory_order_acq_rel) == 1) && (owner != NULL))
+			{
+				owner->Done();
+			}
+		}
+		
+		JobCounter(const JobCounter&);
+		JobCounter& operator=(const JobCounter&);
+		
+		std::atomic<uint32_t>	pending;
+		JobCounter*				parent;
+	};
+	
+	//a work stealing job scheduler. every worker thread owns a deque: it pushes and pops its own jobs at the back, and
+	//when that runs dry steals the oldest job from the front of another's. threads outside the system share one more
+	//deque. Wait() runs jobs on the waiting thread until its counter is done, so waiting never idles a thread, and with
+	//no workers at all every job simply runs on whichever thread waits for it
+	class JobSystem
+	{
+	public:
+		typedef void (*JobFunction)(void* context, uint32_t begin, uint32_t end);
+		
+		static constexpr uint32_t AutoWorkerCount = UINT32_MAX;
+		static constexpr uint32_t WorkerLimit = 64;
+		
+		//AutoWorkerCount is a worker per core, less one for the thread that submits and waits
+		explicit JobSystem(uint32_t workerCount = AutoWorkerCount)
+		: queueCount(0)
+		, queued(0)
+		, stealCount(0)
+		, executedCount(0)
+		, stopping(false)
+		{
+			if (workerCount == AutoWorkerCount)
+			{
+				const uint32_t cores = std::thread::hardware_concurrency();
+				workerCount = (cores > 1) ? cores - 1 : 0;
+			}
+			workerCount = (workerCount < WorkerLimit) ? workerCount : WorkerLimit;
+			
+			queueCount = workerCount + 1;
+			queues.reset(new Queue[queueCount]);
+			for (uint32_t i = 0; i < workerCount; ++i)
+			{
+				workers.push_back(std::thread(&JobSystem::WorkerLoop, this, i + 1));
+			}
+		}
+		
+		~JobSystem()
+		{
+			{
+				std::lock_guard<std::mutex> lock(sleepMutex);
+				stopping = true;
+			}
+			sleepCondition.notify_all();
+			
+			for (auto &worker : workers)
+			{
+				worker.join();
+			}
+		}
+		
+		//queues function(context, begin, end) on this thread's deque
+		void Run(JobCounter& counter, JobFunction function, void* context, uint32_t begin = 0, uint32_t end = 1)
+		{
+			counter.Add(1);
+			
+			Queue& queue = queues[QueueIndex()];
+			{
+				std::lock_guard<std::mutex> lock(queue.mutex);
+				queue.jobs.push_back(MakeJob(counter, function, context, begin, end));
+			}
+			Queued(1);
+		}
+		
+		//splits [0, count) into jobs of at most grain indices each
+		void ParallelFor(JobCounter& counter, uint32_t count, uint32_t grain, JobFunction function, void* context)
+		{
+			qASSERTM(grain > 0, "JobSystem ParallelFor grain must be at least 1");
+			const uint32_t jobCount = (count + grain - 1) / grain;
+			if (jobCount == 0)
+			{
+				return;
+			}
+			
+			counter.Add(jobCount);
+			
+			//pushed last to first, so this thread pops them from the start while thieves take from the end
+			Queue& queue = queues[QueueIndex()];
+			{
+				std::lock_guard<std::mutex> lock(queue.mutex);
+				for (uint32_t job = jobCount; job > 0; --job)
+				{
+					const uint32_t begin = (job - 1) * grain;
+					const uint32_t end = ((count - begin) < grain) ? count : begin + grain;
+					queue.jobs.push_back(MakeJob(counter, function, context, begin, end));
+				}
+			}
+			Queued(jobCount);
+		}
+		
+		//runs jobs (this thread's own first, then stolen ones) until counter is done
+		void Wait(JobCounter& counter)
+		{
+			const uint32_t queue = QueueIndex();
+			while (!counter.IsDone())
+			{
+				Job job;
+				if (Pop(queue, job) || Steal(queue, job))
+				{
+					Execute(job);
+				}
+				else
+				{
+					std::this_thread::yield();
+				}
+			}
+		}
+		
+		uint32_t WorkerCount() const 		{ return queueCount - 1; }
+		uint64_t StealCount() const 		{ return stealCount.load(std::memory_order_relaxed); }
+		uint64_t ExecutedCount() const 		{ return executedCount.load(std::memory_order_relaxed); }
+		
+	private:
+		typedef struct Job
+		{
+			JobFunction		function;
+			void*			context;
+			uint32_t		begin;
+			uint32_t		end;
+			JobCounter*		counter;
+		} Job;
+		
+		typedef struct Queue
+		{
+			std::mutex			mutex;
+			std::deque<Job>		jobs;
+		} Queue;
+		
+		typedef struct ThreadState
+		{
+			const JobSystem*	system;
+			uint32_t			queue;
+		} ThreadState;
+		
+		static ThreadState& CurrentThread()
+		{
+			static thread_local ThreadState state = { NULL, 0 };
+			return state;
+		}
+		
+		//workers use their own deque, every other thread the shared one
+		uint32_t QueueIndex() const
+		{
+			const ThreadState& state = CurrentThread();
+			return (state.system == this) ? state.queue : 0;
+		}
+		
+		static Job MakeJob(JobCounter& counter, JobFunction function, void* context, uint32_t begin, uint32_t end)
+		{
+			Job job;
+			job.function = function;
+			job.context = context;
+			job.begin = begin;
+			job.end = end;
+			job.counter = &counter;
+			return job;
+		}
+		
+		void Queued(uint32_t count)
+		{
+			queued.fetch_add(count, std::memory_order_release);
+			
+			//taking the lock orders this against a worker checking queued before it sleeps
+			{
+				std::lock_guard<std::mutex> lock(sleepMutex);
+			}
+			if (count == 1)
+			{
+				sleepCondition.notify_one();
+			}
+			else
+			{
+				sleepCondition.notify_all();
+			}
+		}
+		
+		bool Pop(uint32_t index, Job& job)
+		{
+			Queue& queue = queues[index];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (queue.jobs.empty())
+			{
+				return false;
+			}
+			job = queue.jobs.back();
+			queue.jobs.pop_back();
+			queued.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+		
+		bool Steal(uint32_t thief, Job& job)
+		{
+			for (uint32_t i = 1; i < queueCount; ++i)
+			{
+				Queue& queue = queues[(thief + i) % queueCount];
+				std::lock_guard<std::mutex> lock(queue.mutex);
+				if (!queue.jobs.empty())
+				{
+					job = queue.jobs.front();
+					queue.jobs.pop_front();
+					queued.fetch_sub(1, std::memory_order_relaxed);
+					stealCount.fetch_add(1, std::memory_order_relaxed);
+					return true;
+				}
+			}
+			return false;
+		}
+		
+		void Execute(const Job& job)
+		{
+			job.function(job.context, job.begin, job.end);
+			executedCount.fetch_add(1, std::memory_order_relaxed);
+			job.counter->Done();
+		}
+		
+		void WorkerLoop(uint32_t index)
+		{
+			ThreadState& state = CurrentThread();
+			state.system = this;
+			state.queue = index;
+			
+			for (;;)
+			{
+				Job job;
+				if (Pop(index, job) || Steal(index, job))
+				{
+					Execute(job);
+					continue;
+				}
+				
+				std::unique_lock<std::mutex> lock(sleepMutex);
+				sleepCondition.wait(lock, [this]() { return stopping || (queued.load(std::memory_order_acquire) > 0); });
+				if (stopping)
+				{
+					return;
+				}
+			}
+		}
+		
+		JobSystem(const JobSystem&);
+		JobSystem& operator=(const JobSystem&);
+		
+		std::unique_ptr<Queue[]>	queues;
+		uint32_t					queueCount;
+		std::vector<std::thread>	workers;
+		std::atomic<uint32_t>		queued;
+		std::atomic<uint64_t>		stealCount;
+		std::atomic<uint64_t>		executedCount;
+		std::mutex					sleepMutex;
+		std::condition_variable		sleepCondition;
+		bool						stopping;
+	};
+}
+
+#endif //__Q_METAL_JOB_SYSTEM_H__
@@ -31,6 +31,19 @@ SOFTWARE.
 #include "qMetalTexture.h"
 #include "qMetalCullState.h"
 #include "qMetalRenderTarget.h"
+#include "qMetalTrackedEncoder.h"
+#include "qMetalIndirectDispatch.h"
+#include "qMetalArgumentBuffer.h"
+#include "qMetalParamsVersion.h"
+#include "qMetalPipelineBatch.h"
+#include "qMetalPipelineCache.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+
+//vertex + fragment param blocks at or under this size are bound inline with set*Bytes instead of a triple-buffered MTLBuffer
+#define Q_METAL_INLINE_PARAMS_LIMIT (256)
 
 namespace qMetal
 {
@@ -44,6 +57,60 @@ namespace qMetal
 	
 	static constexpr NSUInteger ComputeStreamLimit = 31;
 	
+	static_assert(Q_METAL_INLINE_PARAMS_LIMIT <= 4096, "set*Bytes is limited to 4KB");
+	
+	//specialise to force a params type on or off the inline path
+	template<class _Params>
+	struct ParamsTraits
+	{
+		static constexpr bool inlineBytes = !std::is_empty<_Params>::value && (sizeof(_Params) <= Q_METAL_INLINE_PARAMS_LIMIT);
+	};
+	
+	//CPU-side copy of an inline params block; the false specialisation holds nothing, so large blocks pay no storage
+	template<class _Params, bool _Inline = ParamsTraits<_Params>::inlineBytes>
+	struct InlineParams
+	{
+		static constexpr bool enabled = true;
+		
+		_Params params;
+		
+		_Params* Get() { return &params; }
+		
+		void EncodeVertex(TrackedRenderEncoder& encoder, ParamIndex index) const
+		{
+			encoder.SetVertexBytes(&params, sizeof(_Params), index);
+		}
+		
+		void EncodeFragment(TrackedRenderEncoder& encoder, ParamIndex index) const
+		{
+			encoder.SetFragmentBytes(&params, sizeof(_Params), index);
+		}
+	};
+	
+	template<class _Params>
+	struct InlineParams<_Params, false>
+	{
+		static constexpr bool enabled = false;
+		
+		_Params* Get() { return NULL; }
+		
+		void EncodeVertex(TrackedRenderEncoder& encoder, ParamIndex index) const { }
+		void EncodeFragment(TrackedRenderEncoder& encoder, ParamIndex index) const { }
+	};
+	
+	//a render material's binding layout fixed at compile time, for LayoutMaterial: the buffer index of each bind,
+	//or EmptyIndex where there isn't one. fragment is false for materials drawn without a fragment function
+	template<ParamIndex _VertexParamsIndex, ParamIndex _VertexTextureIndex = EmptyIndex, ParamIndex _InstanceParamsIndex = EmptyIndex, ParamIndex _FragmentParamsIndex = EmptyIndex, ParamIndex _FragmentTextureIndex = EmptyIndex, bool _Fragment = true>
+	struct MaterialLayout
+	{
+		static constexpr ParamIndex vertexParamsIndex = _VertexParamsIndex;
+		static constexpr ParamIndex vertexTextureIndex = _VertexTextureIndex;
+		static constexpr ParamIndex instanceParamsIndex = _InstanceParamsIndex;
+		static constexpr ParamIndex fragmentParamsIndex = _Fragment ? _FragmentParamsIndex : EmptyIndex;
+		static constexpr ParamIndex fragmentTextureIndex = _Fragment ? _FragmentTextureIndex : EmptyIndex;
+		static constexpr bool fragment = _Fragment;
+	};
+	
 	//RPW TODO this should live on qMetalMesh or somewhere more common
 	enum eTessellationFactorMode
 	{
@@ -96,6 +163,11 @@ namespace qMetal
 			bool alphaToCoverage;
 			bool forIndirectCommandBuffer;
 			bool tessellated;
+			bool paramsFromUploadRing;	//params are suballocated from the device upload ring each frame instead of owning triple-buffered MTLBuffers; they must be written every frame they're encoded
+			bool versionedParams;		//params keep their last written value across frames, only taking a new slot (and copying forward) when written
+			PipelineBatch* pipelineBatch;	//if set, pipelines build on worker threads as part of this batch rather than in the constructor
+			bool directArgumentBuffers;	//on Metal 3 GPUs, texture + stream argument buffers are written as ArgumentTable slots rather than through argument encoders
+			bool untrackedWrites;		//the kernel writes untracked resources (e.g. in an untracked heap), so coalesced dispatches need a barrier after it to see them
 			
             Config(NSString* _name)
             : name([_name retain])
@@ -120,6 +192,11 @@ namespace qMetal
 			, alphaToCoverage(false)
 			, forIndirectCommandBuffer(false)
 			, tessellated(false)
+			, paramsFromUploadRing(false)
+			, versionedParams(false)
+			, pipelineBatch(NULL)
+			, directArgumentBuffers(false)
+			, untrackedWrites(false)
             {
 				memset(blendStates, 0, sizeof(blendStates));
 				memset(computeTextures, 0, sizeof(computeTextures));
@@ -156,6 +233,11 @@ namespace qMetal
 			, alphaToCoverage(config->alphaToCoverage)
 			, forIndirectCommandBuffer(config->forIndirectCommandBuffer)
 			, tessellated(config->tessellated)
+			, paramsFromUploadRing(config->paramsFromUploadRing)
+			, versionedParams(config->versionedParams)
+			, pipelineBatch(config->pipelineBatch)
+			, directArgumentBuffers(config->directArgumentBuffers)
+			, untrackedWrites(config->untrackedWrites)
 			{
 				memcpy(&blendStates, &config->blendStates, sizeof(blendStates));
 				memcpy(&computeTextures, &config->computeTextures, sizeof(vertexTextures));
@@ -206,8 +288,19 @@ namespace qMetal
       
 		Material(const Config* _config, const Texture::ePixelFormat colourFormat[], const Texture::ePixelFormat depthFormat, const Texture::ePixelFormat stencilFormat, const Texture::eMSAA msaa)
         : config(_config)
+        , computePipelineKey(0)
+        , renderPipelineKey(0)
+        , computePipelineState(nil)
+        , renderPipelineState(nil)
+        , computeTextureEncoder(nil)
+        , computeStreamsEncoder(nil)
+        , vertexTextureEncoder(nil)
+        , fragmentTextureEncoder(nil)
+        , pipelineGroup(NULL)
+        , pipelineParent(NULL)
+        , pipelinesReady(false)
         {	
-            NSError* error = nil;
+			qASSERTM(!(config->paramsFromUploadRing && config->versionedParams), "qMetalMaterial %s can't use both upload ring and versioned params", [config->name UTF8String]);
 			
 			//COMPUTE PIPELINE
 			
@@ -219,51 +312,8 @@ namespace qMetal
 				
 				computeDesc.computeFunction = config->computeFunction->Get();
 				
-				computePipelineState 	= [qMetal::Device::Get() newComputePipelineStateWithDescriptor:computeDesc options:MTLPipelineOptionNone reflection:nil error:&error];
-				
-				qASSERTM((computePipelineState != nil) && (error == nil), "qMetalMaterial Failed to create compute pipeline %s with error %s", [config->name UTF8String], [[error description] UTF8String]);
-			}
-			
-			if (config->computeParamsIndex != EmptyIndex)
-			{
-				//we may not have a function (e.g. indirect command buffers) but still want compute params buffer
-				for (uint32_t i = 0; i < Q_METAL_FRAMES_TO_BUFFER; ++i)
-				{
-					computeParamsBuffer[i] = [qMetal::Device::Get() newBufferWithLength:sizeof(_ComputeParams) options:0];
-					computeParamsBuffer[i].label = [NSString stringWithFormat:@"%@ compute params (frame %i)", config->name, i];
-				}
-			}
-				
-			if (config->computeTextureIndex != EmptyIndex)
-			{
-				id <MTLArgumentEncoder> computeTextureEncoder = [config->computeFunction->Get() newArgumentEncoderWithBufferIndex:config->computeTextureIndex];
-				computeTextureBuffer = [qMetal::Device::Get() newBufferWithLength:computeTextureEncoder.encodedLength options:0];
-				computeTextureBuffer.label = [NSString stringWithFormat:@"%@ compute textures", config->name];
-				[computeTextureEncoder setArgumentBuffer:computeTextureBuffer offset:0];
-				
-				for (int i = 0; i < (int)Texture::eUnit_Count; ++i)
-				{
-					if (config->computeTextures[i] != NULL)
-					{
-						config->computeTextures[i]->EncodeArgumentBuffer(computeTextureEncoder, (Texture::eUnit)i);
-					}
-				}
-			}
-				
-			if (config->computeStreamsIndex != EmptyIndex)
-			{
-				id <MTLArgumentEncoder> computeStreamsEncoder = [config->computeFunction->Get() newArgumentEncoderWithBufferIndex:config->computeStreamsIndex];
-				computeStreamsBuffer = [qMetal::Device::Get() newBufferWithLength:computeStreamsEncoder.encodedLength options:0];
-				computeStreamsBuffer.label = [NSString stringWithFormat:@"%@ compute streams", config->name];
-				[computeStreamsEncoder setArgumentBuffer:computeStreamsBuffer offset:0];
-				
-				for (int i = 0; i < (int)ComputeStreamLimit; ++i)
-				{
-					if (config->computeStreams[i] != nil)
-					{
-						[computeStreamsEncoder setBuffer:config->computeStreams[i] offset:0 atIndex:i];
-					}
-				}
+				computePipelineKey = ComputePipelineKey();
+				BuildPipeline(^{ CreateComputePipeline(computeDesc); });
 			}
 			
             //RENDER PIPELINE
@@ -324,127 +374,293 @@ namespace qMetal
 				
 				renderDesc.supportIndirectCommandBuffers = config->forIndirectCommandBuffer;
 				
-				renderPipelineState 	= [qMetal::Device::Get() newRenderPipelineStateWithDescriptor: renderDesc error: &error];
-				
-				qASSERTM((renderPipelineState != nil) && (error == nil), "qMetalMaterial Failed to create render pipeline %s with error %s", [config->name UTF8String], [[error description] UTF8String]);
-				
-				for (uint32_t i = 0; i < Q_METAL_FRAMES_TO_BUFFER; ++i)
+				renderPipelineKey = RenderPipelineKey(colourFormat, depthFormat, stencilFormat, msaa);
+				BuildPipeline(^{ CreateRenderPipeline(renderDesc); });
+			}
+			else
+			{
+				qASSERTM(config->fragmentFunction == NULL, "Vertex function is null but fragment function isn't");
+			}
+			
+			//ARGUMENT ENCODERS
+			//kept around so material instances can encode their own argument buffers without reflecting the functions again.
+			//direct argument buffers don't need them
+			
+			qWARNING(!config->directArgumentBuffers || ArgumentTable::Supported(), "Material %s wants direct argument buffers, but this GPU isn't Metal 3; using argument encoders", [config->name UTF8String]);
+			
+			if (!DirectArgumentBuffers())
+			{
+				if (config->computeTextureIndex != EmptyIndex)
 				{
-					if (config->vertexParamsIndex != EmptyIndex)
-					{
-						vertexParamsBuffer[i] = [qMetal::Device::Get() newBufferWithLength:sizeof(_VertexParams) options:0];
-						vertexParamsBuffer[i].label = [NSString stringWithFormat:@"%@ vertex params (frame %i)", config->name, i];
-					}
-					
-					if (config->fragmentParamsIndex != EmptyIndex)
-					{
-						fragmentParamsBuffer[i] = [qMetal::Device::Get() newBufferWithLength:sizeof(_FragmentParams) options:0];
-						fragmentParamsBuffer[i].label = [NSString stringWithFormat:@"%@ fragment params (frame %i)", config->name, i];
-					}
-					
-					if (IsInstanced() && (sizeof(_InstanceParams) > 0))
-					{
-						instanceParamsBuffer[i] = [qMetal::Device::Get() newBufferWithLength:(sizeof(_InstanceParams) * config->instanceCount) options:0];
-						instanceParamsBuffer[i].label = [NSString stringWithFormat:@"%@ instance params (frame %i)", config->name, i];
-					}
+					computeTextureEncoder = [config->computeFunction->Get() newArgumentEncoderWithBufferIndex:config->computeTextureIndex];
 				}
 				
-				//TEXTURES
-				//note that "Writable textures are not supported within an argument buffer" (https://developer.apple.com/documentation/metal/resource_objects/about_argument_buffers?language=objc)
-				//so we don't make one for Compute Shaders, as our whole goal there is outputting one (or more) textures
+				if (config->computeStreamsIndex != EmptyIndex)
+				{
+					computeStreamsEncoder = [config->computeFunction->Get() newArgumentEncoderWithBufferIndex:config->computeStreamsIndex];
+				}
 				
-				if (config->vertexTextureIndex != EmptyIndex)
+				if ((config->vertexFunction != NULL) && (config->vertexTextureIndex != EmptyIndex))
 				{
-					id <MTLArgumentEncoder> vertexTextureEncoder = [config->vertexFunction->Get() newArgumentEncoderWithBufferIndex:config->vertexTextureIndex];
-					vertexTextureBuffer = [qMetal::Device::Get() newBufferWithLength:vertexTextureEncoder.encodedLength options:0];
-					vertexTextureBuffer.label = [NSString stringWithFormat:@"%@ vertex textures", config->name];
-					[vertexTextureEncoder setArgumentBuffer:vertexTextureBuffer offset:0];
-					
-					for (int i = 0; i < (int)Texture::eUnit_Count; ++i)
-					{
-						if (config->vertexTextures[i] != NULL)
-						{
-							config->vertexTextures[i]->EncodeArgumentBuffer(vertexTextureEncoder, (Texture::eUnit)i, (Texture::eUnit)config->vertexSamplers[i]);
-						}
-					}
+					vertexTextureEncoder = [config->vertexFunction->Get() newArgumentEncoderWithBufferIndex:config->vertexTextureIndex];
 				}
-
+				
 				if ((config->fragmentTextureIndex != EmptyIndex) && (config->fragmentFunction != NULL)) //we might be sharing a material description with fragment textures but not actually have a fragment funtion
 				{
-					id <MTLArgumentEncoder> fragmentTextureEncoder = [config->fragmentFunction->Get() newArgumentEncoderWithBufferIndex:config->fragmentTextureIndex];
-					fragmentTextureBuffer = [qMetal::Device::Get() newBufferWithLength:fragmentTextureEncoder.encodedLength options:0];
-					fragmentTextureBuffer.label = [NSString stringWithFormat:@"%@ fragment textures", config->name];
-					[fragmentTextureEncoder setArgumentBuffer:fragmentTextureBuffer offset:0];
-					
-					for (int i = 0; i < (int)Texture::eUnit_Count; ++i)
-					{
-						if (config->fragmentTextures[i] != NULL)
-						{
-							config->fragmentTextures[i]->EncodeArgumentBuffer(fragmentTextureEncoder, (Texture::eUnit)i, (Texture::eUnit)config->fragmentSamplers[i]);
-						}
-					}
+					fragmentTextureEncoder = [config->fragmentFunction->Get() newArgumentEncoderWithBufferIndex:config->fragmentTextureIndex];
 				}
 			}
-			else
+			
+			CreateBuffers();
+			
+			if (pipelineGroup == NULL)
 			{
-				qASSERTM(config->fragmentFunction == NULL, "Vertex function is null but fragment function isn't");
+				pipelinesReady.store(true, std::memory_order_release);
 			}
         }
 		
+		~Material()
+		{
+			//don't pull the pipelines out from under a build that's still running
+			WaitUntilReady();
+			
+			if (pipelineGroup != NULL)
+			{
+				dispatch_release(pipelineGroup);
+			}
+			
+			//pipeline states are shared through the device caches, so only the last user destroys them
+			id<MTLComputePipelineState> releasedComputePipelineState = nil;
+			if ((config->computeFunction != NULL) && qMetal::Device::ComputePipelineCache().Release(computePipelineKey, releasedComputePipelineState))
+			{
+				[releasedComputePipelineState release];
+			}
+			
+			id<MTLRenderPipelineState> releasedRenderPipelineState = nil;
+			if ((config->vertexFunction != NULL) && qMetal::Device::RenderPipelineCache().Release(renderPipelineKey, releasedRenderPipelineState))
+			{
+				[releasedRenderPipelineState release];
+			}
+			
+			[computeTextureEncoder release];
+			[computeStreamsEncoder release];
+			[vertexTextureEncoder release];
+			[fragmentTextureEncoder release];
+		}
+		
+		const Config* GetConfig() const
+		{
+			return config;
+		}
+		
+		//with a pipeline batch in the config the pipelines build on worker threads; until they're done the
+		//Encode calls do nothing (and return false where they return anything)
+		bool IsReady() const
+		{
+			if (pipelinesReady.load(std::memory_order_acquire))
+			{
+				return true;
+			}
+			
+			if (pipelineParent != NULL)
+			{
+				return ShareParentPipelines();
+			}
+			
+			if ((pipelineGroup == NULL) || (dispatch_group_wait(pipelineGroup, DISPATCH_TIME_NOW) != 0))
+			{
+				return false;
+			}
+			
+			pipelinesReady.store(true, std::memory_order_release);
+			return true;
+		}
+		
+		void WaitUntilReady() const
+		{
+			if (pipelineParent != NULL)
+			{
+				pipelineParent->WaitUntilReady();
+				ShareParentPipelines();
+				return;
+			}
+			
+			if ((pipelineGroup != NULL) && !IsReady())
+			{
+				dispatch_group_wait(pipelineGroup, DISPATCH_TIME_FOREVER);
+				pipelinesReady.store(true, std::memory_order_release);
+			}
+		}
+		
+		id<MTLComputePipelineState> ComputePipelineState() const
+		{
+			return IsReady() ? computePipelineState : nil;
+		}
+		
+		id<MTLRenderPipelineState> RenderPipelineState() const
+		{
+			return IsReady() ? renderPipelineState : nil;
+		}
+		
 		void EncodeCompute(NSUInteger width, NSUInteger height, NSUInteger depth = 1) const
 		{
-			id<MTLComputeCommandEncoder> computeEncoder = qMetal::Device::ComputeEncoder(config->name);
-			[computeEncoder pushDebugGroup:config->name];
+			if (!IsReady())
+			{
+				return;
+			}
+			
+			//consecutive compute-only materials share one encoder, and its state tracking
+			TrackedComputeEncoder& computeEncoder = qMetal::Device::CoalescedComputeEncoder();
+			[computeEncoder.Get() pushDebugGroup:config->name];
 			
 			EncodeCompute(computeEncoder, width, height, depth);
+			CoalescedBarrier(computeEncoder);
 			
-			[computeEncoder popDebugGroup];
-			[computeEncoder endEncoding];
+			[computeEncoder.Get() popDebugGroup];
+		}
+		
+		//serial dispatch only orders tracked resources, so untracked writes need a barrier before the next coalesced dispatch
+		void CoalescedBarrier(TrackedComputeEncoder& encoder) const
+		{
+			if (config->untrackedWrites)
+			{
+				[encoder.Get() memoryBarrierWithScope:MTLBarrierScopeBuffers | MTLBarrierScopeTextures];
+			}
 		}
 		
 		void EncodeCompute(id<MTLComputeCommandEncoder> encoder, NSUInteger width, NSUInteger height, NSUInteger depth = 1) const
 		{
-			Encode(encoder);
+			TrackedComputeEncoder untracked(encoder, false);
+			EncodeCompute(untracked, width, height, depth);
+		}
+		
+		void EncodeCompute(TrackedComputeEncoder& encoder, NSUInteger width, NSUInteger height, NSUInteger depth = 1) const
+		{
+			if (!Encode(encoder))
+			{
+				return;
+			}
 			
-			//TODO this could likely be optimized in case where width is much wider than height, say, and height is < maxTotalThreadsPerThreadgroupSqrt
+			//the shape comes from the device's tuning table or the grid shape heuristic
+			MTLSize threadsPerGrid = MTLSizeMake(width, height, depth);
+			MTLSize threadsPerThreadgroup = qMetal::Device::DispatchThreadgroupSize(computePipelineState, computePipelineKey, threadsPerGrid);
 			
-			NSUInteger maxTotalThreadsPerThreadgroupSqrt = (NSUInteger)sqrt((double)computePipelineState.maxTotalThreadsPerThreadgroup);
+			encoder.FlushResidency();
+			[encoder.Get() dispatchThreads:threadsPerGrid threadsPerThreadgroup:threadsPerThreadgroup];
+		}
+		
+		//opt in to tuning this kernel's dispatch shape for a grid in a tuning session (see Device::TuneDispatch): it
+		//runs for real, repeatedly, with this material's bindings plus whatever encodeBindings sets (any buffer the
+		//caller binds outside the material), so only tune kernels that are idempotent or bound to scratch resources.
+		//later EncodeCompute() calls on the same grid bucket use the winner
+		void TuneDispatch(NSUInteger width, NSUInteger height, NSUInteger depth, void (^encodeBindings)(id<MTLComputeCommandEncoder> encoder)) const
+		{
+			if (!IsReady())
+			{
+				return;
+			}
 			
-			MTLSize threadsPerGrid = MTLSizeMake(width, height, depth);
-			MTLSize threadsPerThreadgroup = MTLSizeMake(maxTotalThreadsPerThreadgroupSqrt, maxTotalThreadsPerThreadgroupSqrt, 1);
+			qMetal::Device::TuneDispatch(computePipelineState, computePipelineKey, MTLSizeMake(width, height, depth), ^(id<MTLComputeCommandEncoder> tuningEncoder)
+			{
+				TrackedComputeEncoder untracked(tuningEncoder, false);
+				Encode(untracked);
+				if (encodeBindings != nil)
+				{
+					encodeBindings(tuningEncoder);
+				}
+				untracked.FlushResidency();
+			});
+		}
+		
+		//GPU sized dispatches: the grid comes from an IndirectDispatch a previous compute pass wrote, which is also
+		//bound at dispatchIndex if the kernel wants the thread count (see qMetalIndirectDispatchInRange)
+		void EncodeComputeIndirect(const IndirectDispatch* dispatch, ParamIndex dispatchIndex = EmptyIndex) const
+		{
+			if (!IsReady())
+			{
+				return;
+			}
+			
+			TrackedComputeEncoder& computeEncoder = qMetal::Device::CoalescedComputeEncoder();
+			[computeEncoder.Get() pushDebugGroup:config->name];
+			
+			EncodeComputeIndirect(computeEncoder, dispatch, dispatchIndex);
+			CoalescedBarrier(computeEncoder);
+			
+			[computeEncoder.Get() popDebugGroup];
+		}
+		
+		void EncodeComputeIndirect(id<MTLComputeCommandEncoder> encoder, const IndirectDispatch* dispatch, ParamIndex dispatchIndex = EmptyIndex) const
+		{
+			TrackedComputeEncoder untracked(encoder, false);
+			EncodeComputeIndirect(untracked, dispatch, dispatchIndex);
+		}
+		
+		void EncodeComputeIndirect(TrackedComputeEncoder& encoder, const IndirectDispatch* dispatch, ParamIndex dispatchIndex = EmptyIndex) const
+		{
+			if (dispatchIndex != EmptyIndex)
+			{
+				dispatch->Bind(encoder, dispatchIndex);
+			}
 			
-			[encoder dispatchThreads:threadsPerGrid threadsPerThreadgroup:threadsPerThreadgroup];
+			EncodeComputeIndirect(encoder, dispatch->Buffer(), dispatch->ArgumentsOffset(), dispatch->ThreadsPerThreadgroup());
 		}
 		
-        void Encode(id<MTLComputeCommandEncoder> encoder) const
+		//raw MTLDispatchThreadgroupsIndirectArguments, for buffers laid out elsewhere
+		void EncodeComputeIndirect(TrackedComputeEncoder& encoder, id<MTLBuffer> indirectBuffer, NSUInteger indirectOffset, MTLSize threadsPerThreadgroup) const
 		{
-			[encoder setComputePipelineState:computePipelineState];
+			if (!Encode(encoder))
+			{
+				return;
+			}
+			
+			encoder.FlushResidency();
+			[encoder.Get() dispatchThreadgroupsWithIndirectBuffer:indirectBuffer indirectBufferOffset:indirectOffset threadsPerThreadgroup:threadsPerThreadgroup];
+		}
+		
+        bool Encode(id<MTLComputeCommandEncoder> encoder) const
+		{
+			TrackedComputeEncoder untracked(encoder, false);
+			return Encode(untracked);
+		}
+		
+        bool Encode(TrackedComputeEncoder& encoder) const
+		{
+			if (!IsReady())
+			{
+				return false;
+			}
+			
+			encoder.SetComputePipelineState(computePipelineState);
 			
 			if (config->computeParamsIndex != EmptyIndex)
 			{
-				[encoder setBuffer:computeParamsBuffer[qMetal::Device::CurrentFrameIndex()] offset:0 atIndex:config->computeParamsIndex];
+				AssertUploadWritten(computeParamsUpload, "compute");
+				encoder.SetBuffer(CurrentFrameComputeParamsBuffer(), CurrentFrameComputeParamsOffset(), config->computeParamsIndex);
 			}
 			
 			if (config->computeTextureIndex != EmptyIndex)
 			{
-				[encoder setBuffer:computeTextureBuffer offset:0 atIndex:config->computeTextureIndex];
+				encoder.SetBuffer(CurrentArgumentBuffer(computeTextureBuffer, computeTextureVersion), 0, config->computeTextureIndex);
 			}
 			else
 			{
 				//Legacy non-argument buffer path... TODO UPDATE ALL SHADERS AND REMOVE
 				for (int i = 0; i < (int)Texture::eUnit_Count; ++i)
 				{
-					if (config->computeTextures[i] != NULL)
+					if (boundComputeTextures[i] != NULL)
 					{
-						config->computeTextures[i]->EncodeCompute(encoder, (Texture::eUnit)i);
+						boundComputeTextures[i]->EncodeCompute(encoder.Get(), (Texture::eUnit)i);
 					}
 				}
 			}
 			
 			if (config->computeStreamsIndex != EmptyIndex)
 			{
-				[encoder setBuffer:computeStreamsBuffer offset:0 atIndex:config->computeStreamsIndex];
+				encoder.SetBuffer(CurrentArgumentBuffer(computeStreamsBuffer, computeStreamsVersion), 0, config->computeStreamsIndex);
 			}
+			
+			return true;
         }
 		
         void EncodeTextures(id<MTLComputeCommandEncoder> encoder) const
@@ -452,24 +668,35 @@ namespace qMetal
 			//Legacy non-argument buffer path... TODO UPDATE ALL SHADERS AND REMOVE
 			for (int i = 0; i < (int)Texture::eUnit_Count; ++i)
             {
-                if (config->computeTextures[i] != NULL)
+                if (boundComputeTextures[i] != NULL)
                 {
-					config->computeTextures[i]->EncodeCompute(encoder, (Texture::eUnit)i);
+					boundComputeTextures[i]->EncodeCompute(encoder, (Texture::eUnit)i);
 				}
 			}
         }
       
-        void Encode(id<MTLRenderCommandEncoder> encoder) const
+        bool Encode(id<MTLRenderCommandEncoder> encoder) const
+		{
+			TrackedRenderEncoder untracked(encoder, false);
+			return Encode(untracked);
+		}
+		
+        bool Encode(TrackedRenderEncoder& encoder) const
 		{
-			[encoder setRenderPipelineState:renderPipelineState];
+			if (!IsReady())
+			{
+				return false;
+			}
+			
+			encoder.SetRenderPipelineState(renderPipelineState);
 			
 			if (config->vertexTextureIndex != EmptyIndex)
 			{
 				for (int i = 0; i < (int)Texture::eUnit_Count; ++i)
 				{
-					if (config->vertexTextures[i] != NULL)
+					if (boundVertexTextures[i] != NULL)
 					{
-						config->vertexTextures[i]->EncodeUsage(encoder, MTLRenderStageVertex);
+						encoder.UseResource(boundVertexTextures[i]->MTLTexture(), MTLResourceUsageSample, MTLRenderStageVertex);
 					}
 				}
 			}
@@ -480,41 +707,70 @@ namespace qMetal
 				
 				for (int i = 0; i < (int)Texture::eUnit_Count; ++i)
 				{
-					if (config->fragmentTextures[i] != NULL)
+					if (boundFragmentTextures[i] != NULL)
 					{
-						config->fragmentTextures[i]->EncodeUsage(encoder, MTLRenderStageFragment);
+						encoder.UseResource(boundFragmentTextures[i]->MTLTexture(), MTLResourceUsageSample, MTLRenderStageFragment);
 					}
 				}
 			}
 			
 			
+			if ((config->vertexParamsIndex != EmptyIndex) && !VertexParamsInline())
+			{
+				AssertUploadWritten(vertexParamsUpload, "vertex");
+			}
+			
+			if (config->instanceParamsIndex != EmptyIndex)
+			{
+				AssertUploadWritten(instanceParamsUpload, "instance");
+			}
+			
+			if ((config->fragmentFunction != NULL) && (config->fragmentParamsIndex != EmptyIndex) && !FragmentParamsInline())
+			{
+				AssertUploadWritten(fragmentParamsUpload, "fragment");
+			}
+			
 			if (!config->forIndirectCommandBuffer)
 			{
 				if (config->vertexParamsIndex != EmptyIndex)
 				{
-					[encoder setVertexBuffer:vertexParamsBuffer[qMetal::Device::CurrentFrameIndex()] offset:0 atIndex:config->vertexParamsIndex];
+					if (InlineParams<_VertexParams>::enabled)
+					{
+						vertexParamsInline.EncodeVertex(encoder, config->vertexParamsIndex);
+					}
+					else
+					{
+						encoder.SetVertexBuffer(CurrentFrameVertexParamsBuffer(), CurrentFrameVertexParamsOffset(), config->vertexParamsIndex);
+					}
 				}
 				
 				if (config->vertexTextureIndex != EmptyIndex)
 				{
-					[encoder setVertexBuffer:vertexTextureBuffer offset:0 atIndex:config->vertexTextureIndex];
+					encoder.SetVertexBuffer(VertexTextureBuffer(), 0, config->vertexTextureIndex);
 				}
 				
 				if (config->instanceParamsIndex != EmptyIndex)
 				{
-					[encoder setVertexBuffer:instanceParamsBuffer[qMetal::Device::CurrentFrameIndex()] offset:0 atIndex:config->instanceParamsIndex];
+					encoder.SetVertexBuffer(CurrentFrameInstanceParamsBuffer(), CurrentFrameInstanceParamsOffset(), config->instanceParamsIndex);
 				}
 				
 				if (config->fragmentFunction != NULL)
 				{
 					if (config->fragmentParamsIndex != EmptyIndex)
 					{
-						[encoder setFragmentBuffer:fragmentParamsBuffer[qMetal::Device::CurrentFrameIndex()] offset:0 atIndex:config->fragmentParamsIndex];
+						if (InlineParams<_FragmentParams>::enabled)
+						{
+							fragmentParamsInline.EncodeFragment(encoder, config->fragmentParamsIndex);
+						}
+						else
+						{
+							encoder.SetFragmentBuffer(CurrentFrameFragmentParamsBuffer(), CurrentFrameFragmentParamsOffset(), config->fragmentParamsIndex);
+						}
 					}
 					
 					if (config->fragmentTextureIndex != EmptyIndex)
 					{
-						[encoder setFragmentBuffer:fragmentTextureBuffer offset:0 atIndex:config->fragmentTextureIndex];
+						encoder.SetFragmentBuffer(FragmentTextureBuffer(), 0, config->fragmentTextureIndex);
 					}
 				}
 			}
@@ -522,90 +778,363 @@ namespace qMetal
 			{
 				if (config->vertexParamsIndex != EmptyIndex)
 				{
-					[encoder useResource:vertexParamsBuffer[qMetal::Device::CurrentFrameIndex()] usage:MTLResourceUsageRead stages:MTLRenderStageVertex];
+					encoder.UseResource(CurrentFrameVertexParamsBuffer(), MTLResourceUsageRead, MTLRenderStageVertex);
 				}
 				
 				if (config->vertexTextureIndex != EmptyIndex)
 				{
-					[encoder useResource:vertexTextureBuffer usage:MTLResourceUsageRead stages:MTLRenderStageVertex];
+					encoder.UseResource(VertexTextureBuffer(), MTLResourceUsageRead, MTLRenderStageVertex);
 				}
 				
 				if (config->instanceParamsIndex != EmptyIndex)
 				{
-					[encoder useResource:instanceParamsBuffer[qMetal::Device::CurrentFrameIndex()] usage:MTLResourceUsageRead stages:MTLRenderStageVertex];
+					encoder.UseResource(CurrentFrameInstanceParamsBuffer(), MTLResourceUsageRead, MTLRenderStageVertex);
 				}
 				
 				if (config->fragmentFunction != NULL)
 				{
 					if (config->fragmentParamsIndex != EmptyIndex)
 					{
-						[encoder useResource:fragmentParamsBuffer[qMetal::Device::CurrentFrameIndex()] usage:MTLResourceUsageRead stages:MTLRenderStageFragment];
+						encoder.UseResource(CurrentFrameFragmentParamsBuffer(), MTLResourceUsageRead, MTLRenderStageFragment);
 					}
 					
 					if (config->fragmentTextureIndex != EmptyIndex)
 					{
-						[encoder useResource:fragmentTextureBuffer usage:MTLResourceUsageRead stages:MTLRenderStageFragment];
+						encoder.UseResource(FragmentTextureBuffer(), MTLResourceUsageRead, MTLRenderStageFragment);
 					}
 				}
 			}
 			
 			config->depthStencilState->Encode(encoder);
-			[encoder setStencilReferenceValue:config->stencilReferenceValue];
+			encoder.SetStencilReferenceValue(config->stencilReferenceValue);
 			config->cullState->Encode(encoder);
+			
+			return true;
         }
 		
-        _ComputeParams* CurrentFrameComputeParams() const
-        {
-			return (_ComputeParams*)[CurrentFrameComputeParamsBuffer() contents];
-        }
-		
-		id<MTLBuffer> CurrentFrameComputeParamsBuffer() const
+		//Encode() against a compile time layout: every index test is a constant, so only the binds the layout
+		//has are compiled in. the layout must match the config, which CheckLayout() verifies once up front
+		template<class _Layout>
+		bool EncodeLayout(TrackedRenderEncoder& encoder) const
 		{
-			qASSERTM(config->computeParamsIndex != EmptyIndex, "No compute params index set, check material definition");
-			return computeParamsBuffer[qMetal::Device::CurrentFrameIndex()];
+			if (!IsReady())
+			{
+				return false;
+			}
+			
+			encoder.SetRenderPipelineState(renderPipelineState);
+			
+			if (_Layout::vertexTextureIndex != EmptyIndex)
+			{
+				for (uint32_t i = 0; i < vertexUsageTextureCount; ++i)
+				{
+					encoder.UseResource(vertexUsageTextures[i]->MTLTexture(), MTLResourceUsageSample, MTLRenderStageVertex);
+				}
+				encoder.SetVertexBuffer(VertexTextureBuffer(), 0, _Layout::vertexTextureIndex);
+			}
+			
+			if (_Layout::vertexParamsIndex != EmptyIndex)
+			{
+				if (InlineParams<_VertexParams>::enabled)
+				{
+					vertexParamsInline.EncodeVertex(encoder, _Layout::vertexParamsIndex);
+				}
+				else
+				{
+					AssertUploadWritten(vertexParamsUpload, "vertex");
+					encoder.SetVertexBuffer(CurrentFrameVertexParamsBuffer(), CurrentFrameVertexParamsOffset(), _Layout::vertexParamsIndex);
+				}
+			}
+			
+			if (_Layout::instanceParamsIndex != EmptyIndex)
+			{
+				AssertUploadWritten(instanceParamsUpload, "instance");
+				encoder.SetVertexBuffer(CurrentFrameInstanceParamsBuffer(), CurrentFrameInstanceParamsOffset(), _Layout::instanceParamsIndex);
+			}
+			
+			if (_Layout::fragmentTextureIndex != EmptyIndex)
+			{
+				for (uint32_t i = 0; i < fragmentUsageTextureCount; ++i)
+				{
+					encoder.UseResource(fragmentUsageTextures[i]->MTLTexture(), MTLResourceUsageSample, MTLRenderStageFragment);
+				}
+				encoder.SetFragmentBuffer(FragmentTextureBuffer(), 0, _Layout::fragmentTextureIndex);
+			}
+			
+			if (_Layout::fragmentParamsIndex != EmptyIndex)
+			{
+				if (InlineParams<_FragmentParams>::enabled)
+				{
+					fragmentParamsInline.EncodeFragment(encoder, _Layout::fragmentParamsIndex);
+				}
+				else
+				{
+					AssertUploadWritten(fragmentParamsUpload, "fragment");
+					encoder.SetFragmentBuffer(CurrentFrameFragmentParamsBuffer(), CurrentFrameFragmentParamsOffset(), _Layout::fragmentParamsIndex);
+				}
+			}
+			
+			config->depthStencilState->Encode(encoder);
+			encoder.SetStencilReferenceValue(config->stencilReferenceValue);
+			config->cullState->Encode(encoder);
+			
+			return true;
 		}
 		
-		_VertexParams* CurrentFrameVertexParams() const
+		template<class _Layout>
+		void CheckLayout() const
 		{
+			qASSERTM(config->vertexFunction != NULL, "Material %s has a compile time layout but no vertex function", [config->name UTF8String]);
+			qASSERTM(!config->forIndirectCommandBuffer, "Material %s has a compile time layout but is for indirect command buffers", [config->name UTF8String]);
+			qASSERTM(config->vertexParamsIndex == _Layout::vertexParamsIndex, "Material %s vertex params index %i doesn't match its layout's %i", [config->name UTF8String], config->vertexParamsIndex, _Layout::vertexParamsIndex);
+			qASSERTM(config->vertexTextureIndex == _Layout::vertexTextureIndex, "Material %s vertex texture index %i doesn't match its layout's %i", [config->name UTF8String], config->vertexTextureIndex, _Layout::vertexTextureIndex);
+			qASSERTM(config->instanceParamsIndex == _Layout::instanceParamsIndex, "Material %s instance params index %i doesn't match its layout's %i", [config->name UTF8String], config->instanceParamsIndex, _Layout::instanceParamsIndex);
+			qASSERTM((config->fragmentFunction != NULL) == _Layout::fragment, "Material %s fragment function doesn't match its layout", [config->name UTF8String]);
+			qASSERTM(!_Layout::fragment || (config->fragmentParamsIndex == _Layout::fragmentParamsIndex), "Material %s fragment params index %i doesn't match its layout's %i", [config->name UTF8String], config->fragmentParamsIndex, _Layout::fragmentParamsIndex);
+			qASSERTM(!_Layout::fragment || (config->fragmentTextureIndex == _Layout::fragmentTextureIndex), "Material %s fragment texture index %i doesn't match its layout's %i", [config->name UTF8String], config->fragmentTextureIndex, _Layout::fragmentTextureIndex);
+		}
+		
+        _ComputeParams* CurrentFrameComputeParams() const
+        {
+			if (config->versionedParams)
+			{
+				return (_ComputeParams*)WriteVersioned(computeParamsBuffer, computeParamsVersion, sizeof(_ComputeParams), 0, 0);
+			}
+			if (config->paramsFromUploadRing)
+			{
+				return (_ComputeParams*)CurrentFrameUpload(computeParamsUpload, sizeof(_ComputeParams)).contents;
+			}
+			return (_ComputeParams*)[CurrentFrameComputeParamsBuffer() contents];
+        }
+		
+		//with versioned params, only the bytes outside [writeOffset, writeOffset + writeLength) are copied forward from the last version
+		_ComputeParams* WriteComputeParams(NSUInteger writeOffset = 0, NSUInteger writeLength = sizeof(_ComputeParams)) const
+		{
+			if (config->versionedParams)
+			{
+				return (_ComputeParams*)WriteVersioned(computeParamsBuffer, computeParamsVersion, sizeof(_ComputeParams), writeOffset, writeLength);
+			}
+			return CurrentFrameComputeParams();
+		}
+		
+		id<MTLBuffer> CurrentFrameComputeParamsBuffer() const
+		{
+			qASSERTM(config->computeParamsIndex != EmptyIndex, "No compute params index set, check material definition");
+			if (config->versionedParams)
+			{
+				return computeParamsBuffer[computeParamsVersion.Bind(qMetal::Device::CurrentFrameNumber())];
+			}
+			if (config->paramsFromUploadRing)
+			{
+				return CurrentFrameUpload(computeParamsUpload, sizeof(_ComputeParams)).buffer;
+			}
+			return computeParamsBuffer[qMetal::Device::CurrentFrameIndex()];
+		}
+		
+		NSUInteger CurrentFrameComputeParamsOffset() const
+		{
+			return config->paramsFromUploadRing ? CurrentFrameUpload(computeParamsUpload, sizeof(_ComputeParams)).offset : 0;
+		}
+		
+		//inline params are copied into the encoder at Encode() time, so write them before encoding each draw
+		_VertexParams* CurrentFrameVertexParams() const
+		{
+			if (VertexParamsInline())
+			{
+				return vertexParamsInline.Get();
+			}
+			if (config->versionedParams)
+			{
+				return (_VertexParams*)WriteVersioned(vertexParamsBuffer, vertexParamsVersion, sizeof(_VertexParams), 0, 0);
+			}
+			if (config->paramsFromUploadRing)
+			{
+				return (_VertexParams*)CurrentFrameUpload(vertexParamsUpload, sizeof(_VertexParams)).contents;
+			}
 			return (_VertexParams*)[CurrentFrameVertexParamsBuffer() contents];
 		}
 		
+		_VertexParams* WriteVertexParams(NSUInteger writeOffset = 0, NSUInteger writeLength = sizeof(_VertexParams)) const
+		{
+			if (config->versionedParams && !VertexParamsInline())
+			{
+				return (_VertexParams*)WriteVersioned(vertexParamsBuffer, vertexParamsVersion, sizeof(_VertexParams), writeOffset, writeLength);
+			}
+			return CurrentFrameVertexParams();
+		}
+		
 		id<MTLBuffer> CurrentFrameVertexParamsBuffer() const
 		{
 			qASSERTM(config->vertexParamsIndex != EmptyIndex, "No vertex params index set, check material definition");
+			qASSERTM(!VertexParamsInline(), "Vertex params of %s are bound inline and have no buffer", [config->name UTF8String]);
+			if (config->versionedParams)
+			{
+				return vertexParamsBuffer[vertexParamsVersion.Bind(qMetal::Device::CurrentFrameNumber())];
+			}
+			if (config->paramsFromUploadRing)
+			{
+				return CurrentFrameUpload(vertexParamsUpload, sizeof(_VertexParams)).buffer;
+			}
 			return vertexParamsBuffer[qMetal::Device::CurrentFrameIndex()];
 		}
 		
+		NSUInteger CurrentFrameVertexParamsOffset() const
+		{
+			return config->paramsFromUploadRing ? CurrentFrameUpload(vertexParamsUpload, sizeof(_VertexParams)).offset : 0;
+		}
+		
 		id<MTLBuffer> VertexTextureBuffer() const
 		{
 			qASSERTM(config->vertexTextureIndex != EmptyIndex, "No vertex texture index set, check material definition");
-			return vertexTextureBuffer;
+			return CurrentArgumentBuffer(vertexTextureBuffer, vertexTextureVersion);
 		}
 		
 		_InstanceParams* CurrentFrameInstanceParams(uint32_t instanceIndex) const
 		{
 			qASSERTM(IsInstanced(), "Asking for instance %i but with a material that isn't instanced", instanceIndex);
 			qASSERTM(instanceIndex < config->instanceCount, "Asking for instance %i but with a material that only supports %i", instanceIndex, config->instanceCount);
+			if (config->versionedParams)
+			{
+				return WriteInstanceParams(0, 0) + instanceIndex;
+			}
+			if (config->paramsFromUploadRing)
+			{
+				return (_InstanceParams*)CurrentFrameUpload(instanceParamsUpload, sizeof(_InstanceParams) * config->instanceCount).contents + instanceIndex;
+			}
 			return (_InstanceParams*)([instanceParamsBuffer[qMetal::Device::CurrentFrameIndex()] contents]) + instanceIndex;
 		}
 		
+		//returns the first instance; with versioned params, instances outside [firstInstance, firstInstance + instanceCount) are copied forward
+		_InstanceParams* WriteInstanceParams(uint32_t firstInstance, uint32_t instanceCount) const
+		{
+			qASSERTM(firstInstance + instanceCount <= config->instanceCount, "Writing instances %i-%i but with a material that only supports %i", firstInstance, firstInstance + instanceCount, config->instanceCount);
+			if (config->versionedParams)
+			{
+				return (_InstanceParams*)WriteVersioned(instanceParamsBuffer, instanceParamsVersion, sizeof(_InstanceParams) * config->instanceCount, sizeof(_InstanceParams) * firstInstance, sizeof(_InstanceParams) * instanceCount);
+			}
+			return CurrentFrameInstanceParams(0);
+		}
+		
+		id<MTLBuffer> CurrentFrameInstanceParamsBuffer() const
+		{
+			qASSERTM(config->instanceParamsIndex != EmptyIndex, "No instance params index set, check material definition");
+			if (config->versionedParams)
+			{
+				return instanceParamsBuffer[instanceParamsVersion.Bind(qMetal::Device::CurrentFrameNumber())];
+			}
+			if (config->paramsFromUploadRing)
+			{
+				return CurrentFrameUpload(instanceParamsUpload, sizeof(_InstanceParams) * config->instanceCount).buffer;
+			}
+			return instanceParamsBuffer[qMetal::Device::CurrentFrameIndex()];
+		}
+		
+		NSUInteger CurrentFrameInstanceParamsOffset() const
+		{
+			return config->paramsFromUploadRing ? CurrentFrameUpload(instanceParamsUpload, sizeof(_InstanceParams) * config->instanceCount).offset : 0;
+		}
+		
 		_FragmentParams* CurrentFrameFragmentParams() const
 		{
+			if (FragmentParamsInline())
+			{
+				return fragmentParamsInline.Get();
+			}
+			if (config->versionedParams)
+			{
+				return (_FragmentParams*)WriteVersioned(fragmentParamsBuffer, fragmentParamsVersion, sizeof(_FragmentParams), 0, 0);
+			}
+			if (config->paramsFromUploadRing)
+			{
+				return (_FragmentParams*)CurrentFrameUpload(fragmentParamsUpload, sizeof(_FragmentParams)).contents;
+			}
 			return (_FragmentParams*)[CurrentFrameFragmentParamsBuffer() contents];
 		}
 		
+		_FragmentParams* WriteFragmentParams(NSUInteger writeOffset = 0, NSUInteger writeLength = sizeof(_FragmentParams)) const
+		{
+			if (config->versionedParams && !FragmentParamsInline())
+			{
+				return (_FragmentParams*)WriteVersioned(fragmentParamsBuffer, fragmentParamsVersion, sizeof(_FragmentParams), writeOffset, writeLength);
+			}
+			return CurrentFrameFragmentParams();
+		}
+		
 		id<MTLBuffer> CurrentFrameFragmentParamsBuffer() const
 		{
 			qASSERTM(config->fragmentParamsIndex != EmptyIndex, "No fragment params index set, check material definition");
+			qASSERTM(!FragmentParamsInline(), "Fragment params of %s are bound inline and have no buffer", [config->name UTF8String]);
+			if (config->versionedParams)
+			{
+				return fragmentParamsBuffer[fragmentParamsVersion.Bind(qMetal::Device::CurrentFrameNumber())];
+			}
+			if (config->paramsFromUploadRing)
+			{
+				return CurrentFrameUpload(fragmentParamsUpload, sizeof(_FragmentParams)).buffer;
+			}
 			return fragmentParamsBuffer[qMetal::Device::CurrentFrameIndex()];
 		}
 		
+		NSUInteger CurrentFrameFragmentParamsOffset() const
+		{
+			return config->paramsFromUploadRing ? CurrentFrameUpload(fragmentParamsUpload, sizeof(_FragmentParams)).offset : 0;
+		}
+		
 		id<MTLBuffer> FragmentTextureBuffer() const
 		{
 			qASSERTM(config->fragmentTextureIndex != EmptyIndex, "No fragment texture index set, check material definition");
-			return fragmentTextureBuffer;
+			return CurrentArgumentBuffer(fragmentTextureBuffer, fragmentTextureVersion);
+		}
+		
+		//swap the texture in a unit without rebuilding the material or its pipelines. the stage's argument buffer is
+		//versioned like versioned params: the first rebind in a frame writes a slot no in-flight frame is reading.
+		//on direct argument buffers the unit (and its sampler) has to have been populated when the material was made
+		void SetComputeTexture(Texture::eUnit unit, const Texture* texture)
+		{
+			RebindTexture(boundComputeTextures, NULL, unit, texture, computeTextureBuffer, computeTextureVersion, computeTextureEncoder, @"compute textures");
+		}
+		
+		void SetVertexTexture(Texture::eUnit unit, const Texture* texture)
+		{
+			qASSERTM(config->vertexTextureIndex != EmptyIndex, "qMetalMaterial %s has no vertex texture index to rebind", [config->name UTF8String]);
+			RebindTexture(boundVertexTextures, config->vertexSamplers, unit, texture, vertexTextureBuffer, vertexTextureVersion, vertexTextureEncoder, @"vertex textures");
+		}
+		
+		void SetFragmentTexture(Texture::eUnit unit, const Texture* texture)
+		{
+			qASSERTM(config->fragmentTextureIndex != EmptyIndex, "qMetalMaterial %s has no fragment texture index to rebind", [config->name UTF8String]);
+			RebindTexture(boundFragmentTextures, config->fragmentSamplers, unit, texture, fragmentTextureBuffer, fragmentTextureVersion, fragmentTextureEncoder, @"fragment textures");
+		}
+		
+		//as with the config's streams, the material doesn't retain the buffer
+		void SetComputeStream(uint32_t index, id<MTLBuffer> stream)
+		{
+			qASSERTM(config->computeStreamsIndex != EmptyIndex, "qMetalMaterial %s has no compute streams index to rebind", [config->name UTF8String]);
+			qASSERTM(index < ComputeStreamLimit, "qMetalMaterial %s compute stream %u is past the limit of %lu", [config->name UTF8String], index, (unsigned long)ComputeStreamLimit);
+			qASSERTM(stream != nil, "qMetalMaterial %s can't rebind compute stream %u to nil", [config->name UTF8String], index);
+			
+			if (boundComputeStreams[index] == stream)
+			{
+				return;
+			}
+			
+			boundComputeStreams[index] = stream;
+			
+			if (computeStreamsBuffer[0] == nil)
+			{
+				return;
+			}
+			
+			const uint32_t slot = BeginArgumentWrite(computeStreamsBuffer, computeStreamsVersion, @"compute streams");
+			qASSERTM(!DirectArgumentBuffers() || ((index + 1) * ArgumentTable::SlotSize <= [computeStreamsBuffer[0] length]), "qMetalMaterial %s compute stream %u wasn't populated when the material was made", [config->name UTF8String], index);
+			WriteStreams(computeStreamsBuffer[slot]);
 		}
 		
+		const Texture* ComputeTexture(Texture::eUnit unit) const 	{ return boundComputeTextures[unit]; }
+		const Texture* VertexTexture(Texture::eUnit unit) const 	{ return boundVertexTextures[unit]; }
+		const Texture* FragmentTexture(Texture::eUnit unit) const 	{ return boundFragmentTextures[unit]; }
+		id<MTLBuffer> ComputeStream(uint32_t index) const 			{ return boundComputeStreams[index]; }
+		
         const Function* ComputeFunction() const
         {
         	return config->computeFunction;
@@ -631,24 +1160,685 @@ namespace qMetal
 			return config->instanceCount;
 		}
 
+		//materials sharing a cached render pipeline return the same hash
+		uint64_t RenderPipelineHash() const
+		{
+			return renderPipelineKey;
+		}
+
+		bool DirectArgumentBuffers() const
+		{
+			return config->directArgumentBuffers && ArgumentTable::Supported();
+		}
+		
+		bool IsBlended() const
+		{
+			for (int i = 0; i < (int)RenderTarget::eColorAttachment_Count; ++i)
+			{
+				if ((config->blendStates[i] != NULL) && config->blendStates[i]->blendEnabled)
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		//indirect command buffers can't take inline bytes, so those materials keep their buffers
+		bool VertexParamsInline() const
+		{
+			return InlineParams<_VertexParams>::enabled && !config->forIndirectCommandBuffer;
+		}
+		
+		bool FragmentParamsInline() const
+		{
+			return InlineParams<_FragmentParams>::enabled && !config->forIndirectCommandBuffer;
+		}
+
+	protected:
+		
+		//shares the parent's pipeline states and argument encoders, owning only its own params and argument buffers
+		Material(const Config* _config, const Material* parent)
+		: config(_config)
+		, computePipelineKey(parent->computePipelineKey)
+		, renderPipelineKey(parent->renderPipelineKey)
+		, computePipelineState(nil)
+		, renderPipelineState(nil)
+		, computeTextureEncoder(parent->computeTextureEncoder)
+		, computeStreamsEncoder(parent->computeStreamsEncoder)
+		, vertexTextureEncoder(parent->vertexTextureEncoder)
+		, fragmentTextureEncoder(parent->fragmentTextureEncoder)
+		, pipelineGroup(NULL)
+		, pipelineParent(parent)
+		, pipelinesReady(false)
+		{
+			const Config* parentConfig = parent->config;
+			
+			qASSERTM(!(config->paramsFromUploadRing && config->versionedParams), "qMetalMaterial %s can't use both upload ring and versioned params", [config->name UTF8String]);
+			
+			//anything that went into the pipeline states or argument layouts has to match the parent
+			qASSERTM(config->computeFunction == parentConfig->computeFunction, "qMetalMaterial instance %s compute function doesn't match %s", [config->name UTF8String], [parentConfig->name UTF8String]);
+			qASSERTM(config->vertexFunction == parentConfig->vertexFunction, "qMetalMaterial instance %s vertex function doesn't match %s", [config->name UTF8String], [parentConfig->name UTF8String]);
+			qASSERTM(config->fragmentFunction == parentConfig->fragmentFunction, "qMetalMaterial instance %s fragment function doesn't match %s", [config->name UTF8String], [parentConfig->name UTF8String]);
+			qASSERTM(config->vertexDescriptor == parentConfig->vertexDescriptor, "qMetalMaterial instance %s vertex descriptor doesn't match %s", [config->name UTF8String], [parentConfig->name UTF8String]);
+			qASSERTM(memcmp(config->blendStates, parentConfig->blendStates, sizeof(config->blendStates)) == 0, "qMetalMaterial instance %s blend states don't match %s", [config->name UTF8String], [parentConfig->name UTF8String]);
+			qASSERTM(config->alphaToCoverage == parentConfig->alphaToCoverage, "qMetalMaterial instance %s alpha to coverage doesn't match %s", [config->name UTF8String], [parentConfig->name UTF8String]);
+			qASSERTM(config->forIndirectCommandBuffer == parentConfig->forIndirectCommandBuffer, "qMetalMaterial instance %s indirect command buffer support doesn't match %s", [config->name UTF8String], [parentConfig->name UTF8String]);
+			qASSERTM(config->tessellated == parentConfig->tessellated, "qMetalMaterial instance %s tessellation doesn't match %s", [config->name UTF8String], [parentConfig->name UTF8String]);
+			qASSERTM(!config->tessellated || ((config->tessellationIndexBufferType == parentConfig->tessellationIndexBufferType) && (config->tessellationFactorMode == parentConfig->tessellationFactorMode)), "qMetalMaterial instance %s tessellation settings don't match %s", [config->name UTF8String], [parentConfig->name UTF8String]);
+			qASSERTM(IsInstanced() == parent->IsInstanced(), "qMetalMaterial instance %s instancing doesn't match %s", [config->name UTF8String], [parentConfig->name UTF8String]);
+			qASSERTM(config->computeTextureIndex == parentConfig->computeTextureIndex, "qMetalMaterial instance %s compute texture index doesn't match %s", [config->name UTF8String], [parentConfig->name UTF8String]);
+			qASSERTM(config->computeStreamsIndex == parentConfig->computeStreamsIndex, "qMetalMaterial instance %s compute streams index doesn't match %s", [config->name UTF8String], [parentConfig->name UTF8String]);
+			qASSERTM(config->vertexTextureIndex == parentConfig->vertexTextureIndex, "qMetalMaterial instance %s vertex texture index doesn't match %s", [config->name UTF8String], [parentConfig->name UTF8String]);
+			qASSERTM(config->fragmentTextureIndex == parentConfig->fragmentTextureIndex, "qMetalMaterial instance %s fragment texture index doesn't match %s", [config->name UTF8String], [parentConfig->name UTF8String]);
+			qASSERTM(config->vertexParamsIndex == parentConfig->vertexParamsIndex, "qMetalMaterial instance %s vertex params index doesn't match %s", [config->name UTF8String], [parentConfig->name UTF8String]);
+			qASSERTM(config->fragmentParamsIndex == parentConfig->fragmentParamsIndex, "qMetalMaterial instance %s fragment params index doesn't match %s", [config->name UTF8String], [parentConfig->name UTF8String]);
+			qASSERTM(config->instanceParamsIndex == parentConfig->instanceParamsIndex, "qMetalMaterial instance %s instance params index doesn't match %s", [config->name UTF8String], [parentConfig->name UTF8String]);
+			qASSERTM(config->computeParamsIndex == parentConfig->computeParamsIndex, "qMetalMaterial instance %s compute params index doesn't match %s", [config->name UTF8String], [parentConfig->name UTF8String]);
+			qASSERTM(config->directArgumentBuffers == parentConfig->directArgumentBuffers, "qMetalMaterial instance %s direct argument buffers don't match %s", [config->name UTF8String], [parentConfig->name UTF8String]);
+			
+			//the parent's pipelines may still be building on its batch, so they're picked up once they're done
+			IsReady();
+			
+			[computeTextureEncoder retain];
+			[computeStreamsEncoder retain];
+			[vertexTextureEncoder retain];
+			[fragmentTextureEncoder retain];
+			
+			CreateBuffers();
+		}
+		
     private:
+		
+		//an instance takes its parent's pipelines, and a reference to them in the device caches, once they're built.
+		//the cache entries only exist from then on
+		bool ShareParentPipelines() const
+		{
+			if (!pipelineParent->IsReady())
+			{
+				return false;
+			}
+			
+			std::call_once(pipelinesShared, [this]()
+			{
+				computePipelineState = pipelineParent->computePipelineState;
+				renderPipelineState = pipelineParent->renderPipelineState;
+				
+				if (config->computeFunction != NULL)
+				{
+					qMetal::Device::ComputePipelineCache().AddRef(computePipelineKey);
+				}
+				
+				if (config->vertexFunction != NULL)
+				{
+					qMetal::Device::RenderPipelineCache().AddRef(renderPipelineKey);
+				}
+			});
+			
+			pipelinesReady.store(true, std::memory_order_release);
+			return true;
+		}
+		
+		//runs on the constructing thread, or on a worker if the config has a pipeline batch
+		void BuildPipeline(dispatch_block_t build)
+		{
+			if (config->pipelineBatch == NULL)
+			{
+				build();
+				return;
+			}
+			
+			if (pipelineGroup == NULL)
+			{
+				pipelineGroup = dispatch_group_create();
+			}
+			
+			config->pipelineBatch->Enqueue(pipelineGroup, build);
+		}
+		
+		void CreateComputePipeline(MTLComputePipelineDescriptor* computeDesc)
+		{
+			computePipelineState = qMetal::Device::ComputePipelineCache().Acquire(computePipelineKey, [&]()
+			{
+				if (config->computeFunction->HasStableHash())
+				{
+					qMetal::Device::ArchiveComputePipeline(computeDesc, computePipelineKey);
+				}
+				
+				NSError* error = nil;
+				id<MTLComputePipelineState> state = [qMetal::Device::Get() newComputePipelineStateWithDescriptor:computeDesc options:MTLPipelineOptionNone reflection:nil error:&error];
+				
+				qASSERTM((state != nil) && (error == nil), "qMetalMaterial Failed to create compute pipeline %s with error %s", [config->name UTF8String], [[error description] UTF8String]);
+				
+				return state;
+			});
+			
+			[computeDesc release];
+		}
+		
+		void CreateRenderPipeline(MTLRenderPipelineDescriptor* renderDesc)
+		{
+			renderPipelineState = qMetal::Device::RenderPipelineCache().Acquire(renderPipelineKey, [&]()
+			{
+				if (config->vertexFunction->HasStableHash() && ((config->fragmentFunction == NULL) || config->fragmentFunction->HasStableHash()))
+				{
+					qMetal::Device::ArchiveRenderPipeline(renderDesc, renderPipelineKey);
+				}
+				
+				NSError* error = nil;
+				id<MTLRenderPipelineState> state = [qMetal::Device::Get() newRenderPipelineStateWithDescriptor: renderDesc error: &error];
+				
+				qASSERTM((state != nil) && (error == nil), "qMetalMaterial Failed to create render pipeline %s with error %s", [config->name UTF8String], [[error description] UTF8String]);
+				
+				return state;
+			});
+			
+			[renderDesc release];
+		}
+		
+		uint64_t ComputePipelineKey() const
+		{
+			return PipelineHash()
+				.Add(config->computeFunction->Hash())
+				.Value();
+		}
+		
+		//everything the render pipeline descriptor is built from, see the constructor
+		uint64_t RenderPipelineKey(const Texture::ePixelFormat colourFormat[], const Texture::ePixelFormat depthFormat, const Texture::ePixelFormat stencilFormat, const Texture::eMSAA msaa) const
+		{
+			PipelineHash hash;
+			
+			hash.Add(config->vertexFunction->Hash());
+			hash.Add((config->fragmentFunction != NULL) ? config->fragmentFunction->Hash() : 0);
+			
+			for (int i = 0; i < (int)RenderTarget::eColorAttachment_Count; ++i)
+			{
+				const BlendState* blendState = config->blendStates[i];
+				hash.Add(blendState != NULL);
+				if (blendState != NULL)
+				{
+					hash.Add(blendState->blendEnabled)
+						.Add(blendState->rgbBlendOperation)
+						.Add(blendState->rgbSrcBlendFactor)
+						.Add(blendState->rgbDstBlendFactor)
+						.Add(blendState->alphaBlendOperation)
+						.Add(blendState->alphaSrcBlendFactor)
+						.Add(blendState->alphaDstBlendFactor);
+				}
+				hash.Add(colourFormat[i]);
+			}
+			
+			hash.Add(depthFormat)
+				.Add(stencilFormat)
+				.Add(msaa)
+				.Add(config->alphaToCoverage)
+				.Add(config->forIndirectCommandBuffer)
+				.Add(config->tessellated);
+			
+			if (config->tessellated)
+			{
+				hash.Add(config->tessellationIndexBufferType)
+					.Add(config->tessellationFactorMode)
+					.Add(IsInstanced());
+			}
+			
+			MTLVertexDescriptor* vertexDescriptor = config->vertexDescriptor;
+			hash.Add(vertexDescriptor != NULL);
+			if (vertexDescriptor != NULL)
+			{
+				for (NSUInteger i = 0; i < VertexDescriptorLimit; ++i)
+				{
+					MTLVertexAttributeDescriptor* attribute = vertexDescriptor.attributes[i];
+					if (attribute.format != MTLVertexFormatInvalid)
+					{
+						hash.Add(i).Add(attribute.format).Add(attribute.offset).Add(attribute.bufferIndex);
+					}
+					
+					MTLVertexBufferLayoutDescriptor* layout = vertexDescriptor.layouts[i];
+					if (layout.stride != 0)
+					{
+						hash.Add(i).Add(layout.stride).Add(layout.stepFunction).Add(layout.stepRate);
+					}
+				}
+			}
+			
+			return hash.Value();
+		}
+		
+		//params and argument buffers are per material (and per instance); the argument encoders are created up front
+		void CreateBuffers()
+		{
+			//the config holds the initial bindings, after which the material's own copies can be rebound
+			memcpy(boundComputeTextures, config->computeTextures, sizeof(boundComputeTextures));
+			memcpy(boundVertexTextures, config->vertexTextures, sizeof(boundVertexTextures));
+			memcpy(boundFragmentTextures, config->fragmentTextures, sizeof(boundFragmentTextures));
+			for (int i = 0; i < (int)ComputeStreamLimit; ++i)
+			{
+				boundComputeStreams[i] = config->computeStreams[i];
+			}
+			
+			//only slot 0 of each argument buffer exists until a rebind needs another version
+			for (uint32_t i = 0; i < Q_METAL_FRAMES_TO_BUFFER; ++i)
+			{
+				computeTextureBuffer[i] = nil;
+				vertexTextureBuffer[i] = nil;
+				fragmentTextureBuffer[i] = nil;
+				computeStreamsBuffer[i] = nil;
+			}
+			
+			RefreshUsageTextures();
+			
+			if ((config->computeParamsIndex != EmptyIndex) && !config->paramsFromUploadRing)
+			{
+				//we may not have a function (e.g. indirect command buffers) but still want compute params buffer
+				for (uint32_t i = 0; i < Q_METAL_FRAMES_TO_BUFFER; ++i)
+				{
+					computeParamsBuffer[i] = [qMetal::Device::Get() newBufferWithLength:sizeof(_ComputeParams) options:0];
+					computeParamsBuffer[i].label = [NSString stringWithFormat:@"%@ compute params (frame %i)", config->name, i];
+				}
+			}
+			
+			if (DirectArgumentBuffers() && (config->computeTextureIndex != EmptyIndex))
+			{
+				computeTextureBuffer[0] = ArgumentTable::NewBuffer(TextureSlotCount(boundComputeTextures, NULL), [NSString stringWithFormat:@"%@ compute textures", config->name]);
+			}
+			else if (computeTextureEncoder != nil)
+			{
+				computeTextureBuffer[0] = [qMetal::Device::Get() newBufferWithLength:computeTextureEncoder.encodedLength options:0];
+				computeTextureBuffer[0].label = [NSString stringWithFormat:@"%@ compute textures", config->name];
+			}
+			WriteTextures(computeTextureBuffer[0], computeTextureEncoder, boundComputeTextures, NULL);
+			
+			if (DirectArgumentBuffers() && (config->computeStreamsIndex != EmptyIndex))
+			{
+				uint32_t slotCount = 0;
+				for (int i = 0; i < (int)ComputeStreamLimit; ++i)
+				{
+					if (boundComputeStreams[i] != nil)
+					{
+						slotCount = i + 1;
+					}
+				}
+				
+				computeStreamsBuffer[0] = ArgumentTable::NewBuffer(slotCount, [NSString stringWithFormat:@"%@ compute streams", config->name]);
+			}
+			else if (computeStreamsEncoder != nil)
+			{
+				computeStreamsBuffer[0] = [qMetal::Device::Get() newBufferWithLength:computeStreamsEncoder.encodedLength options:0];
+				computeStreamsBuffer[0].label = [NSString stringWithFormat:@"%@ compute streams", config->name];
+			}
+			WriteStreams(computeStreamsBuffer[0]);
+			
+			if (config->vertexFunction == NULL)
+			{
+				return;
+			}
+			
+			for (uint32_t i = 0; (i < Q_METAL_FRAMES_TO_BUFFER) && !config->paramsFromUploadRing; ++i)
+			{
+				if ((config->vertexParamsIndex != EmptyIndex) && !VertexParamsInline())
+				{
+					vertexParamsBuffer[i] = [qMetal::Device::Get() newBufferWithLength:sizeof(_VertexParams) options:0];
+					vertexParamsBuffer[i].label = [NSString stringWithFormat:@"%@ vertex params (frame %i)", config->name, i];
+				}
+				
+				if ((config->fragmentParamsIndex != EmptyIndex) && !FragmentParamsInline())
+				{
+					fragmentParamsBuffer[i] = [qMetal::Device::Get() newBufferWithLength:sizeof(_FragmentParams) options:0];
+					fragmentParamsBuffer[i].label = [NSString stringWithFormat:@"%@ fragment params (frame %i)", config->name, i];
+				}
+				
+				if (IsInstanced() && (sizeof(_InstanceParams) > 0))
+				{
+					instanceParamsBuffer[i] = [qMetal::Device::Get() newBufferWithLength:(sizeof(_InstanceParams) * config->instanceCount) options:0];
+					instanceParamsBuffer[i].label = [NSString stringWithFormat:@"%@ instance params (frame %i)", config->name, i];
+				}
+			}
+			
+			//TEXTURES
+			//note that "Writable textures are not supported within an argument buffer" (https://developer.apple.com/documentation/metal/resource_objects/about_argument_buffers?language=objc)
+			//so we don't make one for Compute Shaders, as our whole goal there is outputting one (or more) textures
+			
+			if (DirectArgumentBuffers() && (config->vertexTextureIndex != EmptyIndex))
+			{
+				vertexTextureBuffer[0] = ArgumentTable::NewBuffer(TextureSlotCount(boundVertexTextures, config->vertexSamplers), [NSString stringWithFormat:@"%@ vertex textures", config->name]);
+			}
+			else if (vertexTextureEncoder != nil)
+			{
+				vertexTextureBuffer[0] = [qMetal::Device::Get() newBufferWithLength:vertexTextureEncoder.encodedLength options:0];
+				vertexTextureBuffer[0].label = [NSString stringWithFormat:@"%@ vertex textures", config->name];
+			}
+			WriteTextures(vertexTextureBuffer[0], vertexTextureEncoder, boundVertexTextures, config->vertexSamplers);
+			
+			if (DirectArgumentBuffers() && (config->fragmentTextureIndex != EmptyIndex) && (config->fragmentFunction != NULL))
+			{
+				fragmentTextureBuffer[0] = ArgumentTable::NewBuffer(TextureSlotCount(boundFragmentTextures, config->fragmentSamplers), [NSString stringWithFormat:@"%@ fragment textures", config->name]);
+			}
+			else if (fragmentTextureEncoder != nil)
+			{
+				fragmentTextureBuffer[0] = [qMetal::Device::Get() newBufferWithLength:fragmentTextureEncoder.encodedLength options:0];
+				fragmentTextureBuffer[0].label = [NSString stringWithFormat:@"%@ fragment textures", config->name];
+			}
+			WriteTextures(fragmentTextureBuffer[0], fragmentTextureEncoder, boundFragmentTextures, config->fragmentSamplers);
+		}
+		
+		//encodes every bound unit into one version of a stage's texture argument buffer. samplers is NULL for compute
+		void WriteTextures(id<MTLBuffer> buffer, id<MTLArgumentEncoder> encoder, const Texture* const textures[], const uint32_t samplers[]) const
+		{
+			if (buffer == nil)
+			{
+				return;
+			}
+			
+			const bool direct = DirectArgumentBuffers();
+			if (!direct)
+			{
+				[encoder setArgumentBuffer:buffer offset:0];
+			}
+			
+			for (int i = 0; i < (int)Texture::eUnit_Count; ++i)
+			{
+				if (textures[i] == NULL)
+				{
+					continue;
+				}
+				
+				if (direct && (samplers != NULL))
+				{
+					textures[i]->WriteArgumentTable([buffer contents], (Texture::eUnit)i, (Texture::eUnit)samplers[i]);
+				}
+				else if (direct)
+				{
+					textures[i]->WriteArgumentTable([buffer contents], (Texture::eUnit)i);
+				}
+				else if (samplers != NULL)
+				{
+					textures[i]->EncodeArgumentBuffer(encoder, (Texture::eUnit)i, (Texture::eUnit)samplers[i]);
+				}
+				else
+				{
+					textures[i]->EncodeArgumentBuffer(encoder, (Texture::eUnit)i);
+				}
+			}
+		}
+		
+		void WriteStreams(id<MTLBuffer> buffer) const
+		{
+			if (buffer == nil)
+			{
+				return;
+			}
+			
+			const bool direct = DirectArgumentBuffers();
+			if (!direct)
+			{
+				[computeStreamsEncoder setArgumentBuffer:buffer offset:0];
+			}
+			
+			for (int i = 0; i < (int)ComputeStreamLimit; ++i)
+			{
+				if (boundComputeStreams[i] == nil)
+				{
+					continue;
+				}
+				
+				if (direct)
+				{
+					ArgumentTable::SetBuffer([buffer contents], i, boundComputeStreams[i]);
+				}
+				else
+				{
+					[computeStreamsEncoder setBuffer:boundComputeStreams[i] offset:0 atIndex:i];
+				}
+			}
+		}
+		
+		void RebindTexture(const Texture* textures[], const uint32_t samplers[], Texture::eUnit unit, const Texture* texture, id<MTLBuffer>* buffers, ParamsVersion<Q_METAL_FRAMES_TO_BUFFER>& version, id<MTLArgumentEncoder> encoder, NSString* stage)
+		{
+			qASSERTM(unit < Texture::eUnit_Count, "qMetalMaterial %s %s unit %d is out of range", [config->name UTF8String], [stage UTF8String], (int)unit);
+			qASSERTM(texture != NULL, "qMetalMaterial %s can't rebind %s unit %d to nothing", [config->name UTF8String], [stage UTF8String], (int)unit);
+			
+			if (textures[unit] == texture)
+			{
+				return;
+			}
+			
+			textures[unit] = texture;
+			RefreshUsageTextures();
+			
+			//the legacy compute path binds textures directly, so there's nothing to version
+			if (buffers[0] == nil)
+			{
+				return;
+			}
+			
+			const uint32_t slot = BeginArgumentWrite(buffers, version, stage);
+			qASSERTM(!DirectArgumentBuffers() || (TextureSlotCount(textures, samplers) * ArgumentTable::SlotSize <= [buffers[0] length]), "qMetalMaterial %s %s unit %d wasn't populated when the material was made", [config->name UTF8String], [stage UTF8String], (int)unit);
+			WriteTextures(buffers[slot], encoder, textures, samplers);
+		}
+		
+		//picks a retired version for this frame, creating its buffer the first time it's used. every version is
+		//rewritten in full, as argument encoder layouts aren't guaranteed to be copyable
+		uint32_t BeginArgumentWrite(id<MTLBuffer>* buffers, ParamsVersion<Q_METAL_FRAMES_TO_BUFFER>& version, NSString* stage)
+		{
+			uint32_t previousSlot;
+			const uint32_t slot = version.BeginWrite(qMetal::Device::CurrentFrameNumber(), previousSlot);
+			
+			if (buffers[slot] == nil)
+			{
+				buffers[slot] = [qMetal::Device::Get() newBufferWithLength:[buffers[0] length] options:0];
+				buffers[slot].label = [NSString stringWithFormat:@"%@ %@ (version %u)", config->name, stage, slot];
+			}
+			
+			return slot;
+		}
+		
+		id<MTLBuffer> CurrentArgumentBuffer(const id<MTLBuffer>* buffers, ParamsVersion<Q_METAL_FRAMES_TO_BUFFER>& version) const
+		{
+			return buffers[version.Bind(qMetal::Device::CurrentFrameNumber())];
+		}
+		
+		//the non-NULL vertex + fragment textures, packed so layout encodes don't walk every unit
+		void RefreshUsageTextures()
+		{
+			vertexUsageTextureCount = 0;
+			fragmentUsageTextureCount = 0;
+			for (int i = 0; i < (int)Texture::eUnit_Count; ++i)
+			{
+				if (boundVertexTextures[i] != NULL)
+				{
+					vertexUsageTextures[vertexUsageTextureCount++] = boundVertexTextures[i];
+				}
+				if (boundFragmentTextures[i] != NULL)
+				{
+					fragmentUsageTextures[fragmentUsageTextureCount++] = boundFragmentTextures[i];
+				}
+			}
+		}
+		
+		//one slot per texture unit in use, plus its sampler's slot
+		static uint32_t TextureSlotCount(const Texture* const textures[], const uint32_t samplers[])
+		{
+			uint32_t slotCount = 0;
+			for (uint32_t i = 0; i < (uint32_t)Texture::eUnit_Count; ++i)
+			{
+				if (textures[i] != NULL)
+				{
+					slotCount = std::max(slotCount, i + 1);
+					if (samplers != NULL)
+					{
+						slotCount = std::max(slotCount, samplers[i] + 1);
+					}
+				}
+			}
+			return slotCount;
+		}
+		
+		typedef struct ParamsUpload
+		{
+			Device::UploadAllocation allocation;
+			uint64_t frameNumber;
+			
+			ParamsUpload()
+			: frameNumber(UINT64_MAX)
+			{ }
+		} ParamsUpload;
+		
+		//suballocates from the upload ring the first time a params block is touched in a frame
+		const Device::UploadAllocation& CurrentFrameUpload(ParamsUpload& upload, NSUInteger length) const
+		{
+			const uint64_t frameNumber = qMetal::Device::CurrentFrameNumber();
+			if (upload.frameNumber != frameNumber)
+			{
+				upload.allocation = qMetal::Device::AllocateUpload(length);
+				upload.frameNumber = frameNumber;
+			}
+			return upload.allocation;
+		}
+		
+		//picks a retired slot for this frame's version, copying forward anything outside the write range
+		void* WriteVersioned(const id<MTLBuffer>* buffers, ParamsVersion<Q_METAL_FRAMES_TO_BUFFER>& version, NSUInteger length, NSUInteger writeOffset, NSUInteger writeLength) const
+		{
+			qASSERTM(writeOffset + writeLength <= length, "qMetalMaterial %s write range %lu-%lu is outside a %lu byte params block", [config->name UTF8String], (unsigned long)writeOffset, (unsigned long)(writeOffset + writeLength), (unsigned long)length);
+			
+			uint32_t previousSlot;
+			const uint32_t slot = version.BeginWrite(qMetal::Device::CurrentFrameNumber(), previousSlot);
+			uint8_t* contents = (uint8_t*)[buffers[slot] contents];
+			
+			if (slot != previousSlot)
+			{
+				const uint8_t* previousContents = (const uint8_t*)[buffers[previousSlot] contents];
+				const NSUInteger writeEnd = writeOffset + writeLength;
+				if (writeOffset > 0)
+				{
+					memcpy(contents, previousContents, writeOffset);
+				}
+				if (writeEnd < length)
+				{
+					memcpy(contents + writeEnd, previousContents + writeEnd, length - writeEnd);
+				}
+			}
+			
+			return contents;
+		}
+		
+		void AssertUploadWritten(const ParamsUpload& upload, const char* stage) const
+		{
+			qASSERTM(!config->paramsFromUploadRing || (upload.frameNumber == qMetal::Device::CurrentFrameNumber()), "qMetalMaterial %s %s params come from the upload ring but weren't written this frame", [config->name UTF8String], stage);
+		}
     
+		static constexpr NSUInteger VertexDescriptorLimit = 31; //attributes and buffer layouts
+		
       	const Config* config;
 		
-		id<MTLComputePipelineState> computePipelineState;
-		id<MTLRenderPipelineState> renderPipelineState;
+		uint64_t computePipelineKey;
+		uint64_t renderPipelineKey;
+		mutable id<MTLComputePipelineState> computePipelineState;	//mutable for instances, which share their parent's lazily
+		mutable id<MTLRenderPipelineState> renderPipelineState;
+		
+		id<MTLArgumentEncoder> computeTextureEncoder;
+		id<MTLArgumentEncoder> computeStreamsEncoder;
+		id<MTLArgumentEncoder> vertexTextureEncoder;
+		id<MTLArgumentEncoder> fragmentTextureEncoder;
+		
+		dispatch_group_t pipelineGroup;
+		const Material* pipelineParent;		//for instances
+		mutable std::once_flag pipelinesShared;
+		mutable std::atomic<bool> pipelinesReady;
 		
 		id<MTLBuffer> computeParamsBuffer[Q_METAL_FRAMES_TO_BUFFER];
 		id<MTLBuffer> vertexParamsBuffer[Q_METAL_FRAMES_TO_BUFFER];
 		id<MTLBuffer> instanceParamsBuffer[Q_METAL_FRAMES_TO_BUFFER];
 		id<MTLBuffer> fragmentParamsBuffer[Q_METAL_FRAMES_TO_BUFFER];
 		
-		id<MTLBuffer> computeTextureBuffer;
-		id<MTLBuffer> vertexTextureBuffer;
-		id<MTLBuffer> fragmentTextureBuffer;
+		mutable ParamsUpload computeParamsUpload;
+		mutable ParamsUpload vertexParamsUpload;
+		mutable ParamsUpload instanceParamsUpload;
+		mutable ParamsUpload fragmentParamsUpload;
+		
+		mutable ParamsVersion<Q_METAL_FRAMES_TO_BUFFER> computeParamsVersion;
+		mutable ParamsVersion<Q_METAL_FRAMES_TO_BUFFER> vertexParamsVersion;
+		mutable ParamsVersion<Q_METAL_FRAMES_TO_BUFFER> instanceParamsVersion;
+		mutable ParamsVersion<Q_METAL_FRAMES_TO_BUFFER> fragmentParamsVersion;
+		
+		mutable InlineParams<_VertexParams> vertexParamsInline;
+		mutable InlineParams<_FragmentParams> fragmentParamsInline;
+		
+		const Texture* boundComputeTextures[Texture::eUnit_Count];
+		const Texture* boundVertexTextures[Texture::eUnit_Count];
+		const Texture* boundFragmentTextures[Texture::eUnit_Count];
+		id<MTLBuffer> boundComputeStreams[ComputeStreamLimit];
+		
+		//argument buffer versions, filled in lazily as rebinds need them
+		id<MTLBuffer> computeTextureBuffer[Q_METAL_FRAMES_TO_BUFFER];
+		id<MTLBuffer> vertexTextureBuffer[Q_METAL_FRAMES_TO_BUFFER];
+		id<MTLBuffer> fragmentTextureBuffer[Q_METAL_FRAMES_TO_BUFFER];
+		id<MTLBuffer> computeStreamsBuffer[Q_METAL_FRAMES_TO_BUFFER];
 		
-		id<MTLBuffer> computeStreamsBuffer;
+		mutable ParamsVersion<Q_METAL_FRAMES_TO_BUFFER> computeTextureVersion;
+		mutable ParamsVersion<Q_METAL_FRAMES_TO_BUFFER> vertexTextureVersion;
+		mutable ParamsVersion<Q_METAL_FRAMES_TO_BUFFER> fragmentTextureVersion;
+		mutable ParamsVersion<Q_METAL_FRAMES_TO_BUFFER> computeStreamsVersion;
+		
+		const Texture* vertexUsageTextures[Texture::eUnit_Count];
+		const Texture* fragmentUsageTextures[Texture::eUnit_Count];
+		uint32_t vertexUsageTextureCount;
+		uint32_t fragmentUsageTextureCount;
     };
+	
+	//a material that reuses another material's compiled pipeline states and argument layouts, with its own
+	//params, textures and streams. the config may differ from the parent's only in those; the parent must outlive it.
+	//creating one doesn't wait on a parent whose pipelines are still building; it isn't ready until the parent is
+	template<class _VertexParams, class _FragmentParams, class _ComputeParams = EmptyParams, class _InstanceParams = EmptyParams>
+	class MaterialInstance : public Material<_VertexParams, _FragmentParams, _ComputeParams, _InstanceParams>
+	{
+	public:
+		typedef Material<_VertexParams, _FragmentParams, _ComputeParams, _InstanceParams> Base;
+		
+		MaterialInstance(const typename Base::Config* _config, const Base* parent)
+		: Base(_config, parent)
+		{}
+	};
+	
+	//a render material whose binding layout is a compile time MaterialLayout, so its Encode() has no per-draw
+	//index or feature checks. meshes and render queues pick this Encode() up when given one of these
+	template<class _Layout, class _VertexParams, class _FragmentParams, class _ComputeParams = EmptyParams, class _InstanceParams = EmptyParams>
+	class LayoutMaterial : public Material<_VertexParams, _FragmentParams, _ComputeParams, _InstanceParams>
+	{
+	public:
+		typedef Material<_VertexParams, _FragmentParams, _ComputeParams, _InstanceParams> Base;
+		typedef _Layout Layout;
+		
+		LayoutMaterial(const typename Base::Config* _config, const RenderTarget* renderTarget)
+		: Base(_config, renderTarget)
+		{
+			Base::template CheckLayout<_Layout>();
+		}
+		
+		LayoutMaterial(const typename Base::Config* _config, const Texture::ePixelFormat colourFormat, const Texture::ePixelFormat depthFormat, const Texture::ePixelFormat stencilFormat, const Texture::eMSAA msaa)
+		: Base(_config, colourFormat, depthFormat, stencilFormat, msaa)
+		{
+			Base::template CheckLayout<_Layout>();
+		}
+		
+		LayoutMaterial(const typename Base::Config* _config, const Texture::ePixelFormat colourFormat[], const Texture::ePixelFormat depthFormat, const Texture::ePixelFormat stencilFormat, const Texture::eMSAA msaa)
+		: Base(_config, colourFormat, depthFormat, stencilFormat, msaa)
+		{
+			Base::template CheckLayout<_Layout>();
+		}
+		
+		using Base::Encode;
+		
+		bool Encode(TrackedRenderEncoder& encoder) const
+		{
+			return Base::template EncodeLayout<_Layout>(encoder);
+		}
+		
+		bool Encode(id<MTLRenderCommandEncoder> encoder) const
+		{
+			TrackedRenderEncoder untracked(encoder, false);
+			return Encode(untracked);
+		}
+	};
 }
 
 #endif //__Q_METAL_MATERIAL_H__
@@ -28,6 +28,7 @@ SOFTWARE.
 #include "qMetalDevice.h"
 #include "qMetalMaterial.h"
 #include <map>
+#include <mutex>
 
 namespace qMetal
 {
@@ -135,15 +136,27 @@ namespace qMetal
 		
 		template<class _VertexParams, class _FragmentParams, class _ComputeParams, class _InstanceParams>
         void Encode(id<MTLComputeCommandEncoder> encoder, const Material<_VertexParams, _FragmentParams, _ComputeParams, _InstanceParams> *material)
+        {
+			TrackedComputeEncoder untracked(encoder, false);
+			Encode(untracked, material);
+		}
+		
+		template<class _VertexParams, class _FragmentParams, class _ComputeParams, class _InstanceParams>
+        void Encode(TrackedComputeEncoder& encoder, const Material<_VertexParams, _FragmentParams, _ComputeParams, _InstanceParams> *material)
         {
 			qASSERT(config->tessellated);
 			
+			if (!material->IsReady())
+			{
+				return;
+			}
+			
 			for (int i = 0; i < config->tessellationStreamCount; ++i)
 			{
-				[encoder setBuffer:tessellationBuffers[i] offset:0 atIndex:i];
+				encoder.SetBuffer(tessellationBuffers[i], 0, i);
 			}
 			
-			[encoder setBuffer:tessellationFactorsBuffer offset:0 atIndex:config->tessellationFactorsIndex];
+			encoder.SetBuffer(tessellationFactorsBuffer, 0, config->tessellationFactorsIndex);
 			
 			NSUInteger width = material->IsInstanced() ? material->InstanceCount() : 1;
 			NSUInteger height = 1;
@@ -158,30 +171,133 @@ namespace qMetal
 		template<class _VertexParams, class _FragmentParams, class _ComputeParams, class _InstanceParams>
         void Encode(id<MTLRenderCommandEncoder> encoder, const Material<_VertexParams, _FragmentParams, _ComputeParams, _InstanceParams> *material)
         {
-        	material->Encode(encoder);
+			TrackedRenderEncoder untracked(encoder, false);
+			Encode(untracked, material);
+		}
+		
+		//draws through a tracked encoder skip re-binding state the previous draws already set
+		template<class _VertexParams, class _FragmentParams, class _ComputeParams, class _InstanceParams>
+        void Encode(TrackedRenderEncoder& encoder, const Material<_VertexParams, _FragmentParams, _ComputeParams, _InstanceParams> *material)
+        {
+			Encode(encoder, material, material->InstanceCount());
+		}
+		
+		//draws instanceCount instances regardless of the material's own count, for callers binding their own per-instance data
+		template<class _VertexParams, class _FragmentParams, class _ComputeParams, class _InstanceParams>
+        void Encode(TrackedRenderEncoder& encoder, const Material<_VertexParams, _FragmentParams, _ComputeParams, _InstanceParams> *material, NSUInteger instanceCount)
+        {
+			EncodeMaterial(encoder, material, instanceCount);
+		}
+		
+		//layout materials encode through their compile time layout rather than the config checks
+		template<class _Layout, class _VertexParams, class _FragmentParams, class _ComputeParams, class _InstanceParams>
+        void Encode(id<MTLRenderCommandEncoder> encoder, const LayoutMaterial<_Layout, _VertexParams, _FragmentParams, _ComputeParams, _InstanceParams> *material)
+        {
+			TrackedRenderEncoder untracked(encoder, false);
+			EncodeMaterial(untracked, material, material->InstanceCount());
+		}
+		
+		template<class _Layout, class _VertexParams, class _FragmentParams, class _ComputeParams, class _InstanceParams>
+        void Encode(TrackedRenderEncoder& encoder, const LayoutMaterial<_Layout, _VertexParams, _FragmentParams, _ComputeParams, _InstanceParams> *material)
+        {
+			EncodeMaterial(encoder, material, material->InstanceCount());
+		}
+		
+		template<class _Layout, class _VertexParams, class _FragmentParams, class _ComputeParams, class _InstanceParams>
+        void Encode(TrackedRenderEncoder& encoder, const LayoutMaterial<_Layout, _VertexParams, _FragmentParams, _ComputeParams, _InstanceParams> *material, NSUInteger instanceCount)
+        {
+			EncodeMaterial(encoder, material, instanceCount);
+		}
+		
+		void Encode(id<MTLIndirectRenderCommand> indirectRenderCommand);
+		
+		void UseResources(id<MTLComputeCommandEncoder> encoder, bool withVertexArgumentBuffer);
+		void UseResources(TrackedComputeEncoder& encoder, bool withVertexArgumentBuffer);
+		
+		void UseResources(id<MTLRenderCommandEncoder> encoder);
+		void UseResources(TrackedRenderEncoder& encoder);
+		
+		//built on the mesh's first draw with the material's vertex function, which parallel encoders can reach from
+		//several job threads at once
+		template<class _VertexParams, class _FragmentParams, class _ComputeParams, class _InstanceParams>
+		id<MTLBuffer> GetVertexArgumentBufferForMaterial(const Material<_VertexParams, _FragmentParams, _ComputeParams, _InstanceParams> *material)
+		{
+			std::lock_guard<std::mutex> lock(argumentBufferMutex);
+			argumentBufferMap_t::const_iterator found = argumentBufferMap.find(material->VertexFunction());
+			if (found == argumentBufferMap.end())
+			{
+				return CreateVertexArgumentBufferForMaterial(material);
+			}
+			return found->second;
+		}
+		
+		id<MTLBuffer> GetVertexBuffer(uint index)
+		{
+			qASSERTM(index < config->vertexStreamCount, "index is out of range for the mesh");
+			return vertexBuffers[index];
+		}
+		
+		id<MTLBuffer> GetQuadIndexBuffer()
+		{
+			return quadIndexBuffer;
+		}
+		
+		id<MTLBuffer> GetIndexBuffer()
+		{
+			return indexBuffer;
+		}
+		
+		NSUInteger GetTessellationFactorsCount()
+		{
+			return tessellationFactorsCount;
+		}
+		
+		id<MTLBuffer> GetTessellationFactorsBuffer()
+		{
+			return tessellationFactorsBuffer;
+		}
+		
+		Config* GetConfig() const
+		{
+			return config;
+		}
+		
+    private:
+		
+		template<class _Material>
+        void EncodeMaterial(TrackedRenderEncoder& encoder, const _Material *material, NSUInteger instanceCount)
+        {
+        	if (!material->Encode(encoder))
+			{
+				//pipelines are still building
+				return;
+			}
 			
 			if (config->vertexStreamIndex == EmptyIndex)
 			{
 				for (int i = 0; i < config->vertexStreamCount; ++i)
 				{
-					[encoder setVertexBuffer:vertexBuffers[i] offset:0 atIndex:i];
+					encoder.SetVertexBuffer(vertexBuffers[i], 0, i);
 				}
 			}
 			else
 			{
 				for (int i = 0; i < config->vertexStreamCount; ++i)
 				{
-					[encoder useResource:vertexBuffers[i] usage:MTLResourceUsageRead];
+					encoder.UseResource(vertexBuffers[i], MTLResourceUsageRead, MTLRenderStageVertex);
 				}
 		
 				id<MTLBuffer> argumentBuffer = GetVertexArgumentBufferForMaterial(material);
-				[encoder setVertexBuffer:argumentBuffer offset:0 atIndex:config->vertexStreamIndex];
+				encoder.SetVertexBuffer(argumentBuffer, 0, config->vertexStreamIndex);
 			}
 			
+			//one batched declaration for everything this draw and the material queued
+			encoder.FlushResidency();
+			
 			if (config->tessellated)
 			{
 				//handles instanced as well
-				NSUInteger stride = material->IsInstanced() ? 1 : 0;
+				NSUInteger stride = (instanceCount > 1) ? 1 : 0;
 				
 				if (config->tessellationFactorMode == eTessellationFactorMode_PerPatch)
 				{
@@ -190,105 +306,71 @@ namespace qMetal
 				
 				stride *= sizeof(MTLTriangleTessellationFactorsHalf);
 				
-				[encoder setTessellationFactorBuffer:tessellationFactorsBuffer offset:0 instanceStride:stride];
+				[encoder.Get() setTessellationFactorBuffer:tessellationFactorsBuffer offset:0 instanceStride:stride];
 				
 				if (config->IsQuadIndexed())
 				{
-					[encoder drawIndexedPatches:4 patchStart:0 patchCount:(config->quadIndexCount / 4) patchIndexBuffer:NULL patchIndexBufferOffset:0 controlPointIndexBuffer:quadIndexBuffer controlPointIndexBufferOffset:0 instanceCount:material->InstanceCount() baseInstance:0];
+					[encoder.Get() drawIndexedPatches:4 patchStart:0 patchCount:(config->quadIndexCount / 4) patchIndexBuffer:NULL patchIndexBufferOffset:0 controlPointIndexBuffer:quadIndexBuffer controlPointIndexBufferOffset:0 instanceCount:instanceCount baseInstance:0];
 				}
 				else if (config->IsIndexed())
 				{
-					[encoder drawIndexedPatches:3 patchStart:0 patchCount:(config->indexCount / 3) patchIndexBuffer:NULL patchIndexBufferOffset:0 controlPointIndexBuffer:indexBuffer controlPointIndexBufferOffset:0 instanceCount:material->InstanceCount() baseInstance:0];
+					[encoder.Get() drawIndexedPatches:3 patchStart:0 patchCount:(config->indexCount / 3) patchIndexBuffer:NULL patchIndexBufferOffset:0 controlPointIndexBuffer:indexBuffer controlPointIndexBufferOffset:0 instanceCount:instanceCount baseInstance:0];
 				}
 				else
 				{
-					[encoder drawPatches:3 patchStart:0 patchCount:(config->vertexCount / 3) patchIndexBuffer:NULL patchIndexBufferOffset:0 instanceCount:material->InstanceCount() baseInstance:0];
+					[encoder.Get() drawPatches:3 patchStart:0 patchCount:(config->vertexCount / 3) patchIndexBuffer:NULL patchIndexBufferOffset:0 instanceCount:instanceCount baseInstance:0];
 				}
 			}
-			else if (material->IsInstanced())
+			else if (instanceCount > 1)
 			{
 				if (config->IsIndexed())
 				{
-					[encoder drawIndexedPrimitives:(MTLPrimitiveType)config->primitiveType indexCount:config->indexCount indexType:((config->indices16 != NULL) ? MTLIndexTypeUInt16 : MTLIndexTypeUInt32) indexBuffer:indexBuffer indexBufferOffset:0 instanceCount:material->InstanceCount() baseVertex:0 baseInstance:0];
+					[encoder.Get() drawIndexedPrimitives:(MTLPrimitiveType)config->primitiveType indexCount:config->indexCount indexType:((config->indices16 != NULL) ? MTLIndexTypeUInt16 : MTLIndexTypeUInt32) indexBuffer:indexBuffer indexBufferOffset:0 instanceCount:instanceCount baseVertex:0 baseInstance:0];
 				}
 				else
 				{
-					[encoder drawPrimitives:(MTLPrimitiveType)config->primitiveType vertexStart:0 vertexCount:config->vertexCount instanceCount:material->InstanceCount()];
+					[encoder.Get() drawPrimitives:(MTLPrimitiveType)config->primitiveType vertexStart:0 vertexCount:config->vertexCount instanceCount:instanceCount];
 				}
 			}
 			else
 			{
 				if (config->IsIndexed())
 				{
-					[encoder drawIndexedPrimitives:(MTLPrimitiveType)config->primitiveType indexCount:config->indexCount indexType:((config->indices16 != NULL) ? MTLIndexTypeUInt16 : MTLIndexTypeUInt32) indexBuffer:indexBuffer indexBufferOffset:0];
+					[encoder.Get() drawIndexedPrimitives:(MTLPrimitiveType)config->primitiveType indexCount:config->indexCount indexType:((config->indices16 != NULL) ? MTLIndexTypeUInt16 : MTLIndexTypeUInt32) indexBuffer:indexBuffer indexBufferOffset:0];
 				}
 				else
 				{
-					[encoder drawPrimitives:(MTLPrimitiveType)config->primitiveType vertexStart:0 vertexCount:config->vertexCount];
+					[encoder.Get() drawPrimitives:(MTLPrimitiveType)config->primitiveType vertexStart:0 vertexCount:config->vertexCount];
 				}
 			}
         }
 		
-		void Encode(id<MTLIndirectRenderCommand> indirectRenderCommand);
-		
-		void UseResources(id<MTLComputeCommandEncoder> encoder, bool withVertexArgumentBuffer);
-		
-		void UseResources(id<MTLRenderCommandEncoder> encoder);
-		
-		template<class _VertexParams, class _FragmentParams, class _ComputeParams, class _InstanceParams>
-		id<MTLBuffer> GetVertexArgumentBufferForMaterial(const Material<_VertexParams, _FragmentParams, _ComputeParams, _InstanceParams> *material)
-		{
-			if (argumentBufferMap.find(material->VertexFunction()) == argumentBufferMap.end())
-			{
-				return CreateVertexArgumentBufferForMaterial(material);
-			}
-			return argumentBufferMap.find(material->VertexFunction())->second;
-		}
-		
-		id<MTLBuffer> GetVertexBuffer(uint index)
-		{
-			qASSERTM(index < config->vertexStreamCount, "index is out of range for the mesh");
-			return vertexBuffers[index];
-		}
-		
-		id<MTLBuffer> GetQuadIndexBuffer()
-		{
-			return quadIndexBuffer;
-		}
-		
-		id<MTLBuffer> GetIndexBuffer()
-		{
-			return indexBuffer;
-		}
-		
-		NSUInteger GetTessellationFactorsCount()
-		{
-			return tessellationFactorsCount;
-		}
-		
-		id<MTLBuffer> GetTessellationFactorsBuffer()
-		{
-			return tessellationFactorsBuffer;
-		}
-		
-		Config* GetConfig() const
-		{
-			return config;
-		}
-		
-    private:
-		
 		template<class _VertexParams, class _FragmentParams, class _ComputeParams, class _InstanceParams>
 		id<MTLBuffer> CreateVertexArgumentBufferForMaterial(const Material<_VertexParams, _FragmentParams, _ComputeParams, _InstanceParams> *material)
 		{
-			id <MTLArgumentEncoder> argumentEncoder = [material->VertexFunction()->Get() newArgumentEncoderWithBufferIndex:config->vertexStreamIndex];
-			id<MTLBuffer> argumentBuffer = [qMetal::Device::Get() newBufferWithLength:argumentEncoder.encodedLength options:0];
-			argumentBuffer.label = @"Mesh Vertex Stream Argument Buffer";
-			[argumentEncoder setArgumentBuffer:argumentBuffer offset:0];
+			id<MTLBuffer> argumentBuffer = nil;
 			
-			for (int i = 0; i < config->vertexStreamCount; ++i)
+			if (material->DirectArgumentBuffers())
+			{
+				//stream i's GPU address goes in slot i, no reflection needed
+				argumentBuffer = ArgumentTable::NewBuffer(config->vertexStreamCount, @"Mesh Vertex Stream Argument Buffer");
+				
+				for (int i = 0; i < config->vertexStreamCount; ++i)
+				{
+					ArgumentTable::SetBuffer([argumentBuffer contents], i, vertexBuffers[i]);
+				}
+			}
+			else
 			{
-				[argumentEncoder setBuffer:vertexBuffers[i] offset:0 atIndex:i];
+				id <MTLArgumentEncoder> argumentEncoder = [material->VertexFunction()->Get() newArgumentEncoderWithBufferIndex:config->vertexStreamIndex];
+				argumentBuffer = [qMetal::Device::Get() newBufferWithLength:argumentEncoder.encodedLength options:0];
+				argumentBuffer.label = @"Mesh Vertex Stream Argument Buffer";
+				[argumentEncoder setArgumentBuffer:argumentBuffer offset:0];
+				
+				for (int i = 0; i < config->vertexStreamCount; ++i)
+				{
+					[argumentEncoder setBuffer:vertexBuffers[i] offset:0 atIndex:i];
+				}
 			}
 			
 			argumentBufferMap_t::value_type KV(material->VertexFunction(), argumentBuffer);
@@ -304,6 +386,7 @@ namespace qMetal
 		
 		typedef std::map<const Function*, id<MTLBuffer> > argumentBufferMap_t;
 		argumentBufferMap_t argumentBufferMap;
+		std::mutex argumentBufferMutex;
 		
 		id<MTLBuffer>		tessellationBuffers[TessellationStreamLimit];
 		id<MTLBuffer>		vertexBuffers[VertexStreamLimit];
@@ -0,0 +1,123 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_PARAMS_VERSION_H__
+#define __Q_METAL_PARAMS_VERSION_H__
+
+#include <stdint.h>
+#include <atomic>
+#include "qCore.h"
+
+namespace qMetal
+{
+	//slot bookkeeping for a versioned, N-buffered params block. rather than writing slot (frame % N) every frame,
+	//the latest version stays bound until it changes, and a write picks a slot no in-flight frame can still be reading.
+	//a slot bound in frame B is retired once frame B + frameCount starts, the same guarantee the device's in-flight
+	//semaphore gives the regular per-frame slots. Bind() may be called from several encoding threads at once; the
+	//writes (BeginWrite) stay on the frame's thread, outside parallel encoding
+	template<uint32_t _FrameCount>
+	class ParamsVersion
+	{
+	public:
+		static constexpr uint32_t InvalidSlot = UINT32_MAX;
+		
+		ParamsVersion()
+		: latestSlot(0)
+		, version(0)
+		, writtenFrameNumber(UINT64_MAX)
+		{
+			for (uint32_t i = 0; i < _FrameCount; ++i)
+			{
+				boundFrameNumber[i].store(UINT64_MAX, std::memory_order_relaxed);
+			}
+		}
+		
+		//returns the slot to write for this frame. if it differs from the previous latest slot, the caller has to
+		//copy forward whatever it isn't about to overwrite from previousSlot
+		uint32_t BeginWrite(uint64_t frameNumber, uint32_t& previousSlot)
+		{
+			previousSlot = latestSlot;
+			
+			if (writtenFrameNumber == frameNumber)
+			{
+				//already have a slot for this frame; further writes land in the same place
+				return latestSlot;
+			}
+			
+			uint32_t slot = InvalidSlot;
+			for (uint32_t i = 1; i <= _FrameCount; ++i)
+			{
+				const uint32_t candidate = (latestSlot + i) % _FrameCount;
+				if ((candidate != latestSlot) && IsRetired(candidate, frameNumber))
+				{
+					slot = candidate;
+					break;
+				}
+			}
+			
+			//only possible with a single slot, or if the caller bound more than one slot per frame
+			qASSERTM(slot != InvalidSlot, "ParamsVersion has no retired slot to write to in frame %llu", (unsigned long long)frameNumber);
+			if (slot == InvalidSlot)
+			{
+				slot = latestSlot;
+			}
+			
+			latestSlot = slot;
+			writtenFrameNumber = frameNumber;
+			++version;
+			return slot;
+		}
+		
+		//call when the latest slot is handed to an encoder. the bound frame only moves forward, so concurrent binds in
+		//one frame (and a straggler from an older one) all leave the latest frame behind
+		uint32_t Bind(uint64_t frameNumber)
+		{
+			const uint32_t slot = latestSlot;
+			std::atomic<uint64_t>& bound = boundFrameNumber[slot];
+			uint64_t previous = bound.load(std::memory_order_relaxed);
+			while (((previous == UINT64_MAX) || (previous < frameNumber)) && !bound.compare_exchange_weak(previous, frameNumber, std::memory_order_relaxed))
+			{ }
+			return slot;
+		}
+		
+		bool IsRetired(uint32_t slot, uint64_t frameNumber) const
+		{
+			const uint64_t bound = boundFrameNumber[slot].load(std::memory_order_relaxed);
+			return (bound == UINT64_MAX) || (bound + _FrameCount <= frameNumber);
+		}
+		
+		uint32_t LatestSlot() const 		{ return latestSlot; }
+		uint64_t Version() const 			{ return version; }
+		bool WrittenIn(uint64_t frameNumber) const { return writtenFrameNumber == frameNumber; }
+		
+	private:
+		ParamsVersion(const ParamsVersion&);
+		ParamsVersion& operator=(const ParamsVersion&);
+		
+		uint32_t	latestSlot;
+		uint64_t	version;
+		uint64_t	writtenFrameNumber;
+		std::atomic<uint64_t>	boundFrameNumber[_FrameCount];
+	};
+}
+
+#endif //__Q_METAL_PARAMS_VERSION_H__
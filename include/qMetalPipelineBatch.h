@@ -0,0 +1,85 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_PIPELINE_BATCH_H__
+#define __Q_METAL_PIPELINE_BATCH_H__
+
+#include <dispatch/dispatch.h>
+#include "qCore.h"
+
+namespace qMetal
+{
+	//a set of pipeline builds fanned out over GCD's worker threads. owners (materials, indirect meshes) pass their
+	//own group too so they can tell when their pipelines are ready, while the batch lets a loader wait on everything
+	class PipelineBatch
+	{
+	public:
+		PipelineBatch()
+		: group(dispatch_group_create())
+		{ }
+		
+		~PipelineBatch()
+		{
+			Wait();
+			dispatch_release(group);
+		}
+		
+		void Enqueue(dispatch_block_t build)
+		{
+			dispatch_group_async(group, Queue(), build);
+		}
+		
+		//runs build on a worker thread as part of both this batch and ownerGroup
+		void Enqueue(dispatch_group_t ownerGroup, dispatch_block_t build)
+		{
+			dispatch_group_t batchGroup = group;
+			dispatch_group_enter(batchGroup);
+			dispatch_group_async(ownerGroup, Queue(), ^{
+				build();
+				dispatch_group_leave(batchGroup);
+			});
+		}
+		
+		bool IsComplete() const
+		{
+			return dispatch_group_wait(group, DISPATCH_TIME_NOW) == 0;
+		}
+		
+		void Wait() const
+		{
+			dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+		}
+		
+		static dispatch_queue_t Queue()
+		{
+			return dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+		}
+		
+	private:
+		PipelineBatch(const PipelineBatch&);
+		PipelineBatch& operator=(const PipelineBatch&);
+		
+		dispatch_group_t group;
+	};
+}
+
+#endif //__Q_METAL_PIPELINE_BATCH_H__
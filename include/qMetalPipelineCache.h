@@ -0,0 +1,197 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_PIPELINE_CACHE_H__
+#define __Q_METAL_PIPELINE_CACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <condition_variable>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+#include "qCore.h"
+
+namespace qMetal
+{
+	//64 bit FNV-1a over the fields that go into a pipeline descriptor. only scalars are hashed directly
+	//so struct padding can't leak into the key
+	class PipelineHash
+	{
+	public:
+		static constexpr uint64_t Seed = 14695981039346656037ULL;
+		static constexpr uint64_t Prime = 1099511628211ULL;
+		
+		PipelineHash()
+		: value(Seed)
+		{ }
+		
+		PipelineHash& AddBytes(const void* data, size_t size)
+		{
+			const uint8_t* bytes = (const uint8_t*)data;
+			for (size_t i = 0; i < size; ++i)
+			{
+				value = (value ^ bytes[i]) * Prime;
+			}
+			return *this;
+		}
+		
+		//length prefixed, so ("ab", "c") and ("a", "bc") hash differently
+		PipelineHash& AddString(const char* string)
+		{
+			const uint64_t length = (string != NULL) ? strlen(string) : 0;
+			Add(length);
+			return AddBytes(string, length);
+		}
+		
+		template<class _Value>
+		PipelineHash& Add(const _Value& v)
+		{
+			static_assert(std::is_scalar<_Value>::value, "PipelineHash only hashes scalars directly");
+			return AddBytes(&v, sizeof(v));
+		}
+		
+		uint64_t Value() const
+		{
+			return value;
+		}
+		
+	private:
+		uint64_t value;
+	};
+	
+	//deduplicates pipeline objects by content hash. the first Acquire of a key creates the object, later ones share it,
+	//and the object is handed back to the caller to destroy once the last reference is released. the device
+	//instantiates it for render and compute pipeline states.
+	//safe to use from several threads: creation runs outside the lock so different keys compile in parallel, and
+	//threads acquiring a key that's still being created wait for it rather than creating it twice
+	template<class _Object>
+	class PipelineCache
+	{
+	public:
+		typedef uint64_t Key;
+		
+		PipelineCache()
+		: hits(0)
+		, misses(0)
+		{ }
+		
+		template<class _Create>
+		_Object Acquire(Key key, _Create create)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			
+			typename EntryMap::iterator it = entries.find(key);
+			if (it != entries.end())
+			{
+				++hits;
+				++it->second.refCount;
+				while (it->second.pending)
+				{
+					created.wait(lock);
+					it = entries.find(key); //rehashing may have moved it
+				}
+				return it->second.object;
+			}
+			
+			++misses;
+			Entry& entry = entries[key];
+			entry.refCount = 1;
+			entry.pending = true;
+			
+			lock.unlock();
+			_Object object = create();
+			lock.lock();
+			
+			it = entries.find(key);
+			it->second.object = object;
+			it->second.pending = false;
+			created.notify_all();
+			return object;
+		}
+		
+		//for sharers that already hold the object (e.g. material instances)
+		void AddRef(Key key)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			typename EntryMap::iterator it = entries.find(key);
+			qASSERTM(it != entries.end(), "PipelineCache AddRef of unknown key %llx", (unsigned long long)key);
+			++it->second.refCount;
+		}
+		
+		//returns true, with the object in released, once the last reference is gone
+		bool Release(Key key, _Object& released)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			typename EntryMap::iterator it = entries.find(key);
+			qASSERTM(it != entries.end(), "PipelineCache Release of unknown key %llx", (unsigned long long)key);
+			qASSERTM(it->second.refCount > 0, "PipelineCache key %llx over-released", (unsigned long long)key);
+			qASSERTM(!it->second.pending, "PipelineCache key %llx released while it's still being created", (unsigned long long)key);
+			
+			if (--it->second.refCount > 0)
+			{
+				return false;
+			}
+			
+			released = it->second.object;
+			entries.erase(it);
+			return true;
+		}
+		
+		uint32_t RefCount(Key key) const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			typename EntryMap::const_iterator it = entries.find(key);
+			return (it != entries.end()) ? it->second.refCount : 0;
+		}
+		
+		void ResetCounters()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			hits = 0;
+			misses = 0;
+		}
+		
+		uint32_t Hits() const 		{ std::lock_guard<std::mutex> lock(mutex); return hits; }
+		uint32_t Misses() const 	{ std::lock_guard<std::mutex> lock(mutex); return misses; }
+		size_t Size() const 		{ std::lock_guard<std::mutex> lock(mutex); return entries.size(); }
+		
+	private:
+		typedef struct Entry
+		{
+			_Object object;
+			uint32_t refCount;
+			bool pending;
+		} Entry;
+		
+		typedef std::unordered_map<Key, Entry> EntryMap;
+		
+		mutable std::mutex mutex;
+		std::condition_variable created;
+		EntryMap entries;
+		uint32_t hits;
+		uint32_t misses;
+	};
+}
+
+#endif //__Q_METAL_PIPELINE_CACHE_H__
@@ -0,0 +1,307 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_PIPELINE_MANIFEST_H__
+#define __Q_METAL_PIPELINE_MANIFEST_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unordered_map>
+#include <vector>
+#include "qMetalPipelineCache.h"
+#include "qCore.h"
+
+namespace qMetal
+{
+	//the set of pipelines a session actually built, saved alongside the binary archive holding their compiled code.
+	//a manifest written for a different environment (device, shader library, app supplied version) or in an older
+	//format is thrown away on load, so a stale archive is never trusted. the device decides what
+	//goes into the environment hash and owns the archive itself
+	//
+	//format, all little endian:
+	//	header	magic u32, format version u32, environment hash u64, record count u32, reserved u32
+	//	records	pipeline key u64, pipeline kind u32, reserved u32
+	//	footer	FNV-1a of everything before it u64
+	class PipelineManifest
+	{
+	public:
+		static constexpr uint32_t Magic = 0x4D504D71; //"qMPM"
+		static constexpr uint32_t FormatVersion = 1;
+		
+		enum ePipelineKind
+		{
+			ePipelineKind_Compute,
+			ePipelineKind_Render,
+			ePipelineKind_Count,
+		};
+		
+		enum eLoadResult
+		{
+			eLoadResult_Loaded,
+			eLoadResult_Missing,
+			eLoadResult_Corrupt,
+			eLoadResult_WrongVersion,
+			eLoadResult_WrongEnvironment,
+		};
+		
+		explicit PipelineManifest(uint64_t _environmentHash)
+		: environmentHash(_environmentHash)
+		, loadedCount(0)
+		, usedCount(0)
+		, newCount(0)
+		{ }
+		
+		eLoadResult Load(const uint8_t* data, size_t size)
+		{
+			Clear();
+			
+			if (data == NULL)
+			{
+				return eLoadResult_Missing;
+			}
+			
+			const size_t headerSize = 24;
+			const size_t recordSize = 16;
+			const size_t footerSize = 8;
+			
+			if (size < headerSize + footerSize)
+			{
+				return eLoadResult_Corrupt;
+			}
+			
+			if (Read32(data) != Magic)
+			{
+				return eLoadResult_Corrupt;
+			}
+			
+			if (Read32(data + 4) != FormatVersion)
+			{
+				return eLoadResult_WrongVersion;
+			}
+			
+			const uint32_t count = Read32(data + 16);
+			if ((size - headerSize - footerSize) / recordSize < count || size != headerSize + (count * recordSize) + footerSize)
+			{
+				return eLoadResult_Corrupt;
+			}
+			
+			if (Read64(data + size - footerSize) != PipelineHash().AddBytes(data, size - footerSize).Value())
+			{
+				return eLoadResult_Corrupt;
+			}
+			
+			if (Read64(data + 8) != environmentHash)
+			{
+				return eLoadResult_WrongEnvironment;
+			}
+			
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				const uint8_t* record = data + headerSize + (i * recordSize);
+				const uint32_t kind = Read32(record + 8);
+				if (kind >= ePipelineKind_Count)
+				{
+					Clear();
+					return eLoadResult_Corrupt;
+				}
+				
+				Entry& entry = entries[EntryKey((ePipelineKind)kind, Read64(record))];
+				entry.key = Read64(record);
+				entry.kind = (ePipelineKind)kind;
+				entry.archived = true;
+				entry.used = false;
+			}
+			
+			loadedCount = (uint32_t)entries.size();
+			return eLoadResult_Loaded;
+		}
+		
+		eLoadResult LoadFile(const char* path)
+		{
+			std::vector<uint8_t> data;
+			if (!ReadFile(path, data))
+			{
+				Clear();
+				return eLoadResult_Missing;
+			}
+			return Load(data.data(), data.size());
+		}
+		
+		//only pipelines used this session are written, so ones that stopped being used age out
+		std::vector<uint8_t> Serialize() const
+		{
+			std::vector<uint8_t> data;
+			data.reserve(24 + (usedCount * 16) + 8);
+			
+			Write32(data, Magic);
+			Write32(data, FormatVersion);
+			Write64(data, environmentHash);
+			Write32(data, usedCount);
+			Write32(data, 0);
+			
+			for (EntryMap::const_iterator it = entries.begin(); it != entries.end(); ++it)
+			{
+				if (it->second.used)
+				{
+					Write64(data, it->second.key);
+					Write32(data, (uint32_t)it->second.kind);
+					Write32(data, 0);
+				}
+			}
+			
+			Write64(data, PipelineHash().AddBytes(data.data(), data.size()).Value());
+			return data;
+		}
+		
+		bool SaveFile(const char* path) const
+		{
+			const std::vector<uint8_t> data = Serialize();
+			FILE* file = fopen(path, "wb");
+			if (file == NULL)
+			{
+				return false;
+			}
+			const bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+			return (fclose(file) == 0) && written;
+		}
+		
+		//marks a pipeline as used this session; returns whether a previous session already archived it
+		bool Record(ePipelineKind kind, uint64_t key)
+		{
+			Entry& entry = entries[EntryKey(kind, key)];
+			if (!entry.used)
+			{
+				if (!entry.archived)
+				{
+					entry.key = key;
+					entry.kind = kind;
+					++newCount;
+				}
+				entry.used = true;
+				++usedCount;
+			}
+			return entry.archived;
+		}
+		
+		bool IsArchived(ePipelineKind kind, uint64_t key) const
+		{
+			EntryMap::const_iterator it = entries.find(EntryKey(kind, key));
+			return (it != entries.end()) && it->second.archived;
+		}
+		
+		//whether saving would change what's on disk
+		bool IsDirty() const
+		{
+			return (newCount > 0) || (usedCount != loadedCount);
+		}
+		
+		void Clear()
+		{
+			entries.clear();
+			loadedCount = 0;
+			usedCount = 0;
+			newCount = 0;
+		}
+		
+		uint64_t EnvironmentHash() const 	{ return environmentHash; }
+		uint32_t LoadedCount() const 		{ return loadedCount; }
+		uint32_t UsedCount() const 			{ return usedCount; }
+		uint32_t NewCount() const 			{ return newCount; }
+		
+	private:
+		typedef struct Entry
+		{
+			uint64_t key;
+			ePipelineKind kind;
+			bool archived;	//in the manifest we loaded
+			bool used;		//built this session
+			
+			Entry()
+			: key(0)
+			, kind(ePipelineKind_Compute)
+			, archived(false)
+			, used(false)
+			{ }
+		} Entry;
+		
+		typedef std::unordered_map<uint64_t, Entry> EntryMap;
+		
+		//render and compute keys come from different caches, so keep them apart
+		static uint64_t EntryKey(ePipelineKind kind, uint64_t key)
+		{
+			return PipelineHash().Add((uint32_t)kind).Add(key).Value();
+		}
+		
+		static uint32_t Read32(const uint8_t* data)
+		{
+			return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+		}
+		
+		static uint64_t Read64(const uint8_t* data)
+		{
+			return (uint64_t)Read32(data) | ((uint64_t)Read32(data + 4) << 32);
+		}
+		
+		static void Write32(std::vector<uint8_t>& data, uint32_t value)
+		{
+			for (int i = 0; i < 4; ++i)
+			{
+				data.push_back((uint8_t)(value >> (i * 8)));
+			}
+		}
+		
+		static void Write64(std::vector<uint8_t>& data, uint64_t value)
+		{
+			Write32(data, (uint32_t)value);
+			Write32(data, (uint32_t)(value >> 32));
+		}
+		
+		static bool ReadFile(const char* path, std::vector<uint8_t>& data)
+		{
+			FILE* file = fopen(path, "rb");
+			if (file == NULL)
+			{
+				return false;
+			}
+			
+			uint8_t chunk[4096];
+			size_t read;
+			while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+			{
+				data.insert(data.end(), chunk, chunk + read);
+			}
+			
+			const bool failed = ferror(file) != 0;
+			fclose(file);
+			return !failed;
+		}
+		
+		uint64_t environmentHash;
+		EntryMap entries;
+		uint32_t loadedCount;
+		uint32_t usedCount;
+		uint32_t newCount;
+	};
+}
+
+#endif //__Q_METAL_PIPELINE_MANIFEST_H__
@@ -0,0 +1,176 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_QUEUE_TIMELINE_H__
+#define __Q_METAL_QUEUE_TIMELINE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include "qCore.h"
+
+namespace qMetal
+{
+	//ordering bookkeeping for command queues that signal a shared event each: every queue's submissions count up from 1,
+	//and a submission signals its value on the queue's event once it completes. Wait() records that the queue's
+	//submission in progress waits for another queue's point, and says whether that wait is needed at all: not when the
+	//point's done, and not when an earlier wait already covers it, directly or through the points that one waited on.
+	//the device turns the waits and submissions into event waits and signals
+	class QueueTimeline
+	{
+	public:
+		static constexpr uint32_t QueueLimit = 4;
+		
+		//value 0 is before anything was submitted, so it's always complete
+		typedef struct Point
+		{
+			uint32_t	queue;
+			uint64_t	value;
+		} Point;
+		
+		QueueTimeline(uint32_t _queueCount)
+		: queueCount(_queueCount)
+		, waitCount(0)
+		, elidedCount(0)
+		{
+			qASSERTM(queueCount > 0 && queueCount <= QueueLimit, "QueueTimeline queue count %u must be in [1, %u]", queueCount, QueueLimit);
+			for (uint32_t queue = 0; queue < QueueLimit; ++queue)
+			{
+				submitted[queue] = 0;
+				completed[queue] = 0;
+				for (uint32_t other = 0; other < QueueLimit; ++other)
+				{
+					known[queue].value[other] = 0;
+				}
+			}
+		}
+		
+		//what the queue's submission in progress signals once it completes
+		Point Next(uint32_t queue) const
+		{
+			return MakePoint(queue, submitted[queue] + 1);
+		}
+		
+		//the queue's most recent submission
+		Point Last(uint32_t queue) const
+		{
+			return MakePoint(queue, submitted[queue]);
+		}
+		
+		//whether the queue's submission in progress already starts after point completes: the point's on the same
+		//queue, done, or behind an earlier wait
+		bool Covers(uint32_t queue, Point point) const
+		{
+			return (point.queue == queue) || (point.value <= completed[point.queue]) || (point.value <= known[queue].value[point.queue]);
+		}
+		
+		//true if the queue's submission in progress has to wait on point
+		bool Wait(uint32_t queue, Point point)
+		{
+			qASSERTM(point.queue < queueCount, "QueueTimeline point on queue %u of %u", point.queue, queueCount);
+			qASSERTM(point.value <= submitted[point.queue], "QueueTimeline queue %u waits on queue %u value %llu, which isn't submitted yet and would never signal", queue, point.queue, (unsigned long long)point.value);
+			
+			if (Covers(queue, point))
+			{
+				++elidedCount;
+				return false;
+			}
+			
+			//everything the point waited on is now behind this queue too
+			const Clock& clock = History(point);
+			for (uint32_t other = 0; other < queueCount; ++other)
+			{
+				known[queue].value[other] = (clock.value[other] > known[queue].value[other]) ? clock.value[other] : known[queue].value[other];
+			}
+			
+			++waitCount;
+			return true;
+		}
+		
+		//closes the queue's submission in progress, which signals the returned point
+		Point Submit(uint32_t queue)
+		{
+			qASSERTM(queue < queueCount, "QueueTimeline queue %u of %u", queue, queueCount);
+			++submitted[queue];
+			known[queue].value[queue] = submitted[queue];
+			history[queue].push_back(known[queue]);
+			return Last(queue);
+		}
+		
+		//the value the queue's event has reached; points up to it no longer need their history
+		void Completed(uint32_t queue, uint64_t value)
+		{
+			if (value <= completed[queue])
+			{
+				return;
+			}
+			
+			qASSERTM(value <= submitted[queue], "QueueTimeline queue %u completed %llu, past its last submission", queue, (unsigned long long)value);
+			completed[queue] = value;
+			while (!history[queue].empty() && (history[queue].front().value[queue] <= value))
+			{
+				history[queue].pop_front();
+			}
+		}
+		
+		bool IsComplete(Point point) const 				{ return point.value <= completed[point.queue]; }
+		uint64_t SubmittedValue(uint32_t queue) const 	{ return submitted[queue]; }
+		uint64_t CompletedValue(uint32_t queue) const 	{ return completed[queue]; }
+		uint32_t QueueCount() const 					{ return queueCount; }
+		
+		//waits that had to be encoded, and ones that were already covered
+		uint64_t WaitCount() const 						{ return waitCount; }
+		uint64_t ElidedCount() const 					{ return elidedCount; }
+		
+		static Point MakePoint(uint32_t queue, uint64_t value)
+		{
+			Point point;
+			point.queue = queue;
+			point.value = value;
+			return point;
+		}
+		
+	private:
+		//per queue, the highest value known to be complete before a submission starts
+		typedef struct Clock
+		{
+			uint64_t	value[QueueLimit];
+		} Clock;
+		
+		const Clock& History(Point point) const
+		{
+			const std::deque<Clock>& queueHistory = history[point.queue];
+			const uint64_t first = queueHistory.front().value[point.queue];
+			return queueHistory[(size_t)(point.value - first)];
+		}
+		
+		uint32_t			queueCount;
+		uint64_t			submitted[QueueLimit];
+		uint64_t			completed[QueueLimit];
+		Clock				known[QueueLimit];		//for each queue's submission in progress
+		std::deque<Clock>	history[QueueLimit];	//for each submission that hasn't completed
+		uint64_t			waitCount;
+		uint64_t			elidedCount;
+	};
+}
+
+#endif //__Q_METAL_QUEUE_TIMELINE_H__
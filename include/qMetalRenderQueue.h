@@ -0,0 +1,286 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_RENDER_QUEUE_H__
+#define __Q_METAL_RENDER_QUEUE_H__
+
+#include <Metal/Metal.h>
+#include <atomic>
+#include "qCore.h"
+#include "qMetalDrawQueue.h"
+#include "qMetalMaterial.h"
+#include "qMetalMesh.h"
+#include "qMetalTrackedEncoder.h"
+
+namespace qMetal
+{
+	//collects mesh + material draws from any number of threads, sorts them by pass, pipeline, material, mesh and
+	//depth, then encodes them in that order through a tracked encoder so consecutive draws skip shared state.
+	//submission is thread safe; Sort() and Encode() run on the encoding thread once submission is done
+	class RenderQueue
+	{
+	public:
+		typedef struct Config
+		{
+			NSString*	name;
+			uint32_t	capacity;
+			ParamIndex	instanceDataIndex;	//vertex buffer index per-draw instance data is bound to with setVertexBytes, if any
+			bool		autoInstance;		//consecutive sorted draws of the same mesh + material become one instanced draw, with their instance data packed into an upload ring array indexed by [[instance_id]]
+			
+			Config(NSString* _name)
+			: name([_name retain])
+			, capacity(0)
+			, instanceDataIndex(EmptyIndex)
+			, autoInstance(false)
+			{ }
+			
+			Config(Config* config, NSString* _name)
+			: name([_name retain])
+			, capacity(config->capacity)
+			, instanceDataIndex(config->instanceDataIndex)
+			, autoInstance(config->autoInstance)
+			{ }
+			
+		} Config;
+		
+		RenderQueue(Config* _config)
+		: config(_config)
+		, queue(_config->capacity)
+		, drawCallCount(0)
+		, instancedDrawCount(0)
+		{
+			qASSERTM(!config->autoInstance || (config->instanceDataIndex != EmptyIndex), "RenderQueue %s auto instancing needs an instance data index", [config->name UTF8String]);
+		}
+		
+		//depth is normalised view depth: opaque draws are ordered front to back, blended draws back to front.
+		//instanceData is copied at encode time, so it must stay valid until then. with autoInstance the shader
+		//sees it as element [[instance_id]] of an array, so instanceDataSize must be the shader's struct stride
+		template<class _VertexParams, class _FragmentParams, class _ComputeParams, class _InstanceParams>
+		bool Submit(uint32_t pass, Mesh* mesh, const Material<_VertexParams, _FragmentParams, _ComputeParams, _InstanceParams>* material, float depth, const void* instanceData = NULL, uint32_t instanceDataSize = 0)
+		{
+			return SubmitMaterial(pass, mesh, material, depth, instanceData, instanceDataSize);
+		}
+		
+		template<class _Layout, class _VertexParams, class _FragmentParams, class _ComputeParams, class _InstanceParams>
+		bool Submit(uint32_t pass, Mesh* mesh, const LayoutMaterial<_Layout, _VertexParams, _FragmentParams, _ComputeParams, _InstanceParams>* material, float depth, const void* instanceData = NULL, uint32_t instanceDataSize = 0)
+		{
+			return SubmitMaterial(pass, mesh, material, depth, instanceData, instanceDataSize);
+		}
+		
+		//sorts over the device's job system
+		void Sort()
+		{
+			queue.Sort(Device::Jobs());
+		}
+		
+		//encodes every queued draw, in key order
+		void Encode(TrackedRenderEncoder& encoder)
+		{
+			Sort();
+			EncodeRange(encoder, 0, queue.Count());
+		}
+		
+		//encodes only the draws submitted to pass, for passes that each get their own encoder
+		void Encode(TrackedRenderEncoder& encoder, uint32_t pass)
+		{
+			Sort();
+			EncodeRange(encoder, queue.PassBegin(pass), queue.PassBegin(pass + 1));
+		}
+		
+		void Encode(id<MTLRenderCommandEncoder> encoder)
+		{
+			TrackedRenderEncoder tracked(encoder);
+			Encode(tracked);
+		}
+		
+		void Encode(id<MTLRenderCommandEncoder> encoder, uint32_t pass)
+		{
+			TrackedRenderEncoder tracked(encoder);
+			Encode(tracked, pass);
+		}
+		
+		//encodes part of partCount equal slices of the sorted draws, for RenderTarget's parallel sub-encoders. safe to
+		//call from several threads at once, but Sort() must have run first
+		void EncodePart(TrackedRenderEncoder& encoder, uint32_t part, uint32_t partCount)
+		{
+			EncodeSlice(encoder, 0, queue.Count(), part, partCount);
+		}
+		
+		void EncodePart(TrackedRenderEncoder& encoder, uint32_t pass, uint32_t part, uint32_t partCount)
+		{
+			EncodeSlice(encoder, queue.PassBegin(pass), queue.PassBegin(pass + 1), part, partCount);
+		}
+		
+		//call once the frame's draws are encoded, before submitting the next frame's
+		void Reset()
+		{
+			queue.Reset();
+			drawCallCount = 0;
+			instancedDrawCount = 0;
+		}
+		
+		uint32_t Count() const
+		{
+			return queue.Count();
+		}
+		
+		//draw calls issued by Encode() since the last Reset(), and how many of those were merged instanced draws
+		uint32_t DrawCallCount() const			{ return drawCallCount; }
+		uint32_t InstancedDrawCount() const		{ return instancedDrawCount; }
+		
+		Config* GetConfig() const
+		{
+			return config;
+		}
+		
+	private:
+		struct Draw;
+		typedef void (*EncodeFunction)(TrackedRenderEncoder& encoder, const Draw& draw, NSUInteger instanceCount);
+		
+		struct Draw
+		{
+			EncodeFunction	encode;
+			Mesh*			mesh;
+			const void*		material;
+			const void*		instanceData;
+			uint32_t		instanceDataSize;
+			bool			instanceable;	//the material draws one instance and the mesh isn't tessellated, so the draw can be merged
+		};
+		
+		template<class _Material>
+		bool SubmitMaterial(uint32_t pass, Mesh* mesh, const _Material* material, float depth, const void* instanceData, uint32_t instanceDataSize)
+		{
+			qASSERTM(instanceDataSize <= 4096, "RenderQueue %s instance data of %u bytes is over the 4KB setVertexBytes limit", [config->name UTF8String], instanceDataSize);
+			qASSERTM((instanceData == NULL) || (config->instanceDataIndex != EmptyIndex), "RenderQueue %s was given instance data without an instance data index", [config->name UTF8String]);
+			
+			Draw draw;
+			draw.encode = &EncodeDraw<_Material>;
+			draw.mesh = mesh;
+			draw.material = material;
+			draw.instanceData = instanceData;
+			draw.instanceDataSize = instanceDataSize;
+			draw.instanceable = (material->InstanceCount() == 1) && !mesh->GetConfig()->tessellated;
+			
+			const uint64_t key = DrawKey::Make(pass, material->RenderPipelineHash(), (uint64_t)(uintptr_t)material, (uint64_t)(uintptr_t)mesh, depth, material->IsBlended());
+			const bool submitted = queue.Submit(key, draw);
+			qWARNING(submitted, "RenderQueue %s is full at %u draws, dropping draw", [config->name UTF8String], queue.Capacity());
+			return submitted;
+		}
+		
+		//keeps the material's concrete type, so layout materials get their layout encode
+		template<class _Material>
+		static void EncodeDraw(TrackedRenderEncoder& encoder, const Draw& draw, NSUInteger instanceCount)
+		{
+			const _Material* material = (const _Material*)draw.material;
+			draw.mesh->Encode(encoder, material, draw.instanceable ? instanceCount : material->InstanceCount());
+		}
+		
+		static bool CanMerge(const Draw& first, const Draw& draw)
+		{
+			return draw.instanceable
+				&& (draw.mesh == first.mesh)
+				&& (draw.material == first.material)
+				&& (draw.instanceDataSize == first.instanceDataSize)
+				&& (draw.instanceData != NULL);
+		}
+		
+		void EncodeSlice(TrackedRenderEncoder& encoder, uint32_t begin, uint32_t end, uint32_t part, uint32_t partCount)
+		{
+			qASSERTM(queue.IsSorted(), "RenderQueue %s must be sorted before encoding in parts", [config->name UTF8String]);
+			qASSERTM(part < partCount, "RenderQueue %s part %u of %u", [config->name UTF8String], part, partCount);
+			
+			const uint64_t count = end - begin;
+			EncodeRange(encoder, begin + (uint32_t)((count * part) / partCount), begin + (uint32_t)((count * (part + 1)) / partCount));
+		}
+		
+		//counts locally, so parts encoding on several threads only touch the totals once
+		void EncodeRange(TrackedRenderEncoder& encoder, uint32_t begin, uint32_t end)
+		{
+			uint32_t drawCalls = 0;
+			uint32_t instancedDraws = 0;
+			
+			uint32_t i = begin;
+			while (i < end)
+			{
+				const Draw& draw = queue.Draw(i);
+				
+				if (!config->autoInstance)
+				{
+					if (draw.instanceData != NULL)
+					{
+						encoder.SetVertexBytes(draw.instanceData, draw.instanceDataSize, config->instanceDataIndex);
+					}
+					draw.encode(encoder, draw, 1);
+					++drawCalls;
+					++i;
+					continue;
+				}
+				
+				//the sort puts same mesh + material draws next to each other, and merging only consecutive
+				//draws keeps blended draws in their back to front order
+				uint32_t groupEnd = i + 1;
+				if (draw.instanceable && (draw.instanceData != NULL))
+				{
+					while ((groupEnd < end) && CanMerge(draw, queue.Draw(groupEnd)))
+					{
+						++groupEnd;
+					}
+				}
+				
+				const uint32_t groupCount = groupEnd - i;
+				if (draw.instanceData != NULL)
+				{
+					//shaders index this as an array even when the group is a single draw
+					Device::UploadAllocation upload = Device::AllocateUpload(draw.instanceDataSize * groupCount);
+					uint8_t* contents = (uint8_t*)upload.contents;
+					for (uint32_t j = i; j < groupEnd; ++j)
+					{
+						memcpy(contents, queue.Draw(j).instanceData, draw.instanceDataSize);
+						contents += draw.instanceDataSize;
+					}
+					encoder.SetVertexBuffer(upload.buffer, upload.offset, config->instanceDataIndex);
+				}
+				
+				draw.encode(encoder, draw, groupCount);
+				++drawCalls;
+				if (groupCount > 1)
+				{
+					++instancedDraws;
+				}
+				i = groupEnd;
+			}
+			
+			drawCallCount += drawCalls;
+			instancedDrawCount += instancedDraws;
+		}
+		
+		RenderQueue(const RenderQueue&);
+		RenderQueue& operator=(const RenderQueue&);
+		
+		Config*					config;
+		DrawQueue<Draw>			queue;
+		std::atomic<uint32_t>	drawCallCount;
+		std::atomic<uint32_t>	instancedDrawCount;
+	};
+}
+
+#endif //__Q_METAL_RENDER_QUEUE_H__
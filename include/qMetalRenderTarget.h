@@ -24,6 +24,7 @@ SOFTWARE.
 #define __Q_METAL_RENDER_TARGET_H__
 
 #include <Metal/Metal.h>
+#include <vector>
 #include "qMetalTexture.h"
 
 namespace qMetal
@@ -56,6 +57,15 @@ namespace qMetal
 			eClearAction_Nothing    = MTLLoadActionDontCare
 		};
 		
+		enum eStoreAction
+		{
+			eStoreAction_Default			= -1,	//store unless memoryless, resolve if there's a resolve texture
+			eStoreAction_Store				= MTLStoreActionStore,
+			eStoreAction_Resolve			= MTLStoreActionMultisampleResolve,
+			eStoreAction_StoreAndResolve	= MTLStoreActionStoreAndMultisampleResolve,
+			eStoreAction_Nothing			= MTLStoreActionDontCare
+		};
+		
 		struct Config
 		{
 			Config(NSString* _name)
@@ -69,9 +79,11 @@ namespace qMetal
 			, depthResolveTexture(NULL)
 			, depthClear(1.0)
 			, depthClearAction(eClearAction_Clear)
+			, depthStoreAction(eStoreAction_Default)
 			, stencilTextureConfig(NULL)
 			, stencilTextureSamplerState(NULL)
 			, stencilClearAction(eClearAction_Clear)
+			, stencilStoreAction(eStoreAction_Default)
 			, stencilTexture(NULL)
 			, stencilClear(0)
 			, slice(0)
@@ -86,6 +98,7 @@ namespace qMetal
 				for (int i = 0; i < eColorAttachment_Count; ++i)
 				{
 					clearAction[i] = eClearAction_Nothing;
+					storeAction[i] = eStoreAction_Default;
 				}
 			}
 			
@@ -100,9 +113,11 @@ namespace qMetal
 			, depthResolveTexture(config->depthResolveTexture)
 			, depthClear(config->depthClear)
 			, depthClearAction(config->depthClearAction)
+			, depthStoreAction(config->depthStoreAction)
 			, stencilTextureConfig(config->stencilTextureConfig)
 			, stencilTextureSamplerState(config->stencilTextureSamplerState)
 			, stencilClearAction(config->stencilClearAction)
+			, stencilStoreAction(config->stencilStoreAction)
 			, stencilTexture(config->stencilTexture)
 			, stencilClear(config->stencilClear)
 			, slice(config->slice)
@@ -117,6 +132,7 @@ namespace qMetal
 				for (int i = 0; i < eColorAttachment_Count; ++i)
 				{
 					clearAction[i] = config->clearAction[i];
+					storeAction[i] = config->storeAction[i];
 				}
 			}
 			
@@ -158,6 +174,10 @@ namespace qMetal
 			eClearAction depthClearAction;
 			eClearAction stencilClearAction;
 			
+			eStoreAction storeAction[eColorAttachment_Count];
+			eStoreAction depthStoreAction;
+			eStoreAction stencilStoreAction;
+			
 			NSUInteger slice;
 			NSUInteger level;
 		};
@@ -167,6 +187,20 @@ namespace qMetal
 		id<MTLRenderCommandEncoder> Begin();
 		void End();
 		
+		typedef void (*StateFunction)(id<MTLRenderCommandEncoder> encoder, void* context);
+		typedef void (*PartFunction)(id<MTLRenderCommandEncoder> encoder, uint32_t part, uint32_t partCount, void* context);
+		
+		//the pass as a parallel encoder with count sub-encoders, which the GPU runs in index order whichever thread
+		//encodes them. setup (if any) gives every sub-encoder the same starting state. encode each sub-encoder on any
+		//thread, but don't end them; EndParallel() does, once every thread is done
+		void BeginParallel(uint32_t count, StateFunction setup = NULL, void* setupContext = NULL);
+		id<MTLRenderCommandEncoder> ParallelEncoder(uint32_t part) const { return mParallelEncoders[part]; }
+		uint32_t ParallelEncoderCount() const { return (uint32_t)mParallelEncoders.size(); }
+		void EndParallel();
+		
+		//BeginParallel(), encode for every part concurrently as jobs on the device's job system, then EndParallel()
+		void EncodeParallel(uint32_t count, PartFunction encode, void* context, StateFunction setup = NULL, void* setupContext = NULL);
+		
 		Texture* ColourTexture(eColorAttachment attachment) const { return mColourTexture[(int)attachment]; }
 		Texture* ColourResolveTexture(eColorAttachment attachment) const { return mColourResolveTexture[(int)attachment]; }
 		Texture* DepthTexture() const { return mDepthTexture; }
@@ -189,6 +223,10 @@ namespace qMetal
 		
 		//current encoder
 		id<MTLRenderCommandEncoder> mEncoder;
+		
+		//current parallel encoder, and its sub-encoders in submission order
+		id<MTLParallelRenderCommandEncoder>			mParallelEncoder;
+		std::vector<id<MTLRenderCommandEncoder> >	mParallelEncoders;
 	};
 }
 
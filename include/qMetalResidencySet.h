@@ -0,0 +1,165 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_RESIDENCY_SET_H__
+#define __Q_METAL_RESIDENCY_SET_H__
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+#include "qCore.h"
+
+namespace qMetal
+{
+	//collects the resources one encoder needs resident, dropping any already declared with at least the requested
+	//usage + stages, and batches the rest by (usage, stages) so each batch can go out as a single useResources call.
+	//resources are compared by pointer and the flags are Metal's, passed through
+	class ResidencySet
+	{
+	public:
+		ResidencySet()
+		: pendingCount(0)
+		{
+			ResetCounters();
+		}
+		
+		void Use(const void* resource, uint32_t usage, uint32_t stages)
+		{
+			++requested;
+			
+			std::unordered_map<const void*, Declaration>::iterator found = declared.find(resource);
+			if (found != declared.end())
+			{
+				if (((usage & ~found->second.usage) == 0) && ((stages & ~found->second.stages) == 0))
+				{
+					++elided;
+					return;
+				}
+				
+				//widen the existing declaration rather than make a second one with fewer flags
+				usage |= found->second.usage;
+				stages |= found->second.stages;
+			}
+			
+			Declaration& entry = declared[resource];
+			entry.usage = usage;
+			entry.stages = stages;
+			PendingBatch(usage, stages).resources.push_back(resource);
+			++pendingCount;
+		}
+		
+		bool HasPending() const
+		{
+			return pendingCount > 0;
+		}
+		
+		//_Functor(uint32_t usage, uint32_t stages, const void* const* resources, uint32_t count), once per batch
+		template<class _Functor>
+		void Flush(_Functor functor)
+		{
+			if (pendingCount == 0)
+			{
+				return;
+			}
+			
+			for (size_t i = 0; i < batches.size(); ++i)
+			{
+				Batch& batch = batches[i];
+				if (!batch.resources.empty())
+				{
+					functor(batch.usage, batch.stages, batch.resources.data(), (uint32_t)batch.resources.size());
+					declaredCount += (uint32_t)batch.resources.size();
+					++batchCount;
+					batch.resources.clear();
+				}
+			}
+			pendingCount = 0;
+		}
+		
+		//call when the set moves to a new encoder; residency doesn't carry across encoders
+		void Reset()
+		{
+			declared.clear();
+			for (size_t i = 0; i < batches.size(); ++i)
+			{
+				batches[i].resources.clear();
+			}
+			pendingCount = 0;
+		}
+		
+		void ResetCounters()
+		{
+			requested = 0;
+			elided = 0;
+			declaredCount = 0;
+			batchCount = 0;
+		}
+		
+		//requested is what one useResource per request would have cost, batches is what was actually issued
+		uint32_t Requested() const			{ return requested; }
+		uint32_t Elided() const				{ return elided; }
+		uint32_t Declared() const			{ return declaredCount; }
+		uint32_t Batches() const			{ return batchCount; }
+		
+	private:
+		typedef struct Declaration
+		{
+			uint32_t usage;
+			uint32_t stages;
+		} Declaration;
+		
+		typedef struct Batch
+		{
+			uint32_t usage;
+			uint32_t stages;
+			std::vector<const void*> resources;
+		} Batch;
+		
+		//there are only ever a handful of flag combinations, so a linear search beats a map
+		Batch& PendingBatch(uint32_t usage, uint32_t stages)
+		{
+			for (size_t i = 0; i < batches.size(); ++i)
+			{
+				if ((batches[i].usage == usage) && (batches[i].stages == stages))
+				{
+					return batches[i];
+				}
+			}
+			
+			Batch batch;
+			batch.usage = usage;
+			batch.stages = stages;
+			batches.push_back(batch);
+			return batches.back();
+		}
+		
+		std::unordered_map<const void*, Declaration> declared;
+		std::vector<Batch> batches;
+		uint32_t pendingCount;
+		uint32_t requested;
+		uint32_t elided;
+		uint32_t declaredCount;
+		uint32_t batchCount;
+	};
+}
+
+#endif //__Q_METAL_RESIDENCY_SET_H__
@@ -0,0 +1,114 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_RING_ALLOCATOR_H__
+#define __Q_METAL_RING_ALLOCATOR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "qCore.h"
+
+namespace qMetal
+{
+	//frame-indexed linear arena: every frame owns a region of [0, capacity) bytes, allocations bump a head
+	//within the current frame's region, and BeginFrame() resets a region once the GPU has retired it.
+	//the device maps each frame's region onto its own MTLBuffer
+	class RingAllocator
+	{
+	public:
+		static constexpr size_t InvalidOffset = SIZE_MAX;
+		static constexpr uint32_t FrameLimit = 8;
+
+		RingAllocator(size_t _capacity, uint32_t _frameCount)
+		: capacity(_capacity)
+		, frameCount(_frameCount)
+		, frameIndex(0)
+		, epoch(0)
+		, overflowCount(0)
+		, allocationCount(0)
+		{
+			qASSERTM(frameCount > 0 && frameCount <= FrameLimit, "RingAllocator frame count %u must be in [1, %u]", frameCount, FrameLimit);
+			for (uint32_t i = 0; i < FrameLimit; ++i)
+			{
+				head[i] = 0;
+				highWaterMark[i] = 0;
+			}
+		}
+
+		//call once the GPU is done with frameIndex's region; wraps, so callers can pass a running frame count
+		void BeginFrame(uint32_t _frameIndex)
+		{
+			frameIndex = _frameIndex % frameCount;
+			head[frameIndex] = 0;
+			overflowCount = 0;
+			allocationCount = 0;
+			++epoch;
+		}
+
+		//returns the offset into the current frame's region, or InvalidOffset if the region can't fit the request
+		size_t Allocate(size_t size, size_t alignment)
+		{
+			qASSERTM(alignment != 0 && (alignment & (alignment - 1)) == 0, "RingAllocator alignment %zu must be a power of two", alignment);
+
+			const size_t offset = AlignUp(head[frameIndex], alignment);
+			if ((offset < head[frameIndex]) || (offset > capacity) || (size > capacity - offset))
+			{
+				++overflowCount;
+				return InvalidOffset;
+			}
+
+			head[frameIndex] = offset + size;
+			if (head[frameIndex] > highWaterMark[frameIndex])
+			{
+				highWaterMark[frameIndex] = head[frameIndex];
+			}
+			++allocationCount;
+			return offset;
+		}
+
+		static size_t AlignUp(size_t value, size_t alignment)
+		{
+			return (value + (alignment - 1)) & ~(alignment - 1);
+		}
+
+		size_t Capacity() const 			{ return capacity; }
+		uint32_t FrameCount() const 		{ return frameCount; }
+		uint32_t FrameIndex() const 		{ return frameIndex; }
+		uint64_t Epoch() const 				{ return epoch; }
+		size_t Used() const 				{ return head[frameIndex]; }
+		size_t HighWaterMark() const		{ return highWaterMark[frameIndex]; }
+		uint32_t OverflowCount() const		{ return overflowCount; }
+		uint32_t AllocationCount() const	{ return allocationCount; }
+
+	private:
+		size_t		capacity;
+		uint32_t	frameCount;
+		uint32_t	frameIndex;
+		uint64_t	epoch;
+		uint32_t	overflowCount;
+		uint32_t	allocationCount;
+		size_t		head[FrameLimit];
+		size_t		highWaterMark[FrameLimit];
+	};
+}
+
+#endif //__Q_METAL_RING_ALLOCATOR_H__
@@ -91,6 +91,7 @@ namespace qMetal
 		);
 		
 		void Encode(id<MTLArgumentEncoder> encoder, uint32_t index) const;
+		void WriteArgumentTable(void* table, uint32_t index) const;
         
         static SamplerState* PredefinedState(eSamplerState);
 		
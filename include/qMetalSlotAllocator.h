@@ -0,0 +1,107 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_SLOT_ALLOCATOR_H__
+#define __Q_METAL_SLOT_ALLOCATOR_H__
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include "qCore.h"
+
+namespace qMetal
+{
+	//hands out stable indices in [0, capacity). a freed index isn't handed out again until retireFrames frames
+	//after it was freed, so the GPU can't still be reading the old occupant through it. the
+	//texture table keeps its argument buffer slots with one of these
+	class SlotAllocator
+	{
+	public:
+		static constexpr uint32_t InvalidSlot = UINT32_MAX;
+		
+		SlotAllocator(uint32_t _capacity, uint32_t _retireFrames)
+		: capacity(_capacity)
+		, retireFrames(_retireFrames)
+		, next(0)
+		, count(0)
+		{ }
+		
+		//returns InvalidSlot when every slot is live or still retiring
+		uint32_t Allocate(uint64_t frameNumber)
+		{
+			while (!retiring.empty() && (retiring.front().frameNumber + retireFrames <= frameNumber))
+			{
+				freeSlots.push_back(retiring.front().slot);
+				retiring.pop_front();
+			}
+			
+			uint32_t slot = InvalidSlot;
+			if (!freeSlots.empty())
+			{
+				slot = freeSlots.back();
+				freeSlots.pop_back();
+			}
+			else if (next < capacity)
+			{
+				slot = next++;
+			}
+			else
+			{
+				return InvalidSlot;
+			}
+			
+			++count;
+			return slot;
+		}
+		
+		//frame numbers passed here must not go backwards
+		void Free(uint32_t slot, uint64_t frameNumber)
+		{
+			qASSERTM(slot < next, "SlotAllocator freeing slot %u that was never allocated", slot);
+			qASSERTM(retiring.empty() || (retiring.back().frameNumber <= frameNumber), "SlotAllocator frame numbers went backwards");
+			Retiring retired = { slot, frameNumber };
+			retiring.push_back(retired);
+			--count;
+		}
+		
+		uint32_t Capacity() const			{ return capacity; }
+		uint32_t Count() const				{ return count; }
+		uint32_t HighWaterMark() const		{ return next; }
+		uint32_t RetiringCount() const		{ return (uint32_t)retiring.size(); }
+		
+	private:
+		struct Retiring
+		{
+			uint32_t slot;
+			uint64_t frameNumber;
+		};
+		
+		uint32_t				capacity;
+		uint32_t				retireFrames;
+		uint32_t				next;
+		uint32_t				count;
+		std::vector<uint32_t>	freeSlots;
+		std::deque<Retiring>	retiring;
+	};
+}
+
+#endif //__Q_METAL_SLOT_ALLOCATOR_H__
@@ -181,16 +181,26 @@ namespace qMetal
         
         Texture(Config* _config, SamplerState* _samplerState);
 		
+		//placed at offset in a placement heap, which may alias it with other textures
+		Texture(Config* _config, SamplerState* _samplerState, id<MTLHeap> heap, NSUInteger offset);
+		
 		~Texture();
 		
         void EncodeCompute(id<MTLComputeCommandEncoder> encoder, eUnit textureIndex) const;
 		void EncodeArgumentBuffer(id<MTLArgumentEncoder> encoder, eUnit textureIndex) const;
 		void EncodeArgumentBuffer(id<MTLArgumentEncoder> encoder, eUnit textureIndex, eUnit samplerIndex) const;
+		void WriteArgumentTable(void* table, eUnit textureIndex) const;
+		void WriteArgumentTable(void* table, eUnit textureIndex, eUnit samplerIndex) const;
 		void EncodeUsage(id<MTLRenderCommandEncoder> encoder, MTLRenderStages stages) const;
 		
 		float BytesPerPixel() const;
 		
         id<MTLTexture> MTLTexture() const;
+		
+		//registers with the device's bindless texture table on first use; the index stays valid until the texture is destroyed.
+		//the first use can't be inside a parallel encode, where registration is closed
+		uint32_t BindlessIndex() const;
+		uint32_t BindlessSamplerIndex() const;
         
         void Fill(uint8_t* data);
 		void Fill(float* data);
@@ -205,17 +215,24 @@ namespace qMetal
 		const Config* GetConfig() const;
 		const NSString* GetName() const;
 		static Texture* LoadByName(const NSString* name, const bool CPUReadable = false, const SamplerState* samplerState = SamplerState::PredefinedState(eSamplerState_LinearLinearLinear_RepeatRepeat));
+		
+		//what placing a texture of config in a private heap needs, whatever the config's own storage mode
+		static MTLSizeAndAlign HeapSizeAndAlign(const Config* config);
         
     private:
 		
 		void Fill(void* data);
 		
+		static MTLTextureDescriptor* Descriptor(const Config* config);
+		
 		template<typename T>
 		T Sample(qVector2 uv, float bytesPerPixel) const;
 		
 		id<MTLTexture>    	texture;
         const Config		*config;
         const SamplerState	*samplerState;
+		mutable uint32_t	bindlessIndex;
+		mutable uint32_t	bindlessSamplerIndex;
     };
 }
 
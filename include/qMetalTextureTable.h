@@ -0,0 +1,90 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_TEXTURE_TABLE_H__
+#define __Q_METAL_TEXTURE_TABLE_H__
+
+#include <Metal/Metal.h>
+#include <map>
+#include <vector>
+#include "qMetalSlotAllocator.h"
+
+namespace qMetal
+{
+	class Texture;
+	struct SamplerState;
+	
+	//one argument buffer holding every registered 2D texture and sampler, matching qMetalTextureTable<textureCapacity, samplerCapacity>
+	//in Shaders/qMetalTextureTableShader.h. textures register once for a stable index, shaders index the table with
+	//indices from their param blocks, and an encoder binds the table and declares its residency once rather than per draw.
+	//registration isn't thread safe, so RenderTarget closes it for the length of a parallel encode: textures used there
+	//need their Texture::BindlessIndex() taken beforehand
+	class TextureTable
+	{
+	public:
+		static constexpr uint32_t InvalidIndex = SlotAllocator::InvalidSlot;
+		
+		TextureTable(uint32_t _textureCapacity, uint32_t _samplerCapacity);
+		~TextureTable();
+		
+		//an index is only reused Q_METAL_FRAMES_TO_BUFFER frames after it's unregistered
+		uint32_t Register(const Texture* texture);
+		void Unregister(uint32_t index);
+		
+		//samplers are deduplicated by their settings and stay registered for the life of the table; InvalidIndex once
+		//samplerCapacity distinct ones are registered
+		uint32_t RegisterSampler(const SamplerState* samplerState);
+		
+		void CloseRegistration()					{ registrationOpen = false; }
+		void OpenRegistration()						{ registrationOpen = true; }
+		bool IsRegistrationOpen() const				{ return registrationOpen; }
+		
+		//binds the table at index for stages and makes every registered texture resident for the rest of the encoder
+		void Encode(id<MTLRenderCommandEncoder> encoder, NSUInteger index, MTLRenderStages stages) const;
+		void Encode(id<MTLComputeCommandEncoder> encoder, NSUInteger index) const;
+		
+		id<MTLBuffer> Buffer() const				{ return buffer; }
+		uint32_t TextureCapacity() const			{ return textureCapacity; }
+		uint32_t SamplerCapacity() const			{ return samplerCapacity; }
+		uint32_t TextureCount() const				{ return slots.Count(); }
+		uint32_t SamplerCount() const				{ return (uint32_t)samplerSlots.size(); }
+		
+	private:
+		TextureTable(const TextureTable&);
+		TextureTable& operator=(const TextureTable&);
+		
+		void SetTexture(uint32_t slot, id<MTLTexture> texture);
+		
+		uint32_t					textureCapacity;
+		uint32_t					samplerCapacity;
+		SlotAllocator				slots;
+		id<MTLBuffer>				buffer;
+		id<MTLArgumentEncoder>		argumentEncoder;	//nil when the table is written directly
+		std::vector<id<MTLResource>>	resident;
+		std::vector<uint32_t>		residentSlot;		//per resident entry, its slot
+		std::vector<uint32_t>		residentPosition;	//per slot, its position in resident
+		std::map<uint64_t, uint32_t>	samplerSlots;
+		bool						registrationOpen;
+	};
+}
+
+#endif //__Q_METAL_TEXTURE_TABLE_H__
@@ -0,0 +1,252 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_TRACKED_ENCODER_H__
+#define __Q_METAL_TRACKED_ENCODER_H__
+
+#include <Metal/Metal.h>
+#include "qMetalEncoderState.h"
+#include "qMetalResidencySet.h"
+
+namespace qMetal
+{
+	//a render encoder that skips state it knows is already set. wrap an encoder for the length of a pass and
+	//encode meshes and materials through it; anything not tracked here goes straight to Get()
+	class TrackedRenderEncoder
+	{
+	public:
+		TrackedRenderEncoder(id<MTLRenderCommandEncoder> _encoder, bool tracking = true)
+		: encoder(_encoder)
+		, state(tracking)
+		{ }
+		
+		id<MTLRenderCommandEncoder> Get() const
+		{
+			return encoder;
+		}
+		
+		EncoderState& State()
+		{
+			return state;
+		}
+		
+		const EncoderState& State() const
+		{
+			return state;
+		}
+		
+		void SetRenderPipelineState(id<MTLRenderPipelineState> pipelineState)
+		{
+			if (state.Pipeline(pipelineState))
+			{
+				[encoder setRenderPipelineState:pipelineState];
+			}
+		}
+		
+		void SetDepthStencilState(id<MTLDepthStencilState> depthStencilState)
+		{
+			if (state.DepthStencil(depthStencilState))
+			{
+				[encoder setDepthStencilState:depthStencilState];
+			}
+		}
+		
+		void SetCullMode(MTLCullMode cullMode)
+		{
+			if (state.CullMode(cullMode))
+			{
+				[encoder setCullMode:cullMode];
+			}
+		}
+		
+		void SetFrontFacingWinding(MTLWinding winding)
+		{
+			if (state.Winding(winding))
+			{
+				[encoder setFrontFacingWinding:winding];
+			}
+		}
+		
+		void SetStencilReferenceValue(uint32_t value)
+		{
+			if (state.StencilReference(value))
+			{
+				[encoder setStencilReferenceValue:value];
+			}
+		}
+		
+		void SetVertexBuffer(id<MTLBuffer> buffer, NSUInteger offset, NSUInteger index)
+		{
+			switch (state.Buffer(EncoderState::eStage_Vertex, (uint32_t)index, buffer, offset))
+			{
+				case EncoderState::eBufferChange_Buffer:	[encoder setVertexBuffer:buffer offset:offset atIndex:index]; break;
+				case EncoderState::eBufferChange_Offset:	[encoder setVertexBufferOffset:offset atIndex:index]; break;
+				case EncoderState::eBufferChange_None:		break;
+			}
+		}
+		
+		void SetFragmentBuffer(id<MTLBuffer> buffer, NSUInteger offset, NSUInteger index)
+		{
+			switch (state.Buffer(EncoderState::eStage_Fragment, (uint32_t)index, buffer, offset))
+			{
+				case EncoderState::eBufferChange_Buffer:	[encoder setFragmentBuffer:buffer offset:offset atIndex:index]; break;
+				case EncoderState::eBufferChange_Offset:	[encoder setFragmentBufferOffset:offset atIndex:index]; break;
+				case EncoderState::eBufferChange_None:		break;
+			}
+		}
+		
+		void SetVertexBytes(const void* bytes, NSUInteger length, NSUInteger index)
+		{
+			state.InvalidateBuffer(EncoderState::eStage_Vertex, (uint32_t)index);
+			[encoder setVertexBytes:bytes length:length atIndex:index];
+		}
+		
+		void SetFragmentBytes(const void* bytes, NSUInteger length, NSUInteger index)
+		{
+			state.InvalidateBuffer(EncoderState::eStage_Fragment, (uint32_t)index);
+			[encoder setFragmentBytes:bytes length:length atIndex:index];
+		}
+		
+		//tracked encoders queue residency until FlushResidency(), which must come before the draw that needs it
+		void UseResource(id<MTLResource> resource, MTLResourceUsage usage, MTLRenderStages stages)
+		{
+			if (state.IsTracking())
+			{
+				residency.Use(resource, (uint32_t)usage, (uint32_t)stages);
+			}
+			else
+			{
+				[encoder useResource:resource usage:usage stages:stages];
+			}
+		}
+		
+		void FlushResidency()
+		{
+			id<MTLRenderCommandEncoder> target = encoder;
+			residency.Flush([target](uint32_t usage, uint32_t stages, const void* const* resources, uint32_t count)
+			{
+				[target useResources:(const id<MTLResource> __unsafe_unretained*)resources count:count usage:(MTLResourceUsage)usage stages:(MTLRenderStages)stages];
+			});
+		}
+		
+		ResidencySet& Residency()
+		{
+			return residency;
+		}
+		
+		const ResidencySet& Residency() const
+		{
+			return residency;
+		}
+		
+	private:
+		id<MTLRenderCommandEncoder> encoder;
+		EncoderState state;
+		ResidencySet residency;
+	};
+	
+	class TrackedComputeEncoder
+	{
+	public:
+		TrackedComputeEncoder(id<MTLComputeCommandEncoder> _encoder, bool tracking = true)
+		: encoder(_encoder)
+		, state(tracking)
+		{ }
+		
+		id<MTLComputeCommandEncoder> Get() const
+		{
+			return encoder;
+		}
+		
+		EncoderState& State()
+		{
+			return state;
+		}
+		
+		const EncoderState& State() const
+		{
+			return state;
+		}
+		
+		void SetComputePipelineState(id<MTLComputePipelineState> pipelineState)
+		{
+			if (state.Pipeline(pipelineState))
+			{
+				[encoder setComputePipelineState:pipelineState];
+			}
+		}
+		
+		void SetBuffer(id<MTLBuffer> buffer, NSUInteger offset, NSUInteger index)
+		{
+			switch (state.Buffer(EncoderState::eStage_Compute, (uint32_t)index, buffer, offset))
+			{
+				case EncoderState::eBufferChange_Buffer:	[encoder setBuffer:buffer offset:offset atIndex:index]; break;
+				case EncoderState::eBufferChange_Offset:	[encoder setBufferOffset:offset atIndex:index]; break;
+				case EncoderState::eBufferChange_None:		break;
+			}
+		}
+		
+		void SetBytes(const void* bytes, NSUInteger length, NSUInteger index)
+		{
+			state.InvalidateBuffer(EncoderState::eStage_Compute, (uint32_t)index);
+			[encoder setBytes:bytes length:length atIndex:index];
+		}
+		
+		void UseResource(id<MTLResource> resource, MTLResourceUsage usage)
+		{
+			if (state.IsTracking())
+			{
+				residency.Use(resource, (uint32_t)usage, 0);
+			}
+			else
+			{
+				[encoder useResource:resource usage:usage];
+			}
+		}
+		
+		void FlushResidency()
+		{
+			id<MTLComputeCommandEncoder> target = encoder;
+			residency.Flush([target](uint32_t usage, uint32_t stages, const void* const* resources, uint32_t count)
+			{
+				[target useResources:(const id<MTLResource> __unsafe_unretained*)resources count:count usage:(MTLResourceUsage)usage];
+			});
+		}
+		
+		ResidencySet& Residency()
+		{
+			return residency;
+		}
+		
+		const ResidencySet& Residency() const
+		{
+			return residency;
+		}
+		
+	private:
+		id<MTLComputeCommandEncoder> encoder;
+		EncoderState state;
+		ResidencySet residency;
+	};
+}
+
+#endif //__Q_METAL_TRACKED_ENCODER_H__
@@ -0,0 +1,208 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_TRANSIENT_ALLOCATOR_H__
+#define __Q_METAL_TRANSIENT_ALLOCATOR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#include "qCore.h"
+
+namespace qMetal
+{
+	//places resources with known lifetimes (an inclusive range of pass positions) in one heap, letting resources whose
+	//lifetimes don't overlap share bytes. Build() places the largest first, each at the lowest aligned offset clear of
+	//everything already placed that's live at the same time. sizes and alignments come from the
+	//device, and the frame graph turns the aliases into fences
+	class TransientAllocator
+	{
+	public:
+		TransientAllocator()
+		: heapSize(0)
+		, built(false)
+		{ }
+		
+		uint32_t Add(size_t size, size_t alignment, uint32_t first, uint32_t last)
+		{
+			qASSERTM(alignment != 0 && (alignment & (alignment - 1)) == 0, "TransientAllocator alignment %zu must be a power of two", alignment);
+			qASSERTM(first <= last, "TransientAllocator lifetime [%u, %u] is empty", first, last);
+			built = false;
+			
+			Resource resource;
+			resource.size = size;
+			resource.alignment = alignment;
+			resource.first = first;
+			resource.last = last;
+			resource.offset = 0;
+			resources.push_back(resource);
+			return (uint32_t)resources.size() - 1;
+		}
+		
+		void Build()
+		{
+			const uint32_t count = ResourceCount();
+			
+			std::vector<uint32_t> placementOrder(count);
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				placementOrder[i] = i;
+			}
+			std::stable_sort(placementOrder.begin(), placementOrder.end(), [this](uint32_t a, uint32_t b) { return resources[a].size > resources[b].size; });
+			
+			heapSize = 0;
+			std::vector<uint32_t> placed;
+			std::vector<uint32_t> conflicts;
+			for (auto &index : placementOrder)
+			{
+				Resource& resource = resources[index];
+				
+				conflicts.clear();
+				for (auto &other : placed)
+				{
+					if (LifetimesOverlap(resource, resources[other]))
+					{
+						conflicts.push_back(other);
+					}
+				}
+				std::sort(conflicts.begin(), conflicts.end(), [this](uint32_t a, uint32_t b) { return resources[a].offset < resources[b].offset; });
+				
+				//first fit between the conflicting ranges
+				size_t offset = 0;
+				for (auto &other : conflicts)
+				{
+					const Resource& conflict = resources[other];
+					if (AlignUp(offset, resource.alignment) + resource.size <= conflict.offset)
+					{
+						break;
+					}
+					offset = std::max(offset, conflict.offset + conflict.size);
+				}
+				
+				resource.offset = AlignUp(offset, resource.alignment);
+				heapSize = std::max(heapSize, resource.offset + resource.size);
+				placed.push_back(index);
+			}
+			
+			//resources that hand their bytes on to a later one
+			aliases.assign(count, std::vector<uint32_t>());
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				for (uint32_t j = 0; j < count; ++j)
+				{
+					if ((resources[j].last < resources[i].first) && RangesOverlap(resources[i], resources[j]))
+					{
+						aliases[i].push_back(j);
+					}
+				}
+			}
+			
+			built = true;
+		}
+		
+		void Reset()
+		{
+			resources.clear();
+			aliases.clear();
+			heapSize = 0;
+			built = false;
+		}
+		
+		static size_t AlignUp(size_t value, size_t alignment)
+		{
+			return (value + (alignment - 1)) & ~(alignment - 1);
+		}
+		
+		uint32_t ResourceCount() const 			{ return (uint32_t)resources.size(); }
+		bool IsBuilt() const 					{ return built; }
+		size_t Offset(uint32_t resource) const 	{ qASSERT(built); return resources[resource].offset; }
+		size_t HeapSize() const 				{ qASSERT(built); return heapSize; }
+		
+		//what dedicated allocations would cost
+		size_t UnaliasedSize() const
+		{
+			size_t size = 0;
+			for (auto &resource : resources)
+			{
+				size += resource.size;
+			}
+			return size;
+		}
+		
+		size_t BytesSaved() const
+		{
+			qASSERT(built);
+			return (UnaliasedSize() > heapSize) ? (UnaliasedSize() - heapSize) : 0;
+		}
+		
+		//the most bytes live at any one pass; no packing can beat this (alignment aside)
+		size_t PeakLiveSize() const
+		{
+			size_t peak = 0;
+			for (auto &resource : resources)
+			{
+				size_t live = 0;
+				for (auto &other : resources)
+				{
+					live += ((other.first <= resource.first) && (other.last >= resource.first)) ? other.size : 0;
+				}
+				peak = std::max(peak, live);
+			}
+			return peak;
+		}
+		
+		//resources whose lifetimes end before this one's starts and whose bytes it reuses
+		const std::vector<uint32_t>& Aliases(uint32_t resource) const
+		{
+			qASSERT(built);
+			return aliases[resource];
+		}
+		
+	private:
+		typedef struct Resource
+		{
+			size_t		size;
+			size_t		alignment;
+			uint32_t	first;
+			uint32_t	last;
+			size_t		offset;
+		} Resource;
+		
+		static bool LifetimesOverlap(const Resource& a, const Resource& b)
+		{
+			return (a.first <= b.last) && (b.first <= a.last);
+		}
+		
+		static bool RangesOverlap(const Resource& a, const Resource& b)
+		{
+			return (a.offset < b.offset + b.size) && (b.offset < a.offset + a.size);
+		}
+		
+		std::vector<Resource>				resources;
+		std::vector<std::vector<uint32_t> >	aliases;
+		size_t								heapSize;
+		bool								built;
+	};
+}
+
+#endif //__Q_METAL_TRANSIENT_ALLOCATOR_H__
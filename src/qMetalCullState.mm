@@ -52,4 +52,10 @@ namespace qMetal
 		[encoder setFrontFacingWinding:(MTLWinding)winding];
 		[encoder setCullMode:(MTLCullMode)face];
 	}
+	
+	void CullState::Encode(TrackedRenderEncoder& encoder)
+	{
+		encoder.SetFrontFacingWinding((MTLWinding)winding);
+		encoder.SetCullMode((MTLCullMode)face);
+	}
 }
@@ -71,4 +71,9 @@ namespace qMetal
 	{
 	  [encoder setDepthStencilState:state];
 	}
+	
+	void DepthStencilState::Encode(TrackedRenderEncoder& encoder)
+	{
+		encoder.SetDepthStencilState(state);
+	}
 }
@@ -21,8 +21,20 @@ SOFTWARE.
 */
 
 #include "qMetal.h"
+#include "qMetalPipelineBatch.h"
+#include "qMetalPipelineManifest.h"
+#include "qMetalRingAllocator.h"
+#include "qMetalTextureTable.h"
+#include "qMetalTrackedEncoder.h"
+#include <algorithm>
+#include <atomic>
+#include <float.h>
+#include <mutex>
+#include <pthread.h>
+#include <vector>
 
 #define Q_METAL_FRAMES_BETWEEN_PRINT 30
+#define Q_METAL_DISPATCH_TUNING_RUNS 3 //each candidate shape keeps its fastest run
 
 namespace qMetal
 {
@@ -38,6 +50,14 @@ namespace qMetal
 		static dispatch_semaphore_t     	sInflightSemaphore;
 		static dispatch_semaphore_t     	sSingleFrameSemaphore;
 		
+		//a frame retires once its drawable command buffer and the async compute command buffers submitted during it have
+		//all completed. they can complete in any order, but frames retire in order, since the semaphores only count them
+		static std::atomic<uint32_t>		sFramePending[Q_METAL_FRAMES_TO_BUFFER];
+		static dispatch_semaphore_t			sFrameRetireSemaphore[Q_METAL_FRAMES_TO_BUFFER];
+		static bool							sFrameCompleted[Q_METAL_FRAMES_TO_BUFFER];
+		static uint32_t						sRetireIndex					= 0;
+		static std::mutex					sRetireMutex;
+		
 		typedef struct IndirectCommandBufferPool
 		{
 			id<MTLIndirectCommandBuffer>	indirectCommandBuffer;
@@ -52,13 +72,110 @@ namespace qMetal
 		static id<MTLComputePipelineState>	sIndirectResetComputePiplineState;
 		static Function*					sIndirectInitFunction;
 		static id<MTLComputePipelineState>	sIndirectInitComputePiplineState;
+		static Function*					sIndirectDispatchResolveFunction;
+		static id<MTLComputePipelineState>	sIndirectDispatchResolveComputePipelineState;
+		static PipelineBatch*				sIndirectPipelineBatch			= NULL;
+		
+		static RingAllocator*				sUploadRing						= NULL;
+		static id<MTLBuffer>				sUploadBuffer[Q_METAL_FRAMES_TO_BUFFER];
+		static std::vector<id<MTLBuffer> >	sUploadOverflowBuffers[Q_METAL_FRAMES_TO_BUFFER];
+		static std::mutex					sUploadMutex;	//parallel render encoding allocates from worker threads
+		
+		static TextureTable*				sBindlessTextures				= NULL;
+		
+		static JobSystem*					sJobs							= NULL;
+		static JobCounter					sFrameJobs;
+		
+		static id<MTLCommandQueue>			sComputeQueue					= nil; //sCommandQueue unless Config::asyncCompute is set
+		static id<MTLCommandBuffer>			sComputeCommandBuffer			= nil;
+		static id<MTLSharedEvent>			sQueueEvent[eQueue_Count];
+		static QueueTimeline				sQueueTimeline(eQueue_Count);
+		static std::vector<QueuePoint>		sQueueWaits[eQueue_Count];		//not yet encoded, for want of an open command buffer
+		
+		static PipelineCache<id<MTLRenderPipelineState>>	sRenderPipelineCache;
+		static PipelineCache<id<MTLComputePipelineState>>	sComputePipelineCache;
+		
+		static PipelineManifest*			sPipelineManifest				= NULL;
+		static id							sPipelineArchive				= nil; //id<MTLBinaryArchive> where available
+		static std::mutex					sPipelineManifestMutex;
+		static pthread_rwlock_t				sPipelineArchiveLock			= PTHREAD_RWLOCK_INITIALIZER; //adds share it, serializing doesn't
+		
+		static DispatchTuningTable*			sDispatchTuning					= NULL;
       
         //current frame
         static uint32_t                 	sFrameIndex            			= 0;
+        static uint64_t                 	sFrameNumber           			= 0;
         static uint32_t						sFramePrintIndex				= 0;
         static id<MTLCommandBuffer>     	sCommandBuffer         			= nil;
         static id<CAMetalDrawable>      	sDrawable              			= nil;
+		
+		//left open across back to back compute-only work, closed when anything else wants the command buffer
+		static TrackedComputeEncoder*		sCoalescedComputeEncoder		= NULL;
         
+		static NSString* PipelineManifestPath()
+		{
+			return [config->pipelineArchivePath stringByAppendingPathExtension:@"manifest"];
+		}
+		
+		static NSString* PipelineArchivePath()
+		{
+			return [config->pipelineArchivePath stringByAppendingPathExtension:@"binarchive"];
+		}
+		
+		//archives are only good for the GPU, OS build and shader library they were made with
+		static uint64_t PipelineEnvironmentHash()
+		{
+			PipelineHash hash;
+			hash.AddString([sDevice.name UTF8String]);
+			hash.AddString([[[NSProcessInfo processInfo] operatingSystemVersionString] UTF8String]);
+			hash.Add(config->pipelineArchiveVersion);
+			
+			NSString* libraryPath = [[NSBundle mainBundle] pathForResource:@"default" ofType:@"metallib"];
+			NSDictionary* libraryAttributes = (libraryPath != nil) ? [[NSFileManager defaultManager] attributesOfItemAtPath:libraryPath error:nil] : nil;
+			hash.Add((uint64_t)[libraryAttributes fileSize]);
+			hash.Add([[libraryAttributes fileModificationDate] timeIntervalSince1970]);
+			
+			return hash.Value();
+		}
+		
+		static NSString* DispatchTuningPath()
+		{
+			return [config->dispatchTuningPath stringByAppendingPathExtension:@"dispatch"];
+		}
+		
+		static void InitPipelineArchive()
+		{
+			sPipelineManifest = new PipelineManifest(PipelineEnvironmentHash());
+			
+			const PipelineManifest::eLoadResult result = sPipelineManifest->LoadFile([PipelineManifestPath() UTF8String]);
+			qWARNING((result == PipelineManifest::eLoadResult_Loaded) || (result == PipelineManifest::eLoadResult_Missing), "Discarding pipeline manifest %s (%i), pipelines will be rebuilt", [PipelineManifestPath() UTF8String], (int)result);
+			
+			if (@available(iOS 14.0, macOS 11.0, *))
+			{
+				MTLBinaryArchiveDescriptor* archiveDesc = [MTLBinaryArchiveDescriptor new];
+				NSError* error = nil;
+				
+				if (result == PipelineManifest::eLoadResult_Loaded)
+				{
+					archiveDesc.url = [NSURL fileURLWithPath:PipelineArchivePath()];
+					sPipelineArchive = [sDevice newBinaryArchiveWithDescriptor:archiveDesc error:&error];
+				}
+				
+				if (sPipelineArchive == nil)
+				{
+					//nothing usable on disk, start a new archive (and forget what the manifest says it held)
+					qWARNING(result != PipelineManifest::eLoadResult_Loaded, "Unable to open pipeline archive %s: %s", [PipelineArchivePath() UTF8String], [[error description] UTF8String]);
+					sPipelineManifest->Clear();
+					archiveDesc.url = nil;
+					error = nil;
+					sPipelineArchive = [sDevice newBinaryArchiveWithDescriptor:archiveDesc error:&error];
+					qWARNING(sPipelineArchive != nil, "Unable to create pipeline archive: %s", [[error description] UTF8String]);
+				}
+				
+				[archiveDesc release];
+			}
+		}
+		
         void Init(Config* _config)
         {
 			config = _config;
@@ -70,6 +187,22 @@ namespace qMetal
             
             sCommandQueue = [sDevice newCommandQueue];
             sCommandQueue.label = @"qMetal Command Queue";
+			
+			if (config->asyncCompute)
+			{
+				sComputeQueue = [sDevice newCommandQueue];
+				sComputeQueue.label = @"qMetal Compute Queue";
+			}
+			else
+			{
+				sComputeQueue = [sCommandQueue retain];
+			}
+			
+			for (uint32_t queue = 0; queue < eQueue_Count; ++queue)
+			{
+				sQueueEvent[queue] = [sDevice newSharedEvent];
+				sQueueEvent[queue].label = (queue == eQueue_Render) ? @"qMetal Render Queue Event" : @"qMetal Compute Queue Event";
+			}
             		
             sRenderTargetConfig = new RenderTarget::Config(@"Framebuffer");
 			
@@ -79,6 +212,11 @@ namespace qMetal
 			
 			sInflightSemaphore = dispatch_semaphore_create(Q_METAL_FRAMES_TO_BUFFER - 1);
 			sSingleFrameSemaphore = dispatch_semaphore_create(0);
+			for (uint32_t i = 0; i < Q_METAL_FRAMES_TO_BUFFER; ++i)
+			{
+				sFramePending[i].store(1, std::memory_order_relaxed);
+				sFrameCompleted[i] = false;
+			}
 			
 			for(uint32_t poolIndex = 0; poolIndex < eIndirectCommandBufferPool_Count; ++poolIndex)
 			{
@@ -111,18 +249,65 @@ namespace qMetal
 			}
 			
 			{
-				NSError* error;
+				//built on worker threads; the first frame waits for them (see WaitForIndirectPipelines)
+				sIndirectPipelineBatch = new PipelineBatch();
             
 				sIndirectResetFunction = new Function(@"qMetalIndirectResetShader");
-				sIndirectResetComputePiplineState = [qMetal::Device::Get() newComputePipelineStateWithFunction:sIndirectResetFunction->Get()
-																									 error:&error];
-				qASSERT(sIndirectResetComputePiplineState != nil);
+				sIndirectPipelineBatch->Enqueue(^{
+					NSError* error = nil;
+					sIndirectResetComputePiplineState = [qMetal::Device::Get() newComputePipelineStateWithFunction:sIndirectResetFunction->Get()
+																										 error:&error];
+					qASSERT(sIndirectResetComputePiplineState != nil);
+				});
             
 				sIndirectInitFunction = new Function(@"qMetalIndirectInitShader");
-				sIndirectInitComputePiplineState = [qMetal::Device::Get() newComputePipelineStateWithFunction:sIndirectInitFunction->Get()
-																									 error:&error];
-				qASSERT(sIndirectInitComputePiplineState != nil);
+				sIndirectPipelineBatch->Enqueue(^{
+					NSError* error = nil;
+					sIndirectInitComputePiplineState = [qMetal::Device::Get() newComputePipelineStateWithFunction:sIndirectInitFunction->Get()
+																										error:&error];
+					qASSERT(sIndirectInitComputePiplineState != nil);
+				});
+            
+				sIndirectDispatchResolveFunction = new Function(@"qMetalIndirectDispatchResolveShader");
+				sIndirectPipelineBatch->Enqueue(^{
+					NSError* error = nil;
+					sIndirectDispatchResolveComputePipelineState = [qMetal::Device::Get() newComputePipelineStateWithFunction:sIndirectDispatchResolveFunction->Get()
+																													 error:&error];
+					qASSERT(sIndirectDispatchResolveComputePipelineState != nil);
+				});
 			}
+			
+			sJobs = new JobSystem(config->jobWorkerCount);
+			
+			if (config->uploadRingSize > 0)
+			{
+				sUploadRing = new RingAllocator(config->uploadRingSize, Q_METAL_FRAMES_TO_BUFFER);
+				for (uint32_t i = 0; i < Q_METAL_FRAMES_TO_BUFFER; ++i)
+				{
+					sUploadBuffer[i] = [sDevice newBufferWithLength:config->uploadRingSize options:MTLResourceCPUCacheModeWriteCombined];
+					sUploadBuffer[i].label = [NSString stringWithFormat:@"qMetal Upload Ring (frame %i)", i];
+				}
+				sUploadRing->BeginFrame(sFrameIndex);
+			}
+			
+			if (config->pipelineArchivePath != nil)
+			{
+				InitPipelineArchive();
+			}
+			
+			if (config->bindlessTextureCount > 0)
+			{
+				sBindlessTextures = new TextureTable(config->bindlessTextureCount, config->bindlessSamplerCount);
+			}
+			
+			if (config->dispatchTuningPath != nil)
+			{
+				//tuned shapes only hold for the GPU, OS and shaders they were timed with, same as the pipeline archive
+				sDispatchTuning = new DispatchTuningTable(PipelineEnvironmentHash());
+				const bool loaded = sDispatchTuning->LoadFile([DispatchTuningPath() UTF8String]);
+				qWARNING(loaded || config->dispatchTuning, "No usable dispatch tuning table at %s, using the dispatch heuristic", [DispatchTuningPath() UTF8String]);
+			}
+			qWARNING(!config->dispatchTuning || (config->dispatchTuningPath != nil), "Dispatch tuning needs a Device::Config::dispatchTuningPath to save to");
             
             sInited = true;
         }
@@ -131,10 +316,21 @@ namespace qMetal
         {
             return sDevice;
         }
+		
+		PipelineCache<id<MTLRenderPipelineState>>& RenderPipelineCache()
+		{
+			return sRenderPipelineCache;
+		}
+		
+		PipelineCache<id<MTLComputePipelineState>>& ComputePipelineCache()
+		{
+			return sComputePipelineCache;
+		}
         
 		id<MTLBlitCommandEncoder> BlitEncoder(NSString* label)
 		{
 			qASSERTM(sCommandBuffer != nil, "Device CommandBuffer is nil; did you call BeginOffScreen()/BeginRenderable()?")
+			EndCoalescedComputeEncoder();
 			id<MTLBlitCommandEncoder> encoder = [sCommandBuffer blitCommandEncoder];
 			encoder.label = label;
 			return encoder;
@@ -143,23 +339,75 @@ namespace qMetal
 		id<MTLComputeCommandEncoder> ComputeEncoder(NSString* label)
 		{
 			qASSERTM(sCommandBuffer != nil, "Device CommandBuffer is nil; did you call BeginOffScreen()/BeginRenderable()?")
+			EndCoalescedComputeEncoder();
 			id<MTLComputeCommandEncoder> encoder = [sCommandBuffer computeCommandEncoder];
 			encoder.label = label;
 			return encoder;
 		}
 		
+		id<MTLComputeCommandEncoder> ComputeEncoder(NSString* label, MTLDispatchType dispatchType)
+		{
+			qASSERTM(sCommandBuffer != nil, "Device CommandBuffer is nil; did you call BeginOffScreen()/BeginRenderable()?")
+			EndCoalescedComputeEncoder();
+			id<MTLComputeCommandEncoder> encoder = [sCommandBuffer computeCommandEncoderWithDispatchType:dispatchType];
+			encoder.label = label;
+			return encoder;
+		}
+		
+		TrackedComputeEncoder& CoalescedComputeEncoder()
+		{
+			qASSERTM(sCommandBuffer != nil, "Device CommandBuffer is nil; did you call BeginOffScreen()/BeginRenderable()?")
+			
+			if (sCoalescedComputeEncoder == NULL)
+			{
+				//serial dispatch: each dispatch sees the previous one's writes to tracked resources, so back to back
+				//dispatches need no barriers of their own
+				id<MTLComputeCommandEncoder> encoder = [[sCommandBuffer computeCommandEncoderWithDispatchType:MTLDispatchTypeSerial] retain];
+				encoder.label = @"qMetal Coalesced Compute";
+				sCoalescedComputeEncoder = new TrackedComputeEncoder(encoder);
+			}
+			
+			return *sCoalescedComputeEncoder;
+		}
+		
+		void EndCoalescedComputeEncoder()
+		{
+			if (sCoalescedComputeEncoder == NULL)
+			{
+				return;
+			}
+			
+			id<MTLComputeCommandEncoder> encoder = sCoalescedComputeEncoder->Get();
+			[encoder endEncoding];
+			[encoder release];
+			
+			delete sCoalescedComputeEncoder;
+			sCoalescedComputeEncoder = NULL;
+		}
+		
 		id<MTLRenderCommandEncoder> RenderEncoder(MTLRenderPassDescriptor* descriptor, NSString* label)
 		{
 			qASSERTM(sCommandBuffer != nil, "Device CommandBuffer is nil; did you call BeginOffScreen()/BeginRenderable()?")
+			EndCoalescedComputeEncoder();
 			id<MTLRenderCommandEncoder> encoder = [sCommandBuffer renderCommandEncoderWithDescriptor:descriptor];
 			encoder.label = label;
 			return encoder;
 		}
 		
+		id<MTLParallelRenderCommandEncoder> ParallelRenderEncoder(MTLRenderPassDescriptor* descriptor, NSString* label)
+		{
+			qASSERTM(sCommandBuffer != nil, "Device CommandBuffer is nil; did you call BeginOffScreen()/BeginRenderable()?")
+			EndCoalescedComputeEncoder();
+			id<MTLParallelRenderCommandEncoder> encoder = [sCommandBuffer parallelRenderCommandEncoderWithDescriptor:descriptor];
+			encoder.label = label;
+			return encoder;
+		}
+		
 		void PushDebugGroup(NSString* label)
 		{
 		#if DEBUG
 			qASSERTM(sCommandBuffer != nil, "Device CommandBuffer is nil; did you call BeginOffScreen()/BeginRenderable()?")
+			EndCoalescedComputeEncoder();
 			[sCommandBuffer pushDebugGroup:label];
 		#endif
 		}
@@ -168,6 +416,7 @@ namespace qMetal
 		{
 		#if DEBUG
 			qASSERTM(sCommandBuffer != nil, "Device CommandBuffer is nil; did you call BeginOffScreen()/BeginRenderable()?")
+			EndCoalescedComputeEncoder();
 			[sCommandBuffer popDebugGroup];
 		#endif
 		}
@@ -176,12 +425,395 @@ namespace qMetal
         {
 			return sFrameIndex;
 		}
+		
+        uint64_t CurrentFrameNumber()
+        {
+			return sFrameNumber;
+		}
+		
+		TextureTable* BindlessTextures()
+		{
+			return sBindlessTextures;
+		}
+		
+		JobSystem& Jobs()
+		{
+			qASSERTM(sJobs != NULL, "Device isn't inited");
+			return *sJobs;
+		}
+		
+		JobCounter& FrameJobs()
+		{
+			return sFrameJobs;
+		}
+		
+		UploadAllocation AllocateUpload(NSUInteger size, NSUInteger alignment)
+		{
+			qASSERTM(sUploadRing != NULL, "Upload ring is disabled; set Device::Config::uploadRingSize");
+			
+			UploadAllocation allocation;
+			std::lock_guard<std::mutex> lock(sUploadMutex);
+			
+			size_t offset = sUploadRing->Allocate(size, alignment);
+			if (offset != RingAllocator::InvalidOffset)
+			{
+				allocation.buffer = sUploadBuffer[sFrameIndex];
+				allocation.offset = offset;
+			}
+			else
+			{
+				//keep going with a dedicated buffer that lives until this frame index comes around again
+				qWARNING(false, "Upload ring overflowed its %lu bytes for frame %i; increase Device::Config::uploadRingSize", (unsigned long)sUploadRing->Capacity(), sFrameIndex);
+				allocation.buffer = [sDevice newBufferWithLength:size options:MTLResourceCPUCacheModeWriteCombined];
+				allocation.buffer.label = [NSString stringWithFormat:@"qMetal Upload Ring Overflow (frame %i)", sFrameIndex];
+				allocation.offset = 0;
+				sUploadOverflowBuffers[sFrameIndex].push_back(allocation.buffer);
+			}
+			
+			allocation.contents = (uint8_t*)[allocation.buffer contents] + allocation.offset;
+			return allocation;
+		}
         
         void Destroy()
         {
             qASSERTM(sInited, "Device isn't inited");
+			
+			SavePipelineArchive();
+			
+			delete sBindlessTextures;
+			sBindlessTextures = NULL;
+			
+			SaveDispatchTuning();
+			delete sDispatchTuning;
+			sDispatchTuning = NULL;
+			
+			sJobs->Wait(sFrameJobs);
+			delete sJobs;
+			sJobs = NULL;
+			
+			qASSERTM(sComputeCommandBuffer == nil, "Device async compute CommandBuffer isn't nil; did you call EndAsyncCompute()?");
+			for (uint32_t queue = 0; queue < eQueue_Count; ++queue)
+			{
+				[sQueueEvent[queue] release];
+				sQueueEvent[queue] = nil;
+			}
+			[sComputeQueue release];
+			sComputeQueue = nil;
         }
 		
+		//times each candidate shape in isolation; its inputs are whatever they were before this frame's command buffer
+		static void TimeDispatchCandidates(id<MTLComputePipelineState> pipeline, uint64_t pipelineKey, const DispatchSize& grid, void (^encode)(id<MTLComputeCommandEncoder> encoder))
+		{
+			std::vector<DispatchSize> candidates;
+			DispatchShape::Candidates(grid, (uint32_t)pipeline.threadExecutionWidth, (uint32_t)pipeline.maxTotalThreadsPerThreadgroup, candidates);
+			
+			for (auto &shape : candidates)
+			{
+				double bestSeconds = DBL_MAX;
+				for (int run = 0; run < Q_METAL_DISPATCH_TUNING_RUNS; ++run)
+				{
+					@autoreleasepool
+					{
+						id<MTLCommandBuffer> commandBuffer = [sCommandQueue commandBuffer];
+						commandBuffer.label = @"qMetal Dispatch Tuning";
+						id<MTLComputeCommandEncoder> encoder = [commandBuffer computeCommandEncoder];
+						encode(encoder);
+						[encoder dispatchThreads:MTLSizeMake(grid.width, grid.height, grid.depth) threadsPerThreadgroup:MTLSizeMake(shape.width, shape.height, shape.depth)];
+						[encoder endEncoding];
+						[commandBuffer commit];
+						[commandBuffer waitUntilCompleted];
+						
+						if (commandBuffer.status == MTLCommandBufferStatusCompleted)
+						{
+							bestSeconds = std::min(bestSeconds, commandBuffer.GPUEndTime - commandBuffer.GPUStartTime);
+						}
+					}
+				}
+				
+				if (bestSeconds < DBL_MAX)
+				{
+					sDispatchTuning->Record(pipelineKey, grid, shape, (uint32_t)std::min(bestSeconds * 1e9, (double)(UINT32_MAX - 1)));
+				}
+			}
+			
+			DispatchSize best;
+			if (sDispatchTuning->Find(pipelineKey, grid, best))
+			{
+				qSPAM("Tuned %ux%ux%u dispatch: %ux%ux%u threadgroups", grid.width, grid.height, grid.depth, best.width, best.height, best.depth);
+			}
+		}
+		
+		MTLSize DispatchThreadgroupSize(id<MTLComputePipelineState> pipeline, uint64_t pipelineKey, MTLSize grid)
+		{
+			const DispatchSize gridSize((uint32_t)grid.width, (uint32_t)grid.height, (uint32_t)grid.depth);
+			DispatchSize shape;
+			
+			if ((sDispatchTuning != NULL) && sDispatchTuning->Find(pipelineKey, gridSize, shape))
+			{
+				return MTLSizeMake(shape.width, shape.height, shape.depth);
+			}
+			
+			shape = DispatchShape::Select(gridSize, (uint32_t)pipeline.threadExecutionWidth, (uint32_t)pipeline.maxTotalThreadsPerThreadgroup);
+			return MTLSizeMake(shape.width, shape.height, shape.depth);
+		}
+		
+		MTLSize TuneDispatch(id<MTLComputePipelineState> pipeline, uint64_t pipelineKey, MTLSize grid, void (^encode)(id<MTLComputeCommandEncoder> encoder))
+		{
+			qASSERTM(encode != nil, "TuneDispatch needs an encode block making every binding the kernel uses");
+			
+			const DispatchSize gridSize((uint32_t)grid.width, (uint32_t)grid.height, (uint32_t)grid.depth);
+			DispatchSize shape;
+			if (config->dispatchTuning && (sDispatchTuning != NULL) && !sDispatchTuning->Find(pipelineKey, gridSize, shape))
+			{
+				TimeDispatchCandidates(pipeline, pipelineKey, gridSize, encode);
+			}
+			
+			return DispatchThreadgroupSize(pipeline, pipelineKey, grid);
+		}
+		
+		void SaveDispatchTuning()
+		{
+			if ((sDispatchTuning == NULL) || !sDispatchTuning->IsDirty())
+			{
+				return;
+			}
+			
+			const bool saved = sDispatchTuning->SaveFile([DispatchTuningPath() UTF8String]);
+			qWARNING(saved, "Unable to save dispatch tuning table %s", [DispatchTuningPath() UTF8String]);
+		}
+		
+		static bool IsPipelineArchived(PipelineManifest::ePipelineKind kind, uint64_t key)
+		{
+			std::lock_guard<std::mutex> lock(sPipelineManifestMutex);
+			return sPipelineManifest->IsArchived(kind, key);
+		}
+		
+		//only once the archive holds the pipeline, so the manifest never lists one it doesn't have
+		static void RecordPipeline(PipelineManifest::ePipelineKind kind, uint64_t key)
+		{
+			std::lock_guard<std::mutex> lock(sPipelineManifestMutex);
+			sPipelineManifest->Record(kind, key);
+		}
+		
+		void ArchiveComputePipeline(MTLComputePipelineDescriptor* descriptor, uint64_t key)
+		{
+			if (sPipelineManifest == NULL)
+			{
+				return;
+			}
+			
+			if (@available(iOS 14.0, macOS 11.0, *))
+			{
+				if (sPipelineArchive != nil)
+				{
+					id<MTLBinaryArchive> archive = (id<MTLBinaryArchive>)sPipelineArchive;
+					if (!IsPipelineArchived(PipelineManifest::ePipelineKind_Compute, key))
+					{
+						//a full backend compile, so it runs outside the manifest lock, alongside other adds
+						NSError* error = nil;
+						pthread_rwlock_rdlock(&sPipelineArchiveLock);
+						[archive addComputePipelineFunctionsWithDescriptor:descriptor error:&error];
+						pthread_rwlock_unlock(&sPipelineArchiveLock);
+						if (error != nil)
+						{
+							qWARNING(false, "Unable to archive compute pipeline %s: %s", [descriptor.label UTF8String], [[error description] UTF8String]);
+							return;
+						}
+					}
+					descriptor.binaryArchives = @[archive];
+				}
+			}
+			
+			RecordPipeline(PipelineManifest::ePipelineKind_Compute, key);
+		}
+		
+		void ArchiveRenderPipeline(MTLRenderPipelineDescriptor* descriptor, uint64_t key)
+		{
+			if (sPipelineManifest == NULL)
+			{
+				return;
+			}
+			
+			if (@available(iOS 14.0, macOS 11.0, *))
+			{
+				if (sPipelineArchive != nil)
+				{
+					id<MTLBinaryArchive> archive = (id<MTLBinaryArchive>)sPipelineArchive;
+					if (!IsPipelineArchived(PipelineManifest::ePipelineKind_Render, key))
+					{
+						//a full backend compile, so it runs outside the manifest lock, alongside other adds
+						NSError* error = nil;
+						pthread_rwlock_rdlock(&sPipelineArchiveLock);
+						[archive addRenderPipelineFunctionsWithDescriptor:descriptor error:&error];
+						pthread_rwlock_unlock(&sPipelineArchiveLock);
+						if (error != nil)
+						{
+							qWARNING(false, "Unable to archive render pipeline %s: %s", [descriptor.label UTF8String], [[error description] UTF8String]);
+							return;
+						}
+					}
+					descriptor.binaryArchives = @[archive];
+				}
+			}
+			
+			RecordPipeline(PipelineManifest::ePipelineKind_Render, key);
+		}
+		
+		void SavePipelineArchive()
+		{
+			std::lock_guard<std::mutex> lock(sPipelineManifestMutex);
+			
+			if ((sPipelineManifest == NULL) || !sPipelineManifest->IsDirty())
+			{
+				return;
+			}
+			
+			//archive first, so the manifest never lists pipelines the archive on disk doesn't have
+			if (@available(iOS 14.0, macOS 11.0, *))
+			{
+				if (sPipelineArchive != nil)
+				{
+					//the open archive may be backed by the file we're replacing, so write alongside and swap
+					NSString* tempPath = [PipelineArchivePath() stringByAppendingPathExtension:@"tmp"];
+					NSError* error = nil;
+					pthread_rwlock_wrlock(&sPipelineArchiveLock);
+					[(id<MTLBinaryArchive>)sPipelineArchive serializeToURL:[NSURL fileURLWithPath:tempPath] error:&error];
+					pthread_rwlock_unlock(&sPipelineArchiveLock);
+					if (error == nil)
+					{
+						[[NSFileManager defaultManager] removeItemAtPath:PipelineArchivePath() error:nil];
+						[[NSFileManager defaultManager] moveItemAtPath:tempPath toPath:PipelineArchivePath() error:&error];
+					}
+					
+					if (error != nil)
+					{
+						qWARNING(false, "Unable to save pipeline archive %s: %s", [PipelineArchivePath() UTF8String], [[error description] UTF8String]);
+						return;
+					}
+				}
+			}
+			
+			const bool saved = sPipelineManifest->SaveFile([PipelineManifestPath() UTF8String]);
+			qWARNING(saved, "Unable to save pipeline manifest %s", [PipelineManifestPath() UTF8String]);
+		}
+		
+		static id<MTLCommandBuffer> QueueCommandBuffer(eQueue queue)
+		{
+			return (queue == eQueue_Render) ? sCommandBuffer : sComputeCommandBuffer;
+		}
+		
+		static void EncodeQueueWaits(eQueue queue)
+		{
+			id<MTLCommandBuffer> commandBuffer = QueueCommandBuffer(queue);
+			for (auto &point : sQueueWaits[queue])
+			{
+				[commandBuffer encodeWaitForEvent:sQueueEvent[point.queue] value:point.value];
+			}
+			sQueueWaits[queue].clear();
+		}
+		
+		static QueuePoint SignalQueue(eQueue queue)
+		{
+			const QueuePoint point = sQueueTimeline.Submit(queue);
+			[QueueCommandBuffer(queue) encodeSignalEvent:sQueueEvent[queue] value:point.value];
+			return point;
+		}
+		
+		static void UpdateQueueCompletion()
+		{
+			for (uint32_t queue = 0; queue < eQueue_Count; ++queue)
+			{
+				sQueueTimeline.Completed(queue, sQueueEvent[queue].signaledValue);
+			}
+		}
+		
+		//called from command buffer completion handlers
+		static void CompleteFrameWork(uint32_t frameIndex)
+		{
+			if (sFramePending[frameIndex].fetch_sub(1, std::memory_order_acq_rel) != 1)
+			{
+				return;
+			}
+			
+			std::lock_guard<std::mutex> lock(sRetireMutex);
+			sFrameCompleted[frameIndex] = true;
+			while (sFrameCompleted[sRetireIndex])
+			{
+				sFrameCompleted[sRetireIndex] = false;
+				dispatch_semaphore_signal(sFrameRetireSemaphore[sRetireIndex]);
+				sRetireIndex = (sRetireIndex + 1) % Q_METAL_FRAMES_TO_BUFFER;
+			}
+		}
+		
+		void BeginAsyncCompute()
+		{
+			qASSERTM(sInited, "Device isn't inited");
+			qASSERTM(sComputeCommandBuffer == nil, "Device async compute CommandBuffer isn't nil; did you call EndAsyncCompute()?");
+			
+			sComputeCommandBuffer = [[sComputeQueue commandBuffer] retain];
+			sComputeCommandBuffer.label = [NSString stringWithFormat:@"qMetal Async Compute Command Buffer for frame %i", sFrameIndex];
+			EncodeQueueWaits(eQueue_Compute);
+		}
+		
+		id<MTLComputeCommandEncoder> AsyncComputeEncoder(NSString* label)
+		{
+			qASSERTM(sComputeCommandBuffer != nil, "Device async compute CommandBuffer is nil; did you call BeginAsyncCompute()?");
+			id<MTLComputeCommandEncoder> encoder = [sComputeCommandBuffer computeCommandEncoder];
+			encoder.label = label;
+			return encoder;
+		}
+		
+		QueuePoint EndAsyncCompute()
+		{
+			qASSERTM(sComputeCommandBuffer != nil, "Device async compute CommandBuffer is nil; did you call BeginAsyncCompute()?");
+			
+			//the frame can't retire, and hand on the upload ring region and param slots this may read, until it completes
+			const uint32_t frameIndex = sFrameIndex;
+			sFramePending[frameIndex].fetch_add(1, std::memory_order_relaxed);
+			[sComputeCommandBuffer addCompletedHandler:^(id<MTLCommandBuffer> buffer) {
+				CompleteFrameWork(frameIndex);
+			}];
+			
+			const QueuePoint point = SignalQueue(eQueue_Compute);
+			[sComputeCommandBuffer commit];
+			[sComputeCommandBuffer release];
+			sComputeCommandBuffer = nil;
+			return point;
+		}
+		
+		QueuePoint QueuePendingPoint(eQueue queue)
+		{
+			return sQueueTimeline.Next(queue);
+		}
+		
+		void WaitForQueue(eQueue queue, QueuePoint point)
+		{
+			qASSERTM(sInited, "Device isn't inited");
+			
+			//a completed point needs no wait, so let the timeline see what's done first
+			UpdateQueueCompletion();
+			if (!sQueueTimeline.Wait(queue, point))
+			{
+				return;
+			}
+			
+			sQueueWaits[queue].push_back(point);
+			if (QueueCommandBuffer(queue) != nil)
+			{
+				if (queue == eQueue_Render)
+				{
+					EndCoalescedComputeEncoder();
+				}
+				EncodeQueueWaits(queue);
+			}
+		}
+		
+		bool IsQueuePointComplete(QueuePoint point)
+		{
+			UpdateQueueCompletion();
+			return sQueueTimeline.IsComplete(point);
+		}
+		
         void BeginOffScreen()
         {
             qASSERTM(sInited, "Device isn't inited");
@@ -189,6 +821,7 @@ namespace qMetal
 			
             sCommandBuffer = [[sCommandQueue commandBuffer] retain];
             sCommandBuffer.label = [NSString stringWithFormat:@"qMetal Off Screen Command Buffer for frame %i", sFrameIndex];
+			EncodeQueueWaits(eQueue_Render);
             
             ResetIndirectCommandBuffers(); //TODO make sure this is only called once per frame
 		}
@@ -198,6 +831,9 @@ namespace qMetal
             qASSERTM(sInited, "Device isn't inited");
 			qASSERTM(sCommandBuffer != nil, "Device CommandBuffer is nil; did you call StartOffScreen()?");
 			
+			EndCoalescedComputeEncoder();
+			SignalQueue(eQueue_Render);
+			
 			#if DEBUG
 			if (sFramePrintIndex == 0)
 			{
@@ -221,6 +857,7 @@ namespace qMetal
 			
             sCommandBuffer = [[sCommandQueue commandBuffer] retain];
             sCommandBuffer.label = [NSString stringWithFormat:@"qMetal Drawable Command Buffer for frame %i", sFrameIndex];
+			EncodeQueueWaits(eQueue_Render);
             
             dispatch_semaphore_wait(sInflightSemaphore, DISPATCH_TIME_FOREVER);
 			
@@ -239,11 +876,17 @@ namespace qMetal
             qASSERTM(sInited, "Device isn't inited");
 			qASSERTM(sCommandBuffer != nil, "Device CommandBuffer is nil; did you call StartOffScreen()?");
 			
+			//frame jobs may still be encoding into the drawable's pass, or allocating from this frame's upload ring
+			sJobs->Wait(sFrameJobs);
+			
             sRenderTarget->End();
 			
-			__block dispatch_semaphore_t blockSemaphore = blockUntilFrameComplete ? sSingleFrameSemaphore : sInflightSemaphore;
+			//the frame retires, handing on its upload ring region and versioned param slots, on the CPU once this and its
+			//async compute have completed; a GPU wait here would stall the render queue behind long running compute
+			qASSERTM(sComputeCommandBuffer == nil, "Device async compute CommandBuffer isn't nil; call EndAsyncCompute() before EndAndPresentDrawable()");
+			
+			#if DEBUG
 			[sCommandBuffer addCompletedHandler:^(id<MTLCommandBuffer> buffer) {
-				#if DEBUG
 				if (sFramePrintIndex == 0)
 				{
 					NSTimeInterval CPUtime = buffer.kernelEndTime - buffer.kernelStartTime;
@@ -251,15 +894,23 @@ namespace qMetal
 					NSLog(@"Onscreen GPU: %0.3f, CPU: %0.3f", GPUtime * 1000.0, CPUtime * 1000.0); //TODO monitor
 				}
 				sFramePrintIndex = (sFramePrintIndex + 1) % Q_METAL_FRAMES_BETWEEN_PRINT;
-				#endif
-				dispatch_semaphore_signal(blockSemaphore);
+			}];
+			#endif
+			
+			const uint32_t frameIndex = sFrameIndex;
+			sFrameRetireSemaphore[frameIndex] = blockUntilFrameComplete ? sSingleFrameSemaphore : sInflightSemaphore;
+			[sCommandBuffer addCompletedHandler:^(id<MTLCommandBuffer> buffer) {
+				CompleteFrameWork(frameIndex);
 			}];
             
+            EndCoalescedComputeEncoder();
+			SignalQueue(eQueue_Render);
             [sCommandBuffer presentDrawable:sDrawable afterMinimumDuration:afterMinimumDuration];
             [sCommandBuffer commit];
             [sCommandBuffer release];
             sCommandBuffer = nil;
             sFrameIndex = (sFrameIndex + 1) % Q_METAL_FRAMES_TO_BUFFER;
+            sFrameNumber++;
             delete(sRenderTarget);
             sRenderTarget = NULL;
 			
@@ -267,6 +918,18 @@ namespace qMetal
 			{
 				dispatch_semaphore_wait(sSingleFrameSemaphore, DISPATCH_TIME_FOREVER);
 			}
+			
+			//the in-flight semaphore guarantees the frame that last used this index has retired, same as the per-material param buffers
+			sFramePending[sFrameIndex].store(1, std::memory_order_relaxed);
+			if (sUploadRing != NULL)
+			{
+				sUploadRing->BeginFrame(sFrameIndex);
+				for (auto &it : sUploadOverflowBuffers[sFrameIndex])
+				{
+					[it release];
+				}
+				sUploadOverflowBuffers[sFrameIndex].clear();
+			}
         }
         
         id<MTLIndirectCommandBuffer> IndirectCommandBuffer(eIndirectCommandBufferPool pool)
@@ -298,8 +961,20 @@ namespace qMetal
 			return sIndirectCommandBufferPool[pool].nextIndirectRangeOffset++;
 		}
         
+		static void WaitForIndirectPipelines()
+		{
+			if (sIndirectPipelineBatch != NULL)
+			{
+				sIndirectPipelineBatch->Wait();
+				delete sIndirectPipelineBatch;
+				sIndirectPipelineBatch = NULL;
+			}
+		}
+        
         void ResetIndirectCommandBuffers()
         {
+			WaitForIndirectPipelines();
+			
 			id<MTLComputeCommandEncoder> encoder =  ComputeEncoder(@"Indirect Command Buffer Reset");
 			[encoder setComputePipelineState:sIndirectResetComputePiplineState];
 			for(uint32_t poolIndex = 0; poolIndex < eIndirectCommandBufferPool_Count; ++poolIndex)
@@ -318,6 +993,8 @@ namespace qMetal
         
         void InitIndirectCommandBuffer(eIndirectCommandBufferPool pool, id<MTLComputeCommandEncoder> encoder, id<MTLBuffer> rangeOffsetBuffer)
         {
+			WaitForIndirectPipelines();
+			
 			[encoder pushDebugGroup:@"Indirect Command Buffer Init"];
 			[encoder setComputePipelineState:sIndirectInitComputePiplineState];
 			[encoder setBuffer:IndirectRangeBuffer(pool) 		offset:0 atIndex:0];
@@ -331,5 +1008,16 @@ namespace qMetal
 		{
 			[encoder executeCommandsInBuffer:IndirectCommandBuffer(pool) indirectBuffer:IndirectRangeBuffer(pool) indirectBufferOffset:(indirectRangeOffset * sizeof(MTLIndirectCommandBufferExecutionRange))];
 		}
+		
+		void ResolveIndirectDispatch(TrackedComputeEncoder& encoder, id<MTLBuffer> dispatchBuffer, NSUInteger offset)
+		{
+			WaitForIndirectPipelines();
+			
+			[encoder.Get() pushDebugGroup:@"Indirect Dispatch Resolve"];
+			encoder.SetComputePipelineState(sIndirectDispatchResolveComputePipelineState);
+			encoder.SetBuffer(dispatchBuffer, offset, 0);
+			[encoder.Get() dispatchThreads:MTLSizeMake(1, 1, 1) threadsPerThreadgroup:MTLSizeMake(1, 1, 1)];
+			[encoder.Get() popDebugGroup];
+		}
     }
 }
@@ -22,30 +22,83 @@ SOFTWARE.
 
 #include "qMetalFunction.h"
 #include "qMetalDevice.h"
+#include "qMetalPipelineCache.h"
 
 #include "qCore.h"
 
 namespace qMetal
 {
 	id <MTLLibrary> Function::sDefaultLibrary = nil;
+	PipelineCache<const Function*> Function::sVariantCache;
 
 	Function::Function(NSString* name, MTLFunctionConstantValues* functionConstantValues)
 	: function(nil)
+	, hash(0)
+	, stableHash(functionConstantValues == nil)
 	{
-		if (sDefaultLibrary == nil)
+		Create(name, functionConstantValues);
+		
+		PipelineHash functionHash;
+		functionHash.AddString([name UTF8String]);
+		if (functionConstantValues != nil)
 		{
-			sDefaultLibrary = [Device::Get() newDefaultLibrary];
+			functionHash.Add((uintptr_t)function);
+		}
+		hash = functionHash.Value();
+	}
+	
+	Function::Function(NSString* name, const FunctionConstants& constants)
+	: function(nil)
+	, hash(VariantHash(name, constants))
+	, stableHash(true)
+	{
+		MTLFunctionConstantValues* functionConstantValues = nil;
+		
+		if (!constants.IsEmpty())
+		{
+			functionConstantValues = [MTLFunctionConstantValues new];
+			
+			const FunctionConstants::ValueMap& values = constants.Values();
+			for (FunctionConstants::ValueMap::const_iterator it = values.begin(); it != values.end(); ++it)
+			{
+				const FunctionConstants::Value& value = it->second;
+				switch (value.type)
+				{
+					case FunctionConstants::eType_Bool:
+					{
+						const bool b = (value.bits != 0);
+						[functionConstantValues setConstantValue:&b type:MTLDataTypeBool atIndex:it->first];
+						break;
+					}
+					case FunctionConstants::eType_Int:
+						[functionConstantValues setConstantValue:&value.bits type:MTLDataTypeInt atIndex:it->first];
+						break;
+					case FunctionConstants::eType_UInt:
+						[functionConstantValues setConstantValue:&value.bits type:MTLDataTypeUInt atIndex:it->first];
+						break;
+					case FunctionConstants::eType_Float:
+						[functionConstantValues setConstantValue:&value.bits type:MTLDataTypeFloat atIndex:it->first];
+						break;
+				}
+			}
 		}
 		
+		Create(name, functionConstantValues);
+		
+		[functionConstantValues release];
+	}
+	
+	void Function::Create(NSString* name, MTLFunctionConstantValues* functionConstantValues)
+	{
 		if (functionConstantValues != nil)
 		{
 			NSError* error = nil;
-			function = [sDefaultLibrary newFunctionWithName:name constantValues:functionConstantValues error:&error];
-			qASSERTM( error == nil, "" );
+			function = [DefaultLibrary() newFunctionWithName:name constantValues:functionConstantValues error:&error];
+			qASSERTM( error == nil, "Unable to specialise function %s: %s", [name UTF8String], [[error description] UTF8String] );
 		}
 		else
 		{
-			function = [sDefaultLibrary newFunctionWithName:name];
+			function = [DefaultLibrary() newFunctionWithName:name];
 		}
 		
 #if DEBUG
@@ -54,4 +107,47 @@ namespace qMetal
 
 		qASSERTM(function != nil, "Unable to find function %s", [name UTF8String]);
 	}
+	
+	id <MTLLibrary> Function::DefaultLibrary()
+	{
+		//variants can be built from several threads at once
+		static dispatch_once_t once;
+		dispatch_once(&once, ^{
+			sDefaultLibrary = [Device::Get() newDefaultLibrary];
+		});
+		return sDefaultLibrary;
+	}
+	
+	uint64_t Function::VariantHash(NSString* name, const FunctionConstants& constants)
+	{
+		PipelineHash hash;
+		hash.AddString([name UTF8String]);
+		if (!constants.IsEmpty())
+		{
+			hash.Add(constants.Hash());
+		}
+		return hash.Value();
+	}
+	
+	const Function* Function::Variant(NSString* name, const FunctionConstants& constants)
+	{
+		return sVariantCache.Acquire(VariantHash(name, constants), [&]()
+		{
+			return new Function(name, constants);
+		});
+	}
+	
+	void Function::BuildVariants(NSString* name, const FunctionPermutationSpace& space)
+	{
+		DefaultLibrary();
+		
+		dispatch_apply(space.Count(), dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t permutation) {
+			Variant(name, space.Permutation(permutation));
+		});
+	}
+	
+	const PipelineCache<const Function*>& Function::VariantCache()
+	{
+		return sVariantCache;
+	}
 }
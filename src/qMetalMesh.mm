@@ -132,40 +132,52 @@ namespace qMetal
 	}
 	
 	void Mesh::UseResources(id<MTLComputeCommandEncoder> encoder, bool withVertexArgumentBuffer)
+	{
+		TrackedComputeEncoder untracked(encoder, false);
+		UseResources(untracked, withVertexArgumentBuffer);
+	}
+	
+	void Mesh::UseResources(TrackedComputeEncoder& encoder, bool withVertexArgumentBuffer)
 	{
 		if (withVertexArgumentBuffer)
 		{
 			for (int i = 0; i < config->vertexStreamCount; ++i)
 			{
-				[encoder useResource:vertexBuffers[i] usage:MTLResourceUsageRead];
+				encoder.UseResource(vertexBuffers[i], MTLResourceUsageRead);
 			}
 		}
 		
 		if (config->IsQuadIndexed())
 		{
-			[encoder useResource:quadIndexBuffer usage:MTLResourceUsageRead];
+			encoder.UseResource(quadIndexBuffer, MTLResourceUsageRead);
 		}
 		else if (config->IsIndexed())
 		{
-			[encoder useResource:indexBuffer usage:MTLResourceUsageRead];
+			encoder.UseResource(indexBuffer, MTLResourceUsageRead);
 		}
 		
 		if (config->tessellated)
 		{
-			[encoder useResource:tessellationFactorsBuffer usage:MTLResourceUsageWrite];
+			encoder.UseResource(tessellationFactorsBuffer, MTLResourceUsageWrite);
 		}
 	}
 	
 	void Mesh::UseResources(id<MTLRenderCommandEncoder> encoder)
+	{
+		TrackedRenderEncoder untracked(encoder, false);
+		UseResources(untracked);
+	}
+	
+	void Mesh::UseResources(TrackedRenderEncoder& encoder)
 	{
 		for (int i = 0; i < config->vertexStreamCount; ++i)
 		{
-			[encoder useResource:vertexBuffers[i] usage:MTLResourceUsageRead];
+			encoder.UseResource(vertexBuffers[i], MTLResourceUsageRead, MTLRenderStageVertex);
 		}
 		
 		if (config->IsIndexed())
 		{
-			[encoder useResource:indexBuffer usage:MTLResourceUsageRead];
+			encoder.UseResource(indexBuffer, MTLResourceUsageRead, MTLRenderStageVertex);
 		}
 	}
 }
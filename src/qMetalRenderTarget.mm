@@ -21,12 +21,15 @@ SOFTWARE.
 */
 
 #include "qMetalRenderTarget.h"
+#include "qMetalDevice.h"
+#include "qMetalTextureTable.h"
 
 namespace qMetal
 {
 	RenderTarget::RenderTarget(const Config* _config)
 	: config(_config)
 	, mEncoder(nil)
+	, mParallelEncoder(nil)
 	{
 		renderPassDescriptor = [MTLRenderPassDescriptor new];
 		
@@ -82,6 +85,11 @@ namespace qMetal
 				attachment.resolveTexture = mColourResolveTexture[i]->MTLTexture();
 				attachment.storeAction = MTLStoreActionMultisampleResolve;
 			}
+			
+			if (config->storeAction[i] != eStoreAction_Default)
+			{
+				attachment.storeAction = (MTLStoreAction)config->storeAction[i];
+			}
 		}
 		
 		for (int i = config->colorAttachmentCount; i < eColorAttachment_Count; ++i)
@@ -135,6 +143,11 @@ namespace qMetal
 				attachment.storeAction = MTLStoreActionMultisampleResolve;
 				attachment.depthResolveFilter = MTLMultisampleDepthResolveFilterMin;
 			}
+			
+			if (config->depthStoreAction != eStoreAction_Default)
+			{
+				attachment.storeAction = (MTLStoreAction)config->depthStoreAction;
+			}
 		}
 		else
 		{
@@ -162,6 +175,11 @@ namespace qMetal
 			attachment.storeAction = (textureConfig != NULL && (textureConfig->storage == Texture::eStorage_Memoryless)) ? MTLStoreActionDontCare : MTLStoreActionStore;
 			attachment.slice = config->slice;
 			attachment.level = config->level;
+			
+			if (config->stencilStoreAction != eStoreAction_Default)
+			{
+				attachment.storeAction = (MTLStoreAction)config->stencilStoreAction;
+			}
 		}
 		else
 		{
@@ -178,6 +196,7 @@ namespace qMetal
 	id<MTLRenderCommandEncoder> RenderTarget::Begin()
 	{
 		qASSERTM(mEncoder == nil, "RenderTexture encoder is set; did you forget to call End()?");
+		qASSERTM(mParallelEncoder == nil, "RenderTexture parallel encoder is set; did you forget to call EndParallel()?");
 		mEncoder = qMetal::Device::RenderEncoder(renderPassDescriptor, config->name);
 		[mEncoder pushDebugGroup:config->name];
 		return mEncoder;
@@ -190,4 +209,87 @@ namespace qMetal
 		[mEncoder endEncoding];
 		mEncoder = nil;
 	}
+	
+	void RenderTarget::BeginParallel(uint32_t count, StateFunction setup, void* setupContext)
+	{
+		qASSERTM(mEncoder == nil, "RenderTexture encoder is set; did you forget to call End()?");
+		qASSERTM(mParallelEncoder == nil, "RenderTexture parallel encoder is set; did you forget to call EndParallel()?");
+		qASSERTM(count > 0, "RenderTexture parallel encoding needs at least one sub-encoder");
+		
+		mParallelEncoder = qMetal::Device::ParallelRenderEncoder(renderPassDescriptor, config->name);
+		[mParallelEncoder pushDebugGroup:config->name];
+		
+		//sub-encoders can't register bindless textures from their job threads
+		if (qMetal::Device::BindlessTextures() != NULL)
+		{
+			qMetal::Device::BindlessTextures()->CloseRegistration();
+		}
+		
+		//sub-encoders execute in the order they're created, so this order is the submission order
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			id<MTLRenderCommandEncoder> encoder = [[mParallelEncoder renderCommandEncoder] retain];
+			encoder.label = [NSString stringWithFormat:@"%@ %u", config->name, i];
+			if (setup != NULL)
+			{
+				setup(encoder, setupContext);
+			}
+			mParallelEncoders.push_back(encoder);
+		}
+	}
+	
+	void RenderTarget::EndParallel()
+	{
+		qASSERTM(mParallelEncoder != nil, "RenderTexture parallel encoder is nil; did you call BeginParallel()?");
+		for (auto &encoder : mParallelEncoders)
+		{
+			[encoder endEncoding];
+			[encoder release];
+		}
+		mParallelEncoders.clear();
+		
+		[mParallelEncoder popDebugGroup];
+		[mParallelEncoder endEncoding];
+		mParallelEncoder = nil;
+		
+		if (qMetal::Device::BindlessTextures() != NULL)
+		{
+			qMetal::Device::BindlessTextures()->OpenRegistration();
+		}
+	}
+	
+	typedef struct ParallelEncode
+	{
+		RenderTarget*					target;
+		RenderTarget::PartFunction		encode;
+		void*							context;
+	} ParallelEncode;
+	
+	static void EncodePartJob(void* context, uint32_t begin, uint32_t end)
+	{
+		const ParallelEncode& parallel = *(const ParallelEncode*)context;
+		for (uint32_t part = begin; part < end; ++part)
+		{
+			@autoreleasepool
+			{
+				parallel.encode(parallel.target->ParallelEncoder(part), part, parallel.target->ParallelEncoderCount(), parallel.context);
+			}
+		}
+	}
+	
+	void RenderTarget::EncodeParallel(uint32_t count, PartFunction encode, void* context, StateFunction setup, void* setupContext)
+	{
+		BeginParallel(count, setup, setupContext);
+		
+		ParallelEncode parallel;
+		parallel.target = this;
+		parallel.encode = encode;
+		parallel.context = context;
+		
+		JobCounter parts(&qMetal::Device::FrameJobs());
+		qMetal::Device::Jobs().ParallelFor(parts, count, 1, &EncodePartJob, &parallel);
+		qMetal::Device::Jobs().Wait(parts);
+		
+		EndParallel();
+	}
 }
@@ -21,6 +21,7 @@ SOFTWARE.
 */
 
 #include "qMetalSamplerState.h"
+#include "qMetalArgumentBuffer.h"
 #include "qCore.h"
 
 namespace qMetal
@@ -69,4 +70,9 @@ namespace qMetal
 	{
 		[encoder setSamplerState:samplerState atIndex:index];
 	}
+	
+	void SamplerState::WriteArgumentTable(void* table, uint32_t index) const
+	{
+		ArgumentTable::SetSampler(table, index, samplerState);
+	}
 }
@@ -22,6 +22,8 @@ SOFTWARE.
 
 #include "qMetalTexture.h"
 #include "qMetalDevice.h"
+#include "qMetalArgumentBuffer.h"
+#include "qMetalTextureTable.h"
 #include <MetalKit/MetalKit.h>
 #include <map>
 
@@ -36,6 +38,8 @@ namespace qMetal
 	: texture(_texture)
 	, config(NULL)
 	, samplerState(_samplerState)
+	, bindlessIndex(TextureTable::InvalidIndex)
+	, bindlessSamplerIndex(TextureTable::InvalidIndex)
 	{
 	}
 	
@@ -43,6 +47,38 @@ namespace qMetal
 	: texture(nil)
 	, config(_config)
 	, samplerState(_samplerState)
+	, bindlessIndex(TextureTable::InvalidIndex)
+	, bindlessSamplerIndex(TextureTable::InvalidIndex)
+	{
+		texture = [qMetal::Device::Get() newTextureWithDescriptor:Descriptor(config)];
+		texture.label = config->name;
+	}
+	
+	Texture::Texture(Config* _config, SamplerState* _samplerState, id<MTLHeap> heap, NSUInteger offset)
+	: texture(nil)
+	, config(_config)
+	, samplerState(_samplerState)
+	, bindlessIndex(TextureTable::InvalidIndex)
+	, bindlessSamplerIndex(TextureTable::InvalidIndex)
+	{
+		qASSERTM(heap.type == MTLHeapTypePlacement, "Texture %s can only be placed in a placement heap", [config->name UTF8String]);
+		qASSERTM(config->storage != eStorage_Memoryless, "Texture %s is memoryless, so can't live in a heap", [config->name UTF8String]);
+		MTLTextureDescriptor* textureDescriptor = Descriptor(config);
+		textureDescriptor.storageMode = heap.storageMode;
+		texture = [heap newTextureWithDescriptor:textureDescriptor offset:offset];
+		texture.label = config->name;
+	}
+	
+	MTLSizeAndAlign Texture::HeapSizeAndAlign(const Config* config)
+	{
+		//sized as the heap constructor places it, with the heap's storage mode rather than the config's; frame graph
+		//heaps are private
+		MTLTextureDescriptor* textureDescriptor = Descriptor(config);
+		textureDescriptor.storageMode = MTLStorageModePrivate;
+		return [qMetal::Device::Get() heapTextureSizeAndAlignWithDescriptor:textureDescriptor];
+	}
+	
+	MTLTextureDescriptor* Texture::Descriptor(const Config* config)
 	{
 		MTLTextureDescriptor* textureDescriptor = NULL;
 	  
@@ -73,7 +109,7 @@ namespace qMetal
 			case eType_3D:
 				qASSERTM(config->arrayLength == 1, "eType_3D textures must have an arrayLength of 1");
 				qASSERTM(config->msaa == eMSAA_1, "eType_3D textures must not use MSAA");
-				textureDescriptor = [MTLTextureDescriptor new];
+				textureDescriptor = [[MTLTextureDescriptor new] autorelease];
 				textureDescriptor.textureType = MTLTextureType3D;
 				textureDescriptor.width = config->width;
 				textureDescriptor.height = config->height;
@@ -97,12 +133,15 @@ namespace qMetal
 			textureDescriptor.storageMode = (MTLStorageMode)eStorage_GPUOnly;
 		}
 		
-		texture = [qMetal::Device::Get() newTextureWithDescriptor: textureDescriptor];
-		texture.label = config->name;
+		return textureDescriptor;
 	}
 	
 	Texture::~Texture()
 	{
+		if (bindlessIndex != TextureTable::InvalidIndex)
+		{
+			Device::BindlessTextures()->Unregister(bindlessIndex);
+		}
 		if (config != NULL)
 		{
 			delete(config);
@@ -131,6 +170,18 @@ namespace qMetal
 		samplerState->Encode(encoder, samplerIndex);
 	}
 	
+	void Texture::WriteArgumentTable(void* table, eUnit textureIndex) const
+	{
+		qASSERT(texture != nil);
+		ArgumentTable::SetTexture(table, textureIndex, texture);
+	}
+	
+	void Texture::WriteArgumentTable(void* table, eUnit textureIndex, eUnit samplerIndex) const
+	{
+		WriteArgumentTable(table, textureIndex);
+		samplerState->WriteArgumentTable(table, samplerIndex);
+	}
+	
 	void Texture::EncodeUsage(id<MTLRenderCommandEncoder> encoder, MTLRenderStages stages) const
 	{
 		qASSERT(texture != nil);
@@ -155,6 +206,27 @@ namespace qMetal
 		return texture;
 	}
 	
+	uint32_t Texture::BindlessIndex() const
+	{
+		if (bindlessIndex == TextureTable::InvalidIndex)
+		{
+			qASSERTM(Device::BindlessTextures() != NULL, "Bindless textures are disabled; set Device::Config::bindlessTextureCount");
+			bindlessIndex = Device::BindlessTextures()->Register(this);
+		}
+		return bindlessIndex;
+	}
+	
+	uint32_t Texture::BindlessSamplerIndex() const
+	{
+		if (bindlessSamplerIndex == TextureTable::InvalidIndex)
+		{
+			qASSERTM(Device::BindlessTextures() != NULL, "Bindless textures are disabled; set Device::Config::bindlessTextureCount");
+			qASSERTM(samplerState != NULL, "Texture %s has no sampler state to register", [texture.label UTF8String]);
+			bindlessSamplerIndex = Device::BindlessTextures()->RegisterSampler(samplerState);
+		}
+		return bindlessSamplerIndex;
+	}
+	
 	void Texture::Fill(uint8_t* data)
 	{
 		qASSERT(config->pixelFormat == ePixelFormat_R8);
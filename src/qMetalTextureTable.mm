@@ -0,0 +1,197 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "qMetalTextureTable.h"
+#include "qMetalArgumentBuffer.h"
+#include "qMetalDevice.h"
+#include "qMetalSamplerState.h"
+#include "qMetalTexture.h"
+#include "qCore.h"
+
+namespace qMetal
+{
+	TextureTable::TextureTable(uint32_t _textureCapacity, uint32_t _samplerCapacity)
+	: textureCapacity(_textureCapacity)
+	, samplerCapacity(_samplerCapacity)
+	, slots(_textureCapacity, Q_METAL_FRAMES_TO_BUFFER)
+	, buffer(nil)
+	, argumentEncoder(nil)
+	, registrationOpen(true)
+	{
+		qASSERTM(textureCapacity > 0, "TextureTable needs room for at least one texture");
+		
+		residentPosition.resize(textureCapacity, InvalidIndex);
+		resident.reserve(textureCapacity);
+		residentSlot.reserve(textureCapacity);
+		
+		if (ArgumentTable::Supported())
+		{
+			buffer = ArgumentTable::NewBuffer(textureCapacity + samplerCapacity, @"qMetal Texture Table");
+		}
+		else
+		{
+			//no function to reflect, so describe the struct by hand; implicit ids put the samplers straight after the textures
+			MTLArgumentDescriptor* textureDescriptor = [MTLArgumentDescriptor argumentDescriptor];
+			textureDescriptor.dataType = MTLDataTypeTexture;
+			textureDescriptor.textureType = MTLTextureType2D;
+			textureDescriptor.access = MTLArgumentAccessReadOnly;
+			textureDescriptor.index = 0;
+			textureDescriptor.arrayLength = textureCapacity;
+			
+			NSMutableArray<MTLArgumentDescriptor*>* descriptors = [NSMutableArray arrayWithObject:textureDescriptor];
+			if (samplerCapacity > 0)
+			{
+				MTLArgumentDescriptor* samplerDescriptor = [MTLArgumentDescriptor argumentDescriptor];
+				samplerDescriptor.dataType = MTLDataTypeSampler;
+				samplerDescriptor.index = textureCapacity;
+				samplerDescriptor.arrayLength = samplerCapacity;
+				[descriptors addObject:samplerDescriptor];
+			}
+			
+			argumentEncoder = [Device::Get() newArgumentEncoderWithArguments:descriptors];
+			buffer = [Device::Get() newBufferWithLength:argumentEncoder.encodedLength options:0];
+			buffer.label = @"qMetal Texture Table";
+			[argumentEncoder setArgumentBuffer:buffer offset:0];
+		}
+	}
+	
+	TextureTable::~TextureTable()
+	{
+		[argumentEncoder release];
+		[buffer release];
+	}
+	
+	uint32_t TextureTable::Register(const Texture* texture)
+	{
+		qASSERTM(registrationOpen, "TextureTable registration is closed during a parallel encode; take Texture::BindlessIndex() before it");
+		id<MTLTexture> mtlTexture = texture->MTLTexture();
+		qASSERTM(mtlTexture != nil, "TextureTable can't register a texture without a Metal texture");
+		qASSERTM(mtlTexture.textureType == MTLTextureType2D, "TextureTable only holds 2D textures, %s isn't one", [mtlTexture.label UTF8String]);
+		
+		const uint32_t slot = slots.Allocate(Device::CurrentFrameNumber());
+		qWARNING(slot != InvalidIndex, "TextureTable is full at %u textures (or waiting on unregistered slots to retire), %s won't be registered", textureCapacity, [mtlTexture.label UTF8String]);
+		if (slot == InvalidIndex)
+		{
+			return InvalidIndex;
+		}
+		
+		//a fresh or retired slot, so no frame in flight reads it
+		SetTexture(slot, mtlTexture);
+		residentPosition[slot] = (uint32_t)resident.size();
+		resident.push_back(mtlTexture);
+		residentSlot.push_back(slot);
+		return slot;
+	}
+	
+	void TextureTable::Unregister(uint32_t index)
+	{
+		qASSERTM(registrationOpen, "TextureTable registration is closed during a parallel encode; take Texture::BindlessIndex() before it");
+		qASSERTM((index < textureCapacity) && (residentPosition[index] != InvalidIndex), "TextureTable index %u isn't registered", index);
+		
+		//swap remove from the resident list
+		const uint32_t position = residentPosition[index];
+		resident[position] = resident.back();
+		residentSlot[position] = residentSlot.back();
+		residentPosition[residentSlot[position]] = position;
+		resident.pop_back();
+		residentSlot.pop_back();
+		residentPosition[index] = InvalidIndex;
+		
+		//the slot keeps its stale texture until it's reused; frames in flight may still sample it
+		slots.Free(index, Device::CurrentFrameNumber());
+	}
+	
+	uint32_t TextureTable::RegisterSampler(const SamplerState* samplerState)
+	{
+		qASSERTM(registrationOpen, "TextureTable registration is closed during a parallel encode; take Texture::BindlessSamplerIndex() before it");
+		const uint64_t key = ((uint64_t)samplerState->minFilter)
+			| ((uint64_t)samplerState->magFilter << 8)
+			| ((uint64_t)samplerState->mipFilter << 16)
+			| ((uint64_t)samplerState->wrapX << 24)
+			| ((uint64_t)samplerState->wrapY << 32);
+		
+		std::map<uint64_t, uint32_t>::const_iterator found = samplerSlots.find(key);
+		if (found != samplerSlots.end())
+		{
+			return found->second;
+		}
+		
+		const uint32_t samplerIndex = (uint32_t)samplerSlots.size();
+		qWARNING(samplerIndex < samplerCapacity, "TextureTable is full at %u samplers, the sampler won't be registered", samplerCapacity);
+		if (samplerIndex >= samplerCapacity)
+		{
+			//its slot would be past the end of the table
+			return InvalidIndex;
+		}
+		
+		if (argumentEncoder == nil)
+		{
+			samplerState->WriteArgumentTable([buffer contents], textureCapacity + samplerIndex);
+		}
+		else
+		{
+			samplerState->Encode(argumentEncoder, textureCapacity + samplerIndex);
+		}
+		
+		samplerSlots[key] = samplerIndex;
+		return samplerIndex;
+	}
+	
+	void TextureTable::Encode(id<MTLRenderCommandEncoder> encoder, NSUInteger index, MTLRenderStages stages) const
+	{
+		if (stages & MTLRenderStageVertex)
+		{
+			[encoder setVertexBuffer:buffer offset:0 atIndex:index];
+		}
+		if (stages & MTLRenderStageFragment)
+		{
+			[encoder setFragmentBuffer:buffer offset:0 atIndex:index];
+		}
+		
+		if (!resident.empty())
+		{
+			[encoder useResources:resident.data() count:resident.size() usage:MTLResourceUsageRead | MTLResourceUsageSample stages:stages];
+		}
+	}
+	
+	void TextureTable::Encode(id<MTLComputeCommandEncoder> encoder, NSUInteger index) const
+	{
+		[encoder setBuffer:buffer offset:0 atIndex:index];
+		
+		if (!resident.empty())
+		{
+			[encoder useResources:resident.data() count:resident.size() usage:MTLResourceUsageRead | MTLResourceUsageSample];
+		}
+	}
+	
+	void TextureTable::SetTexture(uint32_t slot, id<MTLTexture> texture)
+	{
+		if (argumentEncoder == nil)
+		{
+			ArgumentTable::SetTexture([buffer contents], slot, texture);
+		}
+		else
+		{
+			[argumentEncoder setTexture:texture atIndex:slot];
+		}
+	}
+}
@@ -0,0 +1,66 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_BENCH_H__
+#define __Q_METAL_BENCH_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+
+//timing for the host benchmarks: Time() runs a body several times and keeps the fastest run, which is the least
+//disturbed by whatever else the machine is doing. pass --quick for the shorter runs ctest uses
+
+namespace qMetalBench
+{
+	inline bool Quick(int argc, char** argv)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			if (strcmp(argv[i], "--quick") == 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+	
+	template <typename Body>
+	double Time(int runs, Body body)
+	{
+		double best = 1e30;
+		for (int run = 0; run < runs; ++run)
+		{
+			const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			body();
+			const std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+			best = std::min(best, seconds.count());
+		}
+		return best;
+	}
+}
+
+#define qBENCH_CHECK(x) 	do { if (!(x)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x); exit(1); } } while (0)
+
+#endif //__Q_METAL_BENCH_H__
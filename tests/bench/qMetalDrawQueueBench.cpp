@@ -0,0 +1,147 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "qMetalDrawQueue.h"
+#include "qMetalBench.h"
+#include <random>
+#include <thread>
+
+using namespace qMetal;
+
+//100k draws a frame: submit, Sort(), then Sort(JobSystem&), each checked against std::stable_sort of the same keys.
+//mixed keys come from DrawKey over a few hundred pipelines and materials with random depths; sparse keys only differ
+//in a couple of bytes, so the sort skips most of its passes
+
+typedef struct Draw
+{
+	uint32_t id;
+} Draw;
+
+typedef struct KeyedDraw
+{
+	uint64_t key;
+	uint32_t id;
+} KeyedDraw;
+
+static void MixedKeys(std::vector<uint64_t>& keys, uint32_t drawCount, uint32_t seed)
+{
+	std::mt19937_64 random(seed);
+	keys.resize(drawCount);
+	for (uint32_t i = 0; i < drawCount; ++i)
+	{
+		const uint32_t pass = (uint32_t)(random() % 4);
+		const uint64_t pipeline = random() % 200;
+		const uint64_t material = random() % 800;
+		const uint64_t mesh = random() % 2000;
+		const float depth = (float)(random() % 100000) / 100000.0f;
+		keys[i] = DrawKey::Make(pass, pipeline, material, mesh, depth, (random() % 8) == 0);
+	}
+}
+
+static void SparseKeys(std::vector<uint64_t>& keys, uint32_t drawCount, uint32_t seed)
+{
+	std::mt19937_64 random(seed);
+	keys.resize(drawCount);
+	for (uint32_t i = 0; i < drawCount; ++i)
+	{
+		keys[i] = ((random() % 3) << 58) | (random() % 4096);
+	}
+}
+
+static void Submit(DrawQueue<Draw>& queue, const std::vector<uint64_t>& keys)
+{
+	queue.Reset();
+	for (uint32_t i = 0; i < (uint32_t)keys.size(); ++i)
+	{
+		Draw draw;
+		draw.id = i;
+		queue.Submit(keys[i], draw);
+	}
+}
+
+static void CheckOrder(const DrawQueue<Draw>& queue, const std::vector<uint64_t>& keys)
+{
+	std::vector<KeyedDraw> expected(keys.size());
+	for (uint32_t i = 0; i < (uint32_t)keys.size(); ++i)
+	{
+		expected[i].key = keys[i];
+		expected[i].id = i;
+	}
+	std::stable_sort(expected.begin(), expected.end(), [](const KeyedDraw& a, const KeyedDraw& b) { return a.key < b.key; });
+	
+	qBENCH_CHECK(queue.IsSorted());
+	for (uint32_t i = 0; i < (uint32_t)keys.size(); ++i)
+	{
+		qBENCH_CHECK(queue.Key(i) == expected[i].key);
+		qBENCH_CHECK(queue.Draw(i).id == expected[i].id);
+	}
+}
+
+template <typename SortFunction>
+static double TimeSort(DrawQueue<Draw>& queue, const std::vector<uint64_t>& keys, int runs, SortFunction sort)
+{
+	//every run resubmits, since sorting an already sorted queue returns straight away
+	double best = 1e30;
+	for (int run = 0; run < runs; ++run)
+	{
+		Submit(queue, keys);
+		best = std::min(best, qMetalBench::Time(1, [&]() { sort(); }));
+	}
+	CheckOrder(queue, keys);
+	return best;
+}
+
+int main(int argc, char** argv)
+{
+	const bool quick = qMetalBench::Quick(argc, argv);
+	const int runs = quick ? 2 : 20;
+	const uint32_t drawCount = 100000;
+	
+	//at least one worker, so the parallel sort runs its chunked path even on a single core
+	const uint32_t cores = std::thread::hardware_concurrency();
+	JobSystem jobs((cores > 2) ? cores - 1 : 1);
+	DrawQueue<Draw> queue(drawCount);
+	
+	const char* names[] = { "mixed", "sparse" };
+	for (uint32_t keySet = 0; keySet < 2; ++keySet)
+	{
+		std::vector<uint64_t> keys;
+		if (keySet == 0)
+		{
+			MixedKeys(keys, drawCount, 1234);
+		}
+		else
+		{
+			SparseKeys(keys, drawCount, 5678);
+		}
+		
+		const double submitSeconds = qMetalBench::Time(runs, [&]() { Submit(queue, keys); });
+		const double serialSeconds = TimeSort(queue, keys, runs, [&]() { queue.Sort(); });
+		const uint32_t passCount = queue.SortPassCount();
+		const double parallelSeconds = TimeSort(queue, keys, runs, [&]() { queue.Sort(jobs); });
+		qBENCH_CHECK(queue.SortPassCount() == passCount);
+		
+		printf("DrawQueue, %u %s keys: submit %.3f ms, Sort() %.3f ms (%u passes), Sort(jobs) %.3f ms on %u workers\n",
+			   drawCount, names[keySet], submitSeconds * 1e3, serialSeconds * 1e3, passCount, parallelSeconds * 1e3, jobs.WorkerCount());
+	}
+	return 0;
+}
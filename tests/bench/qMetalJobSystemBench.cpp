@@ -0,0 +1,187 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "qMetalJobSystem.h"
+#include "qMetalDrawQueue.h"
+#include "qMetalBench.h"
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace qMetal;
+
+//how the job system scales with its worker count, on three loads: a flat ParallelFor of independent work, a tree of
+//jobs spawning jobs under a child counter (the frame's shape: FrameJobs() with groups under it), and DrawQueue's
+//parallel sort of 200k keys. every run checks its result, so this doubles as a stress test
+
+typedef struct ForContext
+{
+	const uint32_t*	input;
+	uint64_t*		output;
+	uint32_t		rounds;
+} ForContext;
+
+static void ForJob(void* context, uint32_t begin, uint32_t end)
+{
+	ForContext& work = *(ForContext*)context;
+	for (uint32_t i = begin; i < end; ++i)
+	{
+		uint64_t value = work.input[i];
+		for (uint32_t round = 0; round < work.rounds; ++round)
+		{
+			value = (value ^ (value >> 29)) * 0xBF58476D1CE4E5B9ULL + round;
+		}
+		work.output[i] = value;
+	}
+}
+
+typedef struct TreeContext
+{
+	JobSystem*				jobs;
+	JobCounter*				counter;
+	std::atomic<uint32_t>	leaves;
+} TreeContext;
+
+//begin is the node's remaining depth
+static void TreeJob(void* context, uint32_t begin, uint32_t)
+{
+	TreeContext& tree = *(TreeContext*)context;
+	if (begin == 0)
+	{
+		tree.leaves.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	tree.jobs->Run(*tree.counter, &TreeJob, context, begin - 1, begin);
+	tree.jobs->Run(*tree.counter, &TreeJob, context, begin - 1, begin);
+}
+
+typedef struct SortDraw
+{
+	uint32_t id;
+} SortDraw;
+
+int main(int argc, char** argv)
+{
+	const bool quick = qMetalBench::Quick(argc, argv);
+	const int runs = quick ? 1 : 5;
+	const uint32_t forCount = quick ? (1 << 16) : (1 << 20);
+	const uint32_t treeDepth = quick ? 10 : 16;
+	const uint32_t sortCount = quick ? 50000 : 200000;
+	
+	//0 workers is the serial baseline; go past the core count on small machines so the stealing still gets exercised
+	const uint32_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+	std::vector<uint32_t> workerCounts;
+	for (uint32_t workers = 0; workers < std::max(cores, 4u); workers = workers ? workers * 2 : 1)
+	{
+		workerCounts.push_back(workers);
+	}
+	if (workerCounts.back() != cores - 1 && cores > 1)
+	{
+		workerCounts.push_back(cores - 1);
+	}
+	
+	std::vector<uint32_t> input(forCount);
+	std::vector<uint64_t> output(forCount);
+	std::vector<uint64_t> expected(forCount);
+	for (uint32_t i = 0; i < forCount; ++i)
+	{
+		input[i] = i * 2654435761u;
+	}
+	ForContext forContext = { input.data(), expected.data(), 64 };
+	ForJob(&forContext, 0, forCount);
+	forContext.output = output.data();
+	
+	std::mt19937_64 random(99);
+	std::vector<uint64_t> keys(sortCount);
+	for (auto &key : keys)
+	{
+		key = DrawKey::Make((uint32_t)(random() % 4), random() % 300, random() % 1000, random() % 4000, (float)(random() % 1000) / 1000.0f, (random() % 8) == 0);
+	}
+	DrawQueue<SortDraw> reference(sortCount);
+	DrawQueue<SortDraw> queue(sortCount);
+	for (uint32_t i = 0; i < sortCount; ++i)
+	{
+		SortDraw draw = { i };
+		reference.Submit(keys[i], draw);
+	}
+	reference.Sort();
+	
+	printf("%u cores; ParallelFor of %u items, spawn tree of %u leaves, sort of %u keys\n", cores, forCount, 1u << treeDepth, sortCount);
+	double baseline[3] = { 0.0, 0.0, 0.0 };
+	for (auto &workerCount : workerCounts)
+	{
+		JobSystem jobs(workerCount);
+		
+		const double forSeconds = qMetalBench::Time(runs, [&]()
+		{
+			JobCounter counter;
+			jobs.ParallelFor(counter, forCount, 1024, &ForJob, &forContext);
+			jobs.Wait(counter);
+		});
+		qBENCH_CHECK(output == expected);
+		
+		const double treeSeconds = qMetalBench::Time(runs, [&]()
+		{
+			JobCounter root;
+			{
+				JobCounter group(&root);
+				TreeContext tree;
+				tree.jobs = &jobs;
+				tree.counter = &group;
+				tree.leaves.store(0);
+				jobs.Run(group, &TreeJob, &tree, treeDepth, treeDepth + 1);
+				jobs.Wait(root);
+				qBENCH_CHECK(group.IsDone());
+				qBENCH_CHECK(tree.leaves.load() == (1u << treeDepth));
+			}
+		});
+		
+		double sortSeconds = 1e30;
+		for (int run = 0; run < runs; ++run)
+		{
+			queue.Reset();
+			for (uint32_t i = 0; i < sortCount; ++i)
+			{
+				SortDraw draw = { i };
+				queue.Submit(keys[i], draw);
+			}
+			sortSeconds = std::min(sortSeconds, qMetalBench::Time(1, [&]() { queue.Sort(jobs); }));
+			for (uint32_t i = 0; i < sortCount; ++i)
+			{
+				qBENCH_CHECK((queue.Key(i) == reference.Key(i)) && (queue.Draw(i).id == reference.Draw(i).id));
+			}
+		}
+		
+		const double seconds[3] = { forSeconds, treeSeconds, sortSeconds };
+		if (workerCount == 0)
+		{
+			for (int i = 0; i < 3; ++i)
+			{
+				baseline[i] = seconds[i];
+			}
+		}
+		printf("%2u workers: ParallelFor %8.3f ms (%.2fx), tree %8.3f ms (%.2fx), sort %8.3f ms (%.2fx), %llu steals\n", workerCount,
+			   forSeconds * 1e3, baseline[0] / forSeconds, treeSeconds * 1e3, baseline[1] / treeSeconds, sortSeconds * 1e3, baseline[2] / sortSeconds,
+			   (unsigned long long)jobs.StealCount());
+	}
+	return 0;
+}
@@ -0,0 +1,55 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "qMetalRingAllocator.h"
+#include "qMetalBench.h"
+
+using namespace qMetal;
+
+//the material param path: a few thousand small, 256 byte aligned allocations per frame, cycling through the frames
+int main(int argc, char** argv)
+{
+	const bool quick = qMetalBench::Quick(argc, argv);
+	const uint32_t frames = quick ? 60 : 600;
+	const uint32_t allocationsPerFrame = 8192;
+	const size_t sizes[] = { 16, 64, 96, 192, 256, 512 };
+	
+	RingAllocator ring(allocationsPerFrame * 512, 3);
+	size_t checksum = 0;
+	const double seconds = qMetalBench::Time(5, [&]()
+	{
+		for (uint32_t frame = 0; frame < frames; ++frame)
+		{
+			ring.BeginFrame(frame);
+			for (uint32_t i = 0; i < allocationsPerFrame; ++i)
+			{
+				const size_t offset = ring.Allocate(sizes[i % 6], 256);
+				checksum += offset;
+			}
+			qBENCH_CHECK(ring.OverflowCount() == 0);
+		}
+	});
+	
+	const double allocations = (double)frames * allocationsPerFrame;
+	printf("RingAllocator: %u frames x %u allocations, %.2f ns per allocation (checksum %zu)\n", frames, allocationsPerFrame, seconds * 1e9 / allocations, checksum);
+	return 0;
+}
@@ -0,0 +1,224 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "qMetalComputeSchedule.h"
+#include "qMetalTest.h"
+
+using namespace qMetal;
+
+typedef ComputeSchedule CS;
+
+static bool BarrierIs(const ComputeSchedule& schedule, uint32_t level, std::vector<const void*> expected)
+{
+	std::vector<const void*> barrier = schedule.Barrier(level);
+	std::sort(barrier.begin(), barrier.end());
+	std::sort(expected.begin(), expected.end());
+	return barrier == expected;
+}
+
+//resources are opaque, so anything with an address does
+static int A, B, C, X, Y;
+
+static void TestIndependent()
+{
+	ComputeSchedule schedule;
+	for (int i = 0; i < 3; ++i)
+	{
+		schedule.AddPass();
+	}
+	schedule.Build();
+	qTEST_CHECK(schedule.LevelCount() == 1);
+	qTEST_CHECK(schedule.BarrierCount() == 0);
+	
+	schedule.Reset();
+	schedule.AddPass();
+	schedule.Access(&A, CS::eAccess_Write);
+	schedule.AddPass();
+	schedule.Access(&B, CS::eAccess_Write);
+	schedule.AddPass();
+	schedule.Access(&X, CS::eAccess_Read);
+	schedule.AddPass();
+	schedule.Access(&X, CS::eAccess_Read);
+	schedule.Build();
+	
+	qTEST_CHECK(schedule.LevelCount() == 1);
+	qTEST_CHECK(schedule.DependencyCount() == 0);
+	qTEST_CHECK(schedule.BarrierCount() == 0);
+	qTEST_CHECK(schedule.Order() == std::vector<uint32_t>({ 0, 1, 2, 3 }));
+}
+
+//simulate -> cull -> build draw arguments: a level and a one-resource barrier each
+static void TestChain()
+{
+	ComputeSchedule schedule;
+	const uint32_t simulate = schedule.AddPass();
+	schedule.Access(&A, CS::eAccess_Write);
+	const uint32_t cull = schedule.AddPass();
+	schedule.Access(&A, CS::eAccess_Read);
+	schedule.Access(&B, CS::eAccess_Write);
+	const uint32_t arguments = schedule.AddPass();
+	schedule.Access(&B, CS::eAccess_Read);
+	schedule.Access(&C, CS::eAccess_Write);
+	schedule.Build();
+	
+	qTEST_CHECK(schedule.Level(simulate) == 0);
+	qTEST_CHECK(schedule.Level(cull) == 1);
+	qTEST_CHECK(schedule.Level(arguments) == 2);
+	qTEST_CHECK(schedule.LevelCount() == 3);
+	qTEST_CHECK(schedule.Barrier(0).empty());
+	qTEST_CHECK(BarrierIs(schedule, 1, { &A }));
+	qTEST_CHECK(BarrierIs(schedule, 2, { &B }));
+	qTEST_CHECK(schedule.BarrierCount() == 2);
+}
+
+//independent producers share a level, consumers of either share the next, and the order follows the levels
+static void TestLevelsAndOrder()
+{
+	ComputeSchedule schedule;
+	schedule.AddPass();							//0: level 0
+	schedule.Access(&A, CS::eAccess_Write);
+	schedule.AddPass();							//1: level 1
+	schedule.Access(&A, CS::eAccess_Read);
+	schedule.Access(&C, CS::eAccess_Write);
+	schedule.AddPass();							//2: level 0
+	schedule.Access(&B, CS::eAccess_Write);
+	schedule.AddPass();							//3: level 1
+	schedule.Access(&B, CS::eAccess_Read);
+	schedule.Build();
+	
+	qTEST_CHECK(schedule.LevelCount() == 2);
+	qTEST_CHECK(schedule.Order() == std::vector<uint32_t>({ 0, 2, 1, 3 }));
+	qTEST_CHECK(BarrierIs(schedule, 1, { &A, &B }));
+}
+
+static void TestHazards()
+{
+	//write after read: the writer waits for the readers
+	ComputeSchedule war;
+	war.AddPass();
+	war.Access(&A, CS::eAccess_Read);
+	war.AddPass();
+	war.Access(&A, CS::eAccess_Read);
+	const uint32_t writer = war.AddPass();
+	war.Access(&A, CS::eAccess_Write);
+	war.Build();
+	qTEST_CHECK(war.Level(writer) == 1);
+	qTEST_CHECK(war.DependencyCount() == 2);
+	qTEST_CHECK(BarrierIs(war, 1, { &A }));
+	
+	//write after write keeps the order, and a read and write in one pass combine into both
+	ComputeSchedule waw;
+	waw.AddPass();
+	waw.Access(&A, CS::eAccess_Write);
+	const uint32_t second = waw.AddPass();
+	waw.Access(&A, CS::eAccess_Read);
+	waw.Access(&A, CS::eAccess_Write);
+	const uint32_t reader = waw.AddPass();
+	waw.Access(&A, CS::eAccess_Read);
+	const uint32_t third = waw.AddPass();
+	waw.Access(&A, CS::eAccess_ReadWrite);
+	waw.Build();
+	qTEST_CHECK(waw.Level(second) == 1);
+	qTEST_CHECK(waw.Level(reader) == 2);
+	qTEST_CHECK(waw.Level(third) == 3);
+	qTEST_CHECK(waw.BarrierCount() == 3);
+}
+
+//a barrier since the producer already covers the resource, so the consumer doesn't repeat it
+static void TestCoveredBarrier()
+{
+	ComputeSchedule schedule;
+	schedule.AddPass();
+	schedule.Access(&A, CS::eAccess_Write);
+	schedule.Access(&X, CS::eAccess_Write);
+	const uint32_t first = schedule.AddPass();
+	schedule.Access(&A, CS::eAccess_Read);
+	schedule.Access(&B, CS::eAccess_Write);
+	const uint32_t second = schedule.AddPass();
+	schedule.Access(&A, CS::eAccess_Read);
+	schedule.Access(&B, CS::eAccess_Read);
+	schedule.Access(&X, CS::eAccess_Read);
+	schedule.Build();
+	
+	qTEST_CHECK(schedule.Level(first) == 1);
+	qTEST_CHECK(schedule.Level(second) == 2);
+	qTEST_CHECK(BarrierIs(schedule, 1, { &A }));
+	qTEST_CHECK(BarrierIs(schedule, 2, { &B, &X }));
+	
+	//Y's producer is two levels up with nothing in between covering it
+	ComputeSchedule far;
+	far.AddPass();
+	far.Access(&Y, CS::eAccess_Write);
+	far.Access(&A, CS::eAccess_Write);
+	far.AddPass();
+	far.Access(&A, CS::eAccess_Read);
+	far.Access(&B, CS::eAccess_Write);
+	far.AddPass();
+	far.Access(&B, CS::eAccess_Read);
+	far.Access(&C, CS::eAccess_Write);
+	const uint32_t last = far.AddPass();
+	far.Access(&C, CS::eAccess_Read);
+	far.Access(&Y, CS::eAccess_Read);
+	far.Build();
+	qTEST_CHECK(far.Level(last) == 3);
+	qTEST_CHECK(BarrierIs(far, 3, { &C, &Y }));
+}
+
+//a dependency submitted later can need its barrier at a lower level than one submitted before it; that barrier
+//covers the earlier one too (R here)
+static void TestLaterLowerBarrier()
+{
+	static int Q, R, Z;
+	
+	ComputeSchedule schedule;
+	schedule.AddPass();
+	schedule.Access(&R, CS::eAccess_Write);
+	schedule.AddPass();
+	schedule.Access(&Q, CS::eAccess_Write);
+	const uint32_t middle = schedule.AddPass();
+	schedule.Access(&Q, CS::eAccess_Read);
+	schedule.Access(&Z, CS::eAccess_Write);
+	const uint32_t last = schedule.AddPass();
+	schedule.Access(&Z, CS::eAccess_Read);
+	schedule.Access(&R, CS::eAccess_Read);
+	const uint32_t reader = schedule.AddPass();
+	schedule.Access(&R, CS::eAccess_Read);
+	schedule.Build();
+	
+	qTEST_CHECK(schedule.Level(middle) == 1);
+	qTEST_CHECK(schedule.Level(last) == 2);
+	qTEST_CHECK(schedule.Level(reader) == 1);
+	qTEST_CHECK(schedule.DependencyCount() == 4);
+	qTEST_CHECK(BarrierIs(schedule, 1, { &Q, &R }));
+	qTEST_CHECK(BarrierIs(schedule, 2, { &Z }));
+}
+
+int main()
+{
+	TestIndependent();
+	TestChain();
+	TestLevelsAndOrder();
+	TestHazards();
+	TestCoveredBarrier();
+	TestLaterLowerBarrier();
+	return qTEST_RESULT();
+}
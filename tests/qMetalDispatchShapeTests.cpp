@@ -0,0 +1,192 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "qMetalDispatchShape.h"
+#include "qMetalTest.h"
+#include <random>
+
+using namespace qMetal;
+
+static bool Equal(const DispatchSize& shape, uint32_t width, uint32_t height, uint32_t depth)
+{
+	return shape == DispatchSize(width, height, depth);
+}
+
+static void TestSelect()
+{
+	//1D grids become one long row rather than a 32x32 square that's mostly idle
+	qTEST_CHECK(Equal(DispatchShape::Select(DispatchSize(1 << 20, 1), 32, 1024), 1024, 1, 1));
+	qTEST_CHECK(Equal(DispatchShape::Select(DispatchSize(100, 1), 32, 1024), 128, 1, 1));
+	
+	//2D grids keep a SIMD group wide rows
+	qTEST_CHECK(Equal(DispatchShape::Select(DispatchSize(1920, 1080), 32, 1024), 32, 32, 1));
+	qTEST_CHECK(Equal(DispatchShape::Select(DispatchSize(1920, 1080), 32, 256), 32, 8, 1));
+	
+	//wide, short grids hand what y can't use back to x
+	qTEST_CHECK(Equal(DispatchShape::Select(DispatchSize(4096, 2), 32, 1024), 512, 2, 1));
+	qTEST_CHECK(Equal(DispatchShape::Select(DispatchSize(4096, 3, 2), 32, 1024), 160, 3, 2));
+	
+	//grids smaller than a SIMD group aren't padded out
+	qTEST_CHECK(Equal(DispatchShape::Select(DispatchSize(5, 5), 32, 1024), 5, 5, 1));
+	qTEST_CHECK(Equal(DispatchShape::Select(DispatchSize(64, 64, 64), 32, 1024), 32, 32, 1));
+	
+	//a pipeline limit under the SIMD width wins
+	qTEST_CHECK(Equal(DispatchShape::Select(DispatchSize(256, 1), 64, 48), 48, 1, 1));
+	
+	//empty grids and nonsense limits still give a valid shape
+	qTEST_CHECK(Equal(DispatchShape::Select(DispatchSize(0, 16), 32, 1024), 1, 1, 1));
+	qTEST_CHECK(Equal(DispatchShape::Select(DispatchSize(16, 16), 0, 0), 1, 1, 1));
+	
+	std::mt19937 random(42);
+	const uint32_t simdWidths[] = { 8, 16, 32, 64 };
+	const uint32_t limits[] = { 64, 256, 512, 896, 1024 };
+	for (uint32_t i = 0; i < 20000; ++i)
+	{
+		const DispatchSize grid(1 + random() % 5000, 1 + random() % ((i % 3 == 0) ? 1 : 2000), 1 + random() % ((i % 5 == 0) ? 64 : 1));
+		const uint32_t simdWidth = simdWidths[random() % 4];
+		const uint32_t limit = limits[random() % 5];
+		const DispatchSize shape = DispatchShape::Select(grid, simdWidth, limit);
+		
+		qTEST_CHECK((shape.width >= 1) && (shape.height >= 1) && (shape.depth >= 1));
+		qTEST_CHECK(shape.Threads() <= limit);
+		qTEST_CHECK((shape.height <= grid.height) && (shape.depth <= grid.depth));
+		qTEST_CHECK((shape.width <= grid.width) || (shape.width % simdWidth == 0));
+	}
+}
+
+static void TestCandidates()
+{
+	std::vector<DispatchSize> candidates;
+	const DispatchSize grid(1920, 1080);
+	DispatchShape::Candidates(grid, 32, 1024, candidates);
+	
+	qTEST_CHECK(!candidates.empty());
+	qTEST_CHECK(candidates[0] == DispatchShape::Select(grid, 32, 1024));
+	for (size_t i = 0; i < candidates.size(); ++i)
+	{
+		const DispatchSize& shape = candidates[i];
+		qTEST_CHECK((shape.Threads() >= 32) && (shape.Threads() <= 1024));
+		qTEST_CHECK(shape.depth == 1);
+		for (size_t j = 0; j < i; ++j)
+		{
+			qTEST_CHECK(!(candidates[j] == shape));
+		}
+	}
+	
+	//no side bigger than the grid needs
+	DispatchShape::Candidates(DispatchSize(3, 1), 32, 1024, candidates);
+	qTEST_CHECK(candidates[0] == DispatchSize(3, 1, 1));
+	for (size_t i = 1; i < candidates.size(); ++i)
+	{
+		qTEST_CHECK(candidates[i].width <= 4);
+		qTEST_CHECK((candidates[i].height == 1) && (candidates[i].depth == 1));
+	}
+	qTEST_CHECK(candidates.size() == 2); //the heuristic's 3, then 4; 1 and 2 are under the 3 threads the grid has
+}
+
+static void TestBuckets()
+{
+	qTEST_CHECK(DispatchShape::Bucket(0) == 0);
+	qTEST_CHECK(DispatchShape::Bucket(1) == 0);
+	qTEST_CHECK(DispatchShape::Bucket(2) == 1);
+	qTEST_CHECK(DispatchShape::Bucket(3) == 2);
+	qTEST_CHECK(DispatchShape::Bucket(4) == 2);
+	qTEST_CHECK(DispatchShape::Bucket(1024) == 10);
+	qTEST_CHECK(DispatchShape::Bucket(1025) == 11);
+	qTEST_CHECK(DispatchShape::Bucket(UINT32_MAX) == 31);
+	
+	qTEST_CHECK(DispatchShape::TuningKey(7, DispatchSize(1900, 1100)) == DispatchShape::TuningKey(7, DispatchSize(1920, 1080)));
+	qTEST_CHECK(DispatchShape::TuningKey(7, DispatchSize(1920, 1080)) != DispatchShape::TuningKey(8, DispatchSize(1920, 1080)));
+	qTEST_CHECK(DispatchShape::TuningKey(7, DispatchSize(1920, 540)) != DispatchShape::TuningKey(7, DispatchSize(540, 1920)));
+	qTEST_CHECK(DispatchShape::TuningKey(7, DispatchSize(1024, 1)) != DispatchShape::TuningKey(7, DispatchSize(1025, 1)));
+}
+
+static void TestTuningTable()
+{
+	DispatchTuningTable table(0x1234);
+	DispatchSize shape;
+	qTEST_CHECK(!table.Find(1, DispatchSize(1920, 1080), shape));
+	qTEST_CHECK(!table.IsDirty());
+	
+	//the fastest time wins, and grids in the same bucket share it
+	qTEST_CHECK(table.Record(1, DispatchSize(1920, 1080), DispatchSize(32, 32), 500));
+	qTEST_CHECK(table.Record(1, DispatchSize(1920, 1080), DispatchSize(64, 4), 300));
+	qTEST_CHECK(!table.Record(1, DispatchSize(1920, 1080), DispatchSize(16, 16), 400));
+	qTEST_CHECK(table.Record(2, DispatchSize(1 << 20, 1), DispatchSize(1024, 1), 900));
+	qTEST_CHECK(table.IsDirty());
+	qTEST_CHECK(table.Count() == 2);
+	qTEST_CHECK(table.Find(1, DispatchSize(1900, 1050), shape) && (shape == DispatchSize(64, 4)));
+	qTEST_CHECK(!table.Find(1, DispatchSize(1 << 20, 1), shape));
+	
+	std::vector<uint8_t> data = table.Serialize();
+	qTEST_CHECK(data.size() == 24 + 2 * 24 + 8);
+	
+	DispatchTuningTable loaded(0x1234);
+	qTEST_CHECK(loaded.Load(data.data(), data.size()));
+	qTEST_CHECK(loaded.Count() == 2);
+	qTEST_CHECK(!loaded.IsDirty());
+	qTEST_CHECK(loaded.Find(1, DispatchSize(1920, 1080), shape) && (shape == DispatchSize(64, 4)));
+	qTEST_CHECK(loaded.Find(2, DispatchSize(1 << 20, 1), shape) && (shape == DispatchSize(1024, 1)));
+	
+	//a loaded entry still only gives way to a faster time
+	qTEST_CHECK(!loaded.Record(1, DispatchSize(1920, 1080), DispatchSize(8, 8), 300));
+	qTEST_CHECK(loaded.Record(1, DispatchSize(1920, 1080), DispatchSize(8, 8), 299));
+	
+	//tables from another environment, corrupted, or truncated are thrown away
+	DispatchTuningTable otherEnvironment(0x4321);
+	qTEST_CHECK(!otherEnvironment.Load(data.data(), data.size()));
+	qTEST_CHECK(otherEnvironment.Count() == 0);
+	
+	std::vector<uint8_t> corrupt = data;
+	corrupt[30] ^= 1;
+	qTEST_CHECK(!loaded.Load(corrupt.data(), corrupt.size()));
+	qTEST_CHECK(loaded.Count() == 0);
+	
+	qTEST_CHECK(!loaded.Load(data.data(), data.size() - 1));
+	qTEST_CHECK(!loaded.Load(data.data(), 16));
+	qTEST_CHECK(!loaded.Load(NULL, 0));
+	
+	std::vector<uint8_t> overCount = data;
+	overCount[16] = 3;
+	qTEST_CHECK(!loaded.Load(overCount.data(), overCount.size()));
+	
+	//files round trip, and saving clears the dirty flag
+	const char* path = "qMetalDispatchShapeTests.dispatch";
+	qTEST_CHECK(table.SaveFile(path));
+	qTEST_CHECK(!table.IsDirty());
+	DispatchTuningTable fromFile(0x1234);
+	qTEST_CHECK(fromFile.LoadFile(path));
+	qTEST_CHECK(fromFile.Count() == 2);
+	qTEST_CHECK(fromFile.Find(1, DispatchSize(1920, 1080), shape) && (shape == DispatchSize(64, 4)));
+	remove(path);
+	qTEST_CHECK(!fromFile.LoadFile(path));
+	qTEST_CHECK(fromFile.Count() == 0);
+}
+
+int main()
+{
+	TestSelect();
+	TestCandidates();
+	TestBuckets();
+	TestTuningTable();
+	return qTEST_RESULT();
+}
@@ -0,0 +1,232 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "qMetalFrameSchedule.h"
+#include "qMetalTest.h"
+
+using namespace qMetal;
+
+typedef FrameSchedule FS;
+
+static bool OrderIs(const FrameSchedule& schedule, const std::vector<uint32_t>& expected)
+{
+	return schedule.Order() == expected;
+}
+
+//a gbuffer pass feeding a lighting pass: what lighting samples is stored, the depth nobody samples stays on-tile
+static void TestGBufferLighting()
+{
+	FrameSchedule schedule;
+	const uint32_t albedo = schedule.AddAttachment();
+	const uint32_t normal = schedule.AddAttachment();
+	const uint32_t depth = schedule.AddAttachment();
+	const uint32_t backbuffer = schedule.AddAttachment(false, true);
+	
+	const uint32_t gbuffer = schedule.AddPass();
+	schedule.Write(albedo, true);
+	schedule.Write(normal, true);
+	schedule.Write(depth, true);
+	
+	const uint32_t lighting = schedule.AddPass();
+	schedule.Read(albedo);
+	schedule.Read(normal);
+	schedule.Write(backbuffer, true);
+	
+	schedule.Compile();
+	qTEST_CHECK(schedule.IsCompiled());
+	qTEST_CHECK(OrderIs(schedule, { gbuffer, lighting }));
+	qTEST_CHECK(schedule.CulledCount() == 0);
+	
+	qTEST_CHECK(schedule.LoadAction(gbuffer, albedo) == FS::eLoad_Clear);
+	qTEST_CHECK(schedule.StoreAction(gbuffer, albedo) == FS::eStore_Store);
+	qTEST_CHECK(schedule.LoadAction(gbuffer, normal) == FS::eLoad_Clear);
+	qTEST_CHECK(schedule.StoreAction(gbuffer, normal) == FS::eStore_Store);
+	qTEST_CHECK(schedule.LoadAction(gbuffer, depth) == FS::eLoad_Clear);
+	qTEST_CHECK(schedule.StoreAction(gbuffer, depth) == FS::eStore_DontCare);
+	qTEST_CHECK(schedule.LoadAction(lighting, backbuffer) == FS::eLoad_Clear);
+	qTEST_CHECK(schedule.StoreAction(lighting, backbuffer) == FS::eStore_Store);
+	
+	qTEST_CHECK(!schedule.IsMemoryless(albedo));
+	qTEST_CHECK(!schedule.IsMemoryless(normal));
+	qTEST_CHECK(schedule.IsMemoryless(depth));
+	qTEST_CHECK(!schedule.IsMemoryless(backbuffer));
+	
+	//passes with no attachments at all are culled and change nothing else
+	schedule.AddPass();
+	schedule.AddPass();
+	schedule.Compile();
+	qTEST_CHECK(schedule.CulledCount() == 2);
+	qTEST_CHECK(schedule.StoreAction(gbuffer, albedo) == FS::eStore_Store);
+	qTEST_CHECK(schedule.IsMemoryless(depth));
+	
+	//sampling depth in lighting as well means storing it, and it can't be memoryless any more
+	FrameSchedule withDepth;
+	const uint32_t d = withDepth.AddAttachment();
+	const uint32_t out = withDepth.AddAttachment(false, true);
+	const uint32_t writer = withDepth.AddPass();
+	withDepth.Write(d, true);
+	const uint32_t reader = withDepth.AddPass();
+	withDepth.Read(d);
+	withDepth.Write(out, true);
+	withDepth.Compile();
+	qTEST_CHECK(withDepth.StoreAction(writer, d) == FS::eStore_Store);
+	qTEST_CHECK(!withDepth.IsMemoryless(d));
+	qTEST_CHECK(!withDepth.IsCulled(reader));
+}
+
+//an MSAA pass resolving into the frame's output: the MSAA samples are only needed for the resolve
+static void TestMSAAResolve()
+{
+	FrameSchedule schedule;
+	const uint32_t msaa = schedule.AddAttachment();
+	const uint32_t msaaDepth = schedule.AddAttachment();
+	const uint32_t resolved = schedule.AddAttachment(false, true);
+	
+	const uint32_t scene = schedule.AddPass();
+	schedule.Write(msaa, true);
+	schedule.Resolve(msaa, resolved);
+	schedule.Write(msaaDepth, true);
+	
+	schedule.Compile();
+	qTEST_CHECK(!schedule.IsCulled(scene));
+	qTEST_CHECK(schedule.LoadAction(scene, msaa) == FS::eLoad_Clear);
+	qTEST_CHECK(schedule.StoreAction(scene, msaa) == FS::eStore_Resolve);
+	qTEST_CHECK(schedule.StoreAction(scene, msaaDepth) == FS::eStore_DontCare);
+	qTEST_CHECK(schedule.IsMemoryless(msaa));
+	qTEST_CHECK(schedule.IsMemoryless(msaaDepth));
+	qTEST_CHECK(!schedule.IsMemoryless(resolved));
+	
+	//a later pass drawing more into the MSAA target (a transparent pass) needs the samples kept and loaded, and
+	//only its own resolve is needed
+	FrameSchedule twoPass;
+	const uint32_t samples = twoPass.AddAttachment();
+	const uint32_t output = twoPass.AddAttachment(false, true);
+	const uint32_t opaque = twoPass.AddPass();
+	twoPass.Write(samples, true);
+	twoPass.Resolve(samples, output);
+	const uint32_t transparent = twoPass.AddPass();
+	twoPass.Write(samples, false);
+	twoPass.Resolve(samples, output);
+	
+	twoPass.Compile();
+	qTEST_CHECK(twoPass.StoreAction(opaque, samples) == FS::eStore_Store);
+	qTEST_CHECK(twoPass.LoadAction(transparent, samples) == FS::eLoad_Load);
+	qTEST_CHECK(twoPass.StoreAction(transparent, samples) == FS::eStore_Resolve);
+	qTEST_CHECK(!twoPass.IsMemoryless(samples));
+	qTEST_CHECK(OrderIs(twoPass, { opaque, transparent }));
+}
+
+//passes nothing consumes are culled, along with whatever only fed them; side effects keep a pass
+static void TestCulledPass()
+{
+	FrameSchedule schedule;
+	const uint32_t scratch = schedule.AddAttachment();
+	const uint32_t debug = schedule.AddAttachment();
+	const uint32_t sideTarget = schedule.AddAttachment();
+	const uint32_t backbuffer = schedule.AddAttachment(false, true);
+	
+	const uint32_t feed = schedule.AddPass();
+	schedule.Write(scratch, true);
+	const uint32_t debugView = schedule.AddPass();
+	schedule.Read(scratch);
+	schedule.Write(debug, true);
+	const uint32_t stream = schedule.AddPass(true);
+	schedule.Write(sideTarget, true);
+	const uint32_t present = schedule.AddPass();
+	schedule.Write(backbuffer, true);
+	
+	schedule.Compile();
+	qTEST_CHECK(schedule.IsCulled(feed));
+	qTEST_CHECK(schedule.IsCulled(debugView));
+	qTEST_CHECK(!schedule.IsCulled(stream));
+	qTEST_CHECK(!schedule.IsCulled(present));
+	qTEST_CHECK(schedule.CulledCount() == 2);
+	qTEST_CHECK(OrderIs(schedule, { feed, debugView, stream, present }));
+	
+	//attachments only culled passes touch aren't memoryless, they just aren't used
+	qTEST_CHECK(!schedule.IsMemoryless(scratch));
+	qTEST_CHECK(!schedule.IsMemoryless(debug));
+	qTEST_CHECK(schedule.StoreAction(stream, sideTarget) == FS::eStore_DontCare);
+	qTEST_CHECK(schedule.IsMemoryless(sideTarget));
+	
+	//making the debug view an output brings both passes back
+	FrameSchedule kept;
+	const uint32_t keptScratch = kept.AddAttachment();
+	const uint32_t keptDebug = kept.AddAttachment(false, true);
+	const uint32_t keptFeed = kept.AddPass();
+	kept.Write(keptScratch, true);
+	const uint32_t keptView = kept.AddPass();
+	kept.Read(keptScratch);
+	kept.Write(keptDebug, true);
+	kept.Compile();
+	qTEST_CHECK(kept.CulledCount() == 0);
+	qTEST_CHECK(kept.StoreAction(keptFeed, keptScratch) == FS::eStore_Store);
+	qTEST_CHECK(kept.StoreAction(keptView, keptDebug) == FS::eStore_Store);
+}
+
+//a pass added ahead of the one producing what it samples runs after it; imported attachments load
+static void TestLateProducer()
+{
+	FrameSchedule schedule;
+	const uint32_t shadowMap = schedule.AddAttachment();
+	const uint32_t history = schedule.AddAttachment(true, true);
+	const uint32_t backbuffer = schedule.AddAttachment(false, true);
+	
+	const uint32_t lighting = schedule.AddPass();
+	schedule.Read(shadowMap);
+	schedule.Read(history);
+	schedule.Write(backbuffer, true);
+	
+	const uint32_t shadows = schedule.AddPass();
+	schedule.Write(shadowMap, true);
+	
+	const uint32_t accumulate = schedule.AddPass();
+	schedule.Write(history, false);
+	
+	schedule.Compile();
+	qTEST_CHECK(schedule.CulledCount() == 0);
+	qTEST_CHECK(OrderIs(schedule, { shadows, lighting, accumulate }));
+	
+	qTEST_CHECK(schedule.LoadAction(shadows, shadowMap) == FS::eLoad_Clear);
+	qTEST_CHECK(schedule.StoreAction(shadows, shadowMap) == FS::eStore_Store);
+	qTEST_CHECK(!schedule.IsMemoryless(shadowMap));
+	
+	//the history's previous contents are sampled first, then loaded and stored for the next frame
+	qTEST_CHECK(schedule.LoadAction(accumulate, history) == FS::eLoad_Load);
+	qTEST_CHECK(schedule.StoreAction(accumulate, history) == FS::eStore_Store);
+	qTEST_CHECK(!schedule.IsMemoryless(history));
+	
+	//Reset() leaves an empty schedule
+	schedule.Reset();
+	qTEST_CHECK((schedule.PassCount() == 0) && (schedule.AttachmentCount() == 0) && !schedule.IsCompiled());
+	schedule.Compile();
+	qTEST_CHECK(schedule.Order().empty());
+}
+
+int main()
+{
+	TestGBufferLighting();
+	TestMSAAResolve();
+	TestCulledPass();
+	TestLateProducer();
+	return qTEST_RESULT();
+}
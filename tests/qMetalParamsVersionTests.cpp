@@ -0,0 +1,101 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "qMetalParamsVersion.h"
+#include "qMetalTest.h"
+#include <thread>
+#include <vector>
+
+using namespace qMetal;
+
+//a block written in one frame stays bound until the next write, which takes a slot no frame in flight can read
+static void TestSlots()
+{
+	ParamsVersion<3> version;
+	uint32_t previous;
+	
+	const uint32_t first = version.BeginWrite(0, previous);
+	qTEST_CHECK(first != version.InvalidSlot);
+	qTEST_CHECK(version.WrittenIn(0));
+	qTEST_CHECK(version.BeginWrite(0, previous) == first);	//more writes in the frame land in the same slot
+	qTEST_CHECK(version.Version() == 1);
+	
+	//bound in frames 0 to 4 without a write, so the slot is reused rather than cycled
+	for (uint64_t frame = 0; frame < 5; ++frame)
+	{
+		qTEST_CHECK(version.Bind(frame) == first);
+	}
+	
+	//the write in frame 5 can't reuse the slot frame 4 bound, and copies forward from it
+	const uint32_t second = version.BeginWrite(5, previous);
+	qTEST_CHECK(second != first);
+	qTEST_CHECK(previous == first);
+	version.Bind(5);
+	
+	//frame 6 can't take frame 4's or frame 5's slot, so it gets the third
+	const uint32_t third = version.BeginWrite(6, previous);
+	qTEST_CHECK((third != first) && (third != second));
+	version.Bind(6);
+	
+	//by frame 7, frame 4's slot has retired
+	qTEST_CHECK(version.IsRetired(first, 7));
+	qTEST_CHECK(!version.IsRetired(second, 7));
+	qTEST_CHECK(version.BeginWrite(7, previous) == first);
+	qTEST_CHECK(version.Version() == 4);
+}
+
+//parallel encoders bind the same block at once; the slot must end up bound in the newest frame any of them saw
+static void TestConcurrentBind()
+{
+	ParamsVersion<3> version;
+	uint32_t previous;
+	const uint32_t slot = version.BeginWrite(0, previous);
+	
+	const uint32_t threadCount = 8;
+	const uint64_t frameCount = 2000;
+	std::vector<std::thread> threads;
+	for (uint32_t t = 0; t < threadCount; ++t)
+	{
+		threads.push_back(std::thread([&version, t]()
+		{
+			for (uint64_t frame = 0; frame < frameCount; ++frame)
+			{
+				//some threads lag a frame behind, as a late job would
+				version.Bind((t % 2) ? frame : frame / 2);
+			}
+		}));
+	}
+	for (auto &thread : threads)
+	{
+		thread.join();
+	}
+	
+	qTEST_CHECK(!version.IsRetired(slot, frameCount - 1 + 2));
+	qTEST_CHECK(version.IsRetired(slot, frameCount - 1 + 3));
+}
+
+int main()
+{
+	TestSlots();
+	TestConcurrentBind();
+	return qTEST_RESULT();
+}
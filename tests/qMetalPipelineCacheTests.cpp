@@ -0,0 +1,151 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "qMetalPipelineCache.h"
+#include "qMetalTest.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace qMetal;
+
+//keys are saved in pipeline manifests, so the hash can't drift between builds
+static void TestHashStability()
+{
+	qTEST_CHECK(PipelineHash().Value() == PipelineHash::Seed);
+	qTEST_CHECK(PipelineHash().AddBytes("a", 1).Value() == 0xAF63DC4C8601EC8Cull);	//the published FNV-1a 64 of "a"
+	qTEST_CHECK(PipelineHash().AddBytes("foobar", 6).Value() == 0x85944171F73967E8ull);
+	qTEST_CHECK(PipelineHash().Add((uint32_t)7).Add(1.5f).Value() == PipelineHash().Add((uint32_t)7).Add(1.5f).Value());
+}
+
+static void TestHashFields()
+{
+	const uint64_t base = PipelineHash().Add((uint32_t)1).Add((uint32_t)2).Value();
+	qTEST_CHECK(base != PipelineHash().Add((uint32_t)2).Add((uint32_t)1).Value());	//order matters
+	qTEST_CHECK(base != PipelineHash().Add((uint32_t)1).Add((uint32_t)3).Value());
+	qTEST_CHECK(base != PipelineHash().Add((uint64_t)1).Add((uint32_t)2).Value());	//so does width
+	qTEST_CHECK(PipelineHash().Add(true).Value() != PipelineHash().Add(false).Value());
+	qTEST_CHECK(PipelineHash().Add(0.0f).Value() != PipelineHash().Add(1.0f).Value());
+	
+	//strings are length prefixed, so moving a boundary changes the key
+	qTEST_CHECK(PipelineHash().AddString("ab").AddString("c").Value() != PipelineHash().AddString("a").AddString("bc").Value());
+	qTEST_CHECK(PipelineHash().AddString("").AddString("x").Value() != PipelineHash().AddString("x").AddString("").Value());
+	qTEST_CHECK(PipelineHash().AddString("ab").Value() == PipelineHash().Add((uint64_t)2).AddBytes("ab", 2).Value());
+	qTEST_CHECK(PipelineHash().AddString(NULL).Value() == PipelineHash().AddString("").Value());
+	qTEST_CHECK(PipelineHash().AddString("").Value() != PipelineHash().Value());
+}
+
+//the first Acquire of a key creates, later ones share, and the last Release hands the object back
+static void TestDedupe()
+{
+	PipelineCache<int> cache;
+	int creates = 0;
+	auto create = [&creates]() { return ++creates; };
+	
+	qTEST_CHECK(cache.Acquire(10, create) == 1);
+	qTEST_CHECK(cache.Acquire(10, create) == 1);
+	qTEST_CHECK(cache.Acquire(20, create) == 2);
+	qTEST_CHECK(cache.Acquire(10, create) == 1);
+	qTEST_CHECK(creates == 2);
+	qTEST_CHECK(cache.Hits() == 2);
+	qTEST_CHECK(cache.Misses() == 2);
+	qTEST_CHECK(cache.Size() == 2);
+	qTEST_CHECK(cache.RefCount(10) == 3);
+	qTEST_CHECK(cache.RefCount(30) == 0);
+	
+	cache.ResetCounters();
+	qTEST_CHECK((cache.Hits() == 0) && (cache.Misses() == 0));
+	qTEST_CHECK(cache.Size() == 2);
+}
+
+static void TestRelease()
+{
+	PipelineCache<int> cache;
+	auto create = []() { return 42; };
+	
+	cache.Acquire(1, create);
+	cache.AddRef(1);	//a material instance sharing its parent's pipeline
+	qTEST_CHECK(cache.RefCount(1) == 2);
+	
+	int released = 0;
+	qTEST_CHECK(!cache.Release(1, released));
+	qTEST_CHECK(released == 0);
+	qTEST_CHECK(cache.Size() == 1);
+	
+	qTEST_CHECK(cache.Release(1, released));
+	qTEST_CHECK(released == 42);
+	qTEST_CHECK(cache.Size() == 0);
+	qTEST_CHECK(cache.RefCount(1) == 0);
+	
+	//an evicted key is created afresh
+	int creates = 0;
+	cache.Acquire(1, [&creates]() { return ++creates; });
+	qTEST_CHECK(creates == 1);
+	qTEST_CHECK(cache.Misses() == 2);
+}
+
+//threads acquiring a key while it's being created wait for that creation rather than making their own
+static void TestConcurrentAcquire()
+{
+	PipelineCache<int> cache;
+	std::atomic<int> creates(0);
+	std::atomic<int> mismatches(0);
+	const int threadCount = 8;
+	
+	std::vector<std::thread> threads;
+	for (int t = 0; t < threadCount; ++t)
+	{
+		threads.push_back(std::thread([&cache, &creates, &mismatches]()
+		{
+			const int object = cache.Acquire(5, [&creates]()
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(20));	//a slow compile
+				return 100 + creates.fetch_add(1);
+			});
+			if (object != 100)
+			{
+				mismatches.fetch_add(1);
+			}
+		}));
+	}
+	for (auto &thread : threads)
+	{
+		thread.join();
+	}
+	
+	qTEST_CHECK(creates.load() == 1);
+	qTEST_CHECK(mismatches.load() == 0);
+	qTEST_CHECK(cache.Misses() == 1);
+	qTEST_CHECK(cache.Hits() == threadCount - 1);
+	qTEST_CHECK(cache.RefCount(5) == threadCount);
+}
+
+int main()
+{
+	TestHashStability();
+	TestHashFields();
+	TestDedupe();
+	TestRelease();
+	TestConcurrentAcquire();
+	return qTEST_RESULT();
+}
@@ -0,0 +1,167 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "qMetalPipelineManifest.h"
+#include "qMetalTest.h"
+#include <stdio.h>
+#include <vector>
+
+using namespace qMetal;
+
+static const uint64_t Environment = 0x1234ABCDull;
+
+static void Write32(std::vector<uint8_t>& data, size_t offset, uint32_t value)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		data[offset + i] = (uint8_t)(value >> (i * 8));
+	}
+}
+
+//rewrites the footer, so only the field under test is wrong
+static void Rehash(std::vector<uint8_t>& data)
+{
+	const uint64_t hash = PipelineHash().AddBytes(data.data(), data.size() - 8).Value();
+	Write32(data, data.size() - 8, (uint32_t)hash);
+	Write32(data, data.size() - 4, (uint32_t)(hash >> 32));
+}
+
+static std::vector<uint8_t> Saved()
+{
+	PipelineManifest manifest(Environment);
+	manifest.Record(PipelineManifest::ePipelineKind_Compute, 1);
+	manifest.Record(PipelineManifest::ePipelineKind_Render, 1);	//the same key in the other cache is its own entry
+	manifest.Record(PipelineManifest::ePipelineKind_Render, 2);
+	return manifest.Serialize();
+}
+
+//a session's records come back as archived, in the documented layout
+static void TestRoundTrip()
+{
+	const std::vector<uint8_t> data = Saved();
+	qTEST_CHECK(data.size() == 24 + (3 * 16) + 8);
+	
+	PipelineManifest manifest(Environment);
+	qTEST_CHECK(manifest.Load(data.data(), data.size()) == PipelineManifest::eLoadResult_Loaded);
+	qTEST_CHECK(manifest.LoadedCount() == 3);
+	qTEST_CHECK(manifest.IsArchived(PipelineManifest::ePipelineKind_Compute, 1));
+	qTEST_CHECK(manifest.IsArchived(PipelineManifest::ePipelineKind_Render, 1));
+	qTEST_CHECK(manifest.IsArchived(PipelineManifest::ePipelineKind_Render, 2));
+	qTEST_CHECK(!manifest.IsArchived(PipelineManifest::ePipelineKind_Compute, 2));
+	
+	//nothing used yet, so saving would drop all three
+	qTEST_CHECK(manifest.IsDirty());
+	qTEST_CHECK(manifest.Record(PipelineManifest::ePipelineKind_Compute, 1));
+	qTEST_CHECK(manifest.Record(PipelineManifest::ePipelineKind_Render, 1));
+	qTEST_CHECK(manifest.Record(PipelineManifest::ePipelineKind_Render, 2));
+	qTEST_CHECK(!manifest.IsDirty());
+	qTEST_CHECK(manifest.NewCount() == 0);
+	
+	//recording twice counts once, a new pipeline makes it dirty again
+	qTEST_CHECK(manifest.Record(PipelineManifest::ePipelineKind_Render, 2));
+	qTEST_CHECK(manifest.UsedCount() == 3);
+	qTEST_CHECK(!manifest.Record(PipelineManifest::ePipelineKind_Compute, 3));
+	qTEST_CHECK(manifest.IsDirty());
+	qTEST_CHECK(manifest.NewCount() == 1);
+	
+	//unused pipelines age out
+	PipelineManifest next(Environment);
+	const std::vector<uint8_t> saved = manifest.Serialize();
+	qTEST_CHECK(next.Load(saved.data(), saved.size()) == PipelineManifest::eLoadResult_Loaded);
+	next.Record(PipelineManifest::ePipelineKind_Compute, 3);
+	const std::vector<uint8_t> aged = next.Serialize();
+	qTEST_CHECK(next.Load(aged.data(), aged.size()) == PipelineManifest::eLoadResult_Loaded);
+	qTEST_CHECK(next.LoadedCount() == 1);
+	qTEST_CHECK(next.IsArchived(PipelineManifest::ePipelineKind_Compute, 3));
+	qTEST_CHECK(!next.IsArchived(PipelineManifest::ePipelineKind_Render, 1));
+}
+
+//anything stale or damaged loads as empty, so the archive beside it isn't trusted
+static void TestInvalidation()
+{
+	PipelineManifest manifest(Environment);
+	qTEST_CHECK(manifest.Load(NULL, 0) == PipelineManifest::eLoadResult_Missing);
+	
+	std::vector<uint8_t> data = Saved();
+	qTEST_CHECK(manifest.Load(data.data(), 16) == PipelineManifest::eLoadResult_Corrupt);
+	qTEST_CHECK(manifest.Load(data.data(), data.size() - 1) == PipelineManifest::eLoadResult_Corrupt);
+	
+	std::vector<uint8_t> flipped = data;
+	flipped[30] ^= 1;
+	qTEST_CHECK(manifest.Load(flipped.data(), flipped.size()) == PipelineManifest::eLoadResult_Corrupt);
+	
+	std::vector<uint8_t> magic = data;
+	Write32(magic, 0, 0);
+	Rehash(magic);
+	qTEST_CHECK(manifest.Load(magic.data(), magic.size()) == PipelineManifest::eLoadResult_Corrupt);
+	
+	std::vector<uint8_t> count = data;
+	Write32(count, 16, 4);
+	Rehash(count);
+	qTEST_CHECK(manifest.Load(count.data(), count.size()) == PipelineManifest::eLoadResult_Corrupt);
+	
+	std::vector<uint8_t> kind = data;
+	Write32(kind, 24 + 8, PipelineManifest::ePipelineKind_Count);
+	Rehash(kind);
+	qTEST_CHECK(manifest.Load(kind.data(), kind.size()) == PipelineManifest::eLoadResult_Corrupt);
+	qTEST_CHECK(manifest.LoadedCount() == 0);
+	
+	std::vector<uint8_t> version = data;
+	Write32(version, 4, PipelineManifest::FormatVersion + 1);
+	Rehash(version);
+	qTEST_CHECK(manifest.Load(version.data(), version.size()) == PipelineManifest::eLoadResult_WrongVersion);
+	
+	PipelineManifest other(Environment + 1);
+	qTEST_CHECK(other.Load(data.data(), data.size()) == PipelineManifest::eLoadResult_WrongEnvironment);
+	qTEST_CHECK(other.LoadedCount() == 0);
+	qTEST_CHECK(!other.IsArchived(PipelineManifest::ePipelineKind_Compute, 1));
+	
+	//a failed load drops what an earlier one loaded
+	qTEST_CHECK(manifest.Load(data.data(), data.size()) == PipelineManifest::eLoadResult_Loaded);
+	qTEST_CHECK(manifest.Load(version.data(), version.size()) == PipelineManifest::eLoadResult_WrongVersion);
+	qTEST_CHECK(!manifest.IsArchived(PipelineManifest::ePipelineKind_Compute, 1));
+}
+
+static void TestFile()
+{
+	//ctest runs in the build directory
+	const char* path = "qMetalPipelineManifestTests.manifest";
+	remove(path);
+	
+	PipelineManifest manifest(Environment);
+	qTEST_CHECK(manifest.LoadFile(path) == PipelineManifest::eLoadResult_Missing);
+	manifest.Record(PipelineManifest::ePipelineKind_Render, 7);
+	qTEST_CHECK(manifest.SaveFile(path));
+	
+	PipelineManifest loaded(Environment);
+	qTEST_CHECK(loaded.LoadFile(path) == PipelineManifest::eLoadResult_Loaded);
+	qTEST_CHECK(loaded.IsArchived(PipelineManifest::ePipelineKind_Render, 7));
+	remove(path);
+}
+
+int main()
+{
+	TestRoundTrip();
+	TestInvalidation();
+	TestFile();
+	return qTEST_RESULT();
+}
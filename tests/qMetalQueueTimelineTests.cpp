@@ -0,0 +1,132 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "qMetalQueueTimeline.h"
+#include "qMetalTest.h"
+
+using namespace qMetal;
+
+static const uint32_t Render = 0;
+static const uint32_t Compute = 1;
+
+//waits on the same queue, on nothing yet submitted, or on completed work cost nothing
+static void TestElision()
+{
+	QueueTimeline timeline(2);
+	qTEST_CHECK(timeline.Last(Compute).value == 0);
+	qTEST_CHECK(timeline.Covers(Render, timeline.Last(Compute)));
+	qTEST_CHECK(!timeline.Wait(Render, timeline.Last(Compute)));
+	
+	const QueueTimeline::Point render = timeline.Submit(Render);
+	qTEST_CHECK(render.value == 1);
+	qTEST_CHECK(timeline.Next(Render).value == 2);
+	qTEST_CHECK(!timeline.Wait(Render, render));
+	
+	const QueueTimeline::Point compute = timeline.Submit(Compute);
+	qTEST_CHECK(!timeline.Covers(Render, compute));
+	timeline.Completed(Compute, 1);
+	qTEST_CHECK(timeline.IsComplete(compute));
+	qTEST_CHECK(timeline.Covers(Render, compute));
+	qTEST_CHECK(!timeline.Wait(Render, compute));
+	
+	qTEST_CHECK(timeline.WaitCount() == 0);
+	qTEST_CHECK(timeline.ElidedCount() == 3);
+}
+
+//a wait covers every earlier point on that queue, and the next submissions keep it
+static void TestDirect()
+{
+	QueueTimeline timeline(2);
+	const QueueTimeline::Point first = timeline.Submit(Compute);
+	const QueueTimeline::Point second = timeline.Submit(Compute);
+	
+	qTEST_CHECK(timeline.Wait(Render, second));
+	qTEST_CHECK(timeline.Covers(Render, first));
+	qTEST_CHECK(!timeline.Wait(Render, first));
+	qTEST_CHECK(!timeline.Wait(Render, second));
+	
+	timeline.Submit(Render);
+	qTEST_CHECK(timeline.Covers(Render, second));
+	
+	//a later compute submission isn't covered
+	const QueueTimeline::Point third = timeline.Submit(Compute);
+	qTEST_CHECK(!timeline.Covers(Render, third));
+	qTEST_CHECK(timeline.Wait(Render, third));
+	
+	qTEST_CHECK(timeline.WaitCount() == 2);
+	qTEST_CHECK(timeline.ElidedCount() == 2);
+}
+
+//waiting on a point also covers everything that point waited on
+static void TestTransitive()
+{
+	QueueTimeline timeline(3);
+	const uint32_t Copy = 2;
+	
+	const QueueTimeline::Point copy = timeline.Submit(Copy);
+	qTEST_CHECK(timeline.Wait(Compute, copy));
+	const QueueTimeline::Point compute = timeline.Submit(Compute);
+	
+	qTEST_CHECK(!timeline.Covers(Render, copy));
+	qTEST_CHECK(timeline.Wait(Render, compute));
+	qTEST_CHECK(timeline.Covers(Render, copy));
+	qTEST_CHECK(!timeline.Wait(Render, copy));
+	
+	//the compute submission before the wait on copy doesn't pass it on
+	QueueTimeline earlier(3);
+	const QueueTimeline::Point before = earlier.Submit(Compute);
+	const QueueTimeline::Point later = earlier.Submit(Copy);
+	qTEST_CHECK(earlier.Wait(Render, before));
+	qTEST_CHECK(!earlier.Covers(Render, later));
+}
+
+//completion trims the history without losing what later points waited on
+static void TestCompletion()
+{
+	QueueTimeline timeline(2);
+	const QueueTimeline::Point render = timeline.Submit(Render);
+	qTEST_CHECK(timeline.Wait(Compute, render));
+	timeline.Submit(Compute);
+	const QueueTimeline::Point second = timeline.Submit(Compute);
+	
+	timeline.Completed(Compute, 1);
+	timeline.Completed(Compute, 1);	//repeats and stale values are ignored
+	qTEST_CHECK(timeline.CompletedValue(Compute) == 1);
+	qTEST_CHECK(!timeline.IsComplete(second));
+	
+	//the second compute submission's history outlives the first's
+	qTEST_CHECK(timeline.Wait(Render, second));
+	qTEST_CHECK(timeline.Covers(Render, timeline.MakePoint(Compute, 1)));
+	
+	timeline.Completed(Compute, 2);
+	qTEST_CHECK(timeline.IsComplete(second));
+	qTEST_CHECK(timeline.SubmittedValue(Compute) == 2);
+}
+
+int main()
+{
+	TestElision();
+	TestDirect();
+	TestTransitive();
+	TestCompletion();
+	return qTEST_RESULT();
+}
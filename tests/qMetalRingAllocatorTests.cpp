@@ -0,0 +1,104 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "qMetalRingAllocator.h"
+#include "qMetalTest.h"
+
+using namespace qMetal;
+
+static void TestAlignment()
+{
+	RingAllocator ring(1024, 3);
+	qTEST_CHECK(ring.Allocate(1, 1) == 0);
+	qTEST_CHECK(ring.Allocate(4, 256) == 256);
+	qTEST_CHECK(ring.Allocate(3, 4) == 260);
+	qTEST_CHECK(ring.Allocate(16, 16) == 272);
+	qTEST_CHECK(ring.Used() == 288);
+	qTEST_CHECK(ring.AllocationCount() == 4);
+	
+	qTEST_CHECK(RingAllocator::AlignUp(0, 256) == 0);
+	qTEST_CHECK(RingAllocator::AlignUp(1, 256) == 256);
+	qTEST_CHECK(RingAllocator::AlignUp(256, 256) == 256);
+	qTEST_CHECK(RingAllocator::AlignUp(257, 8) == 264);
+}
+
+static void TestOverflow()
+{
+	RingAllocator ring(512, 2);
+	qTEST_CHECK(ring.Allocate(512, 256) == 0);
+	qTEST_CHECK(ring.Allocate(1, 1) == RingAllocator::InvalidOffset);
+	qTEST_CHECK(ring.OverflowCount() == 1);
+	qTEST_CHECK(ring.Used() == 512);
+	
+	//a failed allocation leaves the head alone, so something smaller still fits
+	ring.BeginFrame(1);
+	qTEST_CHECK(ring.Allocate(300, 256) == 0);
+	qTEST_CHECK(ring.Allocate(300, 256) == RingAllocator::InvalidOffset);
+	qTEST_CHECK(ring.Allocate(100, 4) == 300);
+	qTEST_CHECK(ring.Allocate(0, 256) == 512);			//an empty allocation fits right at the end
+	qTEST_CHECK(ring.Allocate(100, 256) == RingAllocator::InvalidOffset);
+	qTEST_CHECK(ring.OverflowCount() == 2);
+	qTEST_CHECK(ring.Used() == 512);
+	
+	//sizes near SIZE_MAX must not wrap the bounds check
+	qTEST_CHECK(ring.Allocate(SIZE_MAX, 1) == RingAllocator::InvalidOffset);
+	qTEST_CHECK(ring.Allocate(SIZE_MAX - 200, 1) == RingAllocator::InvalidOffset);
+	qTEST_CHECK(ring.Used() == 512);
+}
+
+static void TestFrameWrap()
+{
+	RingAllocator ring(4096, 3);
+	const uint64_t firstEpoch = ring.Epoch();
+	
+	//callers pass a running frame count; each region keeps its own head until it comes round again
+	for (uint32_t frame = 0; frame < 7; ++frame)
+	{
+		ring.BeginFrame(frame);
+		qTEST_CHECK(ring.FrameIndex() == frame % 3);
+		qTEST_CHECK(ring.Used() == 0);
+		qTEST_CHECK(ring.OverflowCount() == 0);
+		qTEST_CHECK(ring.AllocationCount() == 0);
+		
+		for (uint32_t i = 0; i <= frame; ++i)
+		{
+			qTEST_CHECK(ring.Allocate(256, 256) == i * 256);
+		}
+		qTEST_CHECK(ring.Used() == (frame + 1) * 256);
+	}
+	qTEST_CHECK(ring.Epoch() == firstEpoch + 7);
+	
+	//the high water mark is per region (frame 4 was region 1's busiest) and survives the region being reset
+	ring.BeginFrame(7);
+	qTEST_CHECK(ring.FrameIndex() == 1);
+	qTEST_CHECK(ring.HighWaterMark() == 5 * 256);
+	ring.Allocate(64, 64);
+	qTEST_CHECK(ring.HighWaterMark() == 5 * 256);
+}
+
+int main()
+{
+	TestAlignment();
+	TestOverflow();
+	TestFrameWrap();
+	return qTEST_RESULT();
+}
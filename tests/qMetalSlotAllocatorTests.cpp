@@ -0,0 +1,134 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "qMetalSlotAllocator.h"
+#include "qMetalTest.h"
+#include <vector>
+
+using namespace qMetal;
+
+static void TestAllocate()
+{
+	SlotAllocator slots(3, 2);
+	qTEST_CHECK(slots.Allocate(0) == 0);
+	qTEST_CHECK(slots.Allocate(0) == 1);
+	qTEST_CHECK(slots.Allocate(0) == 2);
+	qTEST_CHECK(slots.Allocate(0) == SlotAllocator::InvalidSlot);
+	qTEST_CHECK(slots.Count() == 3);
+	qTEST_CHECK(slots.HighWaterMark() == 3);
+	qTEST_CHECK(slots.Capacity() == 3);
+}
+
+//a freed slot comes back only retireFrames frames after it was freed
+static void TestRetire()
+{
+	SlotAllocator slots(2, 3);
+	const uint32_t a = slots.Allocate(0);
+	const uint32_t b = slots.Allocate(0);
+	
+	slots.Free(a, 10);
+	qTEST_CHECK(slots.Count() == 1);
+	qTEST_CHECK(slots.RetiringCount() == 1);
+	qTEST_CHECK(slots.Allocate(10) == SlotAllocator::InvalidSlot);
+	qTEST_CHECK(slots.Allocate(12) == SlotAllocator::InvalidSlot);
+	qTEST_CHECK(slots.RetiringCount() == 1);
+	
+	qTEST_CHECK(slots.Allocate(13) == a);
+	qTEST_CHECK(slots.RetiringCount() == 0);
+	qTEST_CHECK(slots.Count() == 2);
+	
+	//slots retire in the order they were freed
+	slots.Free(b, 20);
+	slots.Free(a, 21);
+	qTEST_CHECK(slots.Allocate(23) == b);
+	qTEST_CHECK(slots.Allocate(23) == SlotAllocator::InvalidSlot);
+	qTEST_CHECK(slots.Allocate(24) == a);
+}
+
+//retired slots are reused before the high water mark grows
+static void TestReuse()
+{
+	SlotAllocator slots(8, 1);
+	const uint32_t a = slots.Allocate(0);
+	slots.Allocate(0);
+	slots.Free(a, 0);
+	qTEST_CHECK(slots.Allocate(1) == a);
+	qTEST_CHECK(slots.HighWaterMark() == 2);
+	
+	//with no retire delay a slot is reusable in the frame it's freed
+	SlotAllocator immediate(1, 0);
+	const uint32_t slot = immediate.Allocate(5);
+	immediate.Free(slot, 5);
+	qTEST_CHECK(immediate.Allocate(5) == slot);
+}
+
+//a live slot is never handed out twice, and never within retireFrames of being freed
+static void TestRandom()
+{
+	const uint32_t capacity = 64;
+	const uint32_t retireFrames = 3;
+	SlotAllocator slots(capacity, retireFrames);
+	std::vector<bool> live(capacity, false);
+	std::vector<uint64_t> freedIn(capacity, 0);
+	std::vector<uint32_t> held;
+	
+	uint32_t state = 12345;
+	for (uint64_t frame = 0; frame < 2000; ++frame)
+	{
+		for (int i = 0; i < 8; ++i)
+		{
+			state = state * 1664525 + 1013904223;
+			if ((state >> 16) & 1)
+			{
+				const uint32_t slot = slots.Allocate(frame);
+				if (slot != SlotAllocator::InvalidSlot)
+				{
+					qTEST_CHECK(slot < capacity);
+					qTEST_CHECK(!live[slot]);
+					qTEST_CHECK((freedIn[slot] == 0) || (freedIn[slot] + retireFrames <= frame + 1));
+					live[slot] = true;
+					held.push_back(slot);
+				}
+			}
+			else if (!held.empty())
+			{
+				const size_t index = (state >> 8) % held.size();
+				const uint32_t slot = held[index];
+				held[index] = held.back();
+				held.pop_back();
+				live[slot] = false;
+				freedIn[slot] = frame + 1;	//+1 so frame 0 isn't mistaken for never freed
+				slots.Free(slot, frame);
+			}
+		}
+		qTEST_CHECK(slots.Count() == held.size());
+	}
+}
+
+int main()
+{
+	TestAllocate();
+	TestRetire();
+	TestReuse();
+	TestRandom();
+	return qTEST_RESULT();
+}
@@ -0,0 +1,43 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_METAL_TEST_H__
+#define __Q_METAL_TEST_H__
+
+#include <stdio.h>
+
+//minimal checks for the host tests: a failed check is reported and counted, and qTEST_RESULT() turns the count into
+//the exit code ctest looks at
+
+namespace qMetalTest
+{
+	inline int& Failures()
+	{
+		static int failures = 0;
+		return failures;
+	}
+}
+
+#define qTEST_CHECK(x) 		do { if (!(x)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x); ++qMetalTest::Failures(); } } while (0)
+#define qTEST_RESULT() 		(qMetalTest::Failures() == 0 ? 0 : (fprintf(stderr, "%d checks failed\n", qMetalTest::Failures()), 1))
+
+#endif //__Q_METAL_TEST_H__
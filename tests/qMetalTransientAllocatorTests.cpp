@@ -0,0 +1,153 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "qMetalTransientAllocator.h"
+#include "qMetalTest.h"
+#include <random>
+
+using namespace qMetal;
+
+static const size_t MB = 1024 * 1024;
+
+//ping-pong targets down a post chain: every other target shares memory
+static void TestChain()
+{
+	TransientAllocator allocator;
+	const uint32_t a = allocator.Add(4 * MB, 64 * 1024, 0, 1);
+	const uint32_t b = allocator.Add(4 * MB, 64 * 1024, 1, 2);
+	const uint32_t c = allocator.Add(4 * MB, 64 * 1024, 2, 3);
+	const uint32_t d = allocator.Add(4 * MB, 64 * 1024, 3, 4);
+	allocator.Build();
+	
+	qTEST_CHECK(allocator.IsBuilt());
+	qTEST_CHECK(allocator.Offset(a) == 0);
+	qTEST_CHECK(allocator.Offset(b) == 4 * MB);
+	qTEST_CHECK(allocator.Offset(c) == 0);
+	qTEST_CHECK(allocator.Offset(d) == 4 * MB);
+	qTEST_CHECK(allocator.HeapSize() == 8 * MB);
+	qTEST_CHECK(allocator.UnaliasedSize() == 16 * MB);
+	qTEST_CHECK(allocator.BytesSaved() == 8 * MB);
+	qTEST_CHECK(allocator.PeakLiveSize() == 8 * MB);
+	
+	qTEST_CHECK(allocator.Aliases(a).empty());
+	qTEST_CHECK(allocator.Aliases(b).empty());
+	qTEST_CHECK((allocator.Aliases(c).size() == 1) && (allocator.Aliases(c)[0] == a));
+	qTEST_CHECK((allocator.Aliases(d).size() == 1) && (allocator.Aliases(d)[0] == b));
+}
+
+static void TestPlacement()
+{
+	//the largest goes first, and smaller ones fill the gaps it leaves, aligned
+	TransientAllocator allocator;
+	const uint32_t small = allocator.Add(100, 256, 0, 2);
+	const uint32_t large = allocator.Add(1000, 1, 0, 2);
+	const uint32_t late = allocator.Add(600, 512, 3, 3);
+	allocator.Build();
+	
+	qTEST_CHECK(allocator.Offset(large) == 0);
+	qTEST_CHECK(allocator.Offset(small) == 1024);
+	qTEST_CHECK(allocator.Offset(late) == 0);
+	qTEST_CHECK(allocator.HeapSize() == 1124);
+	qTEST_CHECK(allocator.PeakLiveSize() == 1100);
+	qTEST_CHECK(allocator.BytesSaved() == 576);
+	qTEST_CHECK(allocator.Aliases(late).size() == 1);
+	qTEST_CHECK(allocator.Aliases(late)[0] == large);
+	
+	//a gap between two live resources is used when the new one fits
+	TransientAllocator gap;
+	const uint32_t first = gap.Add(1000, 1, 0, 0);
+	const uint32_t second = gap.Add(900, 1, 0, 1);
+	const uint32_t third = gap.Add(800, 1, 1, 1);
+	const uint32_t fourth = gap.Add(700, 1, 2, 2);
+	gap.Build();
+	qTEST_CHECK(gap.Offset(first) == 0);
+	qTEST_CHECK(gap.Offset(second) == 1000);
+	qTEST_CHECK(gap.Offset(third) == 0);
+	qTEST_CHECK(gap.Offset(fourth) == 0);
+	qTEST_CHECK(gap.HeapSize() == 1900);
+	qTEST_CHECK(gap.Aliases(fourth).size() == 2);
+	
+	//nothing live together shares nothing
+	TransientAllocator overlapping;
+	overlapping.Add(10, 1, 0, 5);
+	overlapping.Add(20, 1, 0, 5);
+	overlapping.Build();
+	qTEST_CHECK(overlapping.HeapSize() == 30);
+	qTEST_CHECK(overlapping.BytesSaved() == 0);
+	
+	overlapping.Reset();
+	overlapping.Build();
+	qTEST_CHECK((overlapping.ResourceCount() == 0) && (overlapping.HeapSize() == 0));
+}
+
+//whatever the mix, resources live at the same time never share a byte, and every offset is aligned
+static void TestRandom()
+{
+	typedef struct Resource
+	{
+		size_t		size;
+		size_t		alignment;
+		uint32_t	first;
+		uint32_t	last;
+	} Resource;
+	
+	std::mt19937 random(7);
+	for (uint32_t round = 0; round < 500; ++round)
+	{
+		TransientAllocator allocator;
+		std::vector<Resource> resources(1 + random() % 24);
+		for (auto &resource : resources)
+		{
+			resource.size = 1 + random() % 100000;
+			resource.alignment = (size_t)1 << (random() % 17);
+			resource.first = random() % 12;
+			resource.last = resource.first + random() % 4;
+			allocator.Add(resource.size, resource.alignment, resource.first, resource.last);
+		}
+		allocator.Build();
+		
+		qTEST_CHECK(allocator.HeapSize() >= allocator.PeakLiveSize());
+		qTEST_CHECK(allocator.BytesSaved() + allocator.HeapSize() >= allocator.UnaliasedSize());
+		
+		for (uint32_t i = 0; i < (uint32_t)resources.size(); ++i)
+		{
+			const size_t offset = allocator.Offset(i);
+			qTEST_CHECK(offset % resources[i].alignment == 0);
+			qTEST_CHECK(offset + resources[i].size <= allocator.HeapSize());
+			
+			for (uint32_t j = i + 1; j < (uint32_t)resources.size(); ++j)
+			{
+				const bool liveTogether = (resources[i].first <= resources[j].last) && (resources[j].first <= resources[i].last);
+				const bool shareBytes = (offset < allocator.Offset(j) + resources[j].size) && (allocator.Offset(j) < offset + resources[i].size);
+				qTEST_CHECK(!(liveTogether && shareBytes));
+			}
+		}
+	}
+}
+
+int main()
+{
+	TestChain();
+	TestPlacement();
+	TestRandom();
+	return qTEST_RESULT();
+}
@@ -0,0 +1,38 @@
+/*
+Copyright (c) 2019 Generation Loss Interactive
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __Q_CORE_H__
+#define __Q_CORE_H__
+
+//the host tests' stand-in for qCore: just the assert and log macros the plain C++ headers use.
+//asserts stay on in release builds so a test can't pass by compiling them out
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define qASSERT(x) 			do { if (!(x)) { fprintf(stderr, "%s:%d: assert failed: %s\n", __FILE__, __LINE__, #x); abort(); } } while (0);
+#define qASSERTM(x, ...) 	do { if (!(x)) { fprintf(stderr, "%s:%d: assert failed: ", __FILE__, __LINE__); fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); abort(); } } while (0);
+#define qBREAK(...) 		do { fprintf(stderr, "%s:%d: break: ", __FILE__, __LINE__); fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); abort(); } while (0);
+#define qWARNING(x, ...) 	do { if (!(x)) { fprintf(stderr, "warning: "); fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); } } while (0);
+#define qSPAM(...)
+
+#endif //__Q_CORE_H__